@@ -59,7 +59,7 @@ int main(int argc, char** argv){
 
         if(_sysInfo.usedMem != sysInfo.usedMem){
             snprintf(buf, 64, "Used System Memory: %lu MB (%lu KB)", sysInfo.usedMem / 1024, sysInfo.usedMem);
-            usedMem->label = buf;
+            usedMem->SetLabel(buf);
         } sysInfo = _sysInfo;
 
         Lemon::WindowServer::Instance()->Wait();
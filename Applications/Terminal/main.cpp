@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <thread>
@@ -8,6 +9,7 @@
 #include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <Lemon/Core/Keyboard.h>
@@ -17,7 +19,8 @@
 #include "colours.h"
 #include "escape.h"
 
-#define SCROLLBACK_BUFFER_MAX 400
+#define SCROLLBACK_BUFFER_MAX 400 // Lines kept, including the lines on screen
+#define TERMINAL_FRAME_TIME 16    // Minimum time between repaints in ms, output is parsed in between
 
 using namespace Lemon;
 
@@ -49,13 +52,30 @@ struct TerminalChar {
 
 using TerminalLine = std::vector<TerminalChar>;
 
+// Lines are kept in a ring, the last terminalSize.y lines are on screen.
+// Scrolling reuses the oldest line instead of moving the others.
 std::vector<TerminalLine> scrollbackBuffer;
+size_t scrollbackStart = 0; // Index of the oldest line
+size_t scrollbackLines = 0; // Lines in use, at least terminalSize.y
+
+// Rows changed since the last paint, moved along with their lines when scrolling
+std::vector<uint8_t> dirtyRows;
+int pendingScroll = 0;  // Lines scrolled since the last paint
+bool redrawAll = true;  // Nothing painted before can be kept
+Vector2i paintedCursor; // Where the cursor was last painted
+
+// Rendered screen, kept between paints so only changed rows have to be drawn again
+Surface terminalSurface;
+
+inline TerminalLine& ScrollbackLine(size_t index) {
+    return scrollbackBuffer[(scrollbackStart + index) % scrollbackBuffer.size()];
+}
 
 TerminalLine& GetLine(int cursorY) {
-    assert(scrollbackBuffer.size() >= static_cast<unsigned>(terminalSize.y));
+    assert(scrollbackLines >= static_cast<unsigned>(terminalSize.y));
 
     // Cursor starts at (1, 1)
-    TerminalLine& ln = scrollbackBuffer[scrollbackBuffer.size() - terminalSize.y + (cursorY - 1)];
+    TerminalLine& ln = ScrollbackLine(scrollbackLines - terminalSize.y + (cursorY - 1));
 
     // Ensure the line is the right size
     if (ln.size() != static_cast<unsigned>(terminalSize.x))
@@ -63,45 +83,195 @@ TerminalLine& GetLine(int cursorY) {
     return ln;
 }
 
-inline auto FirstLine() { return scrollbackBuffer.begin() + (scrollbackBuffer.size() - terminalSize.y); }
+inline void DamageRow(int cursorY) {
+    if (cursorY >= 1 && cursorY <= terminalSize.y) {
+        dirtyRows[cursorY - 1] = true;
+    }
+}
+
+inline void DamageScreen() {
+    redrawAll = true;
+    pendingScroll = 0;
+}
+
+inline void ClearLine(TerminalLine& line) { line.assign(terminalSize.x, TerminalChar(0)); }
+
+inline bool SameColour(const RGBAColour& l, const RGBAColour& r) {
+    return RGBAColour::ToARGB(l) == RGBAColour::ToARGB(r);
+}
+
+void DrawRow(Surface* surf, int row) {
+    TerminalLine& line = GetLine(row + 1);
+    int y = row * characterSize.y;
+
+    // Backgrounds first, filling runs of the same colour at once
+    for (int i = 0; i < terminalSize.x;) {
+        int start = i;
+        while (i < terminalSize.x && SameColour(line[i].background, line[start].background)) {
+            i++;
+        }
+
+        Lemon::Graphics::DrawRect(Rect{start * characterSize.x, y, (i - start) * characterSize.x, characterSize.y},
+                                  line[start].background, surf);
+    }
+
+    for (int i = 0; i < terminalSize.x; i++) {
+        if (line[i].ch && line[i].ch != ' ') {
+            Lemon::Graphics::DrawChar(line[i].ch, i * characterSize.x, y, line[i].foreground, surf, terminalFont);
+        }
+    }
+
+    if (row == cursorPosition.y - 1) {
+        Lemon::Graphics::DrawRect(Rect{{(cursorPosition.x - 1) * characterSize.x, y}, characterSize},
+                                  currentForegroundColour, surf);
+    }
+}
 
 void OnPaint(Surface* surf) {
-    assert(scrollbackBuffer.size() >= static_cast<unsigned>(terminalSize.y));
-
-    Vector2i screenPos = {0, 0};
-    for (unsigned i = scrollbackBuffer.size() - terminalSize.y; i < scrollbackBuffer.size(); i++) {
-        screenPos.x = 0;
-        for (auto& c : scrollbackBuffer[i]) {
-            Lemon::Graphics::DrawRect(Rect{screenPos, characterSize}, c.background, surf);
-            Lemon::Graphics::DrawChar(c.ch, screenPos.x, screenPos.y, c.foreground, surf, terminalFont);
-            screenPos.x += characterSize.x;
+    assert(scrollbackLines >= static_cast<unsigned>(terminalSize.y));
+
+    if (terminalSurface.width != surf->width || terminalSurface.height != surf->height) {
+        delete[] terminalSurface.buffer;
+
+        terminalSurface.width = surf->width;
+        terminalSurface.height = surf->height;
+        terminalSurface.buffer = new uint8_t[terminalSurface.BufferSize()];
+        DamageScreen();
+    }
+
+    int rowBytes = characterSize.y * terminalSurface.width * 4;
+    if (redrawAll) {
+        Lemon::Graphics::DrawRect(0, 0, terminalSurface.width, terminalSurface.height, defaultBackgroundColour,
+                                  &terminalSurface);
+    } else if (pendingScroll) {
+        // Move the rows which are still on screen up rather than drawing them again,
+        // dirtyRows has already been moved along with them
+        memmove(terminalSurface.buffer, terminalSurface.buffer + pendingScroll * rowBytes,
+                (terminalSize.y - pendingScroll) * rowBytes);
+    }
+
+    // Rub out the old cursor, it has moved up with its row
+    DamageRow(paintedCursor.y - pendingScroll);
+    DamageRow(cursorPosition.y);
+
+    for (int i = 0; i < terminalSize.y; i++) {
+        if (redrawAll || dirtyRows[i]) {
+            DrawRow(&terminalSurface, i);
+        }
+    }
+
+    if (redrawAll || pendingScroll) {
+        surf->Blit(&terminalSurface);
+        terminalWindow->DamageAll();
+    } else {
+        for (int i = 0; i < terminalSize.y; i++) {
+            if (dirtyRows[i]) {
+                Rect row = {0, i * characterSize.y, terminalSurface.width, characterSize.y};
+
+                surf->Blit(&terminalSurface, row.pos, row);
+                terminalWindow->Damage(row);
+            }
         }
-        screenPos.y += characterSize.y;
     }
 
-    Lemon::Graphics::DrawRect(
-        Rect{{(cursorPosition.x - 1) * characterSize.x, (cursorPosition.y - 1) * characterSize.y}, characterSize},
-        currentForegroundColour, surf);
+    std::fill(dirtyRows.begin(), dirtyRows.end(), false);
+    pendingScroll = 0;
+    redrawAll = false;
+    paintedCursor = cursorPosition;
 }
 
 void ClearScrollbackBuffer() {
-    scrollbackBuffer = std::vector<TerminalLine>(terminalSize.y, TerminalLine(terminalSize.x, TerminalChar(0)));
+    if (scrollbackBuffer.size() < static_cast<unsigned>(terminalSize.y)) {
+        scrollbackBuffer.resize(terminalSize.y);
+    }
+
+    scrollbackStart = 0;
+    scrollbackLines = terminalSize.y;
+    for (int i = 0; i < terminalSize.y; i++) {
+        ClearLine(ScrollbackLine(i));
+    }
+
+    dirtyRows.assign(terminalSize.y, false);
+    DamageScreen();
 }
 
+// Add a blank line to the bottom, the oldest line is reused once the buffer is full
 void AddLine() {
-    if (scrollbackBuffer.size() < SCROLLBACK_BUFFER_MAX) {
-        scrollbackBuffer.push_back(TerminalLine(terminalSize.x, TerminalChar(0)));
+    if (scrollbackLines < scrollbackBuffer.size()) {
+        scrollbackLines++;
     } else {
-        scrollbackBuffer.erase(scrollbackBuffer.begin());
-        scrollbackBuffer.push_back(TerminalLine(terminalSize.x, TerminalChar(0)));
+        scrollbackStart = (scrollbackStart + 1) % scrollbackBuffer.size();
+    }
+
+    ClearLine(ScrollbackLine(scrollbackLines - 1));
+}
+
+// Scroll the screen up, adding blank lines to the bottom
+void ScrollUp(int amount) {
+    for (int i = 0; i < amount; i++) {
+        AddLine();
+    }
+
+    amount = std::min(amount, terminalSize.y);
+    dirtyRows.erase(dirtyRows.begin(), dirtyRows.begin() + amount);
+    dirtyRows.insert(dirtyRows.end(), amount, true);
+
+    pendingScroll += amount;
+    if (pendingScroll >= terminalSize.y) {
+        DamageScreen(); // Nothing left to move
+    }
+}
+
+// Scroll the screen down, adding blank lines to the top
+void ScrollDown(int amount) {
+    amount = std::min(amount, terminalSize.y);
+    for (int i = terminalSize.y; i > amount; i--) {
+        std::swap(GetLine(i), GetLine(i - amount));
+    }
+
+    for (int i = 1; i <= amount; i++) {
+        ClearLine(GetLine(i));
     }
+
+    DamageScreen();
+}
+
+void ResizeScreen(Vector2i newSize) {
+    int linesToAdd = newSize.y - terminalSize.y;
+    terminalSize = newSize;
+
+    if (scrollbackBuffer.size() < static_cast<unsigned>(terminalSize.y)) {
+        // Grow the ring, keeping the lines in order
+        std::vector<TerminalLine> lines(terminalSize.y);
+        for (size_t i = 0; i < scrollbackLines; i++) {
+            lines[i] = std::move(ScrollbackLine(i));
+        }
+
+        scrollbackBuffer = std::move(lines);
+        scrollbackStart = 0;
+    }
+
+    while (linesToAdd > 0) {
+        AddLine();
+        linesToAdd--;
+    }
+
+    for (int i = 1; i <= terminalSize.y; i++) {
+        GetLine(i); // Resizes the line
+    }
+
+    cursorPosition.x = std::min(cursorPosition.x, terminalSize.x);
+    cursorPosition.y = std::min(cursorPosition.y, terminalSize.y);
+
+    dirtyRows.assign(terminalSize.y, false);
+    DamageScreen();
 }
 
 void AdvanceCursorY() {
     cursorPosition.y++;
-    while (cursorPosition.y > terminalSize.y) {
-        AddLine();
-        cursorPosition.y--;
+    if (cursorPosition.y > terminalSize.y) {
+        ScrollUp(cursorPosition.y - terminalSize.y);
+        cursorPosition.y = terminalSize.y;
     }
 }
 
@@ -123,6 +293,7 @@ void PutChar(char ch) {
 
     TerminalLine& line = GetLine(cursorPosition.y);
     line.at(cursorPosition.x - 1) = TerminalChar(ch);
+    DamageRow(cursorPosition.y);
 }
 
 // Print a char on screen and advance the cursor
@@ -259,13 +430,14 @@ void ParseChar(char ch) {
                 switch (num) {
                 default:
                 case 0: // Clear entire screen from cursor
-                    ln.erase(ln.begin() + (cursorPosition.x - 1), ln.end());
-                    ln.insert(ln.end(), terminalSize.x - (cursorPosition.x - 1), TerminalChar(0));
+                    std::fill(ln.begin() + (cursorPosition.x - 1), ln.end(), TerminalChar(0));
 
-                    assert(ln.size() == static_cast<unsigned>(terminalSize.x));
-                    scrollbackBuffer.erase(FirstLine() + (cursorPosition.y - 1) + 1, scrollbackBuffer.end());
-                    scrollbackBuffer.insert(scrollbackBuffer.end(), terminalSize.y - (cursorPosition.y - 1),
-                                            TerminalLine(terminalSize.x, TerminalChar(0)));
+                    for (int i = cursorPosition.y; i <= terminalSize.y; i++) {
+                        if (i > cursorPosition.y) {
+                            ClearLine(GetLine(i));
+                        }
+                        DamageRow(i);
+                    }
                     break;
                 case 1: // Clear screen and move cursor
                 case 2: // Same as 1 but delete everything in the scrollback buffer
@@ -288,13 +460,15 @@ void ParseChar(char ch) {
                     cursorPosition = {1, 1};
                     break;
                 case 1: // Clear from cursor to beginning of line
-                    ln.erase(ln.begin(), ln.begin() + cursorPosition.x);
-                    ln.insert(ln.begin(), cursorPosition.x, TerminalChar(0));
+                    std::fill(ln.begin(), ln.begin() + std::min(cursorPosition.x, terminalSize.x), TerminalChar(0));
+                    DamageRow(cursorPosition.y);
                     break;
                 case 0: // Clear from cursor to end of line
                 default:
-                    ln.erase(ln.begin() + (cursorPosition.x - 1), ln.end());
-                    ln.insert(ln.end(), terminalSize.x - (cursorPosition.x - 1), TerminalChar(0));
+                    if (cursorPosition.x <= terminalSize.x) {
+                        std::fill(ln.begin() + (cursorPosition.x - 1), ln.end(), TerminalChar(0));
+                    }
+                    DamageRow(cursorPosition.y);
                     break;
                 }
                 break;
@@ -315,7 +489,7 @@ void ParseChar(char ch) {
                     amount = atoi(escapeBuffer.c_str());
                 }
 
-                scrollbackBuffer.insert(scrollbackBuffer.end(), amount, TerminalLine(terminalSize.x, TerminalChar(0)));
+                ScrollUp(amount);
                 break;
             }
             case ANSI_CSI_SD: { // Scroll Down
@@ -324,7 +498,7 @@ void ParseChar(char ch) {
                     amount = atoi(escapeBuffer.c_str());
                 }
 
-                scrollbackBuffer.insert(FirstLine(), amount, TerminalLine(terminalSize.x, TerminalChar(0)));
+                ScrollDown(amount);
                 break;
             }
             default:
@@ -391,7 +565,6 @@ void ParseChar(char ch) {
     }
 }
 
-bool shouldPaint = true;
 std::mutex paintMutex;
 std::mutex bufferMutex;
 
@@ -402,24 +575,51 @@ void SIGCHLDHandler(int){
     isOpen = false; // Shell has closed
 }
 
+long MillisecondsSince(const timespec& t) {
+    timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+
+    return (now.tv_sec - t.tv_sec) * 1000 + (now.tv_nsec - t.tv_nsec) / 1000000;
+}
+
 void* PTYThread() {
     pollfd pollFd = {.fd = ptyMasterFd, .events = POLLIN};
+
+    // Parse everything the shell writes but repaint at most once a frame,
+    // so heavy output is not held up painting lines which scroll straight off screen
+    timespec lastPaint = {0, 0};
+    bool needsPaint = false;
     while (isOpen) {
-        if (poll(&pollFd, 1, 500000) > 0) {
-            char buf[512];
+        int timeout = 500000;
+        if (needsPaint) {
+            timeout = std::max(TERMINAL_FRAME_TIME - MillisecondsSince(lastPaint), 0L);
+        }
+
+        if (poll(&pollFd, 1, timeout) > 0) {
+            char buf[4096];
             ssize_t r;
-            bufferMutex.lock();
-            while ((r = read(ptyMasterFd, buf, 512)) > 0) {
+
+            std::unique_lock lock(bufferMutex);
+            while ((r = read(ptyMasterFd, buf, sizeof(buf))) > 0) {
                 int i = 0;
                 while (r--) {
                     ParseChar(buf[i++]);
                 }
+                needsPaint = true;
+
+                if (MillisecondsSince(lastPaint) >= TERMINAL_FRAME_TIME) {
+                    break; // Show what we have so far
+                }
             }
-            bufferMutex.unlock();
+        }
+
+        if (needsPaint && MillisecondsSince(lastPaint) >= TERMINAL_FRAME_TIME) {
+            std::unique_lock lock(bufferMutex);
+            std::unique_lock lockPaint(paintMutex);
 
-            std::unique_lock lock(paintMutex);
             terminalWindow->Paint();
-            shouldPaint = false;
+            clock_gettime(CLOCK_BOOTTIME, &lastPaint);
+            needsPaint = false;
         }
     }
 
@@ -441,8 +641,8 @@ int main(int argc, char** argv) {
     terminalSize =
         Vector2i{terminalWindow->GetSize().x / characterSize.x, terminalWindow->GetSize().y / characterSize.y};
 
+    scrollbackBuffer.resize(std::max(SCROLLBACK_BUFFER_MAX, terminalSize.y));
     ClearScrollbackBuffer();
-    assert(FirstLine() == scrollbackBuffer.begin());
     assert(&GetLine(1) == &scrollbackBuffer.at(0));
 
     int ptySlaveFd = -1;
@@ -558,27 +758,11 @@ int main(int argc, char** argv) {
         }
 
         if (shouldResize) {
-            int linesToAdd = newSize.y / characterSize.y - terminalSize.y;
-            int colsToAdd = newSize.x / characterSize.x - terminalSize.x;
-
             // Make sure we repaint the window and stop other thread from painting
             std::unique_lock lock(bufferMutex);
             std::unique_lock lockPaint(paintMutex);
 
-            terminalSize = Vector2i{newSize.x / characterSize.x, newSize.y / characterSize.y};
-
-            for (auto it = FirstLine(); it != scrollbackBuffer.end(); ++it) {
-                if (colsToAdd > 0) {
-                    it->insert(it->end(), colsToAdd, TerminalChar(0));
-                }
-
-                it->resize(terminalSize.x);
-            }
-
-            while (linesToAdd > 0) {
-                AddLine();
-                linesToAdd--;
-            }
+            ResizeScreen(Vector2i{newSize.x / characterSize.x, newSize.y / characterSize.y});
 
             // Round to nearest character
             terminalWindow->Resize({terminalSize.x * characterSize.x, terminalSize.y * characterSize.y});
@@ -591,7 +775,6 @@ int main(int argc, char** argv) {
 
             ioctl(ptyMasterFd, TIOCSWINSZ, &wSz);
             kill(shellPID, SIGWINCH); // Send SIGWINCH to child
-            shouldPaint = true;
         }
 
         Lemon::WindowServer::Instance()->Wait();
@@ -6,10 +6,12 @@
 #include <unistd.h>
 
 #include "Pipe.h"
+#include "TCP.h"
 #include "Terminal.h"
 
 const std::unordered_map<std::string, Test> tests = {
     {"pipe", pipeTest},
+    {"tcp", tcpTest},
     {"terminal", termTest},
 };
 
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "Test.h"
+
+namespace TCPTest {
+
+const uint16_t port = 7423;
+const size_t transferSize = 16 * 1024 * 1024;
+const size_t chunkSize = 64 * 1024;
+
+inline uint8_t PatternByte(size_t offset){
+    return (offset * 7 + (offset >> 12)) & 0xff;
+}
+
+// Accept one connection and check everything sent over it
+int Server(int listenFd){
+    int fd = accept(listenFd, nullptr, nullptr);
+    if(fd < 0){
+        printf("Failed to accept connection: %s\n", strerror(errno));
+        return 1;
+    }
+
+    std::vector<uint8_t> buffer(chunkSize);
+
+    size_t received = 0;
+    while(received < transferSize){
+        ssize_t r = read(fd, buffer.data(), chunkSize);
+        if(r <= 0){
+            printf("Connection closed after %lu bytes: %s\n", received, r ? strerror(errno) : "EOF");
+            return 1;
+        }
+
+        for(ssize_t i = 0; i < r; i++){
+            if(buffer[i] != PatternByte(received + i)){
+                printf("Unexpected data at offset %lu\n", received + i);
+                return 1;
+            }
+        }
+
+        received += r;
+    }
+
+    close(fd);
+    return 0;
+}
+
+};
+
+int RunTCPTest(){
+    using namespace TCPTest;
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(sockaddr_in));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenFd < 0){
+        printf("Failed to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if(bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(sockaddr_in)) || listen(listenFd, 1)){
+        printf("Failed to listen on port %hu: %s\n", port, strerror(errno));
+        return -1;
+    }
+
+    pid_t server = fork();
+    if(server == 0){
+        exit(Server(listenFd));
+    }
+
+    close(listenFd);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(sockaddr_in))){
+        int error = errno;
+        kill(server, SIGKILL);
+        waitpid(server, nullptr, 0);
+
+        if(error == ENETUNREACH){
+            printf("No loopback interface, skipping TCP test\n");
+            return 0;
+        }
+
+        printf("Failed to connect: %s\n", strerror(error));
+        return -1;
+    }
+
+    std::vector<uint8_t> buffer(chunkSize);
+
+    timespec start;
+    clock_gettime(CLOCK_BOOTTIME, &start);
+
+    size_t sent = 0;
+    while(sent < transferSize){
+        for(size_t i = 0; i < chunkSize; i++){
+            buffer[i] = PatternByte(sent + i);
+        }
+
+        size_t offset = 0;
+        while(offset < chunkSize){
+            ssize_t w = write(fd, buffer.data() + offset, chunkSize - offset);
+            if(w <= 0){
+                printf("Failed to send after %lu bytes: %s\n", sent + offset, strerror(errno));
+                close(fd);
+                kill(server, SIGKILL);
+                waitpid(server, nullptr, 0);
+                return -1;
+            }
+
+            offset += w;
+        }
+
+        sent += chunkSize;
+    }
+
+    // The server exits once it has received and checked everything
+    int status = 0;
+    waitpid(server, &status, 0);
+
+    timespec end;
+    clock_gettime(CLOCK_BOOTTIME, &end);
+    close(fd);
+
+    if(WEXITSTATUS(status)){
+        return -1;
+    }
+
+    long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    if(ms <= 0){
+        ms = 1;
+    }
+
+    printf("Sent %lu MB over loopback in %ld ms (%lu MB/s)\n", transferSize / (1024 * 1024), ms, (transferSize / 1024) * 1000 / 1024 / ms);
+    return 0;
+}
+
+static Test tcpTest = {
+    .func = RunTCPTest,
+    .prettyName = "TCP Loopback Throughput Test",
+};
@@ -0,0 +1,84 @@
+#include <Module.h>
+
+#include <Logging.h>
+#include <MM/KMalloc.h>
+#include <Net/Checksum.h>
+#include <String.h>
+#include <UserPointer.h>
+
+// Measures the Internet checksum routines, results are in cycles per kilobyte
+// Load with kmod load /initrd/modules/csumbench.sys
+
+#define CSUM_BENCH_MIN_SIZE 64
+#define CSUM_BENCH_MAX_SIZE 65536
+#define CSUM_BENCH_BYTES (16 * 1024 * 1024) // Amount of data summed for each size and routine
+
+static inline uint64_t ReadTSC() {
+    uint32_t low, high;
+    asm volatile("lfence; rdtsc" : "=a"(low), "=d"(high)::"memory");
+    return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+template <typename F> static uint64_t Measure(size_t size, F&& func) {
+    unsigned iterations = CSUM_BENCH_BYTES / size;
+
+    func(); // Warm the cache
+
+    uint64_t start = ReadTSC();
+    for (unsigned i = 0; i < iterations; i++) {
+        func();
+    }
+    uint64_t cycles = ReadTSC() - start;
+
+    return cycles * 1024 / (static_cast<uint64_t>(iterations) * size);
+}
+
+static int ModuleInit() {
+    uint8_t* source = reinterpret_cast<uint8_t*>(kmalloc(CSUM_BENCH_MAX_SIZE));
+    uint8_t* dest = reinterpret_cast<uint8_t*>(kmalloc(CSUM_BENCH_MAX_SIZE));
+
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < CSUM_BENCH_MAX_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        source[i] = seed >> 16;
+    }
+
+    Log::Info("[csumbench] Cycles per KB (size, scalar, blocks, partial, copy + checksum, memcpy)");
+    for (size_t size = CSUM_BENCH_MIN_SIZE; size <= CSUM_BENCH_MAX_SIZE; size *= 2) {
+        volatile uint64_t sink;
+
+        // Every routine has to agree before the timings mean anything
+        uint64_t copySum = 0;
+        UserMemcpyChecksum(dest, source, size, &copySum);
+
+        uint16_t expected = Network::ChecksumFold(Network::ChecksumPartialScalar(source, size));
+        if (Network::ChecksumFold(Network::checksumBlocks(source, size / 64, 0)) !=
+                Network::ChecksumFold(Network::ChecksumPartialScalar(source, size & ~63UL)) ||
+            Network::ChecksumFold(Network::ChecksumPartial(source, size)) != expected ||
+            Network::ChecksumFold(copySum) != expected || memcmp(dest, source, size)) {
+            Log::Error("[csumbench] Checksum mismatch for %u bytes", size);
+            break;
+        }
+
+        uint64_t scalar = Measure(size, [&]() { sink = Network::ChecksumPartialScalar(source, size); });
+        uint64_t blocks = Measure(size, [&]() { sink = Network::checksumBlocks(source, size / 64, 0); });
+        uint64_t partial = Measure(size, [&]() { sink = Network::ChecksumPartial(source, size); });
+        uint64_t copy = Measure(size, [&]() {
+            uint64_t sum = 0;
+            UserMemcpyChecksum(dest, source, size, &sum);
+            sink = sum;
+        });
+        uint64_t plainCopy = Measure(size, [&]() { sink = UserCopy(dest, source, size); });
+
+        Log::Info("[csumbench] %u: %u %u %u %u %u", size, scalar, blocks, partial, copy, plainCopy);
+    }
+
+    kfree(source);
+    kfree(dest);
+
+    return 0;
+}
+
+static int ModuleExit() { return 0; }
+
+DECLARE_MODULE("csumbench", "Internet checksum microbenchmark", ModuleInit, ModuleExit);
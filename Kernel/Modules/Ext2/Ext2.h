@@ -3,6 +3,7 @@
 #include <Fs/FsVolume.h>
 #include <Hash.h>
 #include <Lock.h>
+#include <MM/Reclaim.h>
 #include <Vector.h>
 
 #include <stdint.h>
@@ -229,7 +230,7 @@ public:
         void Sync();
     };
 
-    class Ext2Volume : public FsVolume {
+    class Ext2Volume : public FsVolume, public Memory::Shrinker {
     private:
         FsNode* m_device;
 
@@ -254,10 +255,13 @@ public:
 
         lock_t m_inodesLock = 0;
         lock_t m_blocksLock = 0;
+        // Not shrunk by reclaim: nodes are freed when their last handle is closed, and VFS path
+        // lookups hold nodes returned by FindDir without a handle, so an idle node may still be in use
         HashMap<uint32_t, Ext2Node*> inodeCache;
         HashMap<uint32_t, uint8_t*> blockCache = HashMap<uint32_t, uint8_t*>(1024);
         HashMap<uint32_t, uint8_t*> bitmapCache = HashMap<uint32_t, uint8_t*>(256);
-        unsigned blockCacheMemoryUsage;
+        List<uint32_t> blockCacheOrder; // Cached blocks, oldest first
+        unsigned blockCacheMemoryUsage = 0;
 
         inline uint32_t LocationToBlock(uint64_t l) { return (l >> super.logBlockSize) >> 10; }
         inline uint32_t BlockToLocation(uint64_t b) { return (b << super.logBlockSize) << 10; }
@@ -285,6 +289,7 @@ public:
 
         int WriteBlock(uint32_t block, void* buffer);
         int WriteBlockCached(uint32_t block, void* buffer);
+        void EvictCachedBlock(uint32_t block);
 
         Ext2Node* CreateNode();
         int EraseInode(ext2_inode_t& e2inode, uint32_t inode);
@@ -315,6 +320,10 @@ public:
         void SyncNode(Ext2Node* node);
         void CleanNode(Ext2Node* node);
 
+        // The block cache is write-through so any cached block can be dropped
+        size_t CountReclaimable() override;
+        size_t Shrink(size_t pages) override;
+
         int Error() { return error; }
     };
 
@@ -32,7 +32,13 @@ lock_t Ext2::m_instanceLock = 0;
 Ext2* Ext2::m_instance = nullptr;
 
 Ext2::Ext2() { fs::RegisterDriver(this); }
-Ext2::~Ext2() { fs::UnregisterDriver(this); }
+Ext2::~Ext2() {
+    for (FsVolume* vol : m_extVolumes) {
+        Memory::UnregisterShrinker(static_cast<Ext2Volume*>(vol));
+    }
+
+    fs::UnregisterDriver(this);
+}
 
 Ext2& Ext2::Instance() {
     if (m_instance) {
@@ -56,6 +62,7 @@ FsVolume* Ext2::Mount(FsNode* device, const char* name) {
     }
 
     m_extVolumes.add_back(vol);
+    Memory::RegisterShrinker(vol);
     return vol;
 }
 
@@ -479,9 +486,11 @@ int Ext2::Ext2Volume::ReadBlockCached(uint32_t block, void* buffer) {
         cachedBlock = (uint8_t*)kmalloc(blocksize);
         if (int e = fs::Read(m_device, BlockToLocation(block), blocksize, cachedBlock); e != blocksize) {
             Log::Error("[Ext2] Disk error (%d) reading block %d (blocksize: %d)", e, block, blocksize);
+            kfree(cachedBlock);
             return e;
         }
         blockCache.insert(block, cachedBlock);
+        blockCacheOrder.add_back(block);
         blockCacheMemoryUsage += blocksize;
         Ext2::Instance().totalBlockCacheMemoryUsage += blocksize;
 
@@ -517,6 +526,53 @@ int Ext2::Ext2Volume::WriteBlockCached(uint32_t block, void* buffer) {
     return 0;
 }
 
+void Ext2::Ext2Volume::EvictCachedBlock(uint32_t block) {
+#ifndef EXT2_NO_CACHE
+    ScopedSpinLock lockBlockCache(m_blocksLock);
+
+    // Leave the block in blockCacheOrder, it gets skipped when shrinking
+    if (uint8_t * cachedBlock; blockCache.get(block, cachedBlock)) {
+        blockCache.remove(block);
+        kfree(cachedBlock);
+
+        blockCacheMemoryUsage -= blocksize;
+        Ext2::Instance().totalBlockCacheMemoryUsage -= blocksize;
+    }
+#endif
+}
+
+// Only the block cache is reclaimable, see inodeCache
+size_t Ext2::Ext2Volume::CountReclaimable() { return blockCacheMemoryUsage >> PAGE_SHIFT_4K; }
+
+size_t Ext2::Ext2Volume::Shrink(size_t pages) {
+#ifndef EXT2_NO_CACHE
+    if (acquireTestLock(&m_blocksLock)) {
+        return 0; // Block cache is in use
+    }
+
+    size_t target = pages << PAGE_SHIFT_4K;
+    size_t freed = 0;
+    while (freed < target && blockCacheOrder.get_length()) {
+        uint32_t block = blockCacheOrder.remove_at(0);
+        if (uint8_t * cachedBlock; blockCache.get(block, cachedBlock)) {
+            blockCache.remove(block);
+            kfree(cachedBlock);
+
+            freed += blocksize;
+        }
+    }
+
+    blockCacheMemoryUsage -= freed;
+    Ext2::Instance().totalBlockCacheMemoryUsage -= freed;
+
+    releaseLock(&m_blocksLock);
+
+    return freed >> PAGE_SHIFT_4K;
+#else
+    return 0;
+#endif
+}
+
 uint32_t Ext2::Ext2Volume::AllocateBlock() {
     for (unsigned i = 0; i < blockGroupCount; i++) {
         ext2_blockgrp_desc_t& group = blockGroups[i];
@@ -724,9 +780,7 @@ int Ext2::Ext2Volume::EraseInode(ext2_inode_t& e2inode, uint32_t inode) {
     for (unsigned i = 0; i < e2inode.blockCount * (blocksize / 512); i++) {
         uint32_t block = GetInodeBlock(i, e2inode);
         FreeBlock(block);
-        if (blockCache.find(block)) {
-            blockCache.remove(block);
-        }
+        EvictCachedBlock(block);
     }
 
     if (e2inode.blocks[EXT2_SINGLY_INDIRECT_INDEX]) {
@@ -742,9 +796,7 @@ int Ext2::Ext2Volume::EraseInode(ext2_inode_t& e2inode, uint32_t inode) {
 
             for (unsigned i = 0; i < (blocksize / sizeof(uint32_t)) && blockPointers[i] != 0; i++) {
                 FreeBlock(blockPointers[i]);
-                if (blockCache.find(blockPointers[i])) {
-                    blockCache.remove(blockPointers[i]);
-                }
+                EvictCachedBlock(blockPointers[i]);
             }
 
             FreeBlock(e2inode.blocks[EXT2_DOUBLY_INDIRECT_INDEX]);
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <Lock.h>
 #include <Net/Adapter.h>
+#include <Net/NetBuffer.h>
 #include <PCI.h>
 
 #define INTEL_VENDOR_ID 0x8086
@@ -11,7 +13,9 @@
 #define I8254_REGISTER_EEPROM       0x14
 #define I8254_REGISTER_CTRL_EXT     0x18
 #define I8254_REGISTER_INT_READ     0xC0
+#define I8254_REGISTER_ITR          0xC4 // Interrupt Throttling
 #define I8254_REGISTER_INT_MASK     0xD0
+#define I8254_REGISTER_INT_MASK_CLR 0xD8 // Interrupt Mask Clear, masks the interrupts written
 
 #define I8254_REGISTER_RCTRL        0x100
 #define I8254_REGISTER_RDESC_LO     0x2800
@@ -19,6 +23,8 @@
 #define I8254_REGISTER_RDESC_LEN    0x2808
 #define I8254_REGISTER_RDESC_HEAD   0x2810
 #define I8254_REGISTER_RDESC_TAIL   0x2818
+#define I8254_REGISTER_RDTR         0x2820 // Receive Delay Timer
+#define I8254_REGISTER_RADV         0x282C // Receive Interrupt Absolute Delay Timer
 
 #define I8254_REGISTER_TCTRL        0x400
 #define I8254_REGISTER_TDESC_LO     0x3800
@@ -27,6 +33,8 @@
 #define I8254_REGISTER_TDESC_HEAD   0x3810
 #define I8254_REGISTER_TDESC_TAIL   0x3818
 
+#define I8254_REGISTER_MPC          0x4010 // Missed Packets Count, cleared on read
+
 #define I8254_REGISTER_MTA          0x5200
 
 #define CTRL_FD (1 << 0)        // Full Duplex
@@ -66,6 +74,16 @@
 #define TSTATUS_EC (1 << 1) // Excess Collisions
 #define TSTATUS_LC (1 << 2) // Late collision
 
+#define ICR_LSC (1 << 2)    // Link Status Change
+#define ICR_RXDMT0 (1 << 4) // Receive Descriptor Minimum Threshold
+#define ICR_RXO (1 << 6)    // Receiver Overrun
+#define ICR_RXT0 (1 << 7)   // Receiver Timer Interrupt
+#define ICR_RX (ICR_RXDMT0 | ICR_RXO | ICR_RXT0)
+
+#define ITR_INTERVAL 488 // In 256ns units, limits the card to about 8000 interrupts per second
+#define RDTR_DELAY 32    // In 1.024us units, wait for more packets before interrupting
+#define RADV_DELAY 128   // In 1.024us units, upper bound on the delay from RDTR
+
 #define STATUS_LINK_UP (1 << 1)
 #define STATUS_SPEED (3 << 6)   // 00b - 10Mb/s, 01b - 100MB/s, 10b/11b - 1000Mb/s
 
@@ -82,6 +100,10 @@ public:
     Intel8254x(const PCIInfo& device);
 
     void SendPacket(void* data, size_t len);
+    void SendBuffer(Network::NetBuffer* buffer);
+
+    int Poll(int budget);
+    void EnableReceiveInterrupts();
 
 private:
     typedef struct {
@@ -106,9 +128,10 @@ private:
 
     r_desc_t* rxDescriptors;
     t_desc_t* txDescriptors;
-    void** txDescriptorsVirt;
-    void** rxDescriptorsVirt;
+    Network::NetBuffer** txBuffers; // Buffers owned by the card until their descriptor is reused
+    Network::NetBuffer** rxBuffers; // Buffers the card receives into
 
+    lock_t txLock = 0; // Protects txTail, txBuffers and the tx descriptors
     unsigned txTail = 0;
     unsigned rxTail = 0;
 
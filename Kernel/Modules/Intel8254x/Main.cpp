@@ -97,40 +97,66 @@ bool Intel8254x::CheckForEEPROM() {
 void Intel8254x::OnInterrupt() {
     uint32_t status = ReadMem32(I8254_REGISTER_INT_READ);
 
-    if (status & 0x4) {
+    if (status & ICR_LSC) {
         Log::Info("[i8254x] Making Links...");
 
         WriteMem32(I8254_REGISTER_CTRL, ReadMem32(I8254_REGISTER_CTRL) | CTRL_SLU | CTRL_ASDE);
 
         UpdateLink();
-    } else if (status & 0x80) {
-        do {
-            rxTail = ReadMem32(I8254_REGISTER_RDESC_TAIL);
-            if (rxTail == ReadMem32(I8254_REGISTER_RDESC_HEAD))
-                return;
-            rxTail = (rxTail + 1) % RX_DESC_COUNT;
+    }
 
-            if (!(rxDescriptors[rxTail].status & 0x1))
-                break;
+    if (status & ICR_RX) {
+        // Leave the ring to the network thread, interrupts are unmasked once it is drained
+        WriteMem32(I8254_REGISTER_INT_MASK_CLR, ICR_RX);
+        SchedulePoll();
+    }
+}
 
-            rxDescriptors[rxTail].status = 0;
+int Intel8254x::Poll(int budget) {
+    // Only the network thread touches the receive ring
+    int received = 0;
+    while (received < budget) {
+        r_desc_t* rxd = &rxDescriptors[rxTail];
+        if (!(rxd->status & 0x1)) {
+            break; // The card has not filled this descriptor yet
+        }
+
+        uint16_t length = rxd->length;
+        Network::NetBuffer* fresh = nullptr;
+        if (length <= ETHERNET_MAX_PACKET_SIZE && (fresh = Network::NetBuffer::Allocate())) {
+            // Pass the filled buffer up the stack as it is and give the card a fresh one
+            Network::NetBuffer* buffer = rxBuffers[rxTail];
+            buffer->Put(length);
+            buffer->adapter = this;
+
+            rxBuffers[rxTail] = fresh;
+            rxd->addr = fresh->PhysicalData();
+
+            queue.add_back(buffer);
+            packetSemaphore.Signal();
+        } else {
+            // The pool is empty, drop the packet and leave the buffer on the ring
+            stats.rxDropped++;
+        }
 
-            if (rxDescriptors[rxTail].length <= ETHERNET_MAX_PACKET_SIZE && cache.get_length()) {
-                NetworkPacket* pkt = cache.remove_at(0);
+        rxd->status = 0;
+        rxTail = (rxTail + 1) % RX_DESC_COUNT;
+        received++;
+    }
 
-                pkt->length = rxDescriptors[rxTail].length;
-                memcpy(pkt->data, rxDescriptorsVirt[rxTail], pkt->length);
+    if (received) {
+        // Hand the processed descriptors back to the card
+        WriteMem32(I8254_REGISTER_RDESC_TAIL, (rxTail + RX_DESC_COUNT - 1) % RX_DESC_COUNT);
+    }
 
-                queue.add_back(pkt);
-                packetSemaphore.Signal();
-                Network::packetQueueSemaphore.Signal();
-            } else {
-                // TODO: Do something that isn't dropping the packet when the cache is empty
-            }
+    stats.rxDropped += ReadMem32(I8254_REGISTER_MPC); // Packets the card had no descriptors for
 
-            WriteMem32(I8254_REGISTER_RDESC_TAIL, rxTail);
-        } while (1);
-    }
+    return received;
+}
+
+void Intel8254x::EnableReceiveInterrupts() {
+    // Any receive causes latched while masked raise an interrupt straight away
+    WriteMem32(I8254_REGISTER_INT_MASK, ICR_RX);
 }
 
 int Intel8254x::GetSpeed() {
@@ -180,7 +206,7 @@ void Intel8254x::InitializeRx() {
     uint32_t rxHead = 0;
     uint32_t _rxTail = RX_DESC_COUNT - 1; // Offset from base
 
-    rxDescriptorsVirt = (void**)kmalloc(RX_DESC_COUNT * sizeof(void*));
+    rxBuffers = (Network::NetBuffer**)kmalloc(RX_DESC_COUNT * sizeof(Network::NetBuffer*));
 
     WriteMem32(I8254_REGISTER_RDESC_LO, rxLow);
     WriteMem32(I8254_REGISTER_RDESC_HI, rxHigh);
@@ -190,14 +216,20 @@ void Intel8254x::InitializeRx() {
 
     for (int i = 0; i < RX_DESC_COUNT; i++) {
         r_desc_t* rxd = &rxDescriptors[i];
-        uint64_t phys = Memory::AllocatePhysicalMemoryBlock();
-        rxd->addr = phys;
-        rxd->status = 0;
 
-        rxDescriptorsVirt[i] = Memory::KernelAllocate4KPages(1);
-        Memory::KernelMapVirtualMemory4K(phys, (uintptr_t)rxDescriptorsVirt[i], 1);
+        // Buffers are a page with no headroom so they match BSIZE_4096
+        rxBuffers[i] = Network::NetBuffer::Allocate();
+        assert(rxBuffers[i]);
+
+        rxd->addr = rxBuffers[i]->PhysicalData();
+        rxd->status = 0;
     }
 
+    // Batch receive interrupts, RADV is ignored by cards older than the 82540
+    WriteMem32(I8254_REGISTER_RDTR, RDTR_DELAY);
+    WriteMem32(I8254_REGISTER_RADV, RADV_DELAY);
+    WriteMem32(I8254_REGISTER_ITR, ITR_INTERVAL);
+
     WriteMem32(I8254_REGISTER_RCTRL,
                (RCTRL_ENABLE | RCTRL_SBP | RCTRL_UPE | RCTRL_MPE | RCTRL_LPE | RCTRL_BAM | RCTRL_SECRC | BSIZE_4096));
 }
@@ -211,7 +243,7 @@ void Intel8254x::InitializeTx() {
     uint32_t txHead = 0;
     uint32_t _txTail = RX_DESC_COUNT; // Offset from base
 
-    txDescriptorsVirt = (void**)kmalloc(TX_DESC_COUNT * sizeof(void*));
+    txBuffers = (Network::NetBuffer**)kmalloc(TX_DESC_COUNT * sizeof(Network::NetBuffer*));
 
     WriteMem32(I8254_REGISTER_TDESC_LO, txLow);
     WriteMem32(I8254_REGISTER_TDESC_HI, txHigh);
@@ -221,12 +253,10 @@ void Intel8254x::InitializeTx() {
 
     for (int i = 0; i < TX_DESC_COUNT; i++) {
         t_desc_t* txd = &txDescriptors[i];
-        uint64_t phys = Memory::AllocatePhysicalMemoryBlock();
-        txd->addr = phys;
+        txd->addr = 0; // Set to the buffer being sent
         txd->status = 0;
 
-        txDescriptorsVirt[i] = Memory::KernelAllocate4KPages(1);
-        Memory::KernelMapVirtualMemory4K(phys, (uintptr_t)txDescriptorsVirt[i], 1);
+        txBuffers[i] = nullptr;
     }
 
     WriteMem32(I8254_REGISTER_TCTRL, (TCTRL_ENABLE | TCTRL_PSP));
@@ -306,25 +336,48 @@ Intel8254x::Intel8254x(const PCIInfo& device)
 
     dState = DriverState::OK;
 
-    maxCache = 256;
-    for (unsigned i = 0; i < maxCache; i++) {
-        cache.add_back(new NetworkPacket()); // Fill the cache
-    }
-
     WriteMem32(I8254_REGISTER_INT_MASK, 0x1F6DF); // Set the interrupt mask to enable all interrupts
     UpdateLink();
 }
 
 void Intel8254x::SendPacket(void* data, size_t len) {
-    asm("cli");
+    Network::NetBuffer* buffer = Network::NetBuffer::Allocate();
+    if (!buffer) {
+        return; // Drop the packet
+    }
+
+    memcpy(buffer->Put(len), data, len);
+    SendBuffer(buffer);
+}
+
+void Intel8254x::SendBuffer(Network::NetBuffer* buffer) {
+    // Packets are sent from every CPU (e.g. by the protocol workers)
+    InterruptDisabler disableInterrupts;
+    ScopedSpinLock lockTx(txLock);
+
     t_desc_t* txd = &(txDescriptors[txTail]);
 
-    memcpy(txDescriptorsVirt[txTail], data, len);
-    txd->length = len;
+    if (txBuffers[txTail]) {
+        if (!(txd->status & TSTATUS_DD)) {
+            // The ring is full, drop the packet rather than overwrite one the card has not sent yet
+            stats.txDropped++;
+            buffer->Unref();
+            return;
+        }
+
+        // The card is done with the last buffer sent from this descriptor
+        txBuffers[txTail]->Unref();
+    }
+
+    // The card reads straight out of the buffer, we hold on to it until the descriptor is reused
+    txBuffers[txTail] = buffer;
+
+    txd->addr = buffer->PhysicalData();
+    txd->length = buffer->Length();
     txd->cmd = TCMD_EOP | TCMD_IFCS | TCMD_RS;
+    txd->status = 0;
 
     txTail = (txTail + 1) % TX_DESC_COUNT;
 
     WriteMem32(I8254_REGISTER_TDESC_TAIL, txTail);
-    asm("sti");
-}
\ No newline at end of file
+}
@@ -0,0 +1,303 @@
+#include "Virtio.h"
+
+#include <CPU.h>
+#include <Logging.h>
+#include <MM/KMalloc.h>
+#include <Paging.h>
+#include <PhysicalAllocator.h>
+#include <String.h>
+
+Virtqueue::Virtqueue(VirtioDevice* device, uint16_t index, uint16_t size, uint16_t notifyOffset)
+    : m_device(device), m_index(index), m_size(size), m_notifyOffset(notifyOffset) {
+    assert(size && size <= VIRTQ_MAX_SIZE);
+
+    for (int i = 0; i < 3; i++) {
+        m_physical[i] = Memory::AllocatePhysicalMemoryBlock(); // The device wants physical addresses
+        m_pages[i] = Memory::KernelAllocate4KPages(1);
+        Memory::KernelMapVirtualMemory4K(m_physical[i], reinterpret_cast<uintptr_t>(m_pages[i]), 1);
+
+        memset(m_pages[i], 0, PAGE_SIZE_4K);
+    }
+
+    m_descriptors = reinterpret_cast<VirtqDescriptor*>(m_pages[0]);
+    m_available = reinterpret_cast<uint16_t*>(m_pages[1]);
+    m_usedHeader = reinterpret_cast<uint16_t*>(m_pages[2]);
+    m_usedRing = reinterpret_cast<VirtqUsedElement*>(reinterpret_cast<uintptr_t>(m_pages[2]) + sizeof(uint16_t) * 2);
+
+    m_usedEvent = &m_available[2 + size];
+    m_availableEvent = reinterpret_cast<volatile uint16_t*>(&m_usedRing[size]);
+
+    m_cookies = reinterpret_cast<void**>(kmalloc(size * sizeof(void*)));
+    memset(m_cookies, 0, size * sizeof(void*));
+
+    // Chain all descriptors into the free list
+    for (uint16_t i = 0; i < size; i++) {
+        m_descriptors[i].next = i + 1;
+    }
+
+    m_freeHead = 0;
+    m_freeCount = size;
+}
+
+Virtqueue::~Virtqueue() {
+    for (int i = 0; i < 3; i++) {
+        Memory::KernelFree4KPages(m_pages[i], 1);
+        Memory::FreePhysicalMemoryBlock(m_physical[i]);
+    }
+
+    kfree(m_cookies);
+}
+
+bool Virtqueue::Submit(const VirtqBuffer* buffers, unsigned count, void* cookie) {
+    assert(count && cookie);
+
+    if (count > m_freeCount) {
+        return false;
+    }
+
+    uint16_t head = m_freeHead;
+    uint16_t last = head;
+
+    uint16_t desc = head;
+    for (unsigned i = 0; i < count; i++) {
+        volatile VirtqDescriptor& d = m_descriptors[desc];
+        d.address = buffers[i].physical;
+        d.length = buffers[i].length;
+        d.flags = (buffers[i].deviceWritable ? VIRTQ_DESC_F_WRITE : 0) | ((i + 1 < count) ? VIRTQ_DESC_F_NEXT : 0);
+
+        last = desc;
+        desc = d.next;
+    }
+
+    m_freeHead = m_descriptors[last].next;
+    m_freeCount -= count;
+
+    m_cookies[head] = cookie;
+
+    m_available[2 + (m_availableIndex % m_size)] = head;
+
+    // The descriptors and ring entry must be visible before the index
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    m_available[1] = ++m_availableIndex;
+
+    return true;
+}
+
+void Virtqueue::Kick() {
+    // Publish avail->idx before reading whether the device wants to be notified
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint16_t old = m_lastKicked;
+    uint16_t current = m_availableIndex;
+    m_lastKicked = current;
+
+    if (old == current) {
+        return;
+    }
+
+    bool notify;
+    if (m_device->HasFeature(VIRTIO_F_RING_EVENT_IDX)) {
+        // vring_need_event, the device asked to be notified once avail->idx passes availableEvent
+        uint16_t event = *m_availableEvent;
+        notify = static_cast<uint16_t>(current - event - 1) < static_cast<uint16_t>(current - old);
+    } else {
+        notify = !(m_usedHeader[0] & VIRTQ_USED_F_NO_NOTIFY);
+    }
+
+    if (notify) {
+        m_device->Notify(m_index, m_notifyOffset);
+    }
+}
+
+void* Virtqueue::PopUsed(uint32_t& length) {
+    if (!HasUsed()) {
+        return nullptr;
+    }
+
+    // Read the used ring entry only after seeing used->idx
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    volatile VirtqUsedElement& e = m_usedRing[m_lastUsed % m_size];
+    uint16_t head = e.id;
+    length = e.length;
+
+    m_lastUsed++;
+
+    void* cookie = m_cookies[head];
+    assert(cookie);
+    m_cookies[head] = nullptr;
+
+    // Return the chain to the free list
+    uint16_t desc = head;
+    unsigned count = 1;
+    while (m_descriptors[desc].flags & VIRTQ_DESC_F_NEXT) {
+        desc = m_descriptors[desc].next;
+        count++;
+    }
+
+    m_descriptors[desc].next = m_freeHead;
+    m_freeHead = head;
+    m_freeCount += count;
+
+    return cookie;
+}
+
+void Virtqueue::DisableInterrupts() {
+    if (m_device->HasFeature(VIRTIO_F_RING_EVENT_IDX)) {
+        // The device ignores the flag, instead move used_event as far away as possible
+        *m_usedEvent = m_lastUsed + 0x7FFF;
+    } else {
+        m_available[0] = VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+}
+
+bool Virtqueue::EnableInterrupts() {
+    if (m_device->HasFeature(VIRTIO_F_RING_EVENT_IDX)) {
+        // Interrupt as soon as the next buffer is used
+        *m_usedEvent = m_lastUsed;
+    } else {
+        m_available[0] = 0;
+    }
+
+    // Make sure the device sees the change before checking for buffers it used in the meantime,
+    // otherwise we could miss them and never get an interrupt
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return HasUsed();
+}
+
+VirtioDevice::VirtioDevice(const PCIInfo& info) : PCIDevice(info) {}
+
+bool VirtioDevice::InitializeTransport() {
+    if (!(Status() & PCI_STATUS_CAPABILITIES)) {
+        Log::Error("[virtio] Device %x has no capabilities, legacy devices are not supported", DeviceID());
+        return false;
+    }
+
+    EnableMemorySpace();
+    EnableBusMastering();
+
+    uint8_t ptr = PCI::ConfigReadByte(Bus(), Slot(), Func(), PCICapabilitiesPointer) & 0xFC;
+    while (ptr) {
+        uint8_t id = PCI::ConfigReadByte(Bus(), Slot(), Func(), ptr);
+        uint8_t next = PCI::ConfigReadByte(Bus(), Slot(), Func(), ptr + 1);
+
+        if (id == PCI_CAP_VENDOR_SPECIFIC) {
+            uint8_t type = PCI::ConfigReadByte(Bus(), Slot(), Func(), ptr + 3);
+            uint8_t bar = PCI::ConfigReadByte(Bus(), Slot(), Func(), ptr + 4);
+            uint32_t offset = PCI::ConfigReadDword(Bus(), Slot(), Func(), ptr + 8);
+            uint32_t length = PCI::ConfigReadDword(Bus(), Slot(), Func(), ptr + 12);
+
+            // Use the first capability of each type
+            if (bar <= 5 && !BarIsIOPort(bar)) {
+                if (type == VirtioPCICapCommonConfig && !m_common) {
+                    m_common = reinterpret_cast<volatile VirtioPCICommonConfig*>(MapCapability(bar, offset, length));
+                } else if (type == VirtioPCICapNotifyConfig && !m_notify) {
+                    m_notifyMultiplier = PCI::ConfigReadDword(Bus(), Slot(), Func(), ptr + 16);
+                    m_notify = MapCapability(bar, offset, length);
+                } else if (type == VirtioPCICapISRConfig && !m_isr) {
+                    m_isr = MapCapability(bar, offset, length);
+                } else if (type == VirtioPCICapDeviceConfig && !m_deviceConfig) {
+                    m_deviceConfig = MapCapability(bar, offset, length);
+                }
+            }
+        }
+
+        ptr = next & 0xFC;
+    }
+
+    if (!m_common || !m_notify || !m_isr || !m_deviceConfig) {
+        Log::Error("[virtio] Device %x is missing virtio capabilities, legacy devices are not supported", DeviceID());
+        return false;
+    }
+
+    // Reset, the device reads 0 once the reset has finished
+    m_common->deviceStatus = 0;
+    while (m_common->deviceStatus)
+        asm volatile("pause");
+
+    m_common->deviceStatus = VIRTIO_STATUS_ACKNOWLEDGE;
+    m_common->deviceStatus = m_common->deviceStatus | VIRTIO_STATUS_DRIVER;
+
+    return true;
+}
+
+bool VirtioDevice::NegotiateFeatures(uint64_t wanted) {
+    wanted |= (1ULL << VIRTIO_F_VERSION_1);
+
+    m_common->deviceFeatureSelect = 0;
+    uint64_t offered = m_common->deviceFeature;
+    m_common->deviceFeatureSelect = 1;
+    offered |= static_cast<uint64_t>(m_common->deviceFeature) << 32;
+
+    m_features = offered & wanted;
+    if (!HasFeature(VIRTIO_F_VERSION_1)) {
+        Log::Error("[virtio] Device %x does not support virtio 1.0", DeviceID());
+        Fail();
+        return false;
+    }
+
+    m_common->driverFeatureSelect = 0;
+    m_common->driverFeature = m_features & 0xFFFFFFFF;
+    m_common->driverFeatureSelect = 1;
+    m_common->driverFeature = m_features >> 32;
+
+    m_common->deviceStatus = m_common->deviceStatus | VIRTIO_STATUS_FEATURES_OK;
+    if (!(m_common->deviceStatus & VIRTIO_STATUS_FEATURES_OK)) {
+        Log::Error("[virtio] Device %x rejected features %x", DeviceID(), m_features);
+        Fail();
+        return false;
+    }
+
+    return true;
+}
+
+Virtqueue* VirtioDevice::CreateQueue(uint16_t index) {
+    if (index >= m_common->queueCount) {
+        return nullptr;
+    }
+
+    m_common->queueSelect = index;
+
+    uint16_t size = m_common->queueSize;
+    if (!size) {
+        return nullptr;
+    }
+
+    // Sizes are powers of two so this stays one
+    if (size > VIRTQ_MAX_SIZE) {
+        size = VIRTQ_MAX_SIZE;
+    }
+
+    Virtqueue* queue = new Virtqueue(this, index, size, m_common->queueNotifyOffset);
+
+    m_common->queueSize = size;
+    m_common->queueDescLow = queue->DescriptorsPhysical() & 0xFFFFFFFF;
+    m_common->queueDescHigh = queue->DescriptorsPhysical() >> 32;
+    m_common->queueAvailLow = queue->AvailablePhysical() & 0xFFFFFFFF;
+    m_common->queueAvailHigh = queue->AvailablePhysical() >> 32;
+    m_common->queueUsedLow = queue->UsedPhysical() & 0xFFFFFFFF;
+    m_common->queueUsedHigh = queue->UsedPhysical() >> 32;
+    m_common->queueEnable = 1;
+
+    return queue;
+}
+
+void VirtioDevice::DriverOK() { m_common->deviceStatus = m_common->deviceStatus | VIRTIO_STATUS_DRIVER_OK; }
+
+void VirtioDevice::Fail() { m_common->deviceStatus = m_common->deviceStatus | VIRTIO_STATUS_FAILED; }
+
+void VirtioDevice::Notify(uint16_t queue, uint16_t notifyOffset) {
+    *reinterpret_cast<volatile uint16_t*>(m_notify + notifyOffset * m_notifyMultiplier) = queue;
+}
+
+volatile uint8_t* VirtioDevice::MapCapability(uint8_t bar, uint32_t offset, uint32_t length) {
+    uintptr_t physical = GetBaseAddressRegister(bar) + offset;
+    uintptr_t base = physical & ~static_cast<uintptr_t>(PAGE_SIZE_4K - 1);
+    size_t pages = (physical + length - base + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K;
+
+    uintptr_t virt = reinterpret_cast<uintptr_t>(Memory::KernelAllocate4KPages(pages));
+    Memory::KernelMapVirtualMemory4K(base, virt, pages,
+                                     PAGE_PRESENT | PAGE_WRITABLE | PAGE_CACHE_DISABLED | PAGE_WRITETHROUGH);
+
+    return reinterpret_cast<volatile uint8_t*>(virt + (physical - base));
+}
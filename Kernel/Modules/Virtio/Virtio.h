@@ -0,0 +1,254 @@
+#pragma once
+
+#include <Compiler.h>
+#include <Lock.h>
+#include <PCI.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VIRTIO_VENDOR_ID 0x1AF4
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FEATURES_OK 8
+#define VIRTIO_STATUS_FAILED 128
+
+#define VIRTIO_F_RING_EVENT_IDX 29
+#define VIRTIO_F_VERSION_1 32
+
+#define VIRTIO_ISR_QUEUE (1 << 0)
+#define VIRTIO_ISR_CONFIG (1 << 1)
+
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2 // Device writes to the buffer
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+#define VIRTQ_USED_F_NO_NOTIFY 1
+
+#define VIRTQ_MAX_SIZE 256 // Keeps the descriptor table within a single page
+
+#define PCI_CAP_VENDOR_SPECIFIC 0x9
+
+enum VirtioPCICapabilityType {
+    VirtioPCICapCommonConfig = 1,
+    VirtioPCICapNotifyConfig = 2,
+    VirtioPCICapISRConfig = 3,
+    VirtioPCICapDeviceConfig = 4,
+};
+
+struct VirtioPCICommonConfig {
+    uint32_t deviceFeatureSelect;
+    uint32_t deviceFeature;
+    uint32_t driverFeatureSelect;
+    uint32_t driverFeature;
+    uint16_t msixConfig;
+    uint16_t queueCount;
+    uint8_t deviceStatus;
+    uint8_t configGeneration;
+
+    // Fields below apply to the queue in queueSelect
+    uint16_t queueSelect;
+    uint16_t queueSize;
+    uint16_t queueMSIXVector;
+    uint16_t queueEnable;
+    uint16_t queueNotifyOffset;
+    uint32_t queueDescLow;
+    uint32_t queueDescHigh;
+    uint32_t queueAvailLow;
+    uint32_t queueAvailHigh;
+    uint32_t queueUsedLow;
+    uint32_t queueUsedHigh;
+} __attribute__((packed));
+
+struct VirtqDescriptor {
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed));
+
+struct VirtqUsedElement {
+    uint32_t id; // Head of the descriptor chain
+    uint32_t length; // Bytes written by the device
+} __attribute__((packed));
+
+// A physically contiguous buffer in a descriptor chain
+struct VirtqBuffer {
+    uintptr_t physical;
+    uint32_t length;
+    bool deviceWritable;
+};
+
+class VirtioDevice;
+
+/////////////////////////////
+/// \brief Split virtqueue
+///
+/// The queue does no locking of its own, callers serialise access
+/// (e.g. with lock or by only using the queue from the interrupt handler).
+/////////////////////////////
+class Virtqueue final {
+public:
+    Virtqueue(VirtioDevice* device, uint16_t index, uint16_t size, uint16_t notifyOffset);
+    ~Virtqueue();
+
+    /////////////////////////////
+    /// \brief Add a descriptor chain to the available ring
+    ///
+    /// The device is not notified until Kick is called,
+    /// so several chains can be submitted at once.
+    ///
+    /// \param cookie Returned by PopUsed when the device is done with the chain, must not be nullptr
+    ///
+    /// \return false if there are not enough free descriptors
+    /////////////////////////////
+    bool Submit(const VirtqBuffer* buffers, unsigned count, void* cookie);
+
+    /////////////////////////////
+    /// \brief Notify the device of submitted chains
+    ///
+    /// With VIRTIO_F_RING_EVENT_IDX the device is only notified
+    /// if it asked to be since the last kick.
+    /////////////////////////////
+    void Kick();
+
+    /////////////////////////////
+    /// \brief Take a chain the device has finished with
+    ///
+    /// \param length Set to the amount of bytes written by the device
+    ///
+    /// \return The cookie passed to Submit, nullptr if there is nothing in the used ring
+    /////////////////////////////
+    void* PopUsed(uint32_t& length);
+
+    /////////////////////////////
+    /// \brief Ask the device not to interrupt when it uses buffers
+    ///
+    /// Only a hint, the device may still interrupt.
+    /////////////////////////////
+    void DisableInterrupts();
+
+    /////////////////////////////
+    /// \brief Ask the device to interrupt again
+    ///
+    /// \return true if buffers were used in the meantime and the caller should poll again
+    /////////////////////////////
+    bool EnableInterrupts();
+
+    ALWAYS_INLINE bool HasUsed() const { return m_lastUsed != m_usedHeader[1]; }
+
+    ALWAYS_INLINE unsigned FreeCount() const { return m_freeCount; }
+    ALWAYS_INLINE uint16_t Size() const { return m_size; }
+    ALWAYS_INLINE uint16_t Index() const { return m_index; }
+
+    ALWAYS_INLINE uintptr_t DescriptorsPhysical() const { return m_physical[0]; }
+    ALWAYS_INLINE uintptr_t AvailablePhysical() const { return m_physical[1]; }
+    ALWAYS_INLINE uintptr_t UsedPhysical() const { return m_physical[2]; }
+
+    lock_t lock = 0;
+
+private:
+    VirtioDevice* m_device;
+
+    uint16_t m_index;
+    uint16_t m_size;
+    uint16_t m_notifyOffset;
+
+    // Descriptor table, available and used rings each get their own page
+    uintptr_t m_physical[3];
+    void* m_pages[3];
+
+    volatile VirtqDescriptor* m_descriptors;
+    volatile uint16_t* m_available; // flags, idx, ring[size], used_event
+    volatile uint16_t* m_usedHeader; // flags, idx
+    volatile VirtqUsedElement* m_usedRing; // ring[size], followed by avail_event
+
+    volatile uint16_t* m_usedEvent;
+    volatile uint16_t* m_availableEvent;
+
+    void** m_cookies; // Indexed by the head of each chain
+
+    uint16_t m_freeHead = 0;
+    unsigned m_freeCount = 0;
+
+    uint16_t m_availableIndex = 0; // Our copy of avail->idx
+    uint16_t m_lastKicked = 0; // avail->idx at the last kick
+    uint16_t m_lastUsed = 0; // Next used ring entry to read
+};
+
+/////////////////////////////
+/// \brief Virtio 1.0 device using the PCI transport
+///
+/// Legacy (pre 1.0) devices without the virtio PCI capabilities are not supported.
+/// Initialization goes InitializeTransport, NegotiateFeatures, CreateQueue, DriverOK.
+/////////////////////////////
+class VirtioDevice : protected PCIDevice {
+    friend class Virtqueue;
+
+public:
+    VirtioDevice(const PCIInfo& info);
+    virtual ~VirtioDevice() = default;
+
+    /////////////////////////////
+    /// \brief Find and map the configuration structures then reset the device
+    ///
+    /// \return false if the device is missing any of the virtio capabilities
+    /////////////////////////////
+    bool InitializeTransport();
+
+    /////////////////////////////
+    /// \brief Accept the features in wanted that the device offers
+    ///
+    /// VIRTIO_F_VERSION_1 is always requested.
+    ///
+    /// \return false if the device did not accept the features, it is then marked as failed
+    /////////////////////////////
+    bool NegotiateFeatures(uint64_t wanted);
+
+    /////////////////////////////
+    /// \brief Set up and enable a virtqueue
+    ///
+    /// Size is the smaller of the device maximum and VIRTQ_MAX_SIZE.
+    ///
+    /// \return nullptr if the queue does not exist
+    /////////////////////////////
+    Virtqueue* CreateQueue(uint16_t index);
+
+    // Tell the device the driver is ready, queues must be created beforehand
+    void DriverOK();
+    // Tell the device the driver has given up on it
+    void Fail();
+
+    // Reading the ISR status clears it and deasserts the interrupt
+    ALWAYS_INLINE uint8_t ReadISR() { return *m_isr; }
+
+    ALWAYS_INLINE bool HasFeature(unsigned bit) const { return m_features & (1ULL << bit); }
+    ALWAYS_INLINE uint16_t QueueCount() const { return m_common->queueCount; }
+
+    template <typename T> ALWAYS_INLINE T ReadConfig(size_t offset) {
+        T value;
+        uint8_t generation;
+        do {
+            generation = m_common->configGeneration;
+            value = *reinterpret_cast<volatile T*>(m_deviceConfig + offset);
+        } while (generation != m_common->configGeneration); // The device changed the config while we were reading it
+
+        return value;
+    }
+
+protected:
+    volatile VirtioPCICommonConfig* m_common = nullptr;
+    volatile uint8_t* m_isr = nullptr;
+    volatile uint8_t* m_deviceConfig = nullptr;
+    volatile uint8_t* m_notify = nullptr;
+    uint32_t m_notifyMultiplier = 0;
+
+    uint64_t m_features = 0;
+
+    void Notify(uint16_t queue, uint16_t notifyOffset);
+
+private:
+    volatile uint8_t* MapCapability(uint8_t bar, uint32_t offset, uint32_t length);
+};
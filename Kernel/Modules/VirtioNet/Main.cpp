@@ -0,0 +1,382 @@
+#include "VirtioNet.h"
+
+#include <Module.h>
+
+#include <CPU.h>
+#include <IDT.h>
+#include <Logging.h>
+#include <Math.h>
+#include <Net/Net.h>
+#include <PCI.h>
+#include <Paging.h>
+#include <PhysicalAllocator.h>
+#include <SMP.h>
+#include <Vector.h>
+
+static Vector<VirtioNet*>* adapters = nullptr;
+
+static void ProbeDevice(const PCIInfo& dev) {
+    VirtioNet* card = new VirtioNet(dev);
+
+    if (card->dState == VirtioNet::DriverState::OK) {
+        Network::NetFS::GetInstance()->RegisterAdapter(card);
+        adapters->add_back(card);
+    } else {
+        delete card;
+    }
+}
+
+static int ModuleInit() {
+    adapters = new Vector<VirtioNet*>();
+
+    PCI::EnumeratePCIDevices(VIRTIO_NET_DEVICE_ID, VIRTIO_VENDOR_ID, ProbeDevice);
+    PCI::EnumeratePCIDevices(VIRTIO_NET_DEVICE_ID_TRANSITIONAL, VIRTIO_VENDOR_ID, ProbeDevice);
+
+    if (adapters->get_length() == 0) {
+        return 1; // No cards, let the kernel unload us
+    }
+
+    return 0;
+}
+
+static int ModuleExit() {
+    for (const auto& card : *adapters) {
+        Network::NetFS::GetInstance()->RemoveAdapter(card);
+        delete card;
+    }
+
+    delete adapters;
+
+    return 0;
+}
+
+DECLARE_MODULE("virtionet", "Virtio Network Adapter Driver", ModuleInit, ModuleExit);
+
+void VirtioNet::InterruptHandler(VirtioNet* card, RegisterContext* r) { card->OnInterrupt(); }
+
+VirtioNet::VirtioNet(const PCIInfo& device) : NetworkAdapter(NetworkAdapterEthernet), VirtioDevice(device) {
+    for (unsigned i = 0; i < VIRTIO_NET_MAX_QUEUE_PAIRS; i++) {
+        queues[i] = {nullptr, nullptr};
+    }
+
+    if (!InitializeTransport()) {
+        dState = DriverState::Error;
+        return;
+    }
+
+    uint64_t wanted = (1ULL << VIRTIO_NET_F_MAC) | (1ULL << VIRTIO_NET_F_STATUS) | (1ULL << VIRTIO_NET_F_MRG_RXBUF) |
+                      (1ULL << VIRTIO_NET_F_CSUM) | (1ULL << VIRTIO_NET_F_HOST_TSO4) | (1ULL << VIRTIO_NET_F_CTRL_VQ) |
+                      (1ULL << VIRTIO_NET_F_MQ) | (1ULL << VIRTIO_F_RING_EVENT_IDX);
+    if (!NegotiateFeatures(wanted)) {
+        dState = DriverState::Error;
+        return;
+    }
+
+    unsigned maxPairs = 1;
+    if (HasFeature(VIRTIO_NET_F_MQ) && HasFeature(VIRTIO_NET_F_CTRL_VQ)) {
+        maxPairs = ReadConfig<uint16_t>(offsetof(Config, maxQueuePairs));
+    }
+
+    // One pair per CPU, transmit queues are picked by CPU so they are not contended
+    queuePairs = MIN(MIN(maxPairs, SMP::processorCount), static_cast<unsigned>(VIRTIO_NET_MAX_QUEUE_PAIRS));
+    if (!queuePairs) {
+        queuePairs = 1;
+    }
+
+    // Receive and transmit queues alternate, followed by the control queue
+    for (unsigned i = 0; i < queuePairs; i++) {
+        queues[i].rx = CreateQueue(i * 2);
+        queues[i].tx = CreateQueue(i * 2 + 1);
+
+        if (!queues[i].rx || !queues[i].tx) {
+            Log::Error("[virtionet] Failed to create queue pair %d", i);
+            Fail();
+            dState = DriverState::Error;
+            return;
+        }
+
+        // Used transmit buffers are reclaimed when sending, so we don't need interrupts for them
+        queues[i].tx->DisableInterrupts();
+    }
+
+    if (HasFeature(VIRTIO_NET_F_CTRL_VQ)) {
+        controlQueue = CreateQueue(maxPairs * 2);
+
+        controlBufferPhys = Memory::AllocatePhysicalMemoryBlock();
+        controlBuffer = reinterpret_cast<uint8_t*>(Memory::KernelAllocate4KPages(1));
+        Memory::KernelMapVirtualMemory4K(controlBufferPhys, reinterpret_cast<uintptr_t>(controlBuffer), 1);
+    }
+
+    if (HasFeature(VIRTIO_NET_F_MAC)) {
+        uint8_t macAddr[6];
+        for (int i = 0; i < 6; i++) {
+            macAddr[i] = ReadConfig<uint8_t>(offsetof(Config, mac) + i);
+        }
+
+        mac = macAddr;
+    }
+
+    Log::Info("[virtionet] MAC Address: %x:%x:%x:%x:%x:%x, Queue pairs: %d, Features: %x", mac[0], mac[1], mac[2],
+              mac[3], mac[4], mac[5], queuePairs, m_features);
+
+    // Without MSI-X all queues share the one interrupt
+    int irqNum = AllocateVector(PCIVectors::PCIVectorLegacy);
+    IDT::RegisterInterruptHandler(irqNum, reinterpret_cast<isr_t>(&VirtioNet::InterruptHandler), this);
+    EnableInterrupts();
+
+    char tempName[NAME_MAX];
+    char busS[16];
+    char slotS[16];
+
+    itoa(Bus(), busS, 10);
+    itoa(Slot(), slotS, 10);
+
+    strcpy(tempName, "vnet");
+    strcat(tempName, busS);
+    strcat(tempName, "s");
+    strcat(tempName, slotS);
+
+    SetInstanceName(tempName); // Name format: vnet%pciBus%s%pciSlot%
+    SetDeviceName("Virtio Network Adapter");
+
+    DriverOK();
+
+    for (unsigned i = 0; i < queuePairs; i++) {
+        FillRx(queues[i].rx);
+    }
+
+    if (queuePairs > 1 && !SetQueuePairs(queuePairs)) {
+        Log::Warning("[virtionet] Failed to enable %d queue pairs", queuePairs);
+        queuePairs = 1;
+    }
+
+    if (HasFeature(VIRTIO_NET_F_CSUM)) {
+        features |= AdapterFeatureChecksumOffload;
+
+        if (HasFeature(VIRTIO_NET_F_HOST_TSO4)) {
+            features |= AdapterFeatureSegmentationOffload;
+        }
+    }
+
+    dState = DriverState::OK;
+    UpdateLink();
+}
+
+bool VirtioNet::SetQueuePairs(unsigned pairs) {
+    if (!controlQueue) {
+        return false;
+    }
+
+    // Class and command, then the amount of pairs, then the ack written by the device
+    controlBuffer[0] = VIRTIO_NET_CTRL_MQ;
+    controlBuffer[1] = VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET;
+    *reinterpret_cast<uint16_t*>(controlBuffer + 2) = pairs;
+    controlBuffer[4] = 0xFF;
+
+    VirtqBuffer command[3] = {
+        {controlBufferPhys, 2, false},
+        {controlBufferPhys + 2, 2, false},
+        {controlBufferPhys + 4, 1, true},
+    };
+
+    if (!controlQueue->Submit(command, 3, controlBuffer)) {
+        return false;
+    }
+    controlQueue->Kick();
+
+    // The device handles control commands straight away, so poll for the reply
+    uint32_t length;
+    for (int i = 0; i < 1000000; i++) {
+        if (controlQueue->PopUsed(length)) {
+            return controlBuffer[4] == VIRTIO_NET_OK;
+        }
+
+        asm volatile("pause");
+    }
+
+    return false;
+}
+
+void VirtioNet::FillRx(Virtqueue* rx) {
+    while (rx->FreeCount()) {
+        // Buffers are a page with no headroom, they hold a full frame and the virtio header
+        Network::NetBuffer* buffer = Network::NetBuffer::Allocate();
+        if (!buffer) {
+            break; // The pool is empty, we will try again on the next interrupt
+        }
+
+        VirtqBuffer desc = {buffer->PhysicalData(), NET_BUFFER_SIZE, true};
+        rx->Submit(&desc, 1, buffer);
+    }
+
+    rx->Kick();
+}
+
+int VirtioNet::ReceivePackets(Virtqueue* rx, int budget) {
+    uint32_t length;
+    Network::NetBuffer* buffer;
+
+    int received = 0;
+    while (received < budget && (buffer = reinterpret_cast<Network::NetBuffer*>(rx->PopUsed(length)))) {
+        received++;
+
+        if (length < sizeof(Header)) {
+            stats.rxDropped++;
+            buffer->Unref();
+            continue;
+        }
+
+        buffer->Put(length);
+
+        // With mergeable buffers a packet may continue in the next buffers
+        bool drop = false;
+        uint16_t bufferCount = reinterpret_cast<Header*>(buffer->data)->bufferCount;
+        for (uint16_t i = 1; i < bufferCount; i++) {
+            Network::NetBuffer* next = reinterpret_cast<Network::NetBuffer*>(rx->PopUsed(length));
+            if (!next) {
+                drop = true;
+                break;
+            }
+
+            // We never negotiate receive offloads so frames always fit in a page
+            if (buffer->Tailroom() >= length) {
+                memcpy(buffer->Put(length), next->data, length);
+            } else {
+                drop = true;
+            }
+
+            next->Unref();
+        }
+
+        if (drop) {
+            stats.rxDropped++;
+            buffer->Unref();
+            continue;
+        }
+
+        buffer->Pull(sizeof(Header));
+        buffer->adapter = this;
+
+        queue.add_back(buffer);
+        packetSemaphore.Signal();
+    }
+
+    FillRx(rx);
+    return received;
+}
+
+int VirtioNet::Poll(int budget) {
+    // Only the network thread touches the receive queues
+    int received = 0;
+    for (unsigned i = 0; i < queuePairs && received < budget; i++) {
+        received += ReceivePackets(queues[i].rx, budget - received);
+    }
+
+    return received;
+}
+
+void VirtioNet::EnableReceiveInterrupts() {
+    bool pending = false;
+    for (unsigned i = 0; i < queuePairs; i++) {
+        pending |= queues[i].rx->EnableInterrupts();
+    }
+
+    if (pending) {
+        SchedulePoll(); // Packets arrived before interrupts were enabled again
+    }
+}
+
+void VirtioNet::ReclaimTx(Virtqueue* tx) {
+    uint32_t length;
+    Network::NetBuffer* buffer;
+    while ((buffer = reinterpret_cast<Network::NetBuffer*>(tx->PopUsed(length)))) {
+        buffer->Unref();
+    }
+}
+
+void VirtioNet::OnInterrupt() {
+    uint8_t status = ReadISR();
+
+    if (status & VIRTIO_ISR_CONFIG) {
+        UpdateLink();
+    }
+
+    if (status & VIRTIO_ISR_QUEUE) {
+        // Leave the queues to the network thread, interrupts are enabled again once they are drained
+        for (unsigned i = 0; i < queuePairs; i++) {
+            queues[i].rx->DisableInterrupts();
+        }
+
+        SchedulePoll();
+    }
+}
+
+void VirtioNet::UpdateLink() {
+    if (!HasFeature(VIRTIO_NET_F_STATUS)) {
+        linkState = LinkUp; // Assume the link is always up
+        return;
+    }
+
+    int _link = ReadConfig<uint16_t>(offsetof(Config, status)) & VIRTIO_NET_S_LINK_UP;
+    Log::Info("[virtionet] Link %s", (_link) ? "Up" : "Down");
+
+    if (_link) {
+        linkState = LinkUp;
+    } else {
+        linkState = LinkDown;
+    }
+}
+
+void VirtioNet::SendPacket(void* data, size_t len) {
+    Network::NetBuffer* buffer = Network::NetBuffer::AllocateWithHeadroom();
+    if (!buffer) {
+        return; // Drop the packet
+    }
+
+    memcpy(buffer->Put(len), data, len);
+    SendBuffer(buffer);
+}
+
+void VirtioNet::SendBuffer(Network::NetBuffer* buffer) {
+    Header header;
+    memset(&header, 0, sizeof(Header));
+
+    if (buffer->checksumStart && HasFeature(VIRTIO_NET_F_CSUM)) {
+        header.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        header.checksumStart = buffer->checksumStart - buffer->data;
+        header.checksumOffset = buffer->checksumOffset;
+
+        if (buffer->gsoSize && HasFeature(VIRTIO_NET_F_HOST_TSO4)) {
+            TCPHeader* tcpHeader = reinterpret_cast<TCPHeader*>(buffer->checksumStart);
+
+            header.gsoType = VIRTIO_NET_HDR_GSO_TCPV4;
+            header.gsoSize = buffer->gsoSize;
+            header.headerLength = header.checksumStart + tcpHeader->dataOffset * 4;
+        }
+    }
+
+    if (buffer->Headroom() < sizeof(Header)) {
+        buffer->Unref(); // Every sender leaves NET_BUFFER_HEADROOM so this should not happen
+        return;
+    }
+    memcpy(buffer->Push(sizeof(Header)), &header, sizeof(Header));
+
+    Virtqueue* tx = queues[GetCPULocal()->id % queuePairs].tx;
+
+    InterruptDisabler disableInterrupts;
+    ScopedSpinLock lockTx(tx->lock);
+
+    ReclaimTx(tx);
+
+    if (!tx->FreeCount()) {
+        // The ring is full, drop the packet rather than overwrite one the device has not sent yet
+        stats.txDropped++;
+        buffer->Unref();
+        return;
+    }
+
+    // The device reads straight out of the buffer, we hold on to it until it is used
+    VirtqBuffer desc = {buffer->PhysicalData(), static_cast<uint32_t>(buffer->Length()), false};
+    tx->Submit(&desc, 1, buffer);
+    tx->Kick();
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Net/Adapter.h>
+#include <Net/NetBuffer.h>
+#include <PCI.h>
+
+#include "../Virtio/Virtio.h"
+
+#define VIRTIO_NET_DEVICE_ID_TRANSITIONAL 0x1000
+#define VIRTIO_NET_DEVICE_ID 0x1041
+
+#define VIRTIO_NET_F_CSUM 0 // Device checksums partial packets
+#define VIRTIO_NET_F_MAC 5
+#define VIRTIO_NET_F_HOST_TSO4 11 // Device segments TCPv4 packets
+#define VIRTIO_NET_F_MRG_RXBUF 15 // Received packets may span several buffers
+#define VIRTIO_NET_F_STATUS 16
+#define VIRTIO_NET_F_CTRL_VQ 17
+#define VIRTIO_NET_F_MQ 22
+
+#define VIRTIO_NET_S_LINK_UP 1
+
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+
+#define VIRTIO_NET_HDR_GSO_NONE 0
+#define VIRTIO_NET_HDR_GSO_TCPV4 1
+
+#define VIRTIO_NET_CTRL_MQ 4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET 0
+
+#define VIRTIO_NET_OK 0
+
+#define VIRTIO_NET_MAX_QUEUE_PAIRS 8
+
+class VirtioNet final : public Network::NetworkAdapter, private VirtioDevice {
+public:
+    VirtioNet(const PCIInfo& device);
+
+    void SendPacket(void* data, size_t len);
+    void SendBuffer(Network::NetBuffer* buffer);
+
+    int Poll(int budget);
+    void EnableReceiveInterrupts();
+
+private:
+    // Precedes every packet, 12 bytes with VIRTIO_F_VERSION_1
+    struct Header {
+        uint8_t flags;
+        uint8_t gsoType;
+        uint16_t headerLength; // Ethernet, IP and TCP headers when using GSO
+        uint16_t gsoSize;
+        uint16_t checksumStart;
+        uint16_t checksumOffset;
+        uint16_t bufferCount; // Amount of receive buffers the packet spans
+    } __attribute__((packed));
+
+    struct Config {
+        uint8_t mac[6];
+        uint16_t status;
+        uint16_t maxQueuePairs;
+    } __attribute__((packed));
+
+    struct QueuePair {
+        Virtqueue* rx;
+        Virtqueue* tx;
+    };
+
+    QueuePair queues[VIRTIO_NET_MAX_QUEUE_PAIRS];
+    unsigned queuePairs = 1;
+
+    Virtqueue* controlQueue = nullptr;
+    uint8_t* controlBuffer; // Command header, data and ack
+    uintptr_t controlBufferPhys;
+
+    bool SetQueuePairs(unsigned pairs);
+
+    void FillRx(Virtqueue* rx);
+    int ReceivePackets(Virtqueue* rx, int budget);
+    void ReclaimTx(Virtqueue* tx);
+
+    void UpdateLink();
+    void OnInterrupt();
+    static void InterruptHandler(VirtioNet* card, RegisterContext* r);
+};
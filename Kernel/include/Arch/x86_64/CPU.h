@@ -92,12 +92,21 @@ enum {
     CPUID_EDX_PBE = 1 << 31
 };
 
+// Structured extended features (leaf 7)
+enum {
+    CPUID_EXT_EBX_ERMS = 1 << 9, // Enhanced rep movsb/stosb
+    CPUID_EXT_EDX_FSRM = 1 << 4, // Fast short rep movsb
+};
+
 typedef struct {
     char vendorString[12];      // CPU vendor string
     char nullTerminator = '\0'; // Acts as a terminator for the vendor string
 
     uint32_t features_ecx; // CPU features (ecx)
     uint32_t features_edx; // CPU features (edx)
+
+    uint32_t features_ext_ebx = 0; // Structured extended features (ebx)
+    uint32_t features_ext_edx = 0; // Structured extended features (edx)
 } __attribute__((packed)) cpuid_info_t;
 
 struct RegisterContext {
@@ -7,6 +7,7 @@
 
 #define IPI_HALT 0xFE
 #define IPI_SCHEDULE 0xFD
+#define IPI_TLB_SHOOTDOWN 0xFC
 
 typedef struct {
     uint16_t base_low;
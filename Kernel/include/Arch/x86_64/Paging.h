@@ -11,6 +11,9 @@
 #define PAGE_DIR_GET_INDEX(addr) (((addr) >> 21) & 0x1FF)
 #define PAGE_TABLE_GET_INDEX(addr) (((addr) >> 12) & 0x1FF)
 
+#define FAULT_AROUND_DEFAULT_PAGES 16 // Default amount of pages mapped around a page fault
+#define FAULT_AROUND_MAX_PAGES 512
+
 #define PML4_PRESENT 1
 #define PML4_WRITABLE (1 << 1)
 #define PML4_FRAME 0xFFFFFFFFFF000
@@ -53,7 +56,10 @@
 #define MAX_PDPT_INDEX 511
 
 #define PAGE_SHIFT_4K 12
+#define PAGE_SHIFT_2M 21
 #define PAGE_COUNT_4K(size) (((size) + (PAGE_SIZE_4K - 1)) >> 12)
+#define PAGE_COUNT_2M(size) (((size) + (PAGE_SIZE_2M - 1)) >> 21)
+#define PAGES_PER_2M (PAGE_SIZE_2M / PAGE_SIZE_4K) // Amount of 4KB pages in a 2MB page
 
 typedef uint64_t page_t;
 typedef uint64_t pd_entry_t;
@@ -89,6 +95,9 @@ class AddressSpace;
 namespace Memory {
 extern pml4_t kernelPML4;
 
+// Size of the window (in 4KB pages) populated around a user page fault, 0 or 1 disables fault-around
+extern unsigned faultAroundPages;
+
 // Creates a new pagemap object
 PageMap* CreatePageMap();
 // Clones an existing pagemap object
@@ -100,9 +109,11 @@ void InitializeVirtualMemory();
 void LateInitializeVirtualMemory();
 
 void* KernelAllocate4KPages(uint64_t amount);
+void* KernelAllocate2MPages(uint64_t amount);
 
 void Free4KPages(void* addr, uint64_t amount, page_map_t* addressSpace);
 void KernelFree4KPages(void* addr, uint64_t amount);
+void KernelFree2MPages(void* addr, uint64_t amount);
 void FreeVirtualMemory(void* pointer, uint64_t size);
 
 /////////////////////////////
@@ -145,6 +156,65 @@ void MapVirtualMemory4K(uint64_t phys, uint64_t virt, uint64_t amount, PageMap*
 /////////////////////////////
 void MapVirtualMemory4K(uint64_t phys, uint64_t virt, uint64_t amount, uint64_t flags, PageMap* pageMap);
 
+/////////////////////////////
+/// \brief Map 2MB Pages
+///
+/// \param phys Physical address to map to (must be 2MB aligned)
+/// \param virt Virtual address of the mapping
+/// \param amount Amount of pages to map
+/////////////////////////////
+void KernelMapVirtualMemory2M(uint64_t phys, uint64_t virt, uint64_t amount);
+
+/////////////////////////////
+/// \brief Map a 2MB Page
+///
+/// Any page table previously covering the 2MB range is unlinked but not freed, as other CPUs may still be walking it.
+/// The caller must call ShootdownTLB and then free the returned table with FreePageTable.
+/// Mapping 4KB pages inside the range afterwards will split the 2MB page back into a page table.
+///
+/// \param phys Physical address to map to (must be 2MB aligned)
+/// \param virt Virtual address of the mapping (must be 2MB aligned)
+/// \param flags Page Flags (PAGE_* flags, the 2MB flag is set automatically)
+/// \param pageMap PageMap to map pages
+///
+/// \return The page table the 2MB page replaced, phys is 0 if there was none
+/////////////////////////////
+page_table_t MapVirtualMemory2M(uint64_t phys, uint64_t virt, uint64_t flags, PageMap* pageMap);
+
+/////////////////////////////
+/// \brief Free a page table returned by MapVirtualMemory2M
+///
+/// Does nothing if phys is 0.
+/////////////////////////////
+void FreePageTable(page_table_t table);
+
+/////////////////////////////
+/// \brief Check whether the 2MB range containing an address is mapped by a 4KB page table
+///
+/// \param virt Virtual address
+/// \param pageMap PageMap to check
+/////////////////////////////
+bool HasPageTable(uint64_t virt, PageMap* pageMap);
+
+/////////////////////////////
+/// \brief Check whether an address is mapped with a 2MB page
+///
+/// \param virt Virtual address
+/// \param pageMap PageMap to check
+/////////////////////////////
+bool IsHugePageMapped(uint64_t virt, PageMap* pageMap);
+
+/////////////////////////////
+/// \brief Flush the TLB of every other CPU using a PageMap
+///
+/// Sends a shootdown IPI and waits for every other CPU to acknowledge it,
+/// any CPU with pageMap loaded flushes its TLB. Must be called with interrupts enabled.
+/// The calling CPU is not flushed, the Map* functions already invalidate the pages they change.
+///
+/// \param pageMap PageMap to flush
+/////////////////////////////
+void ShootdownTLB(PageMap* pageMap);
+
 uintptr_t GetIOMapping(uintptr_t addr);
 
 bool CheckKernelPointer(uintptr_t addr, uint64_t len);
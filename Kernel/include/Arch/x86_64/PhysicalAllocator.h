@@ -30,15 +30,22 @@ void MarkMemoryRegionUsed(uint64_t base, size_t size);
 // Marks a region in physical memory as being free
 void MarkMemoryRegionFree(uint64_t base, size_t size);
 
-// Allocates a block of physical memory
+// Allocates a block of physical memory without waiting for reclaim, returns 0 on failure
+uint64_t TryAllocatePhysicalMemoryBlock();
+
+// Allocates a block of physical memory, panics when out of memory
+// Never sleeps so it is safe to call with spinlocks held
 uint64_t AllocatePhysicalMemoryBlock();
 
-// Allocates a 2MB block of physical memory
+// Allocates a 2MB aligned block of 2MB of physical memory, returns 0 on failure
 uint64_t AllocateLargePhysicalMemoryBlock();
 
 // Frees a block of physical memory
 void FreePhysicalMemoryBlock(uint64_t addr);
 
+// Frees a 2MB block of physical memory
+void FreeLargePhysicalMemoryBlock(uint64_t addr);
+
 // Used Blocks of Memory
 extern uint64_t usedPhysicalBlocks;
 extern uint64_t maxPhysicalBlocks;
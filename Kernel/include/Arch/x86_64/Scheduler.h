@@ -58,6 +58,8 @@ pid_t GetNextPID();
 FancyRefPtr<Process> FindProcessByPID(pid_t pid);
 pid_t GetNextProcessPID(pid_t pid);
 void InsertNewThreadIntoQueue(Thread* thread);
+// Threads are never migrated, so the thread always runs on SMP::cpus[cpu]
+void InsertNewThreadIntoQueue(Thread* thread, unsigned cpu);
 
 void Initialize();
 void Tick(RegisterContext* r);
@@ -236,4 +236,132 @@ private:
 	unsigned itemCount = 0;
 
 	lock_t lock = 0;
-};
\ No newline at end of file
+};
+
+/////////////////////////////
+/// \brief Hash map with a lock per bucket
+///
+/// Lookups only lock the bucket of the key, so lookups of different keys rarely contend.
+/// Values are copied out, T should be a pointer or a small value.
+/////////////////////////////
+template<typename K, typename T> // Key, Value
+class ConcurrentHashMap{
+public:
+	ConcurrentHashMap(unsigned bCount = 512) : bucketCount(bCount){
+		buckets = new Bucket[bucketCount];
+	}
+
+	~ConcurrentHashMap(){
+		delete[](buckets);
+	}
+
+	// Returns false without replacing the value if the key already exists
+	bool insert(const K& key, const T& value){
+		Bucket& bucket = GetBucket(key);
+
+		ScopedSpinLock lockBucket(bucket.lock);
+		for(Entry& entry : bucket.entries){
+			if(entry.key == key){
+				return false;
+			}
+		}
+
+		bucket.entries.add_back({ .key = key, .value = value });
+		__atomic_add_fetch(&itemCount, 1, __ATOMIC_RELAXED);
+		return true;
+	}
+
+	bool remove(const K& key){
+		Bucket& bucket = GetBucket(key);
+
+		ScopedSpinLock lockBucket(bucket.lock);
+		for(unsigned i = 0; i < bucket.entries.get_length(); i++){
+			if(bucket.entries[i].key == key){
+				bucket.entries.remove_at(i);
+				__atomic_sub_fetch(&itemCount, 1, __ATOMIC_RELAXED);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Remove the first entry with value, every bucket is searched
+	bool removeValue(const T& value){
+		for(unsigned b = 0; b < bucketCount; b++){
+			Bucket& bucket = buckets[b];
+
+			ScopedSpinLock lockBucket(bucket.lock);
+			for(unsigned i = 0; i < bucket.entries.get_length(); i++){
+				if(bucket.entries[i].value == value){
+					bucket.entries.remove_at(i);
+					__atomic_sub_fetch(&itemCount, 1, __ATOMIC_RELAXED);
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	bool get(const K& key, T& value){
+		Bucket& bucket = GetBucket(key);
+
+		ScopedSpinLock lockBucket(bucket.lock);
+		for(Entry& entry : bucket.entries){
+			if(entry.key == key){
+				value = entry.value;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Calls ref(value) while the bucket is still locked,
+	// so a reference can be taken before anyone is able to remove and free the value
+	template<typename F>
+	bool get(const K& key, T& value, F ref){
+		Bucket& bucket = GetBucket(key);
+
+		ScopedSpinLock lockBucket(bucket.lock);
+		for(Entry& entry : bucket.entries){
+			if(entry.key == key){
+				value = entry.value;
+				ref(value);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool find(const K& key){
+		T value;
+		return get(key, value);
+	}
+
+	ALWAYS_INLINE unsigned get_length() const {
+		return itemCount;
+	}
+
+private:
+	struct Entry{
+		K key;
+		T value;
+	};
+
+	struct Bucket{
+		lock_t lock = 0;
+		List<Entry> entries;
+	};
+
+	ALWAYS_INLINE Bucket& GetBucket(const K& key){
+		return buckets[Hash(key) % bucketCount];
+	}
+
+	Bucket* buckets;
+	unsigned bucketCount;
+
+	unsigned itemCount = 0;
+};
@@ -135,6 +135,7 @@ public:
     }
 
     ALWAYS_INLINE bool IsWriteLocked() const { return lock && activeReaders == 0; }
+    ALWAYS_INLINE bool IsLocked() const { return lock || fileLock || activeReaders; }
 };
 
 using FilesystemLock = ReadWriteLock;
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <RefPtr.h>
 #include <Vector.h>
 
+#include <MM/RegionTree.h>
 #include <MM/VMObject.h>
 
 class AddressSpace final {
@@ -22,6 +23,7 @@ public:
     /// \brief Find and read lock a region from an address
     ///
     /// Due to the lock, the region cannot be deallocated until this thread and all others release their read locks.
+    /// The lookup itself does not acquire the address space lock so it is safe to use from the page fault handler.
     ///
     /// \param address Address of region
     ///
@@ -53,7 +55,8 @@ public:
     /////////////////////////////
     /// \brief Unmap a region object
     ///
-    /// Unmaps a region object. It is expected that the caller has acquired a write lock
+    /// Unmaps a region object. It is expected that the caller has acquired a write lock,
+    /// which is released once the region has been removed.
     ///
     /// \return 0 if sucessful
     /////////////////////////////
@@ -67,12 +70,29 @@ public:
     void UnmapAll();
 
     size_t UsedPhysicalMemory() const;
+
+    /////////////////////////////
+    /// \brief Get amount of memory mapped with 2MB pages
+    ///
+    /// \return Memory mapped with 2MB pages in bytes
+    /////////////////////////////
+    size_t UsedHugePageMemory();
+
+    /////////////////////////////
+    /// \brief Collapse fully populated ranges of 4KB pages into 2MB pages
+    ///
+    /// \param maxPages Maximum amount of 2MB pages to collapse
+    ///
+    /// \return Amount of 2MB pages collapsed
+    /////////////////////////////
+    unsigned CollapseHugePages(unsigned maxPages);
+
     void DumpRegions();
 
     __attribute__((always_inline)) inline PageMap* GetPageMap() { return m_pageMap; }
 
 protected:
-    MappedRegion* FindAvailableRegion(size_t size);
+    MappedRegion* FindAvailableRegion(size_t size, size_t alignment = PAGE_SIZE_4K);
     MappedRegion* AllocateRegionAt(uintptr_t base, size_t size);
 
     ALWAYS_INLINE bool IsKernel() const { return this == m_kernel; }
@@ -85,7 +105,7 @@ protected:
     lock_t m_lock = 0;
 
     PageMap* m_pageMap = nullptr;
-    List<MappedRegion> m_regions;
+    RegionTree m_regions;
 
     AddressSpace* m_parent = nullptr;
 };
@@ -0,0 +1,17 @@
+#pragma once
+
+#define HUGE_PAGE_COLLAPSE_INTERVAL 1000000 // Time between collapse passes in us
+#define HUGE_PAGE_COLLAPSE_BUDGET 64        // Maximum amount of 2MB pages to collapse per pass
+
+namespace Memory {
+// Whether 2MB pages are used for large anonymous and shared mappings (disabled with 'nothp')
+extern bool transparentHugePages;
+
+/////////////////////////////
+/// \brief Huge page collapse thread
+///
+/// Periodically walks process address spaces and replaces
+/// fully populated 2MB ranges of 4KB pages with 2MB pages.
+/////////////////////////////
+void HugePageCollapseThread();
+} // namespace Memory
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RECLAIM_INTERVAL 500000     // Time between watermark checks in us when nobody wakes the reclaim thread
+#define RECLAIM_OOM_WAIT 5000000    // Time an allocation waits for memory to be freed before giving up in us
+#define RECLAIM_WATERMARK_MIN 256   // Minimum watermark in pages, OOM killer is invoked below this
+#define RECLAIM_WATERMARK_SHIFT 6   // Low watermark is (total pages >> shift), high is twice low
+
+namespace Memory {
+/////////////////////////////
+/// \brief Shrinkable cache
+///
+/// Caches that hold memory which can be dropped register a shrinker,
+/// the reclaim thread calls them when free memory drops below the low watermark.
+/////////////////////////////
+class Shrinker {
+public:
+    virtual ~Shrinker() = default;
+
+    /////////////////////////////
+    /// \brief Amount of pages the cache could free
+    /////////////////////////////
+    virtual size_t CountReclaimable() = 0;
+
+    /////////////////////////////
+    /// \brief Free memory from the cache
+    ///
+    /// Only ever called from the reclaim thread.
+    /// Must not block, if the cache is busy return 0 and it will be asked again.
+    ///
+    /// \param pages Amount of pages to attempt to free
+    ///
+    /// \return Amount of pages freed
+    /////////////////////////////
+    virtual size_t Shrink(size_t pages) = 0;
+};
+
+// Free page counts below which reclaim is woken (low), stops (high) and the OOM killer is invoked (min)
+extern size_t watermarkMin;
+extern size_t watermarkLow;
+extern size_t watermarkHigh;
+
+/////////////////////////////
+/// \brief Calculate the watermarks from the total amount of physical memory
+/////////////////////////////
+void InitializeReclaim();
+
+void RegisterShrinker(Shrinker* shrinker);
+
+/////////////////////////////
+/// \brief Unregister a shrinker
+///
+/// Waits for the reclaim thread if it is currently shrinking the cache,
+/// so the shrinker can be destroyed once this returns.
+/////////////////////////////
+void UnregisterShrinker(Shrinker* shrinker);
+
+/////////////////////////////
+/// \brief Amount of free physical pages
+/////////////////////////////
+size_t FreePhysicalPages();
+
+/////////////////////////////
+/// \brief Wake the reclaim thread
+///
+/// Called by the physical allocator when free memory drops below the low watermark,
+/// does nothing if the reclaim thread is already running.
+/////////////////////////////
+void WakeReclaim();
+
+/////////////////////////////
+/// \brief Wait for physical memory to become available
+///
+/// Called when an allocation that can fail has run out of memory.
+/// The physical allocator never calls this, the caller must not hold any spinlocks.
+/// Wakes the reclaim thread (which may invoke the OOM killer) and retries the allocation
+/// until it succeeds or RECLAIM_OOM_WAIT has passed.
+/// Gives up early if the calling thread is being killed, as it may be the OOM victim.
+///
+/// \param tryAllocate Allocation to retry, returns 0 on failure
+///
+/// \return Result of the allocation, 0 if the caller cannot wait, is being killed or nothing was freed in time
+/////////////////////////////
+uint64_t WaitForFreeMemory(uint64_t (*tryAllocate)());
+
+/////////////////////////////
+/// \brief Kill the process using the most memory
+///
+/// Init and kernel processes are never picked. Does nothing if the
+/// last victim is still dying.
+///
+/// \return true if a process was killed or is still dying
+/////////////////////////////
+bool OOMKill();
+
+/////////////////////////////
+/// \brief Reclaim thread
+///
+/// Calls the registered shrinkers whenever free memory drops below the low watermark
+/// until it is above the high watermark, and invokes the OOM killer below the min watermark.
+/////////////////////////////
+void ReclaimThread();
+} // namespace Memory
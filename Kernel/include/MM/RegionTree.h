@@ -0,0 +1,149 @@
+#pragma once
+
+#include <Compiler.h>
+#include <MM/VMObject.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/////////////////////////////
+/// \brief Balanced interval tree of MappedRegions
+///
+/// AVL tree of non-overlapping regions ordered by base address. Each node also tracks the largest
+/// free gap within its subtree so that free ranges can be found without walking every region.
+///
+/// Modifications must be serialized by the owner. Lookups may be performed without any lock
+/// through FindLockless() from within a ReadGuard; removed regions are retired and only freed
+/// once there are no lockless readers and the region lock is no longer held.
+/////////////////////////////
+class RegionTree final {
+public:
+    class Iterator {
+        friend class RegionTree;
+    public:
+        ALWAYS_INLINE MappedRegion& operator*() const { return *m_node; }
+        ALWAYS_INLINE MappedRegion* operator->() const { return m_node; }
+
+        ALWAYS_INLINE Iterator& operator++() {
+            m_node = RegionTree::Next(m_node);
+            return *this;
+        }
+
+        ALWAYS_INLINE Iterator operator++(int) {
+            Iterator it = *this;
+            m_node = RegionTree::Next(m_node);
+            return it;
+        }
+
+        ALWAYS_INLINE bool operator==(const Iterator& other) const { return m_node == other.m_node; }
+        ALWAYS_INLINE bool operator!=(const Iterator& other) const { return m_node != other.m_node; }
+
+    private:
+        ALWAYS_INLINE Iterator(MappedRegion* node) : m_node(node) {}
+
+        MappedRegion* m_node;
+    };
+
+    // Marks a lockless read section, retired regions will not be freed until it ends
+    class ReadGuard {
+    public:
+        ALWAYS_INLINE ReadGuard(RegionTree& tree) : m_tree(tree) {
+            __atomic_add_fetch(&m_tree.m_readers, 1, __ATOMIC_SEQ_CST);
+        }
+
+        ALWAYS_INLINE ~ReadGuard() { __atomic_sub_fetch(&m_tree.m_readers, 1, __ATOMIC_RELEASE); }
+
+    private:
+        RegionTree& m_tree;
+    };
+
+    RegionTree() = default;
+    RegionTree(const RegionTree&) = delete;
+    RegionTree& operator=(const RegionTree&) = delete;
+    ~RegionTree();
+
+    /////////////////////////////
+    /// \brief Insert a region into the tree
+    ///
+    /// The region must not overlap any existing regions.
+    /////////////////////////////
+    void Insert(MappedRegion* region);
+
+    /////////////////////////////
+    /// \brief Remove a region from the tree
+    ///
+    /// The region is marked as removed and freed once it is safe to do so.
+    /////////////////////////////
+    void Remove(MappedRegion* region);
+
+    /////////////////////////////
+    /// \brief Remove and free all regions
+    /////////////////////////////
+    void Clear();
+
+    /////////////////////////////
+    /// \brief Find the region containing an address
+    ///
+    /// Caller must serialize with modifications.
+    /////////////////////////////
+    MappedRegion* Find(uintptr_t address) const;
+
+    /////////////////////////////
+    /// \brief Find the region containing an address without taking any locks
+    ///
+    /// Must be called from within a ReadGuard. The returned region may be removed concurrently,
+    /// callers should check MappedRegion::IsRemoved() once they have locked it.
+    /////////////////////////////
+    MappedRegion* FindLockless(uintptr_t address) const;
+
+    /////////////////////////////
+    /// \brief Find the last region beginning before an address
+    /////////////////////////////
+    MappedRegion* FindLastBefore(uintptr_t address) const;
+
+    /////////////////////////////
+    /// \brief Find a free range
+    ///
+    /// \param size Size of the range
+    /// \param alignment Alignment of the range, must be a power of two
+    /// \param lower Lowest permitted address
+    /// \param upper The range must end below this address
+    ///
+    /// \return Base of the free range, 0 if there is none
+    /////////////////////////////
+    uintptr_t FindGap(size_t size, size_t alignment, uintptr_t lower, uintptr_t upper) const;
+
+    ALWAYS_INLINE size_t Count() const { return m_count; }
+
+    ALWAYS_INLINE Iterator begin() const { return Iterator(First()); }
+    ALWAYS_INLINE Iterator end() const { return Iterator(nullptr); }
+
+    MappedRegion* First() const;
+    MappedRegion* Last() const;
+
+    static MappedRegion* Next(MappedRegion* node);
+    static MappedRegion* Prev(MappedRegion* node);
+
+private:
+    static ALWAYS_INLINE int Height(const MappedRegion* node) { return node ? node->height : 0; }
+
+    uintptr_t FindGap(MappedRegion* node, size_t size, size_t alignment, uintptr_t lower, uintptr_t upper) const;
+
+    void Update(MappedRegion* node);
+    void Replace(MappedRegion* node, MappedRegion* replacement);
+    MappedRegion* RotateLeft(MappedRegion* node);
+    MappedRegion* RotateRight(MappedRegion* node);
+    void Rebalance(MappedRegion* node);
+
+    void FreeRetired();
+
+    ALWAYS_INLINE void WriteBegin() { __atomic_add_fetch(&m_sequence, 1, __ATOMIC_SEQ_CST); }
+    ALWAYS_INLINE void WriteEnd() { __atomic_add_fetch(&m_sequence, 1, __ATOMIC_RELEASE); }
+
+    MappedRegion* m_root = nullptr;
+    MappedRegion* m_retired = nullptr; // Removed regions waiting to be freed
+    size_t m_count = 0;
+
+    unsigned m_sequence = 0; // Odd whilst the tree is being modified
+    unsigned m_readers = 0;  // Lockless readers
+};
@@ -17,9 +17,18 @@ public:
     VMObject(size_t size, bool anonymous, bool shared);
     virtual ~VMObject() = default;
 
+    // Handle a fault at offset, returns 0 on success, -ENOMEM if out of memory and 1 if the fault is fatal
     virtual int Hit(uintptr_t base, uintptr_t offset, PageMap* pMap);
     virtual void MapAllocatedBlocks(uintptr_t base, PageMap* pMap) = 0;
 
+    // Allocate and map all pages in [offset, offset + length), returns 0 on success and the Hit status on failure
+    virtual int Populate(uintptr_t base, uintptr_t offset, size_t length, PageMap* pMap);
+
+    // Replace fully populated 2MB ranges of 4KB blocks with 2MB pages, returns the amount of pages collapsed
+    // The caller must hold the write lock of the region mapping the object at base
+    virtual unsigned CollapseHugePages(uintptr_t base, PageMap* pMap, unsigned maxPages);
+
+    // Copy the object, returns nullptr if out of memory
     virtual VMObject* Clone() = 0;
     virtual VMObject* Split(uintptr_t offset);
 
@@ -30,6 +39,10 @@ public:
     ALWAYS_INLINE bool IsShared() const { return shared; }
     ALWAYS_INLINE bool IsCopyOnWrite() const { return copyOnWrite; }
     ALWAYS_INLINE bool IsReclaimable() const { return reclaimable; }
+    ALWAYS_INLINE bool UseHugePages() const { return hugePages; }
+
+    // Allow unallocated blocks to be allocated as 2MB pages on fault
+    ALWAYS_INLINE void SetHugePages(bool enable) { hugePages = enable; }
 
     ALWAYS_INLINE virtual bool CanMunmap() const { return false; }
     ALWAYS_INLINE size_t ReferenceCount() const { return refCount; }
@@ -42,6 +55,7 @@ protected:
     bool shared : 1 = false;
     bool copyOnWrite : 1 = false;
     bool reclaimable : 1 = false;
+    bool hugePages : 1 = false;
 };
 
 // VMObject that maps to allocated physical pages (as opposed to MMIO, etc.)
@@ -51,14 +65,27 @@ public:
     virtual ~PhysicalVMObject();
 
     int Hit(uintptr_t base, uintptr_t offset, PageMap* pMap) final;
+    int Populate(uintptr_t base, uintptr_t offset, size_t length, PageMap* pMap) final;
     void ForceAllocate(); // Force allocate all blocks
     virtual void MapAllocatedBlocks(uintptr_t base, PageMap* pMap);
 
     virtual VMObject* Clone();
 
+    unsigned CollapseHugePages(uintptr_t base, PageMap* pMap, unsigned maxPages) override;
+
     virtual size_t UsedPhysicalMemory() const;
 
 protected:
+    // Whether the blocks starting at index are physically contiguous and 2MB aligned
+    bool IsHugeBlock(unsigned index) const;
+    // Map the 2MB page containing offset if it lies within the object and is backed by a huge block
+    bool MapHugeBlock(uintptr_t base, uintptr_t offset, uint64_t flags, PageMap* pMap);
+    // Allocate a 2MB page for the (unpopulated) 2MB range containing offset
+    bool AllocateHugeBlock(uintptr_t base, uintptr_t offset, PageMap* pMap);
+    // Allocate and zero the block at index unless it is already allocated, returns the block (0 on failure)
+    // mapping is used to zero the block, it is allocated if null and the caller must free it
+    uint32_t AllocateBlock(unsigned index, void*& mapping);
+
     uint32_t* physicalBlocks = nullptr; // A bit of an optimization, since one physical block is 4KB, we can shift by 12
 };
 
@@ -82,6 +109,8 @@ class AnonymousVMObject : public PhysicalVMObject{
 };
 
 struct MappedRegion {
+    friend class RegionTree;
+
     uintptr_t base;
     size_t size;
     FancyRefPtr<VMObject> vmObject;
@@ -91,6 +120,9 @@ struct MappedRegion {
     ALWAYS_INLINE uintptr_t Size() const { return size; }
     ALWAYS_INLINE uintptr_t End() const { return base + size; }
 
+    // Set once the region has been removed from its address space
+    ALWAYS_INLINE bool IsRemoved() const { return __atomic_load_n(&removed, __ATOMIC_ACQUIRE); }
+
     MappedRegion() = delete;
     ALWAYS_INLINE MappedRegion(uintptr_t base, size_t size)
         : base(base), size(size), vmObject(nullptr) {
@@ -136,4 +168,17 @@ struct MappedRegion {
 
         return *this;
     }
+
+private:
+    // RegionTree node, not copied with the region
+    MappedRegion* left = nullptr;
+    MappedRegion* right = nullptr;
+    MappedRegion* parent = nullptr;
+    MappedRegion* nextRetired = nullptr;
+
+    int height = 1;
+    uintptr_t gapStart = 0; // End of the previous region
+    size_t maxGap = 0; // Largest free gap before any region in this subtree
+
+    bool removed = false;
 };
\ No newline at end of file
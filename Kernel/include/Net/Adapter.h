@@ -2,8 +2,11 @@
 
 #include <Device.h>
 #include <Net/Net.h>
+#include <Net/NetBuffer.h>
 #include <Scheduler.h>
 
+#define NET_POLL_BUDGET 64 // Maximum amount of packets taken from a device per poll
+
 enum {
     LinkDown,
     LinkUp,
@@ -26,6 +29,19 @@ namespace Network{
         };
         DriverState dState = Uninitialized;
 
+        enum AdapterFeatures {
+            AdapterFeatureChecksumOffload = 1, // Fills in TCP checksums, see NetBuffer::checksumStart
+            AdapterFeatureSegmentationOffload = 2, // Splits TCP segments larger than the MSS, see NetBuffer::gsoSize
+        };
+        unsigned features = 0;
+
+        struct Statistics {
+            uint64_t rxPackets = 0; // Packets handed to the network stack
+            uint64_t rxDropped = 0; // Packets dropped by the driver or device (e.g. no free buffers)
+            uint64_t rxPolls = 0; // Times the device was polled
+            uint64_t txDropped = 0; // Packets dropped because the transmit ring was full
+        } stats;
+
         MACAddress mac;
 
         // All of these are big-endian
@@ -40,12 +56,44 @@ namespace Network{
         
         virtual void SendPacket(void* data, size_t len);
 
+        // Send a buffer, takes the reference to the buffer
+        // Drivers able to DMA straight out of the buffer should override this
+        virtual void SendBuffer(NetBuffer* buffer);
+
         virtual int GetLink() const;
         virtual int QueueSize() const;
 
-        virtual NetworkPacket* Dequeue();
-        virtual NetworkPacket* DequeueBlocking();
-        virtual void CachePacket(NetworkPacket* pkt);
+        inline AdapterType Type() const { return type; }
+
+        // The caller takes the reference to the returned buffer
+        virtual NetBuffer* Dequeue();
+        virtual NetBuffer* DequeueBlocking();
+
+        /////////////////////////////
+        /// \brief Move received packets from the device onto the receive queue
+        ///
+        /// Drivers using polled receive mask their receive interrupts in the interrupt handler
+        /// and call SchedulePoll. The network thread then calls Poll until the device
+        /// has less than budget packets left, after which EnableReceiveInterrupts is called.
+        ///
+        /// \return Amount of packets received
+        /////////////////////////////
+        virtual int Poll(int budget);
+
+        /////////////////////////////
+        /// \brief Unmask receive interrupts once polling is done
+        ///
+        /// If packets may have arrived in the meantime without raising an interrupt
+        /// the driver should call SchedulePoll again.
+        /////////////////////////////
+        virtual void EnableReceiveInterrupts();
+
+        // Have the network thread poll the adapter, safe to call from interrupt handlers
+        void SchedulePoll();
+        // Called by the network thread when Poll did not use its whole budget
+        void CompletePoll();
+
+        inline bool PollScheduled() const { return pollScheduled; }
 
         void BindToSocket(IPSocket* sock);
         void UnbindSocket(IPSocket* sock);
@@ -55,18 +103,17 @@ namespace Network{
 
     protected:
         static int nextDeviceNumber;
-        unsigned maxCache = 256; // Maximum amount of cached packets, NIC drivers are free to change this
     
         int linkState = LinkDown;
 
-        FastList<NetworkPacket*> cache;
-        FastList<NetworkPacket*> queue;
+        FastList<NetBuffer*> queue; // Received buffers waiting for the network thread
 
         Semaphore packetSemaphore = Semaphore(0);
 
-        lock_t cacheLock = 0;
         lock_t queueLock = 0;
 
+        bool pollScheduled = false;
+
         lock_t threadLock = 0;
 
         AdapterType type;
@@ -75,5 +122,21 @@ namespace Network{
         List<class ::IPSocket*> boundSockets; // If an adapter is destroyed, we need to know what sockets are bound to it
     };
 
+    /////////////////////////////
+    /// \brief Loopback adapter (lo) for 127.0.0.0/8
+    ///
+    /// Has no link layer, sent buffers go straight back onto the receive queue
+    /// with the IPv4 header at the front and no Ethernet frame or ARP involved.
+    /////////////////////////////
+    class LoopbackAdapter final : public NetworkAdapter {
+    public:
+        LoopbackAdapter();
+
+        void SendPacket(void* data, size_t len) override;
+        void SendBuffer(NetBuffer* buffer) override;
+
+        NetBuffer* Dequeue() override;
+    };
+
     void AddAdapter(NetworkAdapter* a);
 }
\ No newline at end of file
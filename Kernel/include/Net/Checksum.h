@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Compiler.h>
+#include <Endian.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHECKSUM_BLOCKS_THRESHOLD 256 // Data at least this large is summed by Network::checksumBlocks
+
+extern "C" {
+// Adds blocks of 64 bytes to sum, requires SSE4.1
+uint64_t ChecksumBlocksSSE(const void* data, size_t blocks, uint64_t sum);
+}
+
+// Internet checksum (RFC 1071)
+//
+// Partial sums are 64-bit one's complement sums of the data as it lies in memory,
+// which gives the checksum in network byte order without swapping any words.
+// When summing data in pieces, every piece except the last must be of even length.
+namespace Network {
+// Sums 64 byte blocks, selected depending on CPU features
+extern uint64_t (*checksumBlocks)(const void* data, size_t blocks, uint64_t sum);
+
+/////////////////////////////
+/// \brief Select the checksum routines
+/////////////////////////////
+void InitializeChecksum();
+
+/////////////////////////////
+/// \brief Add data to a partial sum
+///
+/// \return Unfolded sum, pass it to ChecksumFinish for the checksum
+/////////////////////////////
+uint64_t ChecksumPartial(const void* data, size_t length, uint64_t sum = 0);
+
+// Scalar version of ChecksumPartial, used for small amounts of data
+uint64_t ChecksumPartialScalar(const void* data, size_t length, uint64_t sum = 0);
+
+// Add two partial sums
+ALWAYS_INLINE uint64_t ChecksumAdd(uint64_t sum, uint64_t value) {
+    sum += value;
+    return sum + (sum < value); // Carry around
+}
+
+// Fold a partial sum to 16 bits, not inverted
+ALWAYS_INLINE uint16_t ChecksumFold(uint64_t sum) {
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
+// The checksum field value for a partial sum
+ALWAYS_INLINE BigEndian<uint16_t> ChecksumFinish(uint64_t sum) {
+    BigEndian<uint16_t> ret;
+    ret.value = ~ChecksumFold(sum);
+    return ret;
+}
+
+ALWAYS_INLINE BigEndian<uint16_t> Checksum(const void* data, size_t length) {
+    return ChecksumFinish(ChecksumPartial(data, length));
+}
+
+/////////////////////////////
+/// \brief Update a checksum after changing a 16-bit field (RFC 1624)
+///
+/// HC' = ~(~HC + ~m + m'), so the rest of the data does not need to be summed again.
+///
+/// \param oldValue Field as it was in memory
+/// \param newValue Field as it is now in memory
+/////////////////////////////
+ALWAYS_INLINE BigEndian<uint16_t> ChecksumUpdate16(BigEndian<uint16_t> checksum, uint16_t oldValue, uint16_t newValue) {
+    uint64_t sum = static_cast<uint16_t>(~checksum.value);
+    sum += static_cast<uint16_t>(~oldValue);
+    sum += newValue;
+
+    return ChecksumFinish(sum);
+}
+
+// Same as ChecksumUpdate16 for a 32-bit field, such as an IPv4 address
+ALWAYS_INLINE BigEndian<uint16_t> ChecksumUpdate32(BigEndian<uint16_t> checksum, uint32_t oldValue, uint32_t newValue) {
+    uint64_t sum = static_cast<uint16_t>(~checksum.value);
+    sum += static_cast<uint32_t>(~oldValue);
+    sum += newValue;
+
+    return ChecksumFinish(sum);
+}
+} // namespace Network
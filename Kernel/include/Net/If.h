@@ -44,6 +44,8 @@
 #define SIOCSIFHWBROADCAST 0x8937
 #define SIOCGIFCOUNT 0x8938
 
+#define SIOCGIFSTATS 0x89F0 // Copy the adapter's if_stats to ifr_data
+
 typedef struct sockaddr {
     sa_family_t family;
     char data[14];
@@ -67,6 +69,13 @@ struct ifreq {
     };
 };
 
+struct if_stats {
+    uint64_t rx_packets;
+    uint64_t rx_dropped;
+    uint64_t rx_polls;
+    uint64_t tx_dropped;
+};
+
 struct ifconf {
     int                 ifc_len; /* size of buffer */
     union {
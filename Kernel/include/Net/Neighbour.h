@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Net/Net.h>
+#include <Net/NetBuffer.h>
+
+#define NEIGHBOUR_TIMER_INTERVAL 100000      // Neighbour timer period in microseconds
+#define NEIGHBOUR_RETRANSMIT_TIME 1000000    // Time between ARP requests for an unresolved address (1s)
+#define NEIGHBOUR_MAX_PROBES 3               // ARP requests sent before giving up on an address
+#define NEIGHBOUR_REACHABLE_TIME 30000000    // Time an address is trusted after it was confirmed (30s)
+#define NEIGHBOUR_GC_TIME 60000000           // Stale entries unused for this long are removed (60s)
+#define NEIGHBOUR_QUEUE_MAX 16               // Packets held for each unresolved address
+
+namespace Network {
+struct CachedRoute;
+}
+
+// Neighbour (ARP) cache
+//
+// Every entry starts incomplete when an address is first used and an ARP request is sent.
+// Packets sent to an incomplete entry are queued on it and sent as soon as the reply arrives,
+// so senders never wait on ARP. An entry is reachable once a reply confirms it and becomes
+// stale after NEIGHBOUR_REACHABLE_TIME, a stale entry is still used but is confirmed again on use.
+namespace Network::Neighbour {
+enum NeighbourState {
+    NeighbourIncomplete, // ARP request sent, no reply yet
+    NeighbourReachable,  // Confirmed recently
+    NeighbourStale,      // Link layer address is known but has not been confirmed recently
+};
+
+/////////////////////////////
+/// \brief Start the neighbour timer thread
+/////////////////////////////
+void Initialize();
+
+/////////////////////////////
+/// \brief Get the link layer address of ip
+///
+/// \param wait Block until the address has been resolved
+///
+/// \return 0 on success, -EINPROGRESS if not waiting and the address is being resolved,
+/// -EADDRNOTAVAIL if there was no reply
+/////////////////////////////
+int Resolve(NetworkAdapter* adapter, const IPv4Address& ip, MACAddress& mac, bool wait = true);
+
+/////////////////////////////
+/// \brief Send an Ethernet frame to ip
+///
+/// Fills in the destination of the EthernetFrame at the front of the buffer.
+/// When the address is not resolved yet the frame is queued and sent when the reply arrives.
+/// Takes the reference to the buffer.
+///
+/// \param cache (optional) Remembers the entry so the next send to ip does not have to look it up
+/////////////////////////////
+void Output(NetworkAdapter* adapter, const IPv4Address& ip, NetBuffer* buffer, CachedRoute* cache = nullptr);
+
+/////////////////////////////
+/// \brief Update the cache from a received ARP packet
+///
+/// \param create Create an entry if there is none (we are the target of the packet)
+/////////////////////////////
+void Update(NetworkAdapter* adapter, const IPv4Address& ip, const MACAddress& mac, bool create);
+
+/////////////////////////////
+/// \brief Remove the entries of an adapter, dropping any queued packets
+/////////////////////////////
+void RemoveAdapter(NetworkAdapter* adapter);
+} // namespace Network::Neighbour
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <Net/Checksum.h>
 #include <Net/If.h>
 
 #include <CString.h>
 #include <Device.h>
 #include <Endian.h>
+#include <Hash.h>
 #include <netinet/tcp.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -17,22 +19,31 @@ class Socket;
 #define EPHEMERAL_PORT_RANGE_END PORT_MAX
 
 #define ETHERNET_MAX_PACKET_SIZE 1518
+#define UDP_MAX_PAYLOAD (ETHERNET_MAX_PACKET_SIZE - sizeof(EthernetFrame) - sizeof(IPv4Header) - sizeof(UDPHeader))
+
+#define NET_WORKERS_MAX 16 // Maximum amount of protocol worker threads
 
 #define TCP_RETRY_MIN 200000   // 200 ms minimum retry period
 #define TCP_RETRY_MAX 32000000 // 32s
 
-namespace Network {
-class NetworkAdapter;
-}
-struct NetworkPacket {
-    size_t length;
-    uint8_t data[1518];
+#define TCP_INITIAL_RTO 1000000     // Retransmission timeout before an RTT has been measured (RFC 6298)
+#define TCP_CLOCK_GRANULARITY 10000 // G in RFC 6298, the RTO is never less than SRTT + G
+#define TCP_TIMER_INTERVAL 10000    // Retransmission timers are checked every 10ms
+#define TCP_MAX_RETRANSMITS 12      // Connection is reset after a segment has been retransmitted this many times
+#define TCP_DUPLICATE_ACK_THRESHOLD 3
 
-    Network::NetworkAdapter* adapter;
+#define TCP_DEFAULT_MSS 536       // Used when the peer does not send an MSS option (RFC 1122)
+#define TCP_MAX_SEGMENT_SIZE 1460 // 1500 byte Ethernet MTU minus the IPv4 and TCP headers
+#define TCP_TSO_MAX_SEGMENT 3840  // Largest payload handed to adapters with segmentation offload, leaves room in a NetBuffer for headers
+#define TCP_RECEIVE_BUFFER 262144 // Receive window in bytes
+#define TCP_WINDOW_SCALE 3        // Our window scale shift, (TCP_RECEIVE_BUFFER >> TCP_WINDOW_SCALE) must fit in 16 bits
+#define TCP_OUT_OF_ORDER_MAX 128  // Maximum amount of out of order segments held per socket
 
-    NetworkPacket* next;
-    NetworkPacket* prev;
-};
+namespace Network {
+class NetworkAdapter;
+class NetBuffer;
+struct CachedRoute;
+} // namespace Network
 
 struct IPv4Address {
     union {
@@ -204,7 +215,61 @@ struct TCPHeader {
 } __attribute__((packed));
 static_assert(!(sizeof(TCPHeader) & (sizeof(uint32_t) - 1)));
 
+// Create an identifier for a connection with the source IP, dest IP, source port and destination port.
+// This allows for one connection per port per remote address per local adddress
+struct TCPConnectionIdentifier {
+    IPv4Address localIP;  // Local TCP Endpoint IP
+    IPv4Address remoteIP; // Remote TCP Endpoint IP
+    uint16_t localPort;   // Local Port
+    uint16_t remotePort;  // Remote Port
+
+    TCPConnectionIdentifier() = default;
+
+    TCPConnectionIdentifier(const IPv4Address& local, const IPv4Address& remote, uint16_t lPort, uint16_t rPort)
+        : localIP(local), remoteIP(remote), localPort(lPort), remotePort(rPort) {}
+
+    inline bool operator==(const TCPConnectionIdentifier& other) const {
+        return remoteIP.value == other.remoteIP.value && localIP.value == other.localIP.value &&
+               remotePort == other.remotePort && localPort == other.localPort;
+    }
+};
+
+// Also used to steer packets of a connection to the same protocol worker
+template <> inline unsigned Hash<TCPConnectionIdentifier>(const TCPConnectionIdentifier& id) {
+    return ::Hash(id.remoteIP.value) ^ ::Hash(id.localIP.value) ^ ::Hash(id.remotePort) ^ ::Hash(id.localPort);
+}
+
+#define TCP_OPTIONS_MAX 40   // 15 DWORD header - 5 DWORD fixed header
+#define TCP_SACK_BLOCKS_MAX 4 // 2 + 4 * 8 bytes fits in the options space
+
+enum TCPOption {
+    TCPOptionEnd = 0,
+    TCPOptionNop = 1,
+    TCPOptionMSS = 2,           // Maximum segment size, SYN only
+    TCPOptionWindowScale = 3,   // Window scale shift, SYN only (RFC 7323)
+    TCPOptionSACKPermitted = 4, // SYN only (RFC 2018)
+    TCPOptionSACK = 5,          // Selective acknowledgement blocks (RFC 2018)
+};
+
+// Options parsed from a TCP header
+struct TCPOptions {
+    uint16_t mss = 0;     // 0 if not present
+    int windowScale = -1; // -1 if not present
+    bool sackPermitted = false;
+
+    unsigned sackCount = 0;
+    struct {
+        uint32_t left;  // First sequence number of the block
+        uint32_t right; // Sequence number after the last byte of the block
+    } sack[TCP_SACK_BLOCKS_MAX];
+};
+
 struct ICMPHeader {
+    enum {
+        ICMPEchoReply = 0,
+        ICMPEchoRequest = 8,
+    };
+
     uint8_t type;
     uint8_t code;
     BigEndian<uint16_t> checksum;
@@ -244,43 +309,61 @@ public:
     inline static NetFS* GetInstance() { return instance; }
 };
 
-static inline BigEndian<uint16_t> CaclulateChecksum(void* data, uint16_t size) {
-    uint16_t* ptr = (uint16_t*)data;
-    size_t count = size;
-    uint32_t checksum = 0;
-
-    while (count >= 2) {
-        checksum += *ptr++;
-        count -= 2;
-    }
-
-    checksum = (checksum & 0xFFFF) + (checksum >> 16);
-    if (checksum > UINT16_MAX) {
-        checksum += 1;
-    }
-
-    BigEndian<uint16_t> ret;
-    ret.value = ~checksum;
-    return ret;
-}
+static inline BigEndian<uint16_t> CaclulateChecksum(void* data, uint16_t size) { return Checksum(data, size); }
 
 void InitializeConnections();
 
-int IPLookup(NetworkAdapter* adapter, const IPv4Address& ip, MACAddress& mac);
-int Route(const IPv4Address& local, const IPv4Address& dest, MACAddress& mac, NetworkAdapter*& adapter);
+/////////////////////////////
+/// \brief Find the adapter and next hop for a destination
+///
+/// The link layer address of the next hop is resolved by Neighbour::Output when sending.
+///
+/// \param nextHop Set to the destination or the gateway to send through
+/// \param adapter When not null only this adapter is considered, otherwise set to the adapter to send through
+/////////////////////////////
+int Route(const IPv4Address& local, const IPv4Address& dest, IPv4Address& nextHop, NetworkAdapter*& adapter);
 
 void InitializeNetworkThread();
 
+/////////////////////////////
+/// \brief Start the protocol worker threads, one per CPU (up to NET_WORKERS_MAX)
+///
+/// Without more than one CPU packets are processed on the network thread.
+/////////////////////////////
+void InitializeProtocolWorkers();
+
+/////////////////////////////
+/// \brief Hand a received packet to the protocol layers
+///
+/// IPv4 packets are steered by a hash of their addresses and ports,
+/// so every packet of a connection is processed in order by the same worker.
+/// ARP is processed straight away as packets and threads may be waiting for ARP replies.
+/// Takes the reference to the buffer.
+/////////////////////////////
+void ReceivePacket(NetworkAdapter* adapter, NetBuffer* buffer);
+
+// Run the link and protocol layers on a packet, the caller keeps its reference to the buffer
+void ProcessPacket(NetworkAdapter* adapter, NetBuffer* buffer);
+
 void Send(void* data, size_t length, NetworkAdapter* adapter = nullptr);
 int SendIPv4(void* data, size_t length, IPv4Address& source, IPv4Address& destination, uint8_t protocol,
              NetworkAdapter* adapter = nullptr);
+// Pushes the IPv4 and Ethernet headers in front of the buffer data.
+// Takes the reference to the buffer, even on failure.
+// Sockets pass their CachedRoute so the route and neighbour entry are only looked up when they change.
+int SendIPv4(NetBuffer* buffer, IPv4Address& source, IPv4Address& destination, uint8_t protocol,
+             NetworkAdapter* adapter = nullptr, CachedRoute* route = nullptr);
 
 namespace UDP {
 class UDPSocket;
 
 int SendUDP(void* data, size_t length, IPv4Address& source, IPv4Address& destination, BigEndian<uint16_t> sourcePort,
             BigEndian<uint16_t> destinationPort, NetworkAdapter* adapter = nullptr);
-void OnReceiveUDP(IPv4Header& ipHeader, void* data, size_t length);
+// Pushes the UDP header in front of the payload in buffer.
+// Takes the reference to the buffer, even on failure.
+int SendUDP(NetBuffer* buffer, IPv4Address& source, IPv4Address& destination, BigEndian<uint16_t> sourcePort,
+            BigEndian<uint16_t> destinationPort, NetworkAdapter* adapter = nullptr, CachedRoute* route = nullptr);
+void OnReceiveUDP(IPv4Header& ipHeader, NetBuffer* buffer);
 } // namespace UDP
 
 namespace TCP {
@@ -290,6 +373,9 @@ BigEndian<uint16_t> CalculateTCPChecksum(const IPv4Address& src, const IPv4Addre
 
 int SendTCP(void* data, size_t length, IPv4Address& source, IPv4Address& destination, BigEndian<uint16_t> sourcePort,
             BigEndian<uint16_t> destinationPort, NetworkAdapter* adapter = nullptr);
-void OnReceiveTCP(IPv4Header& ipHeader, void* data, size_t length);
+void OnReceiveTCP(IPv4Header& ipHeader, NetBuffer* buffer);
+
+// Start the thread running the retransmission timers
+void InitializeTimerThread();
 } // namespace TCP
 } // namespace Network
\ No newline at end of file
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <Assert.h>
+#include <Compiler.h>
+#include <List.h>
+#include <Paging.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NET_BUFFER_SIZE PAGE_SIZE_4K // Each buffer is a single page so it is physically contiguous for DMA
+#define NET_BUFFER_HEADROOM 128      // Room in front of transmitted data for the link, network and transport headers
+#define NET_BUFFER_POOL_RESERVE 64   // The pool is grown when less than this many buffers are free
+#define NET_BUFFER_POOL_GROW 32      // Amount of buffers to add to the pool at once
+#define NET_BUFFER_POOL_MIN 128      // The pool shrinker will not free buffers below this
+#define NET_BUFFER_POOL_MAX 4096     // The pool is not grown past this (16 MB), allocations fail instead
+#define NET_BUFFER_COALESCE_MAX (NET_BUFFER_SIZE / 4) // Smaller buffers are copied onto the end of a queue
+
+namespace Network {
+class NetworkAdapter;
+
+/////////////////////////////
+/// \brief Reference counted network buffer
+///
+/// Headers are pushed into the headroom on transmit and pulled off on receive,
+/// so a frame is not copied as it moves between layers.
+/// Buffers come from a pool and are returned to it when the last reference is dropped.
+/////////////////////////////
+class NetBuffer final {
+public:
+    NetBuffer* next = nullptr; // Used by FastList queues and the pool
+    NetBuffer* prev = nullptr;
+
+    NetworkAdapter* adapter = nullptr; // Adapter the buffer was received on
+
+    uint8_t* data = nullptr; // Start of the packet
+    uint8_t* tail = nullptr; // End of the packet
+
+    // Transmit offloads, only set when the adapter advertises the matching feature
+    uint8_t* checksumStart = nullptr; // The adapter checksums from here to the end of the packet
+    uint16_t checksumOffset = 0;      // Offset of the checksum field from checksumStart
+    uint16_t gsoSize = 0;             // The adapter splits the TCP payload into segments of this size
+
+    // Unfolded Internet checksum of the payload, summed as it was copied in (see Net/Checksum.h)
+    // Headers pushed in front of the payload are not included
+    uint64_t payloadChecksum = 0;
+    bool hasPayloadChecksum = false;
+
+    /////////////////////////////
+    /// \brief Allocate an empty buffer from the pool
+    ///
+    /// Safe to call from interrupt handlers, however the pool is only grown
+    /// when interrupts are enabled.
+    ///
+    /// \return Buffer with a reference count of 1, nullptr if the pool is empty
+    /////////////////////////////
+    static NetBuffer* Allocate();
+
+    /////////////////////////////
+    /// \brief Allocate a buffer with NET_BUFFER_HEADROOM reserved for headers
+    /////////////////////////////
+    static NetBuffer* AllocateWithHeadroom();
+
+    /////////////////////////////
+    /// \brief Keep the pool above NET_BUFFER_POOL_RESERVE
+    ///
+    /// Interrupt handlers cannot grow the pool, so this is called
+    /// from the network thread to top it back up.
+    /////////////////////////////
+    static void FillPool();
+
+    ALWAYS_INLINE void Ref() { __atomic_add_fetch(&m_refCount, 1, __ATOMIC_RELAXED); }
+    void Unref();
+
+    ALWAYS_INLINE size_t Length() const { return tail - data; }
+    ALWAYS_INLINE size_t Headroom() const { return data - m_head; }
+    ALWAYS_INLINE size_t Tailroom() const { return (m_head + NET_BUFFER_SIZE) - tail; }
+
+    // Physical address of the packet data, for DMA
+    ALWAYS_INLINE uintptr_t PhysicalData() const { return m_physical + Headroom(); }
+
+    // Reserve headroom in an empty buffer
+    ALWAYS_INLINE void Reserve(size_t length) {
+        assert(data == tail && Tailroom() >= length);
+
+        data += length;
+        tail += length;
+    }
+
+    // Add length bytes to the front of the packet, returns the new start of the packet
+    ALWAYS_INLINE uint8_t* Push(size_t length) {
+        assert(Headroom() >= length);
+
+        data -= length;
+        return data;
+    }
+
+    // Remove length bytes from the front of the packet, returns the new start of the packet
+    ALWAYS_INLINE uint8_t* Pull(size_t length) {
+        assert(Length() >= length);
+
+        data += length;
+        return data;
+    }
+
+    // Add length bytes to the end of the packet, returns a pointer to the added bytes
+    ALWAYS_INLINE uint8_t* Put(size_t length) {
+        assert(Tailroom() >= length);
+
+        uint8_t* p = tail;
+        tail += length;
+        return p;
+    }
+
+    // Remove anything after length bytes (e.g. Ethernet padding)
+    ALWAYS_INLINE void Trim(size_t length) {
+        if (length < Length()) {
+            tail = data + length;
+        }
+    }
+
+private:
+    friend class NetBufferPool;
+    friend class NetBufferQueue;
+
+    uint8_t* m_head = nullptr; // Start of the page
+    uintptr_t m_physical = 0;  // Physical address of the page
+    unsigned m_refCount = 0;
+};
+
+/////////////////////////////
+/// \brief Byte stream made of queued buffers
+///
+/// Used for stream sockets, received buffers are queued as they are instead of being copied.
+/// Small buffers are copied onto the end of the last buffer instead, so they do not each pin a page.
+/////////////////////////////
+class NetBufferQueue final {
+public:
+    NetBufferQueue() = default;
+    ~NetBufferQueue();
+
+    /////////////////////////////
+    /// \brief Queue the data of a buffer
+    ///
+    /// Takes a reference to the buffer unless the data was copied.
+    /////////////////////////////
+    void Enqueue(NetBuffer* buffer);
+
+    /////////////////////////////
+    /// \brief Read from the front of the queue
+    ///
+    /// \param buffer Destination, may be a user buffer
+    /// \param length Maximum amount of bytes to read
+    ///
+    /// \return Bytes read, -EFAULT if buffer is invalid
+    /////////////////////////////
+    int64_t Read(void* buffer, size_t length);
+
+    void Clear();
+
+    ALWAYS_INLINE size_t Length() const { return m_length; }
+    ALWAYS_INLINE bool Empty() const { return !m_length; }
+
+    // Memory used by the queued buffers, each is a whole page no matter how much data it holds
+    ALWAYS_INLINE size_t Memory() const { return m_memory; }
+
+private:
+    lock_t m_lock = 0;
+    size_t m_length = 0;
+    size_t m_memory = 0;
+    FastList<NetBuffer*> m_buffers;
+};
+} // namespace Network
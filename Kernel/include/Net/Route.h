@@ -0,0 +1,79 @@
+#pragma once
+
+#include <Net/Net.h>
+
+#include <Spinlock.h>
+
+namespace Network {
+namespace Neighbour {
+struct NeighbourEntry;
+}
+
+/////////////////////////////
+/// \brief Route and neighbour entry remembered by a socket
+///
+/// Sockets mostly send to the same destination, so the result of the routing table lookup
+/// is kept until the table changes and the neighbour entry is kept until it is removed.
+/////////////////////////////
+struct CachedRoute {
+    lock_t lock = 0; // Protects the route, the neighbour entry is protected by the neighbour cache
+
+    unsigned generation = 0; // Routing table generation of the lookup, 0 if nothing has been cached
+    IPv4Address local;
+    IPv4Address destination;
+    IPv4Address nextHop;
+    NetworkAdapter* adapter = nullptr;
+
+    Neighbour::NeighbourEntry* neighbour = nullptr;
+    unsigned neighbourGeneration = 0;
+};
+
+/////////////////////////////
+/// \brief Find the route for a destination, using and updating a cached route
+/////////////////////////////
+int Route(const IPv4Address& local, const IPv4Address& dest, CachedRoute& cache, IPv4Address& nextHop,
+          NetworkAdapter*& adapter);
+} // namespace Network
+
+// IPv4 routing table
+//
+// Routes are kept in a path compressed binary trie of their destination prefixes,
+// a lookup walks down the trie and takes the longest matching prefix.
+// Routes to the same prefix are ordered by metric, the lowest is used first.
+// Every adapter has a connected route to its own subnet which is kept up to date by UpdateAdapter.
+namespace Network::Routing {
+/////////////////////////////
+/// \brief Add a route
+///
+/// \param mask Destination mask, must be contiguous
+/// \param gateway INADDR_ANY for destinations reachable on the link
+///
+/// \return 0 on success, -EEXIST if the route already exists, -EINVAL if the mask is invalid
+/////////////////////////////
+int AddRoute(const IPv4Address& destination, const IPv4Address& mask, const IPv4Address& gateway,
+             NetworkAdapter* adapter, int metric);
+
+/////////////////////////////
+/// \brief Remove a route
+///
+/// \param adapter Only remove the route through this adapter, any adapter if null
+///
+/// \return 0 on success, -ESRCH if there is no such route
+/////////////////////////////
+int RemoveRoute(const IPv4Address& destination, const IPv4Address& mask, NetworkAdapter* adapter);
+
+/////////////////////////////
+/// \brief Update the connected route of an adapter after its address or subnet mask has changed
+/////////////////////////////
+void UpdateAdapter(NetworkAdapter* adapter);
+
+/////////////////////////////
+/// \brief Remove all routes through an adapter
+/////////////////////////////
+void RemoveAdapter(NetworkAdapter* adapter);
+
+/////////////////////////////
+/// \brief Get the routing table generation, incremented whenever a route changes
+/////////////////////////////
+unsigned Generation();
+} // namespace Network::Routing
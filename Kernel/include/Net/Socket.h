@@ -4,10 +4,14 @@
 
 #include <Net/If.h>
 #include <Net/Net.h>
+#include <Net/NetBuffer.h>
+#include <Net/Route.h>
 
 #include <List.h>
 #include <Lock.h>
 #include <Stream.h>
+#include <Timer.h>
+#include <Vector.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -19,6 +23,30 @@
 
 #define STREAM_MAX_BUFSIZE 0x20000 // 128 KB
 
+#define UDP_RECEIVE_BUFFER_DEFAULT 0x40000 // 256 KB
+#define UDP_RECEIVE_BUFFER_MAX 0x100000    // 1 MB, SO_RCVBUF is capped to this
+#define UDP_RECEIVE_RING_SIZE (UDP_RECEIVE_BUFFER_MAX / NET_BUFFER_SIZE) // Each datagram counts as a whole buffer
+#define UDP_SEGMENTS_MAX 64 // Maximum amount of datagrams sent or coalesced at once with UDP_SEGMENT/UDP_GRO
+#define UDP_IOVECS_MAX 64 // Maximum amount of iovecs in a UDP sendmsg or recvmsg, they are copied onto the stack
+
+#define MMSG_VLEN_MAX 1024 // Maximum amount of messages for sendmmsg and recvmmsg
+
+#ifndef MSG_WAITFORONE
+#define MSG_WAITFORONE 0x10000 // recvmmsg, only block for the first message
+#endif
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 // Split sends into datagrams of this size (int or uint16_t control message)
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104 // Coalesce received datagrams, the segment size is returned in an int control message
+#endif
+
 struct rtentry {
     unsigned long rt_pad1;
     struct sockaddr rt_dst;
@@ -58,6 +86,11 @@ struct cmsghdr {
     int cmsg_type;
 };
 
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len; // Bytes sent or received for the message
+};
+
 struct poll {
     int fd;
     short events;
@@ -118,6 +151,26 @@ class Socket : public FsNode {
     virtual int64_t Send(void* buffer, size_t len, int flags);
     virtual ssize_t Write(size_t offset, size_t size, uint8_t* buffer);
 
+    /////////////////////////////
+    /// \brief Receive into the iovecs of a message (recvmsg)
+    ///
+    /// The message header and the buffers it points to must have been checked by the caller.
+    /// By default each iovec is filled with its own ReceiveFrom call.
+    ///
+    /// \return Amount of bytes received, otherwise negative error code
+    /////////////////////////////
+    virtual int64_t ReceiveMessage(msghdr* msg, int flags);
+
+    /////////////////////////////
+    /// \brief Send the iovecs of a message (sendmsg)
+    ///
+    /// The message header and the buffers it points to must have been checked by the caller.
+    /// By default each iovec is sent with its own SendTo call.
+    ///
+    /// \return Amount of bytes sent, otherwise negative error code
+    /////////////////////////////
+    virtual int64_t SendMessage(const msghdr* msg, int flags);
+
     virtual int SetSocketOptions(int level, int opt, const void* optValue, socklen_t optLength);
     virtual int GetSocketOptions(int level, int opt, void* optValue, socklen_t* optLength);
 
@@ -215,8 +268,20 @@ class IPSocket : public Socket {
     virtual int64_t SendTo(void* buffer, size_t len, int flags, const sockaddr* src, socklen_t addrlen,
                            const void* ancillary = nullptr, size_t ancillaryLen = 0);
 
+    // The protocol workers take a reference while delivering a packet,
+    // so the socket is not freed by a close on another CPU.
+    // The socket holds the first reference itself until it is done with.
+    inline void Ref() { __atomic_add_fetch(&m_refCount, 1, __ATOMIC_RELAXED); }
+    inline void Unref() {
+        if (!__atomic_sub_fetch(&m_refCount, 1, __ATOMIC_ACQ_REL)) {
+            delete this;
+        }
+    }
+
     Network::NetworkAdapter* adapter = nullptr; // Bound adapter
   protected:
+    unsigned m_refCount = 1;
+
     IPv4Address address = 0;
     IPv4Address peerAddress = 0;
     BigEndian<uint16_t> port = 0;
@@ -224,7 +289,7 @@ class IPSocket : public Socket {
 
     bool pktInfo = false; // Check for packet info field?
 
-    List<NetworkPacket> pQueue;
+    Network::CachedRoute cachedRoute; // Route to the last destination, usually the peer
 
     virtual unsigned short AllocatePort() = 0;
     virtual int AcquirePort(uint16_t port) = 0;
@@ -250,24 +315,52 @@ class UDPSocket final : public IPSocket {
     int64_t SendTo(void* buffer, size_t len, int flags, const sockaddr* src, socklen_t addrlen,
                    const void* ancillary = nullptr, size_t ancillaryLen = 0);
 
+    // One datagram is scattered across or gathered from all of the iovecs
+    int64_t ReceiveMessage(msghdr* msg, int flags);
+    int64_t SendMessage(const msghdr* msg, int flags);
+
+    int SetSocketOptions(int level, int opt, const void* optValue, socklen_t optLength);
+    int GetSocketOptions(int level, int opt, void* optValue, socklen_t* optLength);
+
+    void Close();
+
+    bool CanRead() { return m_ringCount; }
+
   protected:
-    friend void OnReceiveUDP(IPv4Header& ipHeader, void* data, size_t length);
+    friend void OnReceiveUDP(IPv4Header& ipHeader, NetBuffer* buffer);
 
     struct UDPPacket {
         IPv4Address sourceIP;
         BigEndian<uint16_t> sourcePort;
-        size_t length;
-        uint8_t* data;
+        NetBuffer* buffer; // Holds a reference, data points to the payload
     };
 
-    lock_t packetsLock = 0;
-    List<UDPPacket> packets;
+    lock_t packetsLock = 0; // Protects the ring and the receive accounting
+    // Received datagrams, allocated with the socket so receiving never allocates
+    UDPPacket* m_ring;
+    unsigned m_ringHead = 0; // Oldest datagram
+    unsigned m_ringCount = 0;
+
+    size_t m_receiveBufferSize = UDP_RECEIVE_BUFFER_DEFAULT; // SO_RCVBUF
+    size_t m_receiveQueued = 0; // Memory held by queued datagrams, counted against SO_RCVBUF
+    uint64_t m_receiveDropped = 0; // Datagrams dropped as the receive buffer was full
+
+    uint16_t m_segmentSize = 0; // UDP_SEGMENT, 0 if sends are not split
+    bool m_gro = false; // UDP_GRO
 
     unsigned short AllocatePort();
     int AcquirePort(uint16_t port);
     int ReleasePort();
 
-    int64_t OnReceive(IPv4Address& sourceIP, BigEndian<uint16_t> sourcePort, void* buffer, size_t len);
+    int64_t OnReceive(IPv4Address& sourceIP, BigEndian<uint16_t> sourcePort, NetBuffer* buffer);
+
+    // Receive a datagram, or with UDP_GRO a run of them, into the iovecs
+    // segmentSize is set to the size of the coalesced datagrams, 0 if only one was received
+    int64_t ReceiveDatagrams(const iovec* iov, size_t iovCount, int flags, sockaddr* src, socklen_t* addrlen,
+                             uint16_t& segmentSize, int& messageFlags);
+    // Send the iovecs as one datagram, or as datagrams of segmentSize if it is not 0
+    int64_t SendDatagrams(const iovec* iov, size_t iovCount, const sockaddr* dest, socklen_t addrlen,
+                          uint16_t segmentSize);
 };
 } // namespace Network::UDP
 
@@ -300,9 +393,13 @@ class TCPSocket final : public IPSocket {
     bool m_noDelay = false;   // Disable 'Nagle's algorithm', we don't actualy implement this yet
     bool m_keepAlive = false; // We haven't implmented this yet
 
-    friend void OnReceiveTCP(IPv4Header& ipHeader, void* data, size_t length);
+    friend void OnReceiveTCP(IPv4Header& ipHeader, NetBuffer* buffer);
+    friend void TimerThread();
 
-    void OnReceive(const IPv4Address& source, const IPv4Address& dest, uint8_t* data, size_t length);
+    void OnReceive(const IPv4Address& source, const IPv4Address& dest, NetBuffer* buffer);
+    void OnSynchronize(const IPv4Address& source, const IPv4Address& dest, TCPHeader* tcpHeader,
+                       const TCPOptions& options); // SYN on a listen socket
+    NetBuffer* OnTimer(); // Returns a segment to retransmit, if any
 
     int Synchronize(uint32_t seqNumber); // TCP SYN (Establish a connection to the server)
     int Acknowledge(uint32_t ackNumber); // TCP ACK (Acknowledge connection)
@@ -318,12 +415,43 @@ class TCPSocket final : public IPSocket {
     int ReleasePort();
 
     struct TCPPacket {
-        TCPHeader header;
         uint32_t sequenceNumber;
         uint32_t length;
-        uint8_t* data;
+        NetBuffer* buffer;    // Holds a reference to the sent segment until it is acknowledged,
+                              // the payload is the last length bytes of the buffer
+        timeval sent;         // Time of the first transmission, for RTT samples
+        unsigned retransmits; // RTT is never sampled from retransmitted segments (Karn's algorithm)
+        bool sacked;          // Peer has selectively acknowledged the segment
+    };
+
+    struct TCPSegment {
+        uint32_t sequenceNumber;
+        NetBuffer* buffer; // Holds a reference, data points to the payload
     };
 
+    // Build a segment from the payload (may be nullptr), options are added depending on the flags.
+    // Takes the reference to payload. Returns nullptr if no buffer could be allocated.
+    NetBuffer* BuildSegment(uint16_t flags, uint32_t sequence, uint32_t ackNumber, NetBuffer* payload = nullptr);
+    int SendSegment(uint16_t flags, uint32_t sequence, uint32_t ackNumber, NetBuffer* payload = nullptr);
+    // Copy the payload of an unacknowledged packet into a new segment
+    NetBuffer* BuildRetransmission(TCPPacket& packet);
+
+    void ApplyOptions(const TCPOptions& options); // Options from the peer's SYN
+    uint16_t ReceiveWindow() const;
+    size_t UsableSendWindow() const;
+
+    // These expect m_unacknowledgedPacketsLock to be held.
+    // Segments to retransmit are returned and sent once the lock is released.
+    bool ProcessAcknowledgement(TCPHeader* tcpHeader, size_t dataLength, const TCPOptions& options,
+                                NetBuffer*& retransmit); // false if the ACK is for data we have not sent
+    NetBuffer* RetransmitFirstHole();
+    void SampleRTT(long rtt);
+    void ArmRetransmitTimer();
+
+    bool ProcessData(TCPHeader* tcpHeader, NetBuffer* buffer, size_t headerLength, size_t dataLength);
+    void QueueOutOfOrder(uint32_t sequence, NetBuffer* buffer);
+    void DrainOutOfOrder();
+
     // As per RFC 793
     enum State {
         TCPStateUnknown,
@@ -344,8 +472,41 @@ class TCPSocket final : public IPSocket {
 
     uint32_t m_remoteSequenceNumber; // Sequence number of the remote endpoint
 
-    lock_t m_unacknowledgedPacketsLock = 0;
-    List<TCPPacket> m_unacknowledgedPackets; // Unacknowledged outbound packets
-    DataStream m_inboundData = DataStream(512);
+    // Negotiated in the SYN and SYN-ACK
+    uint16_t m_sendMSS = TCP_DEFAULT_MSS;
+    uint8_t m_sendWindowShift = 0;    // Peer's window scale
+    uint8_t m_receiveWindowShift = 0; // Our window scale, 0 unless the peer supports window scaling
+    bool m_windowScaling = false;
+    bool m_sackPermitted = false;
+
+    uint32_t m_sendWindow = 65535; // Window advertised by the peer in bytes
+
+    // Congestion control (NewReno, RFC 5681 and RFC 6582)
+    uint32_t m_congestionWindow = TCP_DEFAULT_MSS;
+    uint32_t m_slowStartThreshold = UINT32_MAX;
+    unsigned m_duplicateAcks = 0;
+    bool m_inRecovery = false;
+    bool m_timeoutRecovery = false; // Recovering from a retransmission timeout rather than fast retransmit
+    uint32_t m_recover = 0;         // Highest sequence number sent when recovery was entered
+
+    // Retransmission timer (RFC 6298), all in us
+    long m_smoothedRTT = 0; // 0 until the first RTT sample
+    long m_rttVariance = 0;
+    long m_rto = TCP_INITIAL_RTO;
+    timeval m_retransmitDeadline;
+    bool m_retransmitTimerActive = false;
+
+    Semaphore m_sendSemaphore = Semaphore(0); // Signalled when the send window opens
+
+    lock_t m_unacknowledgedPacketsLock = 0;   // Protects the send state above
+    List<TCPPacket> m_unacknowledgedPackets; // Unacknowledged outbound packets, in sequence order
+
+    NetBufferQueue m_inboundData;
+    lock_t m_outOfOrderLock = 0;
+    Vector<TCPSegment> m_outOfOrder; // Received after a gap, in sequence order
+
+    TCPSocket* m_listener = nullptr; // Listen socket to hand us to once the handshake completes
+    unsigned m_backlog = CONNECTION_BACKLOG;
+    lock_t m_pendingLock = 0;
 };
 } // namespace Network::TCP
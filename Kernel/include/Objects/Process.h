@@ -10,6 +10,8 @@
 #include <Hash.h>
 #include <List.h>
 #include <MM/AddressSpace.h>
+#include <MM/HugePages.h>
+#include <MM/Reclaim.h>
 #include <Objects/Handle.h>
 #include <Objects/KObject.h>
 #include <RefPtr.h>
@@ -17,9 +19,13 @@
 #include <TimerEvent.h>
 #include <Vector.h>
 
+#define STACK_PREFAULT_SIZE 0x8000 // Amount of the main thread stack allocated upfront
+
 class Process : public KernelObject {
     friend struct Thread;
     friend void KernelProcess();
+    friend void Memory::HugePageCollapseThread();
+    friend bool Memory::OOMKill();
     friend long SysExecve(RegisterContext* r);
 
 public:
@@ -67,6 +73,8 @@ public:
     void Die();
 
     void Start();
+    // Start with the main thread on SMP::cpus[cpu]
+    void Start(unsigned cpu);
 
     /////////////////////////////
     /// \brief Retrieve KernelObject type ID
@@ -3,10 +3,115 @@
 #include <Compiler.h>
 #include <Paging.h>
 
+#define USER_COPY_LARGE_THRESHOLD 256 // Copies at least this large use Memory::userCopyLarge
+
 extern "C" {
+// Fault tolerant copy routines, these return 0 on success and 1 if a page fault occured
 int UserMemcpy(void* dest, const void* src, size_t count);
+int UserMemcpySSE(void* dest, const void* src, size_t count);
+// Also adds the data to the unfolded Internet checksum in sum, see Net/Checksum.h
+int UserMemcpyChecksum(void* dest, const void* src, size_t count, uint64_t* sum);
+int UserMemset(void* dest, int value, size_t count);
+// Returns length of the string (at most maxLength), -1 if a page fault occured
+long UserStrnlen(const char* str, size_t maxLength);
+
 void UserMemcpyTrap();
 void UserMemcpyTrapHandler();
+
+extern PageFaultTrap UserCopyExceptionTable[];
+extern PageFaultTrap UserCopyExceptionTableEnd[];
+}
+
+namespace Memory {
+// Copy routine used for large copies, selected depending on CPU features
+extern int (*userCopyLarge)(void* dest, const void* src, size_t count);
+
+/////////////////////////////
+/// \brief Register the user copy exception table and select the copy routines
+/////////////////////////////
+void InitializeUserCopy();
+} // namespace Memory
+
+// Check that a range lies entirely in userspace without looking up any regions,
+// page faults are handled by the copy routines instead
+ALWAYS_INLINE static bool IsUsermodeRange(const void* ptr, size_t size) {
+    uintptr_t base = reinterpret_cast<uintptr_t>(ptr);
+    return base + size >= base && base + size <= KERNEL_VIRTUAL_BASE;
+}
+
+// Fault tolerant memcpy that accepts both user and kernel memory
+ALWAYS_INLINE static int UserCopy(void* dest, const void* src, size_t count) {
+    if (count >= USER_COPY_LARGE_THRESHOLD) {
+        return Memory::userCopyLarge(dest, src, count);
+    }
+
+    return UserMemcpy(dest, src, count);
+}
+
+/////////////////////////////
+/// \brief Copy from a usermode buffer
+///
+/// \return 0 on success, 1 if the buffer is invalid
+/////////////////////////////
+ALWAYS_INLINE static int CopyFromUser(void* dest, const void* userSrc, size_t count) {
+    if (!IsUsermodeRange(userSrc, count)) {
+        return 1;
+    }
+
+    return UserCopy(dest, userSrc, count);
+}
+
+/////////////////////////////
+/// \brief Copy to a usermode buffer
+///
+/// \return 0 on success, 1 if the buffer is invalid
+/////////////////////////////
+ALWAYS_INLINE static int CopyToUser(void* userDest, const void* src, size_t count) {
+    if (!IsUsermodeRange(userDest, count)) {
+        return 1;
+    }
+
+    return UserCopy(userDest, src, count);
+}
+
+/////////////////////////////
+/// \brief Zero a usermode buffer
+///
+/// \return 0 on success, 1 if the buffer is invalid
+/////////////////////////////
+ALWAYS_INLINE static int ClearUser(void* userDest, size_t count) {
+    if (!IsUsermodeRange(userDest, count)) {
+        return 1;
+    }
+
+    return UserMemset(userDest, 0, count);
+}
+
+/////////////////////////////
+/// \brief Copy a null-terminated string from userspace
+///
+/// \param dest Buffer of at least maxLength bytes, null-terminated on success
+///
+/// \return Length of the string on success, -1 if the string is invalid or does not fit in dest
+/////////////////////////////
+ALWAYS_INLINE static long StrncpyFromUser(char* dest, const char* userSrc, size_t maxLength) {
+    if (!IsUsermodeRange(userSrc, 0)) {
+        return -1;
+    }
+
+    // Do not scan past the end of userspace
+    uintptr_t userRemaining = KERNEL_VIRTUAL_BASE - reinterpret_cast<uintptr_t>(userSrc);
+    long length = UserStrnlen(userSrc, (maxLength < userRemaining) ? maxLength : userRemaining);
+    if (length < 0 || static_cast<size_t>(length) >= maxLength) {
+        return -1;
+    }
+
+    if (UserMemcpy(dest, userSrc, length)) {
+        return -1;
+    }
+
+    dest[length] = 0;
+    return length;
 }
 
 template <typename T, typename P> inline static constexpr int IsUsermodePointer(P* ptr) {
@@ -31,8 +136,8 @@ template <typename T> class UserPointer {
 public:
     UserPointer(uintptr_t ptr) : m_ptr(reinterpret_cast<T*>(ptr)) {}
 
-    ALWAYS_INLINE int GetValue(T& kernelValue) const { return UserMemcpy(&kernelValue, m_ptr, sizeof(T)); }
-    ALWAYS_INLINE int StoreValue(const T& kernelValue) { return UserMemcpy(m_ptr, &kernelValue, sizeof(T)); }
+    ALWAYS_INLINE int GetValue(T& kernelValue) const { return CopyFromUser(&kernelValue, m_ptr, sizeof(T)); }
+    ALWAYS_INLINE int StoreValue(const T& kernelValue) { return CopyToUser(m_ptr, &kernelValue, sizeof(T)); }
 
     ALWAYS_INLINE T* Pointer() { return m_ptr; }
 
@@ -46,23 +151,15 @@ template <typename T> class UserBuffer {
 public:
     UserBuffer(uintptr_t ptr) : m_ptr(reinterpret_cast<T*>(ptr)) {}
 
-    ALWAYS_INLINE int GetValue(unsigned index, T& kernelValue) const { return UserMemcpy(&kernelValue, &m_ptr[index], sizeof(T)); }
-    ALWAYS_INLINE int StoreValue(unsigned index, const T& kernelValue) { return UserMemcpy(&m_ptr[index], &kernelValue, sizeof(T)); }
+    ALWAYS_INLINE int GetValue(unsigned index, T& kernelValue) const { return CopyFromUser(&kernelValue, &m_ptr[index], sizeof(T)); }
+    ALWAYS_INLINE int StoreValue(unsigned index, const T& kernelValue) { return CopyToUser(&m_ptr[index], &kernelValue, sizeof(T)); }
 
     ALWAYS_INLINE int Read(T* data, size_t offset, size_t count) const {
-        if (!IsUsermodePointer(m_ptr, offset, count)) { // Don't allow kernel memory access
-            return 0;
-        }
-
-        return UserMemcpy(data, &m_ptr[offset], sizeof(T) * count);
+        return CopyFromUser(data, &m_ptr[offset], sizeof(T) * count);
     }
 
     ALWAYS_INLINE int Write(T* data, size_t offset, size_t count) {
-        if (!IsUsermodePointer(m_ptr, offset, count)) { // Don't allow kernel memory access
-            return 0;
-        }
-
-        return UserMemcpy(&m_ptr[offset], data, sizeof(T) * count);
+        return CopyToUser(&m_ptr[offset], data, sizeof(T) * count);
     }
 
     ALWAYS_INLINE T* Pointer() { return m_ptr; }
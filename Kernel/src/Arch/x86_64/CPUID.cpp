@@ -2,11 +2,12 @@
 
 cpuid_info_t CPUID() {
     cpuid_info_t info;
+    uint32_t maxLeaf;
     uint32_t ebx;
     uint32_t edx;
     uint32_t ecx;
 
-    asm volatile("cpuid" : "=b"(ebx), "=d"(edx), "=c"(ecx) : "a"(0)); // Get vendor string
+    asm volatile("cpuid" : "=a"(maxLeaf), "=b"(ebx), "=d"(edx), "=c"(ecx) : "a"(0)); // Get vendor string
     for (int i = 0; i < 4; i++)
         info.vendorString[i] = ebx >> (i * 8) & 0xFF; // Copy string to buffer
     for (int i = 0; i < 4; i++)
@@ -17,5 +18,11 @@ cpuid_info_t CPUID() {
     asm volatile("cpuid" : "=d"(edx), "=c"(ecx) : "a"(1)); // Get features
     info.features_ecx = ecx;
     info.features_edx = edx;
+
+    if (maxLeaf >= 7) {
+        asm volatile("cpuid" : "=b"(ebx), "=d"(edx), "=c"(ecx) : "a"(7), "c"(0)); // Get structured extended features
+        info.features_ext_ebx = ebx;
+        info.features_ext_edx = edx;
+    }
     return info;
 }
\ No newline at end of file
@@ -0,0 +1,67 @@
+BITS 64
+
+global ChecksumBlocksSSE
+
+section .text
+
+; ChecksumBlocksSSE (data, blocks, sum)
+; Adds 64 byte blocks to a 64-bit one's complement sum (Internet checksum).
+; Each 32-bit word is zero extended into a 64-bit lane (pmovzxdq, SSE4.1),
+; the lanes cannot overflow before 2^32 words so carries are only folded at the end.
+; The user's FPU state is still live, so the xmm registers we use are saved on the stack.
+ChecksumBlocksSSE:
+    sub rsp, 96
+    movdqu [rsp], xmm0
+    movdqu [rsp + 16], xmm1
+    movdqu [rsp + 32], xmm2
+    movdqu [rsp + 48], xmm3
+    movdqu [rsp + 64], xmm4
+    movdqu [rsp + 80], xmm5
+
+    pxor xmm4, xmm4
+    pxor xmm5, xmm5
+
+    test rsi, rsi
+    jz .done
+
+.loop:
+    pmovzxdq xmm0, [rdi]
+    pmovzxdq xmm1, [rdi + 8]
+    pmovzxdq xmm2, [rdi + 16]
+    pmovzxdq xmm3, [rdi + 24]
+    paddq xmm4, xmm0
+    paddq xmm5, xmm1
+    paddq xmm4, xmm2
+    paddq xmm5, xmm3
+
+    pmovzxdq xmm0, [rdi + 32]
+    pmovzxdq xmm1, [rdi + 40]
+    pmovzxdq xmm2, [rdi + 48]
+    pmovzxdq xmm3, [rdi + 56]
+    paddq xmm4, xmm0
+    paddq xmm5, xmm1
+    paddq xmm4, xmm2
+    paddq xmm5, xmm3
+
+    add rdi, 64
+    dec rsi
+    jnz .loop
+
+.done:
+    paddq xmm4, xmm5
+    movq rax, xmm4
+    pextrq rcx, xmm4, 1
+
+    ; Add both lanes and the sum passed in, carrying around
+    add rax, rcx
+    adc rax, rdx
+    adc rax, 0
+
+    movdqu xmm0, [rsp]
+    movdqu xmm1, [rsp + 16]
+    movdqu xmm2, [rsp + 32]
+    movdqu xmm3, [rsp + 48]
+    movdqu xmm4, [rsp + 64]
+    movdqu xmm5, [rsp + 80]
+    add rsp, 96
+    ret
@@ -7,6 +7,7 @@
 #include <Device.h>
 #include <IDT.h>
 #include <Logging.h>
+#include <MM/HugePages.h>
 #include <MM/KMalloc.h>
 #include <PCI.h>
 #include <Paging.h>
@@ -107,6 +108,21 @@ void InitExtra() {
     Memory::LateInitializeVirtualMemory();
 }
 
+// Parse the size of the page fault-around window (in 4KB pages)
+static void ParseFaultAround(const char* value) {
+    unsigned pages = 0;
+    for (; *value >= '0' && *value <= '9'; value++) {
+        pages = pages * 10 + (*value - '0');
+
+        if (pages > FAULT_AROUND_MAX_PAGES) {
+            pages = FAULT_AROUND_MAX_PAGES;
+            break;
+        }
+    }
+
+    Memory::faultAroundPages = pages;
+}
+
 void InitMultiboot2(multiboot2_info_header_t* mbInfo) {
     InitCore();
 
@@ -228,6 +244,10 @@ void InitMultiboot2(multiboot2_info_header_t* mbInfo) {
                 disableSMP = true;
             else if (strcmp(cmdLine, "kcon") == 0)
                 useKCon = true;
+            else if (strcmp(cmdLine, "nothp") == 0)
+                Memory::transparentHugePages = false;
+            else if (strncmp(cmdLine, "faultaround=", 12) == 0)
+                ParseFaultAround(cmdLine + 12);
             cmdLine = strtok_r(NULL, " ", &savePtr);
         }
     }
@@ -371,6 +391,10 @@ void InitStivale2(stivale2_info_header_t* st2Info) {
                 disableSMP = true;
             else if (strcmp(cmdLine, "kcon") == 0)
                 useKCon = true;
+            else if (strcmp(cmdLine, "nothp") == 0)
+                Memory::transparentHugePages = false;
+            else if (strncmp(cmdLine, "faultaround=", 12) == 0)
+                ParseFaultAround(cmdLine + 12);
             else if (strcmp(cmdLine, "runtests") == 0)
                 runTests = true;
             cmdLine = strtok_r(NULL, " ", &savePtr);
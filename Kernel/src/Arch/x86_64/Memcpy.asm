@@ -3,16 +3,200 @@ BITS 64
 global UserMemcpy
 global UserMemcpyTrap
 global UserMemcpyTrapHandler
+global UserMemcpySSE
+global UserMemcpyChecksum
+global UserMemset
+global UserStrnlen
+
+global UserCopyExceptionTable
+global UserCopyExceptionTableEnd
+
+; Adds an entry to the exception table (PageFaultTrap),
+; if instruction (%1) faults then execution continues at handler (%2)
+%macro EXTABLE 2
+[section .data]
+    dq %1, %2
+__SECT__
+%endmacro
+
+section .data
+align 16
+UserCopyExceptionTable:
+
+section .text
 
 ; UserMemcpy (dst, src, cnt)
+; rep movsb, fast on CPUs with ERMS and for small copies
 UserMemcpy:
     mov rcx, rdx
 
 UserMemcpyTrap:
     rep movsb
 
-    mov rax, 0
+    xor rax, rax
     ret
 UserMemcpyTrapHandler:
     mov rax, 1
     ret
+
+EXTABLE UserMemcpyTrap, UserMemcpyTrapHandler
+
+; UserMemcpySSE (dst, src, cnt)
+; Copies 64 bytes at a time for CPUs without ERMS.
+; The user's FPU state is still live, so the xmm registers we use are saved on the stack.
+UserMemcpySSE:
+    sub rsp, 64
+    movdqu [rsp], xmm0
+    movdqu [rsp + 16], xmm1
+    movdqu [rsp + 32], xmm2
+    movdqu [rsp + 48], xmm3
+
+    mov rcx, rdx
+    shr rcx, 6 ; Amount of 64 byte blocks
+    jz .tail
+
+.loop:
+.load0: movdqu xmm0, [rsi]
+.load1: movdqu xmm1, [rsi + 16]
+.load2: movdqu xmm2, [rsi + 32]
+.load3: movdqu xmm3, [rsi + 48]
+.store0: movdqu [rdi], xmm0
+.store1: movdqu [rdi + 16], xmm1
+.store2: movdqu [rdi + 32], xmm2
+.store3: movdqu [rdi + 48], xmm3
+
+    add rsi, 64
+    add rdi, 64
+    dec rcx
+    jnz .loop
+
+.tail:
+    mov rcx, rdx
+    and rcx, 63
+.tailCopy:
+    rep movsb
+
+    xor rax, rax
+    jmp .restore
+
+.fault:
+    mov rax, 1
+
+.restore:
+    movdqu xmm0, [rsp]
+    movdqu xmm1, [rsp + 16]
+    movdqu xmm2, [rsp + 32]
+    movdqu xmm3, [rsp + 48]
+    add rsp, 64
+    ret
+
+EXTABLE UserMemcpySSE.load0, UserMemcpySSE.fault
+EXTABLE UserMemcpySSE.load1, UserMemcpySSE.fault
+EXTABLE UserMemcpySSE.load2, UserMemcpySSE.fault
+EXTABLE UserMemcpySSE.load3, UserMemcpySSE.fault
+EXTABLE UserMemcpySSE.store0, UserMemcpySSE.fault
+EXTABLE UserMemcpySSE.store1, UserMemcpySSE.fault
+EXTABLE UserMemcpySSE.store2, UserMemcpySSE.fault
+EXTABLE UserMemcpySSE.store3, UserMemcpySSE.fault
+EXTABLE UserMemcpySSE.tailCopy, UserMemcpySSE.fault
+
+; UserMemcpyChecksum (dst, src, cnt, sum)
+; Copies while adding the data to the 64-bit one's complement sum at [sum] (Internet checksum),
+; so the data is only read once. [sum] is left alone if we fault.
+UserMemcpyChecksum:
+    mov r10, rcx
+    mov r8, [r10]
+
+    mov r9, rdx
+    shr r9, 3 ; Amount of 8 byte words
+    jz .tail
+
+.loop:
+.load: mov rax, [rsi]
+.store: mov [rdi], rax
+    add r8, rax
+    adc r8, 0
+
+    add rsi, 8
+    add rdi, 8
+    dec r9
+    jnz .loop
+
+.tail:
+    mov r9, rdx
+    and r9, 7
+    jz .done
+
+    ; Gather the remaining bytes into rax, as if the data was padded with zeroes
+    xor eax, eax
+    xor ecx, ecx
+.tailLoop:
+.tailLoad: movzx r11d, byte [rsi]
+.tailStore: mov [rdi], r11b
+    shl r11, cl
+    or rax, r11
+
+    inc rsi
+    inc rdi
+    add ecx, 8
+    dec r9
+    jnz .tailLoop
+
+    add r8, rax
+    adc r8, 0
+
+.done:
+    mov [r10], r8
+    xor rax, rax
+    ret
+.fault:
+    mov rax, 1
+    ret
+
+EXTABLE UserMemcpyChecksum.load, UserMemcpyChecksum.fault
+EXTABLE UserMemcpyChecksum.store, UserMemcpyChecksum.fault
+EXTABLE UserMemcpyChecksum.tailLoad, UserMemcpyChecksum.fault
+EXTABLE UserMemcpyChecksum.tailStore, UserMemcpyChecksum.fault
+
+; UserMemset (dst, value, cnt)
+UserMemset:
+    mov rcx, rdx
+    movzx eax, sil
+
+.trap:
+    rep stosb
+
+    xor rax, rax
+    ret
+.fault:
+    mov rax, 1
+    ret
+
+EXTABLE UserMemset.trap, UserMemset.fault
+
+; UserStrnlen (str, maxLength)
+; Returns length of the string (no more than maxLength), -1 on fault
+UserStrnlen:
+    xor rax, rax
+
+.loop:
+    cmp rax, rsi
+    jae .done
+
+.trap:
+    cmp byte [rdi + rax], 0
+    je .done
+
+    inc rax
+    jmp .loop
+
+.done:
+    ret
+.fault:
+    mov rax, -1
+    ret
+
+EXTABLE UserStrnlen.trap, UserStrnlen.fault
+
+section .data
+UserCopyExceptionTableEnd:
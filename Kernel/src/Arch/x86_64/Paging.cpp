@@ -1,12 +1,15 @@
 #include <APIC.h>
 #include <CPU.h>
 #include <CString.h>
+#include <Errno.h>
 #include <IDT.h>
 #include <Logging.h>
+#include <MM/Reclaim.h>
 #include <Memory.h>
 #include <Paging.h>
 #include <Panic.h>
 #include <PhysicalAllocator.h>
+#include <SMP.h>
 #include <Scheduler.h>
 #include <StackTrace.h>
 #include <Syscalls.h>
@@ -30,8 +33,14 @@ page_dir_t ioDirs[4] __attribute__((aligned(4096)));
 
 lock_t kernelHeapDirLock = 0;
 
+unsigned faultAroundPages = FAULT_AROUND_DEFAULT_PAGES;
+
 HashMap<uintptr_t, PageFaultTrap>* pageFaultTraps;
 
+lock_t tlbShootdownLock = 0;
+volatile uintptr_t tlbShootdownPML4 = 0;
+volatile unsigned tlbShootdownPending = 0; // CPUs yet to acknowledge the shootdown
+
 uint64_t VirtualToPhysicalAddress(uint64_t addr) {
     uint64_t address = 0;
 
@@ -60,8 +69,10 @@ uint64_t VirtualToPhysicalAddress(uint64_t addr, page_map_t* addressSpace) {
     uint32_t pageTableIndex = PAGE_TABLE_GET_INDEX(addr);
 
     if (pml4Index == 0) { // From Process Address Space
-        if ((addressSpace->pageDirs[pdptIndex][pageDirIndex] & 0x1) &&
-            addressSpace->pageTables[pdptIndex][pageDirIndex])
+        pd_entry_t dirEnt = addressSpace->pageDirs[pdptIndex][pageDirIndex];
+        if ((dirEnt & PDE_PRESENT) && (dirEnt & PDE_2M))
+            return (dirEnt & PDE_FRAME & ~static_cast<uint64_t>(PAGE_SIZE_2M - 1)) + (addr & (PAGE_SIZE_2M - 1));
+        else if ((dirEnt & 0x1) && addressSpace->pageTables[pdptIndex][pageDirIndex])
             return addressSpace->pageTables[pdptIndex][pageDirIndex][pageTableIndex] & PAGE_FRAME;
         else
             return 0;
@@ -102,8 +113,37 @@ page_table_t CreatePageTable(uint16_t pdptIndex, uint16_t pageDirIndex, PageMap*
     return pTable;
 }
 
+// Replaces a 2MB mapping with a page table mapping the same physical memory
+void SplitHugePage(uint16_t pdptIndex, uint16_t pageDirIndex, PageMap* pageMap) {
+    pd_entry_t dirEnt = pageMap->pageDirs[pdptIndex][pageDirIndex];
+    assert(dirEnt & PDE_2M);
+
+    uint64_t phys = dirEnt & PDE_FRAME & ~static_cast<uint64_t>(PAGE_SIZE_2M - 1);
+    uint64_t flags = dirEnt & (PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER | PAGE_WRITETHROUGH | PAGE_CACHE_DISABLED);
+
+    pageMap->pageDirs[pdptIndex][pageDirIndex] = 0;
+    page_table_t pTable = CreatePageTable(pdptIndex, pageDirIndex, pageMap);
+    for (unsigned i = 0; i < PAGES_PER_TABLE; i++) {
+        pTable.virt[i] = flags;
+        SetPageFrame(&pTable.virt[i], phys + i * PAGE_SIZE_4K);
+    }
+
+    uintptr_t virt = pdptIndex * PAGE_SIZE_1G + pageDirIndex * static_cast<uintptr_t>(PAGE_SIZE_2M);
+    invlpg(virt);
+}
+
+void TLBShootdownHandler(void*, RegisterContext*) {
+    uintptr_t pml4 = __atomic_load_n(&tlbShootdownPML4, __ATOMIC_ACQUIRE);
+    if (GetCR3() == pml4) {
+        asm volatile("mov %%rax, %%cr3" ::"a"(pml4) : "memory"); // Reloading CR3 flushes all non-global entries
+    }
+
+    __atomic_sub_fetch(&tlbShootdownPending, 1, __ATOMIC_RELEASE);
+}
+
 void InitializeVirtualMemory() {
     IDT::RegisterInterruptHandler(14, PageFaultHandler);
+    IDT::RegisterInterruptHandler(IPI_TLB_SHOOTDOWN, TLBShootdownHandler);
     memset(kernelPML4, 0, sizeof(pml4_t));
     memset(kernelPDPT, 0, sizeof(pdpt_t));
     memset(kernelHeapDir, 0, sizeof(page_dir_t));
@@ -143,8 +183,26 @@ void InitializeVirtualMemory() {
 void LateInitializeVirtualMemory() {
     pageFaultTraps = new HashMap<uintptr_t, PageFaultTrap>();
 
-    RegisterPageFaultTrap(PageFaultTrap{.instructionPointer = reinterpret_cast<uintptr_t>(UserMemcpyTrap),
-                                        .handler = UserMemcpyTrapHandler});
+    InitializeUserCopy();
+    InitializeReclaim();
+}
+
+int (*userCopyLarge)(void* dest, const void* src, size_t count) = UserMemcpy;
+
+void InitializeUserCopy() {
+    for (PageFaultTrap* trap = UserCopyExceptionTable; trap < UserCopyExceptionTableEnd; trap++) {
+        RegisterPageFaultTrap(*trap);
+    }
+
+    cpuid_info_t cpuid = CPUID();
+    if (!(cpuid.features_ext_ebx & CPUID_EXT_EBX_ERMS) && (cpuid.features_edx & CPUID_EDX_SSE2)) {
+        userCopyLarge = UserMemcpySSE; // rep movsb is slow without ERMS
+    }
+
+    IF_DEBUG((debugLevelUsermodeMM >= DebugLevelNormal), {
+        Log::Info("User copy: %s (ERMS: %Y, FSRM: %Y)", (userCopyLarge == UserMemcpySSE) ? "SSE" : "rep movsb",
+                  cpuid.features_ext_ebx & CPUID_EXT_EBX_ERMS, cpuid.features_ext_edx & CPUID_EXT_EDX_FSRM);
+    });
 }
 
 PageMap* CreatePageMap() {
@@ -264,8 +322,8 @@ void DestroyPageMap(PageMap* pageMap) {
 
         for (int j = 0; j < TABLES_PER_DIR; j++) {
             pd_entry_t dirEnt = pageMap->pageDirs[i][j];
-            if (dirEnt & PAGE_PRESENT) {
-                uint64_t phys = GetPageFrame(dirEnt);
+            if ((dirEnt & PAGE_PRESENT) && !(dirEnt & PDE_2M)) { // 2MB pages are owned by their VMObject
+                uint64_t phys = dirEnt & PDE_FRAME;
                 if (phys < PHYSALLOC_BLOCK_SIZE) {
                     continue;
                 }
@@ -591,6 +649,8 @@ void Free4KPages(void* addr, uint64_t amount, page_map_t* addressSpace) {
 
         if (!(addressSpace->pageDirs[pdptIndex][pageDirIndex] & 0x1))
             continue;
+        else if (addressSpace->pageDirs[pdptIndex][pageDirIndex] & PDE_2M)
+            SplitHugePage(pdptIndex, pageDirIndex, addressSpace);
 
         addressSpace->pageTables[pdptIndex][pageDirIndex][pageIndex] = 0;
 
@@ -654,6 +714,8 @@ void MapVirtualMemory4K(uint64_t phys, uint64_t virt, uint64_t amount, PageMap*
         if (!(pageMap->pageDirs[pdptIndex][pageDirIndex] & 0x1))
             CreatePageTable(pdptIndex, pageDirIndex,
                             pageMap); // If we don't have a page table at this address, create one.
+        else if (pageMap->pageDirs[pdptIndex][pageDirIndex] & PDE_2M)
+            SplitHugePage(pdptIndex, pageDirIndex, pageMap); // Fall back to 4KB pages
 
         pageMap->pageTables[pdptIndex][pageDirIndex][pageIndex] = PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
         SetPageFrame(&(pageMap->pageTables[pdptIndex][pageDirIndex][pageIndex]), phys);
@@ -682,6 +744,8 @@ void MapVirtualMemory4K(uint64_t phys, uint64_t virt, uint64_t amount, uint64_t
         if (!(pageMap->pageDirs[pdptIndex][pageDirIndex] & 0x1))
             CreatePageTable(pdptIndex, pageDirIndex,
                             pageMap); // If we don't have a page table at this address, create one.
+        else if (pageMap->pageDirs[pdptIndex][pageDirIndex] & PDE_2M)
+            SplitHugePage(pdptIndex, pageDirIndex, pageMap); // Fall back to 4KB pages
 
         pageMap->pageTables[pdptIndex][pageDirIndex][pageIndex] = flags;
         SetPageFrame(&(pageMap->pageTables[pdptIndex][pageDirIndex][pageIndex]), phys);
@@ -693,6 +757,84 @@ void MapVirtualMemory4K(uint64_t phys, uint64_t virt, uint64_t amount, uint64_t
     }
 }
 
+page_table_t MapVirtualMemory2M(uint64_t phys, uint64_t virt, uint64_t flags, PageMap* pageMap) {
+    assert(!(phys & (PAGE_SIZE_2M - 1)));
+    assert(!(virt & (PAGE_SIZE_2M - 1)));
+
+    uint64_t pml4Index = PML4_GET_INDEX(virt);
+    uint64_t pdptIndex = PDPT_GET_INDEX(virt);
+    uint64_t pageDirIndex = PAGE_DIR_GET_INDEX(virt);
+
+    const char* panic[1] = {"Process address space cannot be >512GB"};
+    if (pdptIndex > MAX_PDPT_INDEX || pml4Index)
+        KernelPanic(panic, 1);
+
+    assert(pageMap->pageDirs[pdptIndex]);
+
+    page_table_t oldTable = {0, nullptr};
+
+    pd_entry_t dirEnt = pageMap->pageDirs[pdptIndex][pageDirIndex];
+    if ((dirEnt & PDE_PRESENT) && !(dirEnt & PDE_2M)) { // Unlink the page table, the caller frees it
+        oldTable.phys = dirEnt & PDE_FRAME;
+        oldTable.virt = pageMap->pageTables[pdptIndex][pageDirIndex];
+        pageMap->pageTables[pdptIndex][pageDirIndex] = nullptr;
+    }
+
+    pageMap->pageDirs[pdptIndex][pageDirIndex] = flags | PDE_2M;
+    SetPageFrame(&(pageMap->pageDirs[pdptIndex][pageDirIndex]), phys);
+
+    for (uintptr_t i = 0; i < PAGE_SIZE_2M; i += PAGE_SIZE_4K) {
+        invlpg(virt + i); // Stale 4KB entries may be cached
+    }
+
+    return oldTable;
+}
+
+void FreePageTable(page_table_t table) {
+    if (!table.phys) {
+        return;
+    }
+
+    FreePhysicalMemoryBlock(table.phys);
+    KernelFree4KPages(table.virt, 1);
+}
+
+bool HasPageTable(uint64_t virt, PageMap* pageMap) {
+    if (PML4_GET_INDEX(virt)) {
+        return false;
+    }
+
+    pd_entry_t dirEnt = pageMap->pageDirs[PDPT_GET_INDEX(virt)][PAGE_DIR_GET_INDEX(virt)];
+    return (dirEnt & PDE_PRESENT) && !(dirEnt & PDE_2M);
+}
+
+bool IsHugePageMapped(uint64_t virt, PageMap* pageMap) {
+    if (PML4_GET_INDEX(virt)) {
+        return false;
+    }
+
+    pd_entry_t dirEnt = pageMap->pageDirs[PDPT_GET_INDEX(virt)][PAGE_DIR_GET_INDEX(virt)];
+    return (dirEnt & PDE_PRESENT) && (dirEnt & PDE_2M);
+}
+
+void ShootdownTLB(PageMap* pageMap) {
+    if (SMP::processorCount <= 1) {
+        return;
+    }
+
+    acquireLock(&tlbShootdownLock);
+
+    __atomic_store_n(&tlbShootdownPML4, pageMap->pml4Phys, __ATOMIC_RELEASE);
+    __atomic_store_n(&tlbShootdownPending, SMP::processorCount - 1, __ATOMIC_RELEASE);
+    APIC::Local::SendIPI(0, ICR_DSH_OTHER, ICR_MESSAGE_TYPE_FIXED, IPI_TLB_SHOOTDOWN);
+
+    while (__atomic_load_n(&tlbShootdownPending, __ATOMIC_ACQUIRE)) {
+        asm volatile("pause");
+    }
+
+    releaseLock(&tlbShootdownLock);
+}
+
 uintptr_t GetIOMapping(uintptr_t addr) {
     if (addr > 0xffffffff) { // Typically most MMIO will not reside > 4GB, but check just in case
         Log::Error("MMIO >4GB current unsupported");
@@ -764,6 +906,8 @@ void PageFaultHandler(void*, RegisterContext* regs) {
 
     if (process) {
         AddressSpace* addressSpace = process->addressSpace;
+        int status = 1; // Fatal unless the VMO handles the fault
+
         asm("sti");
         MappedRegion* faultRegion =
             addressSpace->AddressToRegionReadLock(faultAddress); // Remember that this acquires a lock
@@ -779,51 +923,84 @@ void PageFaultHandler(void*, RegisterContext* regs) {
                         addressSpace->GetPageMap()); // This should remap all allocated blocks as writable
 
                     asm("sti");
-                    vmo->Hit(faultRegion->Base(), faultAddress - faultRegion->Base(),
-                             addressSpace->GetPageMap()); // In case the block was never allocated in the first place
+                    status = vmo->Hit(faultRegion->Base(), faultAddress - faultRegion->Base(),
+                                      addressSpace->GetPageMap()); // In case the block was never allocated in the first place
                     asm("cli");
-
-                    faultRegion->lock.ReleaseRead();
-                    if ((regs->cs & 0x3)) {
-                        releaseLock(&Scheduler::GetCurrentThread()->lock);
-                    }
-                    return;
                 } else {
                     asm("sti");
                     VMObject* clone = vmo->Clone();
+                    if (clone) {
+                        vmo->refCount--;
+                        faultRegion->vmObject = clone;
+                        asm("cli");
+
+                        clone->MapAllocatedBlocks(faultRegion->Base(), addressSpace->GetPageMap());
+                        status = clone->Hit(faultRegion->Base(), faultAddress - faultRegion->Base(),
+                                            addressSpace->GetPageMap()); // In case the block was never allocated in the first place
+                    } else {
+                        asm("cli");
+                        status = -ENOMEM;
+                    }
+                }
+            } else {
+                asm("sti");
+                status = vmo->Hit(faultRegion->Base(), faultAddress - faultRegion->Base(), addressSpace->GetPageMap());
+                if (!status && faultAroundPages > 1 && vmo->IsAnonymous() && !vmo->IsCopyOnWrite()) {
+                    // Populate the window around the fault so neighbouring accesses do not fault as well
+                    uintptr_t windowSize = static_cast<uintptr_t>(faultAroundPages) << PAGE_SHIFT_4K;
+                    uintptr_t windowBase = faultAddress & ~static_cast<uintptr_t>(PAGE_SIZE_4K - 1);
+                    if (windowBase - faultRegion->Base() >= windowSize / 2) {
+                        windowBase -= windowSize / 2;
+                    } else {
+                        windowBase = faultRegion->Base();
+                    }
 
-                    vmo->refCount--;
-                    faultRegion->vmObject = clone;
-                    asm("cli");
+                    uintptr_t windowEnd = windowBase + windowSize;
+                    if (windowEnd > faultRegion->End()) {
+                        windowEnd = faultRegion->End();
+                    }
 
-                    clone->MapAllocatedBlocks(faultRegion->Base(), addressSpace->GetPageMap());
-                    clone->Hit(faultRegion->Base(), faultAddress - faultRegion->Base(),
-                               addressSpace->GetPageMap()); // In case the block was never allocated in the first place
+                    vmo->Populate(faultRegion->Base(), windowBase - faultRegion->Base(), windowEnd - windowBase,
+                                  addressSpace->GetPageMap());
+                }
+                asm("cli");
+            }
 
-                    faultRegion->lock.ReleaseRead();
+            faultRegion->lock.ReleaseRead();
+        } else if (faultRegion) {
+            faultRegion->lock.ReleaseRead();
+        }
 
-                    if ((regs->cs & 0x3)) {
-                        releaseLock(&Scheduler::GetCurrentThread()->lock);
-                    }
-                    return;
-                }
+        if (!status) {
+            if ((regs->cs & 0x3)) {
+                releaseLock(&Scheduler::GetCurrentThread()->lock);
             }
+            return; // Success!
+        }
 
+        // Kernel faults may come from code holding spinlocks, so only user faults wait for memory.
+        // The region lock has been released so the reclaim thread and OOM killer can make progress.
+        if (status == -ENOMEM && (regs->cs & 0x3)) {
             asm("sti");
-            int status = faultRegion->vmObject->Hit(faultRegion->Base(), faultAddress - faultRegion->Base(),
-                                                    addressSpace->GetPageMap());
-            faultRegion->lock.ReleaseRead();
+            if (uint64_t block = WaitForFreeMemory(TryAllocatePhysicalMemoryBlock)) {
+                // Memory is available again, give it back and let the access fault again
+                FreePhysicalMemoryBlock(block);
 
-            if (!status) {
-                if ((regs->cs & 0x3)) {
-                    releaseLock(&Scheduler::GetCurrentThread()->lock);
-                }
-                return; // Success!
+                releaseLock(&Scheduler::GetCurrentThread()->lock);
+                return;
             }
             asm("cli");
-        } else if (faultRegion) {
-            faultRegion->lock.ReleaseRead();
-        } else if (PageFaultTrap trap; pageFaultTraps->get(regs->rip, trap)) {
+
+            Log::Warning("Process %s (PID: %x) out of memory, killing.", process->name, process->PID());
+            process->Die();
+            return;
+        }
+    }
+
+    if (!(regs->cs & 0x3)) {
+        // Check the exception table, even if the address lies within a region
+        // the fault may not have been resolved (e.g. out of memory)
+        if (PageFaultTrap trap; pageFaultTraps->get(regs->rip, trap)) {
             // If we have found a handler, set the IP to the handler
             // and run
             regs->rip = reinterpret_cast<uintptr_t>(trap.handler);
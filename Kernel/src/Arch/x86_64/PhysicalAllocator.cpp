@@ -4,6 +4,7 @@
 #include <CString.h>
 #include <Lock.h>
 #include <Logging.h>
+#include <MM/Reclaim.h>
 #include <Paging.h>
 #include <Panic.h>
 #include <Serial.h>
@@ -22,7 +23,7 @@ lock_t allocatorLock = 0;
 void InitializePhysicalAllocator(memory_info_t* mem_info) {
     memset(physicalMemoryBitmap, 0xFFFFFFFF, PHYSALLOC_BITMAP_SIZE_DWORDS * sizeof(uint32_t));
 
-    maxPhysicalBlocks = PHYSALLOC_BITMAP_SIZE_DWORDS;
+    maxPhysicalBlocks = PHYSALLOC_BITMAP_SIZE_DWORDS * 32; // One bit per block
     usedPhysicalBlocks = maxPhysicalBlocks;
 }
 
@@ -85,29 +86,53 @@ uint64_t GetFirstFreeMemoryBlock() {
     return 0;
 }
 
-// Marks a region in physical memory as being used
+// Marks a region in physical memory as being used, memory past the end of the bitmap is ignored
 void MarkMemoryRegionUsed(uint64_t base, size_t size) {
-    for (uint32_t blocks = (size + (PHYSALLOC_BLOCK_SIZE - 1)) / PHYSALLOC_BLOCK_SIZE,
+    for (uint64_t blocks = (size + (PHYSALLOC_BLOCK_SIZE - 1)) / PHYSALLOC_BLOCK_SIZE,
                   align = base / PHYSALLOC_BLOCK_SIZE;
-         blocks > 0; blocks--, usedPhysicalBlocks++)
+         blocks > 0 && align < maxPhysicalBlocks; blocks--, usedPhysicalBlocks++)
         SetBit(align++);
 }
 
-// Marks a region in physical memory as being free
+// Marks a region in physical memory as being free, memory past the end of the bitmap is ignored
 void MarkMemoryRegionFree(uint64_t base, size_t size) {
-    for (uint32_t blocks = (size + (PHYSALLOC_BLOCK_SIZE - 1)) / PHYSALLOC_BLOCK_SIZE,
+    for (uint64_t blocks = (size + (PHYSALLOC_BLOCK_SIZE - 1)) / PHYSALLOC_BLOCK_SIZE,
                   align = base / PHYSALLOC_BLOCK_SIZE;
-         blocks > 0; blocks--, usedPhysicalBlocks--)
+         blocks > 0 && align < maxPhysicalBlocks; blocks--, usedPhysicalBlocks--)
         ClearBit(align++);
 }
 
-// Allocates a block of physical memory
-uint64_t AllocatePhysicalMemoryBlock() {
+// Takes a free block from the bitmap, returns 0 on failure
+static uint64_t TakePhysicalMemoryBlock() {
     acquireLock(&allocatorLock);
     InterruptDisabler disableInterrupts;
 
     uint64_t index = GetFirstFreeMemoryBlock();
-    if (!index) {
+    if (index) {
+        SetBit(index);
+        usedPhysicalBlocks++;
+    }
+
+    releaseLock(&allocatorLock);
+
+    return index << PHYSALLOC_BLOCK_SHIFT;
+}
+
+// Allocates a block of physical memory without waiting for reclaim, returns 0 on failure
+uint64_t TryAllocatePhysicalMemoryBlock() {
+    uint64_t block = TakePhysicalMemoryBlock();
+    if (FreePhysicalPages() < watermarkLow) {
+        WakeReclaim();
+    }
+
+    return block;
+}
+
+// Allocates a block of physical memory
+// Never sleeps, as most callers (e.g. kmalloc and the page table code) hold spinlocks
+uint64_t AllocatePhysicalMemoryBlock() {
+    uint64_t block = TryAllocatePhysicalMemoryBlock();
+    if (!block) {
         asm("cli");
         Log::Error("Out of memory!");
         KernelPanic((const char**)(&"Out of memory!"), 1);
@@ -115,41 +140,44 @@ uint64_t AllocatePhysicalMemoryBlock() {
             ;
     }
 
-    SetBit(index);
-    usedPhysicalBlocks++;
-
-    releaseLock(&allocatorLock);
-
-    return index << PHYSALLOC_BLOCK_SHIFT;
+    return block;
 }
 
 // Allocates a block of 2MB physical memory
-/*uint64_t AllocateLargePhysicalMemoryBlock() {
-    uint64_t index = GetFirstFreeMemoryBlock();
-    uint64_t blockCount = 0x200000
-    uint64_t counter = 0;
-    while(counter < blockCount){
-        if(bit_test(index)){
-            index++;
-            counter = 0;
+uint64_t AllocateLargePhysicalMemoryBlock() {
+    // 2MB is 512 blocks, or 16 dwords of the bitmap
+    const uint32_t dwordsPerLargeBlock = (PAGE_SIZE_2M / PHYSALLOC_BLOCK_SIZE) >> 5;
+
+    acquireLock(&allocatorLock);
+    InterruptDisabler disableInterrupts;
+
+    // Skip the first 2MB as the first block is always reserved
+    for (uint32_t i = dwordsPerLargeBlock; i + dwordsPerLargeBlock <= (maxPhysicalBlocks >> 5);
+         i += dwordsPerLargeBlock) {
+        uint32_t j = 0;
+        for (; j < dwordsPerLargeBlock; j++) {
+            if (physicalMemoryBitmap[i + j]) {
+                break; // At least one block is in use
+            }
+        }
+
+        if (j < dwordsPerLargeBlock) {
             continue;
         }
 
-        index++;
-        counter++;
-    }
+        memset(&physicalMemoryBitmap[i], 0xff, dwordsPerLargeBlock * sizeof(uint32_t));
+        usedPhysicalBlocks += dwordsPerLargeBlock << 5;
 
-    if (index == 0)
-        return 0;
+        releaseLock(&allocatorLock);
 
-    uint64_t addr = index * PHYSALLOC_BLOCK_SIZE;
+        return static_cast<uint64_t>(i << 5) << PHYSALLOC_BLOCK_SHIFT;
+    }
 
-    while(blockCount--)
-        bit_set(index++);
-    usedPhysicalBlocks += counter;
+    releaseLock(&allocatorLock);
 
-    return addr;
-}*/
+    // Physical memory is too fragmented, the caller should fall back to 4KB blocks
+    return 0;
+}
 
 // Frees a block of physical memory
 void FreePhysicalMemoryBlock(uint64_t addr) {
@@ -166,12 +194,24 @@ void FreePhysicalMemoryBlock(uint64_t addr) {
     }
 }
 
-// Frees a block of physical memory
+// Frees a 2MB block of physical memory
 void FreeLargePhysicalMemoryBlock(uint64_t addr) {
-    uint64_t index = addr / PHYSALLOC_BLOCK_SIZE;
-    uint64_t blockCount = 0x200000 /* 2MB */ / PHYSALLOC_BLOCK_SIZE;
-    usedPhysicalBlocks -= blockCount;
-    while (blockCount--)
-        ClearBit(index++);
+    assert(!(addr & (PAGE_SIZE_2M - 1)));
+
+    // 2MB is 512 blocks, or 16 dwords of the bitmap
+    const uint32_t dwordsPerLargeBlock = (PAGE_SIZE_2M / PHYSALLOC_BLOCK_SIZE) >> 5;
+    uint64_t chunk = addr >> (PHYSALLOC_BLOCK_SHIFT + 5);
+
+    acquireLock(&allocatorLock);
+    InterruptDisabler disableInterrupts;
+
+    memset(&physicalMemoryBitmap[chunk], 0, dwordsPerLargeBlock * sizeof(uint32_t));
+    usedPhysicalBlocks -= dwordsPerLargeBlock << 5;
+
+    if (chunk < nextChunk) {
+        nextChunk = chunk;
+    }
+
+    releaseLock(&allocatorLock);
 }
 } // namespace Memory
\ No newline at end of file
@@ -45,6 +45,15 @@ inline void InsertThreadIntoQueue(Thread* thread) { GetCPULocal()->runQueue->add
 
 inline void RemoveThreadFromQueue(Thread* thread) { GetCPULocal()->runQueue->remove(thread); }
 
+static void InsertNewThreadIntoCPUQueue(Thread* thread, CPU* cpu) {
+    asm("sti");
+    acquireLock(&cpu->runQueueLock);
+    asm("cli");
+    cpu->runQueue->add_back(thread);
+    releaseLock(&cpu->runQueueLock);
+    asm("sti");
+}
+
 void InsertNewThreadIntoQueue(Thread* thread) {
     CPU* cpu = SMP::cpus[0];
     for (unsigned i = 1; i < SMP::processorCount; i++) {
@@ -57,12 +66,11 @@ void InsertNewThreadIntoQueue(Thread* thread) {
         }
     }
 
-    asm("sti");
-    acquireLock(&cpu->runQueueLock);
-    asm("cli");
-    cpu->runQueue->add_back(thread);
-    releaseLock(&cpu->runQueueLock);
-    asm("sti");
+    InsertNewThreadIntoCPUQueue(thread, cpu);
+}
+
+void InsertNewThreadIntoQueue(Thread* thread, unsigned cpu) {
+    InsertNewThreadIntoCPUQueue(thread, SMP::cpus[cpu % SMP::processorCount]);
 }
 
 void Initialize() {
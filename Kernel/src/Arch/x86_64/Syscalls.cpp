@@ -27,6 +27,7 @@
 #include <Video/Video.h>
 #include <UserPointer.h>
 
+#include <ABI/MMap.h>
 #include <ABI/Process.h>
 #include <ABI/Syscall.h>
 
@@ -40,7 +41,7 @@
 #define SC_ARG4(r) ((r)->r9)
 #define SC_ARG5(r) ((r)->r8)
 
-#define NUM_SYSCALLS 108
+#define NUM_SYSCALLS 110
 
 #define EXEC_CHILD 1
 
@@ -176,7 +177,9 @@ long SysRead(RegisterContext* r) {
     uint8_t* buffer = (uint8_t*)SC_ARG1(r);
     uint64_t count = SC_ARG2(r);
 
-    if (!Memory::CheckUsermodePointer(SC_ARG1(r), count, proc->addressSpace)) {
+    // Sockets copy with the fault tolerant UserCopy, filesystem drivers use memcpy and need the buffer to be mapped
+    bool isSocket = (handle->node->flags & FS_NODE_TYPE) == FS_NODE_SOCKET;
+    if (isSocket ? !IsUsermodeRange(buffer, count) : !Memory::CheckUsermodePointer(SC_ARG1(r), count, proc->addressSpace)) {
         Log::Warning("SysRead: Invalid Memory Buffer: %x", SC_ARG1(r));
         return -EFAULT;
     }
@@ -197,7 +200,9 @@ long SysWrite(RegisterContext* r) {
     uint8_t* buffer = (uint8_t*)SC_ARG1(r);
     uint64_t count = SC_ARG2(r);
 
-    if (!Memory::CheckUsermodePointer(SC_ARG1(r), count, proc->addressSpace)) {
+    // Sockets copy with the fault tolerant UserCopy, filesystem drivers use memcpy and need the buffer to be mapped
+    bool isSocket = (handle->node->flags & FS_NODE_TYPE) == FS_NODE_SOCKET;
+    if (isSocket ? !IsUsermodeRange(buffer, count) : !Memory::CheckUsermodePointer(SC_ARG1(r), count, proc->addressSpace)) {
         Log::Warning("SysWrite: Invalid Memory Buffer: %x", SC_ARG1(r));
         return -EFAULT;
     }
@@ -954,7 +959,9 @@ long SysMmap(RegisterContext* r) {
     bool anon = flags & MAP_ANON;
     // bool privateMapping = flags & MAP_PRIVATE;
 
-    uint64_t unknownFlags = flags & ~static_cast<uint64_t>(MAP_ANON | MAP_FIXED | MAP_PRIVATE);
+    bool populate = flags & MAP_POPULATE;
+
+    uint64_t unknownFlags = flags & ~static_cast<uint64_t>(MAP_ANON | MAP_FIXED | MAP_PRIVATE | MAP_POPULATE);
     if (unknownFlags || !anon) {
         Log::Warning("SysMmap: Unsupported mmap flags %x", flags);
         return -EINVAL;
@@ -978,6 +985,18 @@ long SysMmap(RegisterContext* r) {
         return -1;
     }
 
+    if (size > PAGE_SIZE_2M) {
+        region->vmObject->SetHugePages(true); // Back with 2MB pages where possible
+    }
+
+    if (populate) {
+        // Allocate all pages now instead of faulting them in one by one
+        if (region->vmObject->Populate(region->base, 0, size, proc->GetPageMap())) {
+            proc->addressSpace->UnmapMemory(region->base, size);
+            return -ENOMEM;
+        }
+    }
+
     *address = region->base;
     return 0;
 }
@@ -1465,7 +1484,7 @@ long SysSend(RegisterContext* r) {
         return -ENOTSOCK;
     }
 
-    if (!Memory::CheckUsermodePointer(SC_ARG1(r), len, proc->addressSpace)) {
+    if (!IsUsermodeRange(reinterpret_cast<void*>(SC_ARG1(r)), len)) {
         Log::Warning("SysSend: Invalid buffer ptr");
         return -EFAULT;
     }
@@ -1502,7 +1521,7 @@ long SysSendTo(RegisterContext* r) {
         return -ENOTSOCK;
     }
 
-    if (!Memory::CheckUsermodePointer(SC_ARG1(r), len, proc->addressSpace)) {
+    if (!IsUsermodeRange(reinterpret_cast<void*>(SC_ARG1(r)), len)) {
         Log::Warning("SysSendTo: Invalid buffer ptr");
         return -EFAULT;
     }
@@ -1542,7 +1561,7 @@ long SysReceive(RegisterContext* r) {
         return -ENOTSOCK;
     }
 
-    if (!Memory::CheckUsermodePointer(SC_ARG1(r), len, proc->addressSpace)) {
+    if (!IsUsermodeRange(reinterpret_cast<void*>(SC_ARG1(r)), len)) {
         Log::Warning("SysReceive: Invalid buffer ptr");
         return -EINVAL;
     }
@@ -1579,7 +1598,7 @@ long SysReceiveFrom(RegisterContext* r) {
         return -ENOTSOCK;
     }
 
-    if (!Memory::CheckUsermodePointer(SC_ARG1(r), len, proc->addressSpace)) {
+    if (!IsUsermodeRange(reinterpret_cast<void*>(SC_ARG1(r)), len)) {
         Log::Warning("SysReceiveFrom: Invalid buffer ptr");
         return -EFAULT;
     }
@@ -1782,6 +1801,56 @@ long SysPoll(RegisterContext* r) {
     return eventCount;
 }
 
+// Check the pointers in a message header from userspace before the socket uses them
+static long CheckMessageHeader(Process* proc, const msghdr* msg, const char* syscall) {
+    if (!Memory::CheckUsermodePointer((uintptr_t)msg->msg_iov, sizeof(iovec) * msg->msg_iovlen, proc->addressSpace)) {
+        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal, { Log::Warning("%s: msg: Invalid iovec ptr", syscall); });
+        return -EFAULT;
+    }
+
+    if (msg->msg_name && msg->msg_namelen &&
+        !Memory::CheckUsermodePointer((uintptr_t)msg->msg_name, msg->msg_namelen, proc->addressSpace)) {
+        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal,
+                 { Log::Warning("%s: msg: Invalid name ptr and name not null", syscall); });
+        return -EFAULT;
+    }
+
+    if (msg->msg_control && msg->msg_controllen &&
+        !Memory::CheckUsermodePointer((uintptr_t)msg->msg_control, msg->msg_controllen, proc->addressSpace)) {
+        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal,
+                 { Log::Warning("%s: msg: Invalid control ptr and control null", syscall); });
+        return -EFAULT;
+    }
+
+    for (unsigned i = 0; i < static_cast<unsigned>(msg->msg_iovlen); i++) {
+        if (!Memory::CheckUsermodePointer((uintptr_t)msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len,
+                                          proc->addressSpace)) {
+            Log::Warning("%s: msg: Invalid iovec entry base", syscall);
+            return -EFAULT;
+        }
+    }
+
+    return 0;
+}
+
+// Get the file descriptor of a socket, the handle keeps the socket alive for the syscall
+static long GetSocketHandle(Process* proc, int fd, FancyRefPtr<UNIXFileDescriptor>& handle, const char* syscall) {
+    handle = proc->GetFileDescriptor(fd);
+    if (!handle) {
+        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal,
+                 { Log::Warning("%s: Invalid File Descriptor: %d", syscall, fd); });
+        return -EBADF;
+    }
+
+    if ((handle->node->flags & FS_NODE_TYPE) != FS_NODE_SOCKET) {
+        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal,
+                 { Log::Warning("%s: File (Descriptor: %d) is not a socket", syscall, fd); });
+        return -ENOTSOCK;
+    }
+
+    return 0;
+}
+
 /*
  * SysSend (sockfd, msg, flags) - Send data through a socket
  * sockfd - Socket file descriptor
@@ -1794,69 +1863,25 @@ long SysPoll(RegisterContext* r) {
 long SysSendMsg(RegisterContext* r) {
     Process* proc = Scheduler::GetCurrentProcess();
 
-    FancyRefPtr<UNIXFileDescriptor> handle = proc->GetFileDescriptor(SC_ARG0(r));
-    if (!handle) {
-        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal,
-                 { Log::Warning("SysSendMsg: Invalid File Descriptor: %d", SC_ARG0(r)); });
-        return -EBADF;
+    FancyRefPtr<UNIXFileDescriptor> handle;
+    if (long e = GetSocketHandle(proc, SC_ARG0(r), handle, "SysSendMsg")) {
+        return e;
     }
 
     msghdr* msg = (msghdr*)SC_ARG1(r);
     uint64_t flags = SC_ARG3(r);
 
-    if ((handle->node->flags & FS_NODE_TYPE) != FS_NODE_SOCKET) {
-
-        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal,
-                 { Log::Warning("SysSendMsg: File (Descriptor: %d) is not a socket", SC_ARG0(r)); });
-        return -ENOTSOCK;
-    }
-
     if (!Memory::CheckUsermodePointer(SC_ARG1(r), sizeof(msghdr), proc->addressSpace)) {
 
         IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal, { Log::Warning("SysSendMsg: Invalid msg ptr"); });
         return -EFAULT;
     }
 
-    if (!Memory::CheckUsermodePointer((uintptr_t)msg->msg_iov, sizeof(iovec) * msg->msg_iovlen, proc->addressSpace)) {
-
-        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal, { Log::Warning("SysSendMsg: msg: Invalid iovec ptr"); });
-        return -EFAULT;
-    }
-
-    if (msg->msg_name && msg->msg_namelen &&
-        !Memory::CheckUsermodePointer((uintptr_t)msg->msg_name, msg->msg_namelen, proc->addressSpace)) {
-        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal,
-                 { Log::Warning("SysSendMsg: msg: Invalid name ptr and name not null"); });
-        return -EFAULT;
-    }
-
-    if (msg->msg_control && msg->msg_controllen &&
-        !Memory::CheckUsermodePointer((uintptr_t)msg->msg_control, msg->msg_controllen, proc->addressSpace)) {
-        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal,
-                 { Log::Warning("SysSendMsg: msg: Invalid control ptr and control null"); });
-        return -EFAULT;
-    }
-
-    long sent = 0;
-    Socket* sock = (Socket*)handle->node;
-
-    for (unsigned i = 0; i < msg->msg_iovlen; i++) {
-        if (!Memory::CheckUsermodePointer((uintptr_t)msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len,
-                                          proc->addressSpace)) {
-            Log::Warning("SysSendMsg: msg: Invalid iovec entry base");
-            return -EFAULT;
-        }
-        
-        long ret = sock->SendTo(msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len, flags, (sockaddr*)msg->msg_name,
-                                msg->msg_namelen, msg->msg_control, msg->msg_controllen);
-
-        if (ret < 0)
-            return ret;
-
-        sent += ret;
+    if (long e = CheckMessageHeader(proc, msg, "SysSendMsg")) {
+        return e;
     }
 
-    return sent;
+    return ((Socket*)handle->node)->SendMessage(msg, flags);
 }
 
 /*
@@ -1871,11 +1896,9 @@ long SysSendMsg(RegisterContext* r) {
 long SysRecvMsg(RegisterContext* r) {
     Process* proc = Scheduler::GetCurrentProcess();
 
-    FancyRefPtr<UNIXFileDescriptor> handle = proc->GetFileDescriptor(SC_ARG0(r));
-    if (!handle) {
-        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal,
-                 { Log::Warning("SysRecvMsg: Invalid File Descriptor: %d", SC_ARG0(r)); });
-        return -EBADF;
+    FancyRefPtr<UNIXFileDescriptor> handle;
+    if (long e = GetSocketHandle(proc, SC_ARG0(r), handle, "SysRecvMsg")) {
+        return e;
     }
 
     msghdr* msg = (msghdr*)SC_ARG1(r);
@@ -1885,53 +1908,16 @@ long SysRecvMsg(RegisterContext* r) {
         flags |= MSG_DONTWAIT; // Don't wait if socket marked as nonblock
     }
 
-    if ((handle->node->flags & FS_NODE_TYPE) != FS_NODE_SOCKET) {
-        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal,
-                 { Log::Warning("SysRecvMsg: File (Descriptor: %d) is not a socket", SC_ARG0(r)); });
-        return -ENOTSOCK;
-    }
-
     if (!Memory::CheckUsermodePointer(SC_ARG1(r), sizeof(msghdr), proc->addressSpace)) {
         IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal, { Log::Warning("SysRecvMsg: Invalid msg ptr"); });
         return -EFAULT;
     }
 
-    if (!Memory::CheckUsermodePointer((uintptr_t)msg->msg_iov, sizeof(iovec) * msg->msg_iovlen, proc->addressSpace)) {
-        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal, { Log::Warning("SysRecvMsg: msg: Invalid iovec ptr"); });
-        return -EFAULT;
-    }
-
-    if (msg->msg_control && msg->msg_controllen &&
-        !Memory::CheckUsermodePointer((uintptr_t)msg->msg_control, msg->msg_controllen, proc->addressSpace)) {
-        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal,
-                 { Log::Warning("SysRecvMsg: msg: Invalid control ptr and control null"); });
-        return -EFAULT;
-    }
-
-    long read = 0;
-    Socket* sock = (Socket*)handle->node;
-
-    for (unsigned i = 0; i < msg->msg_iovlen; i++) {
-        if (!Memory::CheckUsermodePointer((uintptr_t)msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len,
-                                          proc->addressSpace)) {
-            Log::Warning("SysRecvMsg: msg: Invalid iovec entry base");
-            return -EFAULT;
-        }
-
-        socklen_t len = msg->msg_namelen;
-        long ret =
-            sock->ReceiveFrom(msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len, flags,
-                              reinterpret_cast<sockaddr*>(msg->msg_name), &len, msg->msg_control, msg->msg_controllen);
-        msg->msg_namelen = len;
-
-        if (ret < 0) {
-            return ret;
-        }
-
-        read += ret;
+    if (long e = CheckMessageHeader(proc, msg, "SysRecvMsg")) {
+        return e;
     }
 
-    return read;
+    return ((Socket*)handle->node)->ReceiveMessage(msg, flags);
 }
 
 /////////////////////////////
@@ -2002,6 +1988,7 @@ long SysGetProcessInfo(RegisterContext* r) {
     pInfo->activeUs = reqProcess->activeTicks * 1000000 / Timer::GetFrequency();
 
     pInfo->usedMem = reqProcess->addressSpace->UsedPhysicalMemory();
+    pInfo->hugePageMem = reqProcess->addressSpace->UsedHugePageMemory() / 1024;
     pInfo->isCPUIdle = reqProcess->IsCPUIdleProcess();
 
     return 0;
@@ -2056,6 +2043,7 @@ long SysGetNextProcessInfo(RegisterContext* r) {
     pInfo->activeUs = reqProcess->activeTicks * 1000000 / Timer::GetFrequency();
 
     pInfo->usedMem = reqProcess->usedMemoryBlocks / 4;
+    pInfo->hugePageMem = reqProcess->addressSpace ? (reqProcess->addressSpace->UsedHugePageMemory() / 1024) : 0;
     pInfo->isCPUIdle = reqProcess->IsCPUIdleProcess();
 
     return 0;
@@ -2639,7 +2627,7 @@ long SysEndpointQueue(RegisterContext* r) {
     }
 
     size_t size = SC_ARG2(r);
-    if (size && !Memory::CheckUsermodePointer(SC_ARG3(r), size, currentProcess->addressSpace)) {
+    if (size && !IsUsermodeRange(reinterpret_cast<void*>(SC_ARG3(r)), size)) {
         IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal, {
             Log::Warning("(%s): SysEndpointQueue: Invalid data buffer %x", currentProcess->name, SC_ARG3(r));
             Log::Info("%x", r->rip);
@@ -3557,6 +3545,151 @@ long SysGetResourceLimit(RegisterContext* r){
     return -ENOSYS;
 }
 
+/////////////////////////////
+/// \brief SysSendMMsg (sockfd, msgvec, vlen, flags) - Send several messages through a socket
+///
+/// The amount of bytes sent for each message is written to its msg_len.
+///
+/// \param sockfd Socket file descriptor
+/// \param msgvec Array of mmsghdr
+/// \param vlen Amount of messages in msgvec, at most MMSG_VLEN_MAX
+/// \param flags Flags
+///
+/// \return Amount of messages sent, negative error code if the first message could not be sent
+/////////////////////////////
+long SysSendMMsg(RegisterContext* r) {
+    Process* proc = Scheduler::GetCurrentProcess();
+
+    FancyRefPtr<UNIXFileDescriptor> handle;
+    if (long e = GetSocketHandle(proc, SC_ARG0(r), handle, "SysSendMMsg")) {
+        return e;
+    }
+
+    mmsghdr* msgvec = (mmsghdr*)SC_ARG1(r);
+    unsigned vlen = SC_ARG2(r);
+    int flags = SC_ARG3(r);
+
+    if (vlen > MMSG_VLEN_MAX) {
+        vlen = MMSG_VLEN_MAX;
+    }
+
+    if (!Memory::CheckUsermodePointer(SC_ARG1(r), sizeof(mmsghdr) * vlen, proc->addressSpace)) {
+        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal, { Log::Warning("SysSendMMsg: Invalid msgvec ptr"); });
+        return -EFAULT;
+    }
+
+    Socket* sock = (Socket*)handle->node;
+
+    unsigned i = 0;
+    for (; i < vlen; i++) {
+        long ret = CheckMessageHeader(proc, &msgvec[i].msg_hdr, "SysSendMMsg");
+        if (!ret) {
+            ret = sock->SendMessage(&msgvec[i].msg_hdr, flags);
+        }
+
+        if (ret < 0) {
+            if (!i) {
+                return ret;
+            }
+
+            break; // The error is reported by the next call
+        }
+
+        unsigned length = ret;
+        if (CopyToUser(&msgvec[i].msg_len, &length, sizeof(unsigned))) {
+            return i ? i : -EFAULT;
+        }
+    }
+
+    return i;
+}
+
+/////////////////////////////
+/// \brief SysRecvMMsg (sockfd, msgvec, vlen, flags, timeout) - Receive several messages through a socket
+///
+/// Blocks until vlen messages have been received unless MSG_DONTWAIT or MSG_WAITFORONE are set.
+/// The timeout is only checked after each message is received.
+///
+/// \param sockfd Socket file descriptor
+/// \param msgvec Array of mmsghdr, msg_len is set to the amount of bytes received for each message
+/// \param vlen Amount of messages in msgvec, at most MMSG_VLEN_MAX
+/// \param flags Flags
+/// \param timeout (optional) timespec
+///
+/// \return Amount of messages received, negative error code if no messages were received
+/////////////////////////////
+long SysRecvMMsg(RegisterContext* r) {
+    Process* proc = Scheduler::GetCurrentProcess();
+
+    FancyRefPtr<UNIXFileDescriptor> handle;
+    if (long e = GetSocketHandle(proc, SC_ARG0(r), handle, "SysRecvMMsg")) {
+        return e;
+    }
+
+    mmsghdr* msgvec = (mmsghdr*)SC_ARG1(r);
+    unsigned vlen = SC_ARG2(r);
+    int flags = SC_ARG3(r);
+    const timespec* timeout = (const timespec*)SC_ARG4(r);
+
+    if (handle->mode & O_NONBLOCK) {
+        flags |= MSG_DONTWAIT; // Don't wait if socket marked as nonblock
+    }
+
+    if (vlen > MMSG_VLEN_MAX) {
+        vlen = MMSG_VLEN_MAX;
+    }
+
+    if (!Memory::CheckUsermodePointer(SC_ARG1(r), sizeof(mmsghdr) * vlen, proc->addressSpace)) {
+        IF_DEBUG(debugLevelSyscalls >= DebugLevelNormal, { Log::Warning("SysRecvMMsg: Invalid msgvec ptr"); });
+        return -EFAULT;
+    }
+
+    long timeoutUs = -1;
+    if (timeout) {
+        timespec t;
+        if (CopyFromUser(&t, timeout, sizeof(timespec))) {
+            return -EFAULT;
+        }
+
+        timeoutUs = t.tv_sec * 1000000 + t.tv_nsec / 1000;
+    }
+
+    Socket* sock = (Socket*)handle->node;
+    timeval start = Timer::GetSystemUptimeStruct();
+
+    unsigned i = 0;
+    for (; i < vlen; i++) {
+        long ret = CheckMessageHeader(proc, &msgvec[i].msg_hdr, "SysRecvMMsg");
+        if (!ret) {
+            ret = sock->ReceiveMessage(&msgvec[i].msg_hdr, flags & ~MSG_WAITFORONE);
+        }
+
+        if (ret < 0) {
+            if (!i) {
+                return ret;
+            }
+
+            break; // Return what we have, the error is reported by the next call
+        }
+
+        unsigned length = ret;
+        if (CopyToUser(&msgvec[i].msg_len, &length, sizeof(unsigned))) {
+            return i ? i : -EFAULT;
+        }
+
+        if (flags & MSG_WAITFORONE) {
+            flags |= MSG_DONTWAIT; // Only wait for the first message
+        }
+
+        if (timeoutUs >= 0 && Timer::GetSystemUptimeStruct() - start >= timeoutUs) {
+            i++;
+            break;
+        }
+    }
+
+    return i;
+}
+
 syscall_t syscalls[NUM_SYSCALLS]{
     SysDebug,
     SysExit, // 1
@@ -3666,6 +3799,8 @@ syscall_t syscalls[NUM_SYSCALLS]{
     SysSignalReturn, // 105
     SysAlarm,
     SysGetResourceLimit,
+    SysSendMMsg,
+    SysRecvMMsg,
 };
 
 void DumpLastSyscall(Thread* t) {
@@ -5,7 +5,9 @@
 #include <HAL.h>
 #include <Lemon.h>
 #include <Logging.h>
+#include <MM/HugePages.h>
 #include <MM/KMalloc.h>
+#include <MM/Reclaim.h>
 #include <Math.h>
 #include <Modules.h>
 #include <Net/Net.h>
@@ -95,6 +97,9 @@ void KernelProcess() {
 
     PTMultiplexor::Initialize();
 
+    Process::CreateKernelProcess((void*)Memory::HugePageCollapseThread, "HugePageDaemon", nullptr)->Start();
+    Process::CreateKernelProcess((void*)Memory::ReclaimThread, "ReclaimDaemon", nullptr)->Start();
+
     Log::Info("Loading Initialize Process...");
     FsNode* initFsNode = nullptr;
 
@@ -7,77 +7,66 @@ AddressSpace::AddressSpace(PageMap* pm) : m_pageMap(pm) {}
 
 AddressSpace::~AddressSpace() {
     IF_DEBUG((debugLevelUsermodeMM >= DebugLevelNormal),
-             { Log::Info("Destroying address space %x with %u regions.", this, m_regions.get_length()); });
+             { Log::Info("Destroying address space %x with %u regions.", this, m_regions.Count()); });
 
     for (auto& region : m_regions) {
         if (region.vmObject) {
             region.vmObject->refCount--;
         }
     }
-    m_regions.clear(); // Let FancyRefPtr handle cleanup for us
+    m_regions.Clear(); // Let FancyRefPtr handle cleanup for us
 
     Memory::DestroyPageMap(m_pageMap);
 }
 
 MappedRegion* AddressSpace::AddressToRegionReadLock(uintptr_t address) {
-    ScopedSpinLock acquired(m_lock);
+    RegionTree::ReadGuard guard(m_regions);
 
-    for (MappedRegion& region : m_regions) {
-        if (!region.vmObject.get()) {
-            continue;
+    for (;;) {
+        MappedRegion* region = m_regions.FindLockless(address);
+        if (!region || !region->vmObject.get()) {
+            return nullptr;
         }
 
-        if (address >= region.Base() && address < region.End()) {
-            region.lock.AcquireRead();
-            return &region;
+        region->lock.AcquireRead();
+        if (!region->IsRemoved()) {
+            return region;
         }
-    }
 
-    return nullptr;
+        region->lock.ReleaseRead(); // Region was unmapped whilst we were waiting for it
+    }
 }
 
 MappedRegion* AddressSpace::AddressToRegionWriteLock(uintptr_t address) {
     ScopedSpinLock acquired(m_lock);
 
-    for (MappedRegion& region : m_regions) {
-        if (!region.vmObject.get()) {
-            continue;
-        }
-
-        if (address >= region.Base() && address < region.End()) {
-            region.lock.AcquireWrite();
-            return &region;
-        }
+    MappedRegion* region = m_regions.Find(address);
+    if (!region || !region->vmObject.get()) {
+        return nullptr;
     }
 
-    return nullptr;
+    region->lock.AcquireWrite();
+    return region;
 }
 
 bool AddressSpace::RangeInRegion(uintptr_t base, size_t size) {
     uintptr_t end = base + size;
 
-    auto it = m_regions.begin();
-    for (; it != m_regions.end(); it++) {
-        if (base < it->Base()) {
+    RegionTree::ReadGuard guard(m_regions);
+    while (base < end) {
+        MappedRegion* region = m_regions.FindLockless(base);
+        if (!region) {
             IF_DEBUG((debugLevelUsermodeMM >= DebugLevelNormal), {
-                Log::Warning("range (%x-%x) not in region (%x-%x)!", base, base + size, it->Base(), it->End());
+                Log::Warning("range (%x-%x) not in region!", base, end);
                 PrintStackTrace(GetRBP());
             });
-            return false;                                    // Outside of the region, regions are ordered
-        } else if (base >= it->Base() && base < it->End()) { // We intersect with this region
-            base = it->End();
-        }
-
-        if (base >= end) {
-            return true; // Range lies completely within the region
+            return false;
         }
-    }
 
-    if (base >= end) {
-        return true; // Range lies completely within the region
+        base = region->End(); // Check that the rest of the range lies in the following regions
     }
 
-    return false;
+    return true; // Range lies completely within regions
 }
 
 long AddressSpace::UnmapRegion(MappedRegion* region) {
@@ -86,26 +75,25 @@ long AddressSpace::UnmapRegion(MappedRegion* region) {
 
     assert(region->lock.IsWriteLocked());
 
-    for (auto it = m_regions.begin(); it != m_regions.end(); it++) {
-        if (it->Base() == region->Base()) {
-            if(IsKernel()){
-                assert(it->Base() >= KERNEL_VIRTUAL_BASE);
-                Memory::KernelMapVirtualMemory4K(0, region->Base(), PAGE_COUNT_4K(region->Size()), 0);
-            } else {
-                Memory::MapVirtualMemory4K(0, region->Base(), PAGE_COUNT_4K(region->Size()), 0, m_pageMap);
-            }
+    if (m_regions.Find(region->Base()) != region) {
+        Log::Warning("Failed to unmap region object!");
+        return 1;
+    }
 
-            if (it->vmObject) {
-                it->vmObject->refCount--;
-            }
+    if(IsKernel()){
+        assert(region->Base() >= KERNEL_VIRTUAL_BASE);
+        Memory::KernelMapVirtualMemory4K(0, region->Base(), PAGE_COUNT_4K(region->Size()), 0);
+    } else {
+        Memory::MapVirtualMemory4K(0, region->Base(), PAGE_COUNT_4K(region->Size()), 0, m_pageMap);
+    }
 
-            m_regions.remove(it);
-            return 0;
-        }
+    if (region->vmObject) {
+        region->vmObject->refCount--;
     }
 
-    Log::Warning("Failed to unmap region object!");
-    return 1;
+    m_regions.Remove(region);
+    region->lock.ReleaseWrite(); // Let any waiting readers see that the region has been removed
+    return 0;
 }
 
 MappedRegion* AddressSpace::MapVMO(FancyRefPtr<VMObject> obj, uintptr_t base, bool fixed) {
@@ -129,7 +117,7 @@ MappedRegion* AddressSpace::MapVMO(FancyRefPtr<VMObject> obj, uintptr_t base, bo
             });
             return nullptr;
         } else {
-            region = FindAvailableRegion(obj->Size());
+            region = FindAvailableRegion(obj->Size(), (obj->Size() >= PAGE_SIZE_2M) ? PAGE_SIZE_2M : PAGE_SIZE_4K);
             assert(region);
         }
     }
@@ -159,7 +147,7 @@ MappedRegion* AddressSpace::AllocateAnonymousVMObject(size_t size, uintptr_t bas
                         base, size);
             return nullptr;
         } else {
-            region = FindAvailableRegion(size);
+            region = FindAvailableRegion(size, (size >= PAGE_SIZE_2M) ? PAGE_SIZE_2M : PAGE_SIZE_4K);
         }
 
         assert(region && region->Base());
@@ -192,7 +180,7 @@ AddressSpace* AddressSpace::Fork() {
             r.vmObject->MapAllocatedBlocks(r.Base(), m_pageMap);
         }
 
-        fork->m_regions.add_back(const_cast<const MappedRegion&>(r));
+        fork->m_regions.Insert(new MappedRegion(const_cast<const MappedRegion&>(r)));
 
         r.vmObject->MapAllocatedBlocks(r.Base(), fork->m_pageMap);
     }
@@ -206,33 +194,24 @@ long AddressSpace::UnmapMemory(uintptr_t base, size_t size) {
     uintptr_t end = base + size;
     ScopedSpinLock acquired(m_lock);
 
-retry:
-    for (auto it = m_regions.begin(); it != m_regions.end(); it++) {
-        MappedRegion& region = *it;
-        region.lock.AcquireWrite();
+    // Start from the first region that could lie within the range
+    MappedRegion* region = m_regions.FindLastBefore(base);
+    region = region ? RegionTree::Next(region) : m_regions.First();
 
-        if (!region.vmObject) {
-            Memory::MapVirtualMemory4K(0, base, PAGE_COUNT_4K(size), 0, m_pageMap);
+    while (region && region->Base() < end) {
+        MappedRegion* next = RegionTree::Next(region);
 
-            // Assume vmobject has been removed
-            m_regions.remove(it);
-            goto retry;
-        }
+        if (region->vmObject && region->End() <= end) { // Whole region within our range
+            region->lock.AcquireWrite();
 
-        if (region.Base() >= base && region.Base() <= end) {
-            if (region.End() <= end) { // Whole region within our range
-                if (region.vmObject) {
-                    it->vmObject->refCount--;
-                }
-
-                Memory::MapVirtualMemory4K(0, base, PAGE_COUNT_4K(size), 0, m_pageMap);
+            region->vmObject->refCount--;
+            Memory::MapVirtualMemory4K(0, region->Base(), PAGE_COUNT_4K(region->Size()), 0, m_pageMap);
 
-                m_regions.remove(it);
-                goto retry;
-            }
+            m_regions.Remove(region);
+            region->lock.ReleaseWrite();
         }
 
-        region.lock.ReleaseWrite();
+        region = next;
     }
 
     return 0;
@@ -249,7 +228,7 @@ void AddressSpace::UnmapAll() {
         }
     }
 
-    m_regions.clear();
+    m_regions.Clear();
 }
 
 size_t AddressSpace::UsedPhysicalMemory() const {
@@ -264,71 +243,89 @@ size_t AddressSpace::UsedPhysicalMemory() const {
     return mem;
 }
 
-void AddressSpace::DumpRegions() {
+size_t AddressSpace::UsedHugePageMemory() {
+    ScopedSpinLock acquired(m_lock);
+    size_t mem = 0;
+
     for (MappedRegion& region : m_regions) {
-        if (!region.vmObject.get())
+        if (!region.vmObject.get()) {
             continue;
-        Log::Info("region (%x - %x) anon? %Y, shared? %Y, COW? %Y", region.Base(), region.End(),
-                  region.vmObject->IsAnonymous(), region.vmObject->IsShared(), region.vmObject->IsCopyOnWrite());
+        }
+
+        uintptr_t virt = (region.Base() + PAGE_SIZE_2M - 1) & ~static_cast<uintptr_t>(PAGE_SIZE_2M - 1);
+        for (; virt + PAGE_SIZE_2M <= region.End(); virt += PAGE_SIZE_2M) {
+            if (Memory::IsHugePageMapped(virt, m_pageMap)) {
+                mem += PAGE_SIZE_2M;
+            }
+        }
     }
+
+    return mem;
 }
 
-MappedRegion* AddressSpace::FindAvailableRegion(size_t size) {
-    uintptr_t base = PAGE_SIZE_4K; // We do not want zero addresses
-    uintptr_t end = base + size;
+unsigned AddressSpace::CollapseHugePages(unsigned maxPages) {
+    unsigned collapsed = 0;
+    uintptr_t next = 0;
+    while (collapsed < maxPages) {
+        MappedRegion* region;
+        {
+            ScopedSpinLock acquired(m_lock);
+
+            // Regions may have changed whilst the last one was collapsed, so find the next one by address
+            MappedRegion* last = m_regions.FindLastBefore(next);
+            region = last ? RegionTree::Next(last) : m_regions.First();
+            while (region && (!region->vmObject.get() || region->Size() < PAGE_SIZE_2M)) {
+                region = RegionTree::Next(region);
+            }
 
-    auto it = m_regions.begin();
-    for (; it != m_regions.end(); it++) {
-        if (it->Base() >= end) {
-            return &m_regions.insert(MappedRegion(base, size), it);
-        }
+            if (!region) {
+                break;
+            }
 
-        if (base >= it->Base() && base < it->End()) { // We intersect with this region
-            base = it->End();
-            end = base + size;
+            region->lock.AcquireWrite(); // Stops the region being unmapped once m_lock is released
         }
 
-        if (end > it->Base() && end <= it->End()) { // We intersect with this region
-            base = it->End();
-            end = base + size;
-        }
+        // Copying can take a while, so only the region is kept locked
+        next = region->End();
+        collapsed += region->vmObject->CollapseHugePages(region->Base(), m_pageMap, maxPages - collapsed);
+        region->lock.ReleaseWrite();
+    }
 
-        if (base < it->Base() && end > it->End()) { // We encapsulate this region
-            base = it->End();
-            end = base + size;
-        }
+    return collapsed;
+}
+
+void AddressSpace::DumpRegions() {
+    for (MappedRegion& region : m_regions) {
+        if (!region.vmObject.get())
+            continue;
+        Log::Info("region (%x - %x) anon? %Y, shared? %Y, COW? %Y", region.Base(), region.End(),
+                  region.vmObject->IsAnonymous(), region.vmObject->IsShared(), region.vmObject->IsCopyOnWrite());
     }
+}
 
-    if (end < m_endRegion) {
-        return &m_regions.add_back(MappedRegion(base, size));
+MappedRegion* AddressSpace::FindAvailableRegion(size_t size, size_t alignment) {
+    // We do not want zero addresses
+    uintptr_t base = m_regions.FindGap(size, alignment, PAGE_SIZE_4K, m_endRegion);
+    if (!base) {
+        return nullptr; // Failed to allocate
     }
 
-    return nullptr; // Failed to allocate
+    MappedRegion* region = new MappedRegion(base, size);
+    m_regions.Insert(region);
+    return region;
 }
 
 MappedRegion* AddressSpace::AllocateRegionAt(uintptr_t base, size_t size) {
     uintptr_t end = base + size;
 
-    auto it = m_regions.begin();
-    auto lastIt = m_regions.end();
-    for (; it != m_regions.end(); it++) {
-        if (it->End() <= base) {
-            lastIt = it;
-            continue;
-        }
-
-        if (it->Base() >= end) {
-            return &m_regions.insert(MappedRegion(base, size), it);
-        }
-
+    MappedRegion* prev = m_regions.FindLastBefore(end);
+    if (prev && prev->End() > base) { // Overlaps with an existing region
         IF_DEBUG((debugLevelUsermodeMM >= DebugLevelNormal),
-                 { Log::Error("AllocateRegionAt: Failed at %x - %x", it->Base(), it->End()); });
+                 { Log::Error("AllocateRegionAt: Failed at %x - %x", prev->Base(), prev->End()); });
         return nullptr;
     }
 
-    if (!m_regions.get_length() || m_regions.get_back().End() <= base) {
-        return &m_regions.add_back(MappedRegion(base, size)); // Region is at end
-    }
-
-    return nullptr;
-}
\ No newline at end of file
+    MappedRegion* region = new MappedRegion(base, size);
+    m_regions.Insert(region);
+    return region;
+}
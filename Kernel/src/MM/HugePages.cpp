@@ -0,0 +1,45 @@
+#include <MM/HugePages.h>
+
+#include <Logging.h>
+#include <Objects/Process.h>
+#include <Scheduler.h>
+
+namespace Memory {
+bool transparentHugePages = true;
+
+void HugePageCollapseThread() {
+    for (;;) {
+        Scheduler::GetCurrentThread()->Sleep(HUGE_PAGE_COLLAPSE_INTERVAL);
+
+        if (!transparentHugePages) {
+            continue;
+        }
+
+        unsigned budget = HUGE_PAGE_COLLAPSE_BUDGET;
+        pid_t pid = 0;
+        while (budget && (pid = Scheduler::GetNextProcessPID(pid))) {
+            FancyRefPtr<Process> proc = Scheduler::FindProcessByPID(pid);
+            if (!proc.get() || proc->State() != Process::Process_Running) {
+                continue;
+            }
+
+            // Stop the address space from being destroyed whilst we use it
+            if (acquireTestLock(&proc->m_processLock)) {
+                continue;
+            }
+
+            if (proc->addressSpace) {
+                budget -= proc->addressSpace->CollapseHugePages(budget);
+            }
+
+            releaseLock(&proc->m_processLock);
+        }
+
+        IF_DEBUG((debugLevelUsermodeMM >= DebugLevelVerbose), {
+            if (budget < HUGE_PAGE_COLLAPSE_BUDGET) {
+                Log::Info("[HugePages] Collapsed %u pages", HUGE_PAGE_COLLAPSE_BUDGET - budget);
+            }
+        });
+    }
+}
+} // namespace Memory
@@ -23,6 +23,7 @@ struct KernelAllocator {
         void* ptr = Memory::KernelAllocate4KPages(pageCount);
         uintptr_t base = reinterpret_cast<uintptr_t>(ptr);
 
+        // Called with the slab lock held, AllocatePhysicalMemoryBlock never waits for reclaim
         while (pageCount--) {
             Memory::KernelMapVirtualMemory4K(Memory::AllocatePhysicalMemoryBlock(), base, 1);
             base += PAGE_SIZE_4K;
@@ -0,0 +1,240 @@
+#include <MM/Reclaim.h>
+
+#include <CPU.h>
+#include <HAL.h>
+#include <List.h>
+#include <Lock.h>
+#include <Logging.h>
+#include <Math.h>
+#include <Objects/Process.h>
+#include <PhysicalAllocator.h>
+#include <Scheduler.h>
+#include <Signal.h>
+#include <Timer.h>
+
+namespace Memory {
+size_t watermarkMin = RECLAIM_WATERMARK_MIN;
+size_t watermarkLow = RECLAIM_WATERMARK_MIN * 2;
+size_t watermarkHigh = RECLAIM_WATERMARK_MIN * 4;
+
+static List<Shrinker*> shrinkers;
+static lock_t shrinkersLock = 0;
+static Shrinker* activeShrinker = nullptr; // Being shrunk by the reclaim thread without shrinkersLock held
+
+static Semaphore reclaimSemaphore = Semaphore(0);
+static bool reclaimPending = false;
+static bool reclaimThreadRunning = false;
+
+static pid_t oomVictim = 0;
+
+void InitializeReclaim() {
+    size_t totalPages = HAL::mem_info.totalMemory >> PHYSALLOC_BLOCK_SHIFT;
+
+    watermarkLow = totalPages >> RECLAIM_WATERMARK_SHIFT;
+    if (watermarkLow < RECLAIM_WATERMARK_MIN * 2) {
+        watermarkLow = RECLAIM_WATERMARK_MIN * 2;
+    }
+
+    watermarkMin = RECLAIM_WATERMARK_MIN;
+    watermarkHigh = watermarkLow * 2;
+
+    Log::Info("[Reclaim] Watermarks (pages): min %u, low %u, high %u", watermarkMin, watermarkLow, watermarkHigh);
+}
+
+void RegisterShrinker(Shrinker* shrinker) {
+    ScopedSpinLock lockShrinkers(shrinkersLock);
+
+    shrinkers.add_back(shrinker);
+}
+
+void UnregisterShrinker(Shrinker* shrinker) {
+    for (;;) {
+        {
+            ScopedSpinLock lockShrinkers(shrinkersLock);
+
+            if (activeShrinker != shrinker) {
+                shrinkers.remove(shrinker);
+                return;
+            }
+        }
+
+        Scheduler::Yield(); // Wait for the reclaim thread to finish with it
+    }
+}
+
+size_t FreePhysicalPages() {
+    // Memory past the end of the allocator bitmap is never handed out
+    size_t totalPages = MIN(HAL::mem_info.totalMemory >> PHYSALLOC_BLOCK_SHIFT, maxPhysicalBlocks);
+    if (usedPhysicalBlocks >= totalPages) {
+        return 0;
+    }
+
+    return totalPages - usedPhysicalBlocks;
+}
+
+void WakeReclaim() {
+    if (!reclaimThreadRunning || __atomic_exchange_n(&reclaimPending, true, __ATOMIC_ACQ_REL)) {
+        return; // Reclaim thread is not up yet or has already been woken
+    }
+
+    reclaimSemaphore.Signal();
+}
+
+// The OOM killer signals the main thread of its victim, other threads of the victim notice the process dying
+static bool IsBeingKilled(Thread* thread) {
+    return (thread->pendingSignals & (1 << (SIGKILL - 1))) ||
+           (thread->parent && thread->parent->State() != Process::Process_Running);
+}
+
+uint64_t WaitForFreeMemory(uint64_t (*tryAllocate)()) {
+    Thread* thread = Scheduler::GetCurrentThread();
+    if (!reclaimThreadRunning || !thread || !CheckInterrupts()) {
+        return 0; // We cannot sleep, nothing can be done
+    }
+
+    timeval start = Timer::GetSystemUptimeStruct();
+    do {
+        // We may be the OOM victim, stop waiting so we can die and release our memory
+        if (IsBeingKilled(thread)) {
+            return 0;
+        }
+
+        WakeReclaim();
+        Scheduler::Yield();
+
+        // Other threads may take memory as soon as it is freed, so retry rather than check the free count
+        if (uint64_t block = tryAllocate()) {
+            return block;
+        }
+    } while (Timer::GetSystemUptimeStruct() - start <= RECLAIM_OOM_WAIT);
+
+    return 0;
+}
+
+bool OOMKill() {
+    if (oomVictim) {
+        FancyRefPtr<Process> last = Scheduler::FindProcessByPID(oomVictim);
+        if (last.get() && !last->IsDead()) {
+            return true; // Wait for the last victim to release its memory
+        }
+
+        oomVictim = 0;
+    }
+
+    FancyRefPtr<Process> victim = nullptr;
+    size_t victimMemory = 0;
+
+    pid_t pid = 0;
+    while ((pid = Scheduler::GetNextProcessPID(pid))) {
+        FancyRefPtr<Process> proc = Scheduler::FindProcessByPID(pid);
+
+        // Never kill init or kernel processes, they have no parent
+        if (!proc.get() || proc->State() != Process::Process_Running || proc->IsCPUIdleProcess() ||
+            !proc->Parent()) {
+            continue;
+        }
+
+        // Stop the address space from being destroyed whilst we use it
+        if (acquireTestLock(&proc->m_processLock)) {
+            continue;
+        }
+
+        size_t used = proc->addressSpace ? proc->addressSpace->UsedPhysicalMemory() : 0;
+        releaseLock(&proc->m_processLock);
+
+        if (used > victimMemory) {
+            victim = proc;
+            victimMemory = used;
+        }
+    }
+
+    if (!victim.get()) {
+        return false;
+    }
+
+    Log::Warning("[Reclaim] Out of memory, killing process %s (PID %d, %u KB)", victim->name, victim->PID(),
+                 victimMemory / 1024);
+
+    oomVictim = victim->PID();
+    victim->GetMainThread()->Signal(SIGKILL);
+    return true;
+}
+
+// Ask the shrinkers to free (at least) pages, returns the amount of pages freed
+// shrinkersLock is dropped whilst each shrinker runs as shrinking may take locks of its own or free to the allocator
+static size_t Reclaim(size_t pages) {
+    size_t reclaimable = 0;
+    {
+        ScopedSpinLock lockShrinkers(shrinkersLock);
+        for (Shrinker* shrinker : shrinkers) {
+            reclaimable += shrinker->CountReclaimable();
+        }
+    }
+
+    if (!reclaimable) {
+        return 0;
+    }
+
+    size_t freed = 0;
+    for (unsigned i = 0;; i++) {
+        Shrinker* shrinker;
+        size_t target;
+        {
+            ScopedSpinLock lockShrinkers(shrinkersLock);
+            if (i >= shrinkers.get_length()) {
+                break;
+            }
+
+            // Take from each cache in proportion to its size
+            shrinker = shrinkers.get_at(i);
+            target = (shrinker->CountReclaimable() * pages + reclaimable - 1) / reclaimable;
+            if (!target) {
+                continue;
+            }
+
+            activeShrinker = shrinker; // Stops it being unregistered until we are done
+        }
+
+        freed += shrinker->Shrink(target);
+
+        ScopedSpinLock lockShrinkers(shrinkersLock);
+        activeShrinker = nullptr;
+    }
+
+    return freed;
+}
+
+void ReclaimThread() {
+    reclaimThreadRunning = true;
+
+    for (;;) {
+        long timeout = RECLAIM_INTERVAL;
+        (void)reclaimSemaphore.WaitTimeout(timeout);
+
+        __atomic_store_n(&reclaimPending, false, __ATOMIC_RELEASE);
+
+        size_t free = FreePhysicalPages();
+        if (free >= watermarkLow) {
+            continue;
+        }
+
+        size_t freed = 0;
+        while (free < watermarkHigh) {
+            size_t pass = Reclaim(watermarkHigh - free);
+            if (!pass) {
+                break; // Nothing left to reclaim
+            }
+
+            freed += pass;
+            free = FreePhysicalPages();
+        }
+
+        IF_DEBUG((debugLevelUsermodeMM >= DebugLevelVerbose),
+                 { Log::Info("[Reclaim] Freed %u pages (%u free)", freed, free); });
+
+        if (FreePhysicalPages() < watermarkMin) {
+            OOMKill();
+        }
+    }
+}
+} // namespace Memory
@@ -0,0 +1,377 @@
+#include <MM/RegionTree.h>
+
+#include <Assert.h>
+
+// Lockless lookups give up and retry past this depth, a valid AVL tree cannot get anywhere near it
+#define REGION_TREE_MAX_DEPTH 128
+
+static ALWAYS_INLINE uintptr_t AlignUp(uintptr_t address, size_t alignment) {
+    return (address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+}
+
+RegionTree::~RegionTree() {
+    Clear();
+
+    while (m_retired) {
+        MappedRegion* region = m_retired;
+        m_retired = region->nextRetired;
+
+        delete region;
+    }
+}
+
+void RegionTree::Insert(MappedRegion* region) {
+    WriteBegin();
+
+    region->left = region->right = region->parent = nullptr;
+    region->height = 1;
+    region->removed = false;
+
+    MappedRegion* parent = nullptr;
+    MappedRegion** link = &m_root;
+    while (*link) {
+        parent = *link;
+
+        assert(region->End() <= parent->Base() || region->Base() >= parent->End());
+        if (region->Base() < parent->Base()) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+        }
+    }
+
+    region->parent = parent;
+    __atomic_store_n(link, region, __ATOMIC_RELEASE);
+    m_count++;
+
+    MappedRegion* prev = Prev(region);
+    MappedRegion* next = Next(region);
+
+    region->gapStart = prev ? prev->End() : 0;
+    Rebalance(region);
+
+    if (next) {
+        next->gapStart = region->End();
+        Rebalance(next);
+    }
+
+    WriteEnd();
+
+    FreeRetired();
+}
+
+void RegionTree::Remove(MappedRegion* region) {
+    assert(!region->removed);
+
+    WriteBegin();
+
+    MappedRegion* prev = Prev(region);
+    MappedRegion* next = Next(region);
+
+    MappedRegion* rebalanceFrom;
+    if (!region->left || !region->right) {
+        rebalanceFrom = region->parent;
+        Replace(region, region->left ? region->left : region->right);
+    } else {
+        MappedRegion* successor = next; // Leftmost node of the right subtree
+        if (successor->parent != region) {
+            rebalanceFrom = successor->parent;
+
+            Replace(successor, successor->right);
+            successor->right = region->right;
+            successor->right->parent = successor;
+        } else {
+            rebalanceFrom = successor;
+        }
+
+        Replace(region, successor);
+        successor->left = region->left;
+        successor->left->parent = successor;
+    }
+
+    if (next) {
+        next->gapStart = prev ? prev->End() : 0;
+    }
+
+    Rebalance(rebalanceFrom);
+    if (next) {
+        Rebalance(next);
+    }
+
+    m_count--;
+
+    WriteEnd();
+
+    // Lockless readers may still have a reference to the region,
+    // leave the tree pointers as they are so they can find their way out
+    __atomic_store_n(&region->removed, true, __ATOMIC_RELEASE);
+    region->nextRetired = m_retired;
+    m_retired = region;
+
+    FreeRetired();
+}
+
+void RegionTree::Clear() {
+    while (m_root) {
+        Remove(m_root);
+    }
+}
+
+MappedRegion* RegionTree::Find(uintptr_t address) const {
+    MappedRegion* node = m_root;
+    while (node) {
+        if (address < node->Base()) {
+            node = node->left;
+        } else if (address >= node->End()) {
+            node = node->right;
+        } else {
+            return node;
+        }
+    }
+
+    return nullptr;
+}
+
+MappedRegion* RegionTree::FindLockless(uintptr_t address) const {
+    for (;;) {
+        unsigned sequence;
+        while ((sequence = __atomic_load_n(&m_sequence, __ATOMIC_ACQUIRE)) & 1) {
+            asm volatile("pause"); // Tree is being modified
+        }
+
+        MappedRegion* node = __atomic_load_n(&m_root, __ATOMIC_ACQUIRE);
+        MappedRegion* found = nullptr;
+        for (unsigned depth = 0; node && depth < REGION_TREE_MAX_DEPTH; depth++) {
+            if (address < node->Base()) {
+                node = __atomic_load_n(&node->left, __ATOMIC_ACQUIRE);
+            } else if (address >= node->End()) {
+                node = __atomic_load_n(&node->right, __ATOMIC_ACQUIRE);
+            } else {
+                found = node;
+                break;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&m_sequence, __ATOMIC_RELAXED) == sequence) {
+            return found; // Tree was not modified whilst we were walking it
+        }
+    }
+}
+
+MappedRegion* RegionTree::FindLastBefore(uintptr_t address) const {
+    MappedRegion* node = m_root;
+    MappedRegion* last = nullptr;
+    while (node) {
+        if (node->Base() < address) {
+            last = node;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+
+    return last;
+}
+
+uintptr_t RegionTree::FindGap(size_t size, size_t alignment, uintptr_t lower, uintptr_t upper) const {
+    assert(!(alignment & (alignment - 1)));
+
+    if (uintptr_t base = FindGap(m_root, size, alignment, lower, upper)) {
+        return base;
+    }
+
+    // Try after the last region
+    MappedRegion* last = Last();
+    uintptr_t base = AlignUp((last && last->End() > lower) ? last->End() : lower, alignment);
+    if (base + size < upper) {
+        return base;
+    }
+
+    return 0;
+}
+
+MappedRegion* RegionTree::Next(MappedRegion* node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+
+        return node;
+    }
+
+    while (node->parent && node->parent->right == node) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
+
+MappedRegion* RegionTree::Prev(MappedRegion* node) {
+    if (node->left) {
+        node = node->left;
+        while (node->right) {
+            node = node->right;
+        }
+
+        return node;
+    }
+
+    while (node->parent && node->parent->left == node) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
+
+MappedRegion* RegionTree::First() const {
+    MappedRegion* node = m_root;
+    while (node && node->left) {
+        node = node->left;
+    }
+
+    return node;
+}
+
+MappedRegion* RegionTree::Last() const {
+    MappedRegion* node = m_root;
+    while (node && node->right) {
+        node = node->right;
+    }
+
+    return node;
+}
+
+uintptr_t RegionTree::FindGap(MappedRegion* node, size_t size, size_t alignment, uintptr_t lower,
+                              uintptr_t upper) const {
+    if (!node || node->maxGap < size) {
+        return 0; // No gap in this subtree is large enough
+    }
+
+    if (uintptr_t base = FindGap(node->left, size, alignment, lower, upper)) {
+        return base;
+    }
+
+    uintptr_t base = AlignUp((node->gapStart > lower) ? node->gapStart : lower, alignment);
+    if (base < node->Base() && node->Base() - base >= size) {
+        return (base + size < upper) ? base : 0;
+    }
+
+    if (node->Base() >= upper) {
+        return 0; // Everything to the right is out of range
+    }
+
+    return FindGap(node->right, size, alignment, lower, upper);
+}
+
+void RegionTree::Update(MappedRegion* node) {
+    int leftHeight = Height(node->left);
+    int rightHeight = Height(node->right);
+    node->height = 1 + ((leftHeight > rightHeight) ? leftHeight : rightHeight);
+
+    size_t maxGap = node->Base() - node->gapStart;
+    if (node->left && node->left->maxGap > maxGap) {
+        maxGap = node->left->maxGap;
+    }
+
+    if (node->right && node->right->maxGap > maxGap) {
+        maxGap = node->right->maxGap;
+    }
+
+    node->maxGap = maxGap;
+}
+
+void RegionTree::Replace(MappedRegion* node, MappedRegion* replacement) {
+    MappedRegion* parent = node->parent;
+    if (!parent) {
+        __atomic_store_n(&m_root, replacement, __ATOMIC_RELEASE);
+    } else if (parent->left == node) {
+        __atomic_store_n(&parent->left, replacement, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&parent->right, replacement, __ATOMIC_RELEASE);
+    }
+
+    if (replacement) {
+        replacement->parent = parent;
+    }
+}
+
+MappedRegion* RegionTree::RotateLeft(MappedRegion* node) {
+    MappedRegion* pivot = node->right;
+
+    __atomic_store_n(&node->right, pivot->left, __ATOMIC_RELEASE);
+    if (pivot->left) {
+        pivot->left->parent = node;
+    }
+
+    Replace(node, pivot);
+    __atomic_store_n(&pivot->left, node, __ATOMIC_RELEASE);
+    node->parent = pivot;
+
+    Update(node);
+    Update(pivot);
+    return pivot;
+}
+
+MappedRegion* RegionTree::RotateRight(MappedRegion* node) {
+    MappedRegion* pivot = node->left;
+
+    __atomic_store_n(&node->left, pivot->right, __ATOMIC_RELEASE);
+    if (pivot->right) {
+        pivot->right->parent = node;
+    }
+
+    Replace(node, pivot);
+    __atomic_store_n(&pivot->right, node, __ATOMIC_RELEASE);
+    node->parent = pivot;
+
+    Update(node);
+    Update(pivot);
+    return pivot;
+}
+
+void RegionTree::Rebalance(MappedRegion* node) {
+    while (node) {
+        Update(node);
+
+        int balance = Height(node->left) - Height(node->right);
+        if (balance > 1) {
+            if (Height(node->left->left) < Height(node->left->right)) {
+                RotateLeft(node->left);
+            }
+            node = RotateRight(node);
+        } else if (balance < -1) {
+            if (Height(node->right->right) < Height(node->right->left)) {
+                RotateRight(node->right);
+            }
+            node = RotateLeft(node);
+        }
+
+        node = node->parent;
+    }
+}
+
+void RegionTree::FreeRetired() {
+    if (!m_retired) {
+        return;
+    }
+
+    // Make sure our unlinking of the regions is visible before checking for readers
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&m_readers, __ATOMIC_SEQ_CST)) {
+        return; // Lockless readers may still be using them
+    }
+
+    MappedRegion** link = &m_retired;
+    while (*link) {
+        MappedRegion* region = *link;
+        if (region->lock.IsLocked()) {
+            link = &region->nextRetired; // Still in use
+            continue;
+        }
+
+        *link = region->nextRetired;
+        delete region;
+    }
+}
@@ -1,11 +1,13 @@
 #include <MM/VMObject.h>
 
+#include <MM/HugePages.h>
 #include <Paging.h>
 #include <PhysicalAllocator.h>
 #include <Scheduler.h>
 #include <CPU.h>
 
 #include <Assert.h>
+#include <Errno.h>
 
 VMObject::VMObject(size_t size, bool anonymous, bool shared) : size(size), anonymous(anonymous), shared(shared) {
     assert(!(size & (PAGE_SIZE_4K - 1)));
@@ -15,6 +17,20 @@ int VMObject::Hit(uintptr_t, uintptr_t, PageMap*){
     return 1; // Fatal page fault, kill process
 }
 
+int VMObject::Populate(uintptr_t base, uintptr_t offset, size_t length, PageMap* pMap){
+    for(uintptr_t off = offset & ~static_cast<uintptr_t>(PAGE_SIZE_4K - 1); off < offset + length; off += PAGE_SIZE_4K){
+        if(int status = Hit(base, off, pMap); status){
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+unsigned VMObject::CollapseHugePages(uintptr_t, PageMap*, unsigned){
+    return 0; // Cannot collapse
+}
+
 VMObject* VMObject::Split(uintptr_t offset){
     assert(!"Cannot split VMObject!");
 
@@ -33,6 +49,21 @@ PhysicalVMObject::PhysicalVMObject(uintptr_t size, bool anonymous, bool shared)
     } else {
         void* mapping = Memory::KernelAllocate4KPages(1);
         for(unsigned i = 0; i < blockCount; i++){
+            if(Memory::transparentHugePages && !(i % PAGES_PER_2M) && blockCount - i >= PAGES_PER_2M){
+                // Back each whole 2MB of the object with a 2MB block where possible
+                if(uintptr_t phys = Memory::AllocateLargePhysicalMemoryBlock(); phys){
+                    for(unsigned j = 0; j < PAGES_PER_2M; j++, phys += PAGE_SIZE_4K){
+                        physicalBlocks[i + j] = phys >> PAGE_SHIFT_4K;
+
+                        Memory::KernelMapVirtualMemory4K(phys, (uintptr_t)mapping, 1);
+                        memset(mapping, 0, PAGE_SIZE_4K);
+                    }
+
+                    i += PAGES_PER_2M - 1;
+                    continue;
+                }
+            }
+
             uintptr_t phys = Memory::AllocatePhysicalMemoryBlock();
             physicalBlocks[i] = phys >> PAGE_SHIFT_4K; // Allocate all of our blocks
 
@@ -47,35 +78,81 @@ int PhysicalVMObject::Hit(uintptr_t base, uintptr_t offset, PageMap* pMap){
     unsigned blockIndex = offset >> PAGE_SHIFT_4K;
     assert(blockIndex < (size >> PAGE_SHIFT_4K));
 
-    uint32_t& block = physicalBlocks[blockIndex];
+    uint32_t block = __atomic_load_n(&physicalBlocks[blockIndex], __ATOMIC_ACQUIRE);
     if(block){ // Another reference to the VMObject probably mapped this block
-        Memory::MapVirtualMemory4K(static_cast<uintptr_t>(block) << PAGE_SHIFT_4K, base + offset, 1, pMap);
+        if(!MapHugeBlock(base, offset, PAGE_USER | PAGE_WRITABLE | PAGE_PRESENT, pMap)){
+            Memory::MapVirtualMemory4K(static_cast<uintptr_t>(block) << PAGE_SHIFT_4K, base + offset, 1, pMap);
+        }
     } else { // We need to allocate block
         assert(anonymous);
 
-        uintptr_t phys = Memory::AllocatePhysicalMemoryBlock();
-        assert(phys < PHYS_BLOCK_MAX);
-        if(!phys){
-            return 1; // Failed to allocate
+        if(hugePages && AllocateHugeBlock(base, offset, pMap)){
+            return 0; // Allocated and mapped a 2MB page
+        }
+
+        void* mapping = nullptr;
+        block = AllocateBlock(blockIndex, mapping);
+        if(mapping){
+            Memory::KernelFree4KPages(mapping, 1);
         }
 
-        block = phys >> PAGE_SHIFT_4K;
+        if(!block){
+            return -ENOMEM; // Failed to allocate
+        }
 
-        Memory::MapVirtualMemory4K(phys, base + offset, 1, PAGE_USER | PAGE_WRITABLE | PAGE_PRESENT, pMap);
-        
-        if(GetCR3() == pMap->pml4Phys){
-            memset(reinterpret_cast<void*>((base + offset) & ~static_cast<uintptr_t>(PAGE_SIZE_4K - 1)), 0, PAGE_SIZE_4K); // Zero the block
-        } else {
-            void* mapping = Memory::KernelAllocate4KPages(1);
-            Memory::KernelMapVirtualMemory4K(phys, (uintptr_t)mapping, 1);
+        Memory::MapVirtualMemory4K(static_cast<uintptr_t>(block) << PAGE_SHIFT_4K, base + offset, 1, PAGE_USER | PAGE_WRITABLE | PAGE_PRESENT, pMap);
+    }
 
-            memset(mapping, 0, PAGE_SIZE_4K);
+    return 0; // Success
+}
 
-            Memory::KernelFree4KPages(mapping, 1);
+int PhysicalVMObject::Populate(uintptr_t base, uintptr_t offset, size_t length, PageMap* pMap){
+    unsigned blockIndex = offset >> PAGE_SHIFT_4K;
+    unsigned endIndex = (offset + length + PAGE_SIZE_4K - 1) >> PAGE_SHIFT_4K;
+    assert(endIndex <= (size >> PAGE_SHIFT_4K));
+
+    uint64_t flags = PAGE_USER | (PAGE_WRITABLE * (!copyOnWrite)) | PAGE_PRESENT;
+    void* mapping = nullptr; // Used to zero new blocks
+
+    int status = 0;
+    for(unsigned i = blockIndex; i < endIndex; i++){
+        uintptr_t virt = base + (static_cast<uintptr_t>(i) << PAGE_SHIFT_4K);
+        if(!(virt & (PAGE_SIZE_2M - 1)) || i == blockIndex){
+            if(Memory::IsHugePageMapped(virt, pMap)){
+                // Skip to the end of the 2MB page
+                i = ((((virt & ~static_cast<uintptr_t>(PAGE_SIZE_2M - 1)) + PAGE_SIZE_2M) - base) >> PAGE_SHIFT_4K) - 1;
+                continue;
+            }
+        }
+
+        uint32_t block = __atomic_load_n(&physicalBlocks[i], __ATOMIC_ACQUIRE);
+        if(block && !(virt & (PAGE_SIZE_2M - 1)) && MapHugeBlock(base, virt - base, flags, pMap)){
+            i += PAGES_PER_2M - 1;
+            continue;
         }
+
+        if(!block){
+            assert(anonymous);
+            if(hugePages && !(virt & (PAGE_SIZE_2M - 1)) && AllocateHugeBlock(base, virt - base, pMap)){
+                i += PAGES_PER_2M - 1;
+                continue;
+            }
+
+            // Another thread faulting on the region may beat us to it, in which case we map its block
+            if(!(block = AllocateBlock(i, mapping))){
+                status = -ENOMEM; // Failed to allocate
+                break;
+            }
+        }
+
+        Memory::MapVirtualMemory4K(static_cast<uintptr_t>(block) << PAGE_SHIFT_4K, virt, 1, flags, pMap);
     }
 
-    return 0; // Success
+    if(mapping){
+        Memory::KernelFree4KPages(mapping, 1);
+    }
+
+    return status;
 }
 
 void PhysicalVMObject::ForceAllocate(){
@@ -104,7 +181,14 @@ void PhysicalVMObject::MapAllocatedBlocks(uintptr_t base, PageMap* pMap){
         uint64_t block = physicalBlocks[i];
         if(block){ // Is it allocated?
             // Only set write flag if copyOnWrite is false
-            Memory::MapVirtualMemory4K(block << PAGE_SHIFT_4K, virt, 1, PAGE_USER | (PAGE_WRITABLE * (!copyOnWrite)) | PAGE_PRESENT, pMap);
+            uint64_t flags = PAGE_USER | (PAGE_WRITABLE * (!copyOnWrite)) | PAGE_PRESENT;
+            if(!(virt & (PAGE_SIZE_2M - 1)) && MapHugeBlock(base, virt - base, flags, pMap)){
+                i += PAGES_PER_2M - 1;
+                virt += PAGE_SIZE_2M;
+                continue;
+            }
+
+            Memory::MapVirtualMemory4K(block << PAGE_SHIFT_4K, virt, 1, flags, pMap);
         } else {
             Memory::MapVirtualMemory4K(0, virt, 1, PAGE_USER, pMap); // Mark as user, not present, not writable
         }
@@ -124,7 +208,22 @@ VMObject* PhysicalVMObject::Clone(){
     for(unsigned i = 0; i < (size >> PAGE_SHIFT_4K); i++){
         uintptr_t block = physicalBlocks[i];
         if(block){
-            uintptr_t newBlock = Memory::AllocatePhysicalMemoryBlock();
+            if(!newVMO->physicalBlocks[i] && !(block & (PAGES_PER_2M - 1)) && i + PAGES_PER_2M <= (size >> PAGE_SHIFT_4K) && IsHugeBlock(i)){
+                // Keep huge blocks huge in the copy if we can
+                if(uintptr_t newHugeBlock = Memory::AllocateLargePhysicalMemoryBlock(); newHugeBlock){
+                    for(unsigned j = 0; j < PAGES_PER_2M; j++){
+                        newVMO->physicalBlocks[i + j] = (newHugeBlock >> PAGE_SHIFT_4K) + j;
+                    }
+                }
+            }
+
+            uintptr_t newBlock = newVMO->physicalBlocks[i] ? (static_cast<uintptr_t>(newVMO->physicalBlocks[i]) << PAGE_SHIFT_4K) : Memory::TryAllocatePhysicalMemoryBlock();
+            if(!newBlock){
+                // Out of memory, the destructor frees the blocks copied so far
+                Memory::KernelFree4KPages(virtBuffer, 2);
+                delete newVMO;
+                return nullptr;
+            }
             newVMO->physicalBlocks[i] = newBlock >> PAGE_SHIFT_4K;
 
             Memory::KernelMapVirtualMemory4K(block << PAGE_SHIFT_4K, (uintptr_t)virtBuffer, 1); // Map temporary mappings to our blocks
@@ -137,11 +236,79 @@ VMObject* PhysicalVMObject::Clone(){
     Memory::KernelFree4KPages(virtBuffer, 2);
 
     newVMO->copyOnWrite = false;
+    newVMO->hugePages = hugePages;
     newVMO->refCount = 1;
 
     return newVMO;
 }
 
+unsigned PhysicalVMObject::CollapseHugePages(uintptr_t base, PageMap* pMap, unsigned maxPages){
+    if(!Memory::transparentHugePages || !anonymous || shared || (copyOnWrite && refCount > 1)){
+        return 0; // Other address spaces may reference our blocks
+    }
+
+    unsigned collapsed = 0;
+    uint64_t flags = PAGE_USER | (PAGE_WRITABLE * (!copyOnWrite)) | PAGE_PRESENT;
+
+    uintptr_t virt = (base + PAGE_SIZE_2M - 1) & ~static_cast<uintptr_t>(PAGE_SIZE_2M - 1);
+    for(; virt + PAGE_SIZE_2M <= base + size && collapsed < maxPages; virt += PAGE_SIZE_2M){
+        unsigned index = (virt - base) >> PAGE_SHIFT_4K;
+        if(IsHugeBlock(index)){
+            if(!Memory::IsHugePageMapped(virt, pMap)){
+                page_table_t oldTable = Memory::MapVirtualMemory2M(static_cast<uintptr_t>(physicalBlocks[index]) << PAGE_SHIFT_4K, virt, flags, pMap);
+                if(oldTable.phys){
+                    Memory::ShootdownTLB(pMap);
+                    Memory::FreePageTable(oldTable);
+                }
+            }
+            continue;
+        }
+
+        unsigned populated = 0;
+        while(populated < PAGES_PER_2M && physicalBlocks[index + populated]){
+            populated++;
+        }
+
+        if(populated < PAGES_PER_2M){
+            continue; // Only collapse fully populated ranges so we do not use extra memory
+        }
+
+        uintptr_t hugeBlock = Memory::AllocateLargePhysicalMemoryBlock();
+        if(!hugeBlock){
+            break; // Physical memory is too fragmented
+        }
+
+        // Unmap the range and flush it from every other CPU so it cannot be modified whilst being copied.
+        // Any access will now fault and wait for the region lock held by our caller.
+        Memory::MapVirtualMemory4K(0, virt, PAGES_PER_2M, PAGE_USER, pMap);
+        Memory::ShootdownTLB(pMap);
+
+        uint8_t* virtBuffer = reinterpret_cast<uint8_t*>(Memory::KernelAllocate4KPages(2));
+        uint8_t* virtDestBuffer = virtBuffer + PAGE_SIZE_4K;
+        for(unsigned i = 0; i < PAGES_PER_2M; i++){
+            Memory::KernelMapVirtualMemory4K(static_cast<uintptr_t>(physicalBlocks[index + i]) << PAGE_SHIFT_4K, (uintptr_t)virtBuffer, 1);
+            Memory::KernelMapVirtualMemory4K(hugeBlock + (i << PAGE_SHIFT_4K), (uintptr_t)virtDestBuffer, 1);
+            memcpy(virtDestBuffer, virtBuffer, PAGE_SIZE_4K);
+        }
+        Memory::KernelFree4KPages(virtBuffer, 2);
+
+        // Mapping the 2MB page unlinks the page table, flush again so no CPU
+        // can still be walking it before it and the old blocks are reused
+        page_table_t oldTable = Memory::MapVirtualMemory2M(hugeBlock, virt, flags, pMap);
+        Memory::ShootdownTLB(pMap);
+
+        Memory::FreePageTable(oldTable);
+        for(unsigned i = 0; i < PAGES_PER_2M; i++){
+            Memory::FreePhysicalMemoryBlock(static_cast<uintptr_t>(physicalBlocks[index + i]) << PAGE_SHIFT_4K);
+            physicalBlocks[index + i] = (hugeBlock >> PAGE_SHIFT_4K) + i;
+        }
+
+        collapsed++;
+    }
+
+    return collapsed;
+}
+
 size_t PhysicalVMObject::UsedPhysicalMemory() const {
     if(!anonymous){
         return size;
@@ -157,15 +324,141 @@ size_t PhysicalVMObject::UsedPhysicalMemory() const {
     return blockCount << PAGE_SHIFT_4K;
 }
 
+bool PhysicalVMObject::IsHugeBlock(unsigned index) const {
+    uint32_t first = physicalBlocks[index];
+    if(!first || (first & (PAGES_PER_2M - 1))){
+        return false; // Not allocated or not 2MB aligned
+    }
+
+    for(unsigned i = 1; i < PAGES_PER_2M; i++){
+        if(physicalBlocks[index + i] != first + i){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool PhysicalVMObject::MapHugeBlock(uintptr_t base, uintptr_t offset, uint64_t flags, PageMap* pMap){
+    uintptr_t hugeVirt = (base + offset) & ~static_cast<uintptr_t>(PAGE_SIZE_2M - 1);
+    if(!Memory::transparentHugePages || hugeVirt < base || hugeVirt + PAGE_SIZE_2M > base + size){
+        return false; // The 2MB page would lie partly outside of the object
+    }
+
+    unsigned index = (hugeVirt - base) >> PAGE_SHIFT_4K;
+    if(!IsHugeBlock(index)){
+        return false;
+    }
+
+    // We may be called with interrupts disabled so cannot shoot down the TLB,
+    // leave replacing the page table to CollapseHugePages
+    if(Memory::HasPageTable(hugeVirt, pMap)){
+        return false;
+    }
+
+    page_table_t oldTable = Memory::MapVirtualMemory2M(static_cast<uintptr_t>(physicalBlocks[index]) << PAGE_SHIFT_4K, hugeVirt, flags, pMap);
+    assert(!oldTable.phys);
+    return true;
+}
+
+uint32_t PhysicalVMObject::AllocateBlock(unsigned index, void*& mapping){
+    uint32_t block = __atomic_load_n(&physicalBlocks[index], __ATOMIC_ACQUIRE);
+    if(block){
+        return block;
+    }
+
+    // Called from the fault path with the region lock held, so do not wait for reclaim
+    uintptr_t phys = Memory::TryAllocatePhysicalMemoryBlock();
+    if(!phys){
+        return 0;
+    }
+    assert(phys < PHYS_BLOCK_MAX);
+
+    // Zero the block before anyone can see it
+    if(!mapping){
+        mapping = Memory::KernelAllocate4KPages(1);
+    }
+    Memory::KernelMapVirtualMemory4K(phys, (uintptr_t)mapping, 1);
+    memset(mapping, 0, PAGE_SIZE_4K);
+
+    // Faults only hold the region read lock, so several threads may be allocating the same block
+    if(!__atomic_compare_exchange_n(&physicalBlocks[index], &block, phys >> PAGE_SHIFT_4K, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+        Memory::FreePhysicalMemoryBlock(phys); // Lost the race, use theirs
+        return block;
+    }
+
+    return phys >> PAGE_SHIFT_4K;
+}
+
+bool PhysicalVMObject::AllocateHugeBlock(uintptr_t base, uintptr_t offset, PageMap* pMap){
+    uintptr_t hugeVirt = (base + offset) & ~static_cast<uintptr_t>(PAGE_SIZE_2M - 1);
+    if(!Memory::transparentHugePages || hugeVirt < base || hugeVirt + PAGE_SIZE_2M > base + size){
+        return false; // The 2MB page would lie partly outside of the object
+    }
+
+    unsigned index = (hugeVirt - base) >> PAGE_SHIFT_4K;
+    for(unsigned i = 0; i < PAGES_PER_2M; i++){
+        if(__atomic_load_n(&physicalBlocks[index + i], __ATOMIC_ACQUIRE)){
+            return false; // Partially populated, leave it to the collapse thread
+        }
+    }
+
+    if(!CheckInterrupts() && Memory::HasPageTable(hugeVirt, pMap)){
+        return false; // Cannot shoot down the TLB to free the page table
+    }
+
+    uintptr_t phys = Memory::AllocateLargePhysicalMemoryBlock();
+    if(!phys){
+        return false; // Fall back to 4KB blocks
+    }
+    assert(phys < PHYS_BLOCK_MAX);
+
+    // Zero the block before anyone can see it
+    void* mapping = Memory::KernelAllocate4KPages(1);
+    for(unsigned i = 0; i < PAGES_PER_2M; i++){
+        Memory::KernelMapVirtualMemory4K(phys + (i << PAGE_SHIFT_4K), (uintptr_t)mapping, 1);
+        memset(mapping, 0, PAGE_SIZE_4K);
+    }
+    Memory::KernelFree4KPages(mapping, 1);
+
+    // Claim each block as AllocateBlock would. If another thread got to one first
+    // the blocks we did claim are left as 4KB blocks, they are already zeroed
+    bool claimedAll = true;
+    for(unsigned i = 0; i < PAGES_PER_2M; i++){
+        uint32_t expected = 0;
+        uintptr_t block = phys + (i << PAGE_SHIFT_4K);
+        if(!__atomic_compare_exchange_n(&physicalBlocks[index + i], &expected, block >> PAGE_SHIFT_4K, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            Memory::FreePhysicalMemoryBlock(block);
+            claimedAll = false;
+        }
+    }
+
+    if(!claimedAll){
+        return false;
+    }
+
+    page_table_t oldTable = Memory::MapVirtualMemory2M(phys, hugeVirt, PAGE_USER | PAGE_WRITABLE | PAGE_PRESENT, pMap);
+    if(oldTable.phys){
+        Memory::ShootdownTLB(pMap); // Other CPUs may still be walking the page table
+        Memory::FreePageTable(oldTable);
+    }
+    return true;
+}
+
 PhysicalVMObject::~PhysicalVMObject(){
     assert(refCount <= 1); // Make sure someone isn't trying to free the VMO with more than 1 reference left
 
     if(physicalBlocks){
         for(unsigned i = 0; i < size >> PAGE_SHIFT_4K; i++){ // Free our allocated physical blocks
+            if(!(i % PAGES_PER_2M) && i + PAGES_PER_2M <= (size >> PAGE_SHIFT_4K) && IsHugeBlock(i)){
+                Memory::FreeLargePhysicalMemoryBlock(static_cast<uintptr_t>(physicalBlocks[i]) << PAGE_SHIFT_4K);
+                i += PAGES_PER_2M - 1;
+                continue;
+            }
+
             if(physicalBlocks[i]){
                 Memory::FreePhysicalMemoryBlock(static_cast<uintptr_t>(physicalBlocks[i]) << PAGE_SHIFT_4K);
             }
-            
         }
 
         delete[] physicalBlocks;
@@ -0,0 +1,63 @@
+#include <Net/Checksum.h>
+
+#include <CPU.h>
+#include <Logging.h>
+
+namespace Network {
+    static uint64_t ChecksumBlocksScalar(const void* data, size_t blocks, uint64_t sum){
+        return ChecksumPartialScalar(data, blocks * 64, sum);
+    }
+
+    uint64_t (*checksumBlocks)(const void* data, size_t blocks, uint64_t sum) = ChecksumBlocksScalar;
+
+    void InitializeChecksum(){
+        cpuid_info_t cpuid = CPUID();
+        if(cpuid.features_ecx & CPUID_ECX_SSE4_1){
+            checksumBlocks = ChecksumBlocksSSE;
+        }
+
+        Log::Info("[Network] Checksum: %s", (checksumBlocks == ChecksumBlocksSSE) ? "SSE4.1" : "scalar");
+    }
+
+    uint64_t ChecksumPartialScalar(const void* data, size_t length, uint64_t sum){
+        // Fold to 33 bits so adding 32-bit words cannot overflow
+        sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+
+        const uint32_t* ptr = reinterpret_cast<const uint32_t*>(data);
+        while(length >= 16){ // Four independent adds per iteration
+            sum += static_cast<uint64_t>(ptr[0]) + ptr[1] + ptr[2] + ptr[3];
+            ptr += 4;
+            length -= 16;
+        }
+
+        while(length >= 4){
+            sum += *ptr++;
+            length -= 4;
+        }
+
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(ptr);
+        if(length >= 2){
+            sum += *reinterpret_cast<const uint16_t*>(bytes);
+            bytes += 2;
+            length -= 2;
+        }
+
+        if(length){ // Uneven amount of data, pad with a zero byte
+            sum += *bytes;
+        }
+
+        return sum;
+    }
+
+    uint64_t ChecksumPartial(const void* data, size_t length, uint64_t sum){
+        if(length >= CHECKSUM_BLOCKS_THRESHOLD){
+            size_t blocks = length / 64;
+            sum = checksumBlocks(data, blocks, sum);
+
+            data = reinterpret_cast<const uint8_t*>(data) + blocks * 64;
+            length -= blocks * 64;
+        }
+
+        return ChecksumPartialScalar(data, length, sum);
+    }
+}
@@ -75,17 +75,7 @@ int IPSocket::Listen(int backlog){
 }
     
 int64_t IPSocket::ReceiveFrom(void* buffer, size_t len, int flags, sockaddr* src, socklen_t* addrlen, const void* ancillary, size_t ancillaryLen){
-	if(flags & SOCK_NONBLOCK && !pQueue.get_length()){
-		return -EAGAIN;
-	}
-
 	return -ENOSYS;
-
-	while(!pQueue.get_length()) Scheduler::Yield();
-
-	if(src && addrlen){
-		src->family = InternetProtocol;
-	}
 }
 
 int64_t IPSocket::SendTo(void* buffer, size_t len, int flags, const sockaddr* src, socklen_t addrlen, const void* ancillary, size_t ancillaryLen){
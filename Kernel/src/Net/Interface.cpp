@@ -1,5 +1,7 @@
 #include <Net/Net.h>
 #include <Net/Adapter.h>
+#include <Net/Neighbour.h>
+#include <Net/Route.h>
 
 #include <Scheduler.h>
 #include <Logging.h>
@@ -13,13 +15,12 @@
 #define NET_INTERFACE_STACKSIZE 32768
 
 namespace Network{
-	extern HashMap<uint32_t, MACAddress> addressCache;
 	extern Vector<NetworkAdapter*> adapters;
 
 	Semaphore packetQueueSemaphore(0);
 	FancyRefPtr<Process> netProcess;
 
-	void OnReceiveARP(void* data, size_t length){
+	void OnReceiveARP(NetworkAdapter* receiveAdapter, void* data, size_t length){
 		if(length < sizeof(ARPHeader)){
 			IF_DEBUG(debugLevelNetwork >= DebugLevelVerbose, {
 				Log::Warning("[Network] [ARP] Discarding packet (too short, make it looonger)");
@@ -44,7 +45,7 @@ namespace Network{
 				uint8_t buffer[sizeof(EthernetFrame) + sizeof(ARPHeader)];
 				
 				EthernetFrame* ethFrame = reinterpret_cast<EthernetFrame*>(buffer);
-				ethFrame->etherType = EtherTypeIPv4;
+				ethFrame->etherType = EtherTypeARP;
 				ethFrame->src = adapter->mac;
 				ethFrame->dest = arp->srcHwAddr;
 
@@ -65,11 +66,19 @@ namespace Network{
 			}
 		}
 
-		// Insert into cache regardless of whether it was a reply or request
-		addressCache.insert(arp->srcPrAddr.value, arp->srcHwAddr);
+		if(arp->srcPrAddr.value == INADDR_ANY){
+			return; // ARP probe, the sender does not have an address yet
+		}
+
+		// Update the cache from both replies and requests,
+		// only adding new entries for hosts that are looking for us (RFC 826)
+		bool targetIsUs = NetFS::GetInstance()->FindAdapter(arp->destPrAddr.value);
+		Neighbour::Update(receiveAdapter, arp->srcPrAddr.value, arp->srcHwAddr, targetIsUs);
 	}
 
-	void OnReceiveICMP(void* data, size_t length){
+	void OnReceiveICMP(IPv4Header& ipHeader, NetBuffer* buffer){
+		void* data = buffer->data;
+		size_t length = buffer->Length();
 		if(length < sizeof(ICMPHeader)){
 			Log::Warning("[Network] [ICMP] Discarding packet (too short)");
 			return;
@@ -77,38 +86,59 @@ namespace Network{
 
 		ICMPHeader* header = (ICMPHeader*)data;
 		Log::Info("[Network] [ICMP] Received packet, Type: %d, Code: %d", header->type, header->code);
+
+		if(header->type == ICMPHeader::ICMPEchoRequest && ipHeader.destIP.value != INADDR_BROADCAST){
+			// Reply with the same message, only the type changes so the checksum can be updated instead of recalculated
+			uint16_t oldWord = *reinterpret_cast<uint16_t*>(header);
+			header->type = ICMPHeader::ICMPEchoReply;
+			header->checksum = ChecksumUpdate16(header->checksum, oldWord, *reinterpret_cast<uint16_t*>(header));
+
+			IPv4Address source = ipHeader.destIP;
+			IPv4Address destination = ipHeader.sourceIP;
+			SendIPv4(data, length, source, destination, IPv4ProtocolICMP, buffer->adapter);
+		}
 	}
 
-    void OnReceiveIPv4(void* data, size_t length){
-		if(length < sizeof(IPv4Header)){
+    void OnReceiveIPv4(NetBuffer* buffer){
+		if(buffer->Length() < sizeof(IPv4Header)){
 			Log::Warning("[Network] [IPv4] Discarding packet (too short)");
 			return;
 		}
 
-		IPv4Header* header = (IPv4Header*)data;
+		IPv4Header* header = (IPv4Header*)buffer->data;
 
 		if(header->version != 4){
 			Log::Warning("[Network] [IPv4] Discarding packet (invalid version :( )");
 			return;
 		}
 
-		BigEndian<uint16_t> checksum = header->headerChecksum;
-
-		header->headerChecksum = 0;
-		if(checksum.value != CaclulateChecksum(data, sizeof(IPv4Header)).value){ // Verify checksum
-			Log::Warning("[Network] [IPv4] Discarding packet (invalid checksum)");
+		size_t headerLength = header->ihl * 4;
+		if(headerLength < sizeof(IPv4Header) || header->length < headerLength || header->length > buffer->Length()){
+			Log::Warning("[Network] [IPv4] Discarding packet (invalid length)");
 			return;
 		}
 
+		// Loopback packets never leave memory so they are not checksummed
+		if(!buffer->adapter || buffer->adapter->Type() != NetworkAdapter::NetworkAdapterLoopback){
+			// Summing the header including its checksum gives 0xFFFF when it is valid
+			if(ChecksumFold(ChecksumPartial(header, headerLength)) != 0xFFFF){
+				Log::Warning("[Network] [IPv4] Discarding packet (invalid checksum)");
+				return;
+			}
+		}
+
+		buffer->Trim(header->length); // Remove any Ethernet padding
+		buffer->Pull(headerLength); // The header stays in the buffer so it remains valid
+
 		switch(header->protocol){
 			case IPv4ProtocolICMP:
-				OnReceiveICMP(header->data, length - sizeof(IPv4Header));
+				OnReceiveICMP(*header, buffer);
 				break;
 			case IPv4ProtocolUDP:
-				UDP::OnReceiveUDP(*header, header->data, ((uint16_t)header->length) - sizeof(IPv4Header));
+				UDP::OnReceiveUDP(*header, buffer);
 				break;
 			case IPv4ProtocolTCP:
-				TCP::OnReceiveTCP(*header, header->data, ((uint16_t)header->length) - sizeof(IPv4Header));
+				TCP::OnReceiveTCP(*header, buffer);
 				break;
 			default:
 				Log::Warning("[Network] [IPv4] Discarding packet (invalid protocol %x)", header->protocol);
@@ -116,58 +146,87 @@ namespace Network{
 		}
 	}
 
+	void OnReceiveEthernet(NetworkAdapter* adapter, NetBuffer* buffer){
+		if(buffer->Length() < sizeof(EthernetFrame)){
+			Log::Warning("[Network] Discarding packet (too short)");
+			return;
+		}
+
+		EthernetFrame* etherFrame = reinterpret_cast<EthernetFrame*>(buffer->data);
+		Log::Warning("[Network] Receiving packet (EtherType %x)", etherFrame->etherType);
+
+		if(etherFrame->dest != adapter->mac && etherFrame->dest != MACAddress{0xff, 0xff, 0xff, 0xff, 0xff, 0xff}){
+			Log::Warning("[Network] Discarding packet (invalid MAC address %x:%x:%x:%x:%x:%x)", etherFrame->dest[0], etherFrame->dest[1], etherFrame->dest[2], etherFrame->dest[3], etherFrame->dest[4], etherFrame->dest[5]);
+			return;
+		}
+
+		buffer->Pull(sizeof(EthernetFrame));
+		
+		switch ((uint16_t)etherFrame->etherType)
+		{
+		case EtherTypeIPv4:
+			OnReceiveIPv4(buffer);
+			break;
+		case EtherTypeARP:
+			OnReceiveARP(adapter, buffer->data, buffer->Length());
+			break;
+		default:
+			Log::Warning("[Network] Discarding packet (invalid EtherType %x)", etherFrame->etherType);
+			break;
+		}
+	}
+
 	[[noreturn]] void InterfaceThread(){
 		Log::Info("[Network] Initializing network interface layer...");
 
 		for(;;){
-			NetworkPacket* p;
+			NetBuffer* buffer;
 			if(packetQueueSemaphore.Wait()){
 				continue; // We got interrupted
 			}
+
+			NetBuffer::FillPool(); // NIC drivers take buffers in their IRQ handlers, which cannot grow the pool
 			
+			bool morePending = false;
 			for(NetworkAdapter* adapter : adapters){
-				if((p = adapter->Dequeue())){
-					if(p->length < sizeof(EthernetFrame)){
-						Log::Warning("[Network] Discarding packet (too short)");
+				if(adapter->PollScheduled()){
+					adapter->stats.rxPolls++;
 
-						adapter->CachePacket(p);
-						break;
+					if(adapter->Poll(NET_POLL_BUDGET) < NET_POLL_BUDGET){
+						adapter->CompletePoll(); // The device is drained
+					} else {
+						morePending = true; // Come back after giving the other adapters a turn
 					}
+				}
 
-					size_t len = p->length;
-					uint8_t buffer[ETHERNET_MAX_PACKET_SIZE];
-					memcpy(buffer, p->data, p->length);
-
-					adapter->CachePacket(p); // Get the packet back to the NIC driver's cache as soon as possible
-
-					EthernetFrame* etherFrame = reinterpret_cast<EthernetFrame*>(buffer);
-					Log::Warning("[Network] Receiving packet (EtherType %x)", etherFrame->etherType);
+				while((buffer = adapter->Dequeue())){
+					adapter->stats.rxPackets++;
 
-					if(etherFrame->dest != adapter->mac && etherFrame->dest != MACAddress{0xff, 0xff, 0xff, 0xff, 0xff, 0xff}){
-						Log::Warning("[Network] Discarding packet (invalid MAC address %x:%x:%x:%x:%x:%x)", etherFrame->dest[0], etherFrame->dest[1], etherFrame->dest[2], etherFrame->dest[3], etherFrame->dest[4], etherFrame->dest[5]);
-						continue;
-					}
-					
-					switch ((uint16_t)etherFrame->etherType)
-					{
-					case EtherTypeIPv4:
-						OnReceiveIPv4(etherFrame->data, len - sizeof(EthernetFrame));
-						break;
-					case EtherTypeARP:
-						OnReceiveARP(etherFrame->data, len - sizeof(EthernetFrame));
-						break;
-					default:
-						Log::Warning("[Network] Discarding packet (invalid EtherType %x)", etherFrame->etherType);
-						break;
-					}
+					ReceivePacket(adapter, buffer); // Steered to a protocol worker
 				}
 			}
+
+			if(morePending){
+				packetQueueSemaphore.Signal();
+			}
+		}
+	}
+
+	void ProcessPacket(NetworkAdapter* adapter, NetBuffer* buffer){
+		if(adapter->Type() == NetworkAdapter::NetworkAdapterLoopback){
+			OnReceiveIPv4(buffer); // No link layer
+		} else {
+			OnReceiveEthernet(adapter, buffer);
 		}
 	}
 
 	void InitializeNetworkThread(){
+		InitializeChecksum();
+
 		netProcess = Process::CreateKernelProcess((void*)InterfaceThread, "NetworkStack", nullptr);
 		netProcess->Start();
+
+		InitializeProtocolWorkers();
 	}
 
 	void Send(void* data, size_t length, NetworkAdapter* adapter){
@@ -180,25 +239,40 @@ namespace Network{
 	}
 
     int SendIPv4(void* data, size_t length, IPv4Address& source, IPv4Address& destination, uint8_t protocol, NetworkAdapter* adapter){
-		if(length > 1518 - sizeof(EthernetFrame) - sizeof(IPv4Header)){
+		if(length > ETHERNET_MAX_PACKET_SIZE - sizeof(EthernetFrame) - sizeof(IPv4Header)){
 			return -EMSGSIZE;
 		}
 
-		assert(adapter);
+		NetBuffer* buffer = NetBuffer::AllocateWithHeadroom();
+		if(!buffer){
+			return -ENOBUFS;
+		}
 
-		uint8_t buffer[1600]; // The maxmium Ethernet frame size is 1518 so this will do
+		memcpy(buffer->Put(length), data, length);
 
-		EthernetFrame* ethFrame = (EthernetFrame*)buffer;
-		ethFrame->etherType = EtherTypeIPv4;
-		ethFrame->src = adapter->mac;
-		
-		if(destination.value == INADDR_BROADCAST){
-			ethFrame->dest = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}; // Broadcast MAC Address
-		} else if(int status = Route(source, destination, ethFrame->dest, adapter); status < 0){
-			return status;
+		return SendIPv4(buffer, source, destination, protocol, adapter);
+	}
+
+    int SendIPv4(NetBuffer* buffer, IPv4Address& source, IPv4Address& destination, uint8_t protocol, NetworkAdapter* adapter, CachedRoute* route){
+		size_t length = buffer->Length();
+		// Segments for offload are split by the adapter
+		if(!buffer->gsoSize && length > ETHERNET_MAX_PACKET_SIZE - sizeof(EthernetFrame) - sizeof(IPv4Header)){
+			buffer->Unref();
+			return -EMSGSIZE;
+		}
+
+		assert(adapter);
+
+		IPv4Address nextHop = destination;
+		if(destination.value != INADDR_BROADCAST){
+			int status = route ? Route(source, destination, *route, nextHop, adapter) : Route(source, destination, nextHop, adapter);
+			if(status < 0){
+				buffer->Unref();
+				return status;
+			}
 		}
 
-		IPv4Header* ipHeader = (IPv4Header*)ethFrame->data;
+		IPv4Header* ipHeader = (IPv4Header*)buffer->Push(sizeof(IPv4Header));
 		memset(ipHeader, 0, sizeof(IPv4Header));
 
 		ipHeader->ihl = 5; // 5 dwords (20 bytes)
@@ -211,11 +285,23 @@ namespace Network{
 		ipHeader->destIP = destination;
 		ipHeader->sourceIP = adapter->adapterIP;
 
+		if(adapter->Type() == NetworkAdapter::NetworkAdapterLoopback){
+			adapter->SendBuffer(buffer); // Straight back to the receive side, no checksum or Ethernet frame
+			return 0;
+		}
+
 		ipHeader->headerChecksum = CaclulateChecksum(ipHeader, sizeof(IPv4Header));
 
-		memcpy(ipHeader->data, data, length);
+		EthernetFrame* ethFrame = (EthernetFrame*)buffer->Push(sizeof(EthernetFrame));
+		ethFrame->etherType = EtherTypeIPv4;
+		ethFrame->src = adapter->mac;
 
-		Send(ethFrame, sizeof(EthernetFrame) + sizeof(IPv4Header) + length, adapter);
+		if(destination.value == INADDR_BROADCAST){
+			ethFrame->dest = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}; // Broadcast MAC Address
+			adapter->SendBuffer(buffer);
+		} else {
+			Neighbour::Output(adapter, nextHop, buffer, route); // Queued if the address is still being resolved
+		}
 
 		return 0;
 	}
@@ -0,0 +1,46 @@
+#include <Net/Adapter.h>
+
+#include <Lock.h>
+
+namespace Network {
+    LoopbackAdapter::LoopbackAdapter() : NetworkAdapter(NetworkAdapterLoopback) {
+        SetInstanceName("lo");
+
+        adapterIP = IPv4Address(127, 0, 0, 1);
+        subnetMask = IPv4Address(255, 0, 0, 0);
+
+        linkState = LinkUp;
+        dState = OK;
+    }
+
+    void LoopbackAdapter::SendPacket(void* data, size_t len){
+        if(len > NET_BUFFER_SIZE - NET_BUFFER_HEADROOM){
+            return;
+        }
+
+        NetBuffer* buffer = NetBuffer::AllocateWithHeadroom();
+        if(!buffer){
+            return; // Dropped, as a NIC would when out of buffers
+        }
+
+        memcpy(buffer->Put(len), data, len);
+        SendBuffer(buffer);
+    }
+
+    void LoopbackAdapter::SendBuffer(NetBuffer* buffer){
+        buffer->adapter = this;
+
+        acquireLock(&queueLock);
+        queue.add_back(buffer); // Our reference is handed to the network thread
+        releaseLock(&queueLock);
+
+        packetSemaphore.Signal();
+        packetQueueSemaphore.Signal();
+    }
+
+    NetBuffer* LoopbackAdapter::Dequeue(){
+        ScopedSpinLock lockQueue(queueLock);
+
+        return NetworkAdapter::Dequeue();
+    }
+}
@@ -0,0 +1,354 @@
+#include <Net/Neighbour.h>
+
+#include <Net/Adapter.h>
+#include <Net/Route.h>
+
+#include <Errno.h>
+#include <Hash.h>
+#include <Lock.h>
+#include <Logging.h>
+#include <Objects/Process.h>
+#include <Scheduler.h>
+#include <Timer.h>
+
+namespace Network::Neighbour {
+    // The same address can be on more than one link, so entries belong to an adapter
+    struct NeighbourKey {
+        NetworkAdapter* adapter;
+        uint32_t ip;
+
+        NeighbourKey() = default;
+        NeighbourKey(NetworkAdapter* adapter, const IPv4Address& ip) : adapter(adapter), ip(ip.value) {}
+
+        inline bool operator==(const NeighbourKey& other) const {
+            return adapter == other.adapter && ip == other.ip;
+        }
+    };
+}
+
+template <> inline unsigned Hash<Network::Neighbour::NeighbourKey>(const Network::Neighbour::NeighbourKey& key) {
+    return ::Hash(reinterpret_cast<uintptr_t>(key.adapter)) ^ ::Hash(key.ip);
+}
+
+namespace Network::Neighbour {
+    struct NeighbourEntry;
+
+    // Thread waiting for an entry to be resolved
+    class NeighbourBlocker : public ThreadBlocker {
+    public:
+        NeighbourBlocker* next = nullptr;
+        NeighbourBlocker* prev = nullptr;
+
+        NeighbourEntry* entry = nullptr; // Entry we are waiting on, cleared when woken (protected by neighboursLock)
+    };
+
+    struct NeighbourEntry {
+        IPv4Address ip;
+        NetworkAdapter* adapter;
+        MACAddress mac;
+
+        int state = NeighbourIncomplete;
+        unsigned probes = 0; // ARP requests sent since the entry was last confirmed
+        timeval updated; // When the entry was last confirmed or, while probing, when the last request was sent
+        timeval used; // When the entry was last used to send
+
+        FastList<NetBuffer*> queue; // Packets waiting for the address to be resolved
+        FastList<NeighbourBlocker*> waiters;
+
+        NeighbourEntry(NetworkAdapter* adapter, const IPv4Address& ip) : ip(ip), adapter(adapter) {}
+    };
+
+    // Protects the entries, their queues and waiters
+    static lock_t neighboursLock = 0;
+    static HashMap<NeighbourKey, NeighbourEntry*> entries;
+    static Vector<NeighbourEntry*> entryList; // Walked by the timer thread
+    static unsigned removedGeneration = 0; // Incremented whenever an entry is freed, so cached entries can be checked
+
+    static void SendRequest(NetworkAdapter* adapter, const IPv4Address& ip){
+        uint8_t buffer[sizeof(EthernetFrame) + sizeof(ARPHeader)];
+
+        EthernetFrame* ethFrame = reinterpret_cast<EthernetFrame*>(buffer);
+        ethFrame->etherType = EtherTypeARP;
+        ethFrame->src = adapter->mac;
+        ethFrame->dest = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+        ARPHeader* arp = reinterpret_cast<ARPHeader*>(buffer + sizeof(EthernetFrame));
+        arp->destHwAddr = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+        arp->srcHwAddr = adapter->mac;
+        arp->hLength = 6;
+        arp->hwType = 1; // Ethernet
+
+        arp->destPrAddr = ip.value;
+        arp->srcPrAddr = adapter->adapterIP.value;
+        arp->pLength = 4;
+        arp->prType = EtherTypeIPv4;
+
+        arp->opcode = ARPHeader::ARPRequest;
+
+        Network::Send(buffer, sizeof(EthernetFrame) + sizeof(ARPHeader), adapter);
+    }
+
+    // Wake everything waiting on the entry, neighboursLock must be held
+    static void WakeWaiters(NeighbourEntry* entry){
+        while(entry->waiters.get_length()){
+            NeighbourBlocker* blocker = entry->waiters.remove_at(0);
+            blocker->entry = nullptr;
+            blocker->Unblock();
+        }
+    }
+
+    // Remove an entry from the table and free it, neighboursLock must be held
+    static void RemoveEntry(NeighbourEntry* entry){
+        entries.remove({entry->adapter, entry->ip});
+        removedGeneration++;
+
+        while(entry->queue.get_length()){
+            entry->queue.remove_at(0)->Unref();
+        }
+
+        WakeWaiters(entry); // They will find the entry has gone
+        delete entry;
+    }
+
+    // Note that an entry has been used to send, neighboursLock must be held.
+    // probe is set when the caller should send an ARP request once the lock has been released.
+    static void UseEntry(NeighbourEntry* entry, const timeval& now, bool& probe){
+        if(entry->state == NeighbourStale && !entry->probes){
+            // Keep using the address while it is confirmed again
+            entry->probes = 1;
+            entry->updated = now;
+
+            probe = true;
+        }
+
+        entry->used = now;
+    }
+
+    // Get the entry for ip on adapter, creating it if it does not exist, neighboursLock must be held
+    static NeighbourEntry* GetEntry(NetworkAdapter* adapter, const IPv4Address& ip, bool& probe){
+        timeval now = Timer::GetSystemUptimeStruct();
+
+        NeighbourEntry* entry;
+        if(!entries.get({adapter, ip}, entry)){
+            entry = new NeighbourEntry(adapter, ip);
+            entry->probes = 1;
+            entry->updated = now;
+
+            entries.insert({adapter, ip}, entry);
+            entryList.add_back(entry);
+
+            probe = true;
+        }
+
+        UseEntry(entry, now, probe);
+        return entry;
+    }
+
+    static void TimerThread(){
+        struct Probe {
+            NetworkAdapter* adapter;
+            IPv4Address ip;
+        };
+        Vector<Probe> probes;
+
+        for(;;){
+            Scheduler::GetCurrentThread()->Sleep(NEIGHBOUR_TIMER_INTERVAL);
+
+            timeval now = Timer::GetSystemUptimeStruct();
+
+            acquireLock(&neighboursLock);
+            for(unsigned i = 0; i < entryList.get_length();){
+                NeighbourEntry* entry = entryList[i];
+                bool expired = false;
+
+                if(entry->state == NeighbourReachable){
+                    if(now - entry->updated >= NEIGHBOUR_REACHABLE_TIME){
+                        entry->state = NeighbourStale;
+                    }
+                } else if(entry->probes && now - entry->updated >= NEIGHBOUR_RETRANSMIT_TIME){
+                    if(entry->probes >= NEIGHBOUR_MAX_PROBES){
+                        IF_DEBUG((debugLevelNetwork >= DebugLevelNormal), {
+                            Log::Warning("[Network] [ARP] No reply from %d.%d.%d.%d", entry->ip.data[0], entry->ip.data[1], entry->ip.data[2], entry->ip.data[3]);
+                        });
+                        expired = true;
+                    } else {
+                        entry->probes++;
+                        entry->updated = now;
+                        probes.add_back({entry->adapter, entry->ip});
+                    }
+                } else if(entry->state == NeighbourStale && now - entry->used >= NEIGHBOUR_GC_TIME){
+                    expired = true;
+                }
+
+                if(expired){
+                    entryList.erase(i);
+                    RemoveEntry(entry);
+                } else {
+                    i++;
+                }
+            }
+            releaseLock(&neighboursLock);
+
+            for(Probe& p : probes){
+                SendRequest(p.adapter, p.ip);
+            }
+            probes.clear();
+        }
+    }
+
+    void Initialize(){
+        Process::CreateKernelProcess((void*)TimerThread, "NetNeighbour", nullptr)->Start();
+    }
+
+    int Resolve(NetworkAdapter* adapter, const IPv4Address& ip, MACAddress& mac, bool wait){
+        NeighbourBlocker blocker;
+        bool probe = false;
+
+        acquireLock(&neighboursLock);
+        NeighbourEntry* entry = GetEntry(adapter, ip, probe);
+        if(entry->state != NeighbourIncomplete){
+            mac = entry->mac;
+            releaseLock(&neighboursLock);
+
+            if(probe){
+                SendRequest(adapter, ip);
+            }
+            return 0;
+        } else if(!wait){
+            releaseLock(&neighboursLock);
+
+            if(probe){
+                SendRequest(adapter, ip);
+            }
+            return -EINPROGRESS;
+        }
+
+        blocker.entry = entry;
+        entry->waiters.add_back(&blocker);
+        releaseLock(&neighboursLock);
+
+        if(probe){
+            SendRequest(adapter, ip);
+        }
+
+        // The timer thread gives up on the entry well before this
+        long timeout = NEIGHBOUR_RETRANSMIT_TIME * (NEIGHBOUR_MAX_PROBES + 1);
+        bool interrupted = Scheduler::GetCurrentThread()->Block(&blocker, timeout);
+
+        int status = -EADDRNOTAVAIL;
+
+        acquireLock(&neighboursLock);
+        if(blocker.entry){
+            blocker.entry->waiters.remove(&blocker); // Interrupted or timed out
+        }
+
+        if(entries.get({adapter, ip}, entry) && entry->state != NeighbourIncomplete){
+            mac = entry->mac;
+            status = 0;
+        }
+        releaseLock(&neighboursLock);
+
+        if(status && interrupted){
+            return -EINTR;
+        }
+
+        return status;
+    }
+
+    void Output(NetworkAdapter* adapter, const IPv4Address& ip, NetBuffer* buffer, CachedRoute* cache){
+        bool probe = false;
+
+        acquireLock(&neighboursLock);
+        NeighbourEntry* entry;
+        if(cache && cache->neighbour && cache->neighbourGeneration == removedGeneration &&
+            cache->neighbour->adapter == adapter && cache->neighbour->ip.value == ip.value){
+            entry = cache->neighbour; // Still in the table, skip the lookup
+            UseEntry(entry, Timer::GetSystemUptimeStruct(), probe);
+        } else {
+            entry = GetEntry(adapter, ip, probe);
+
+            if(cache){
+                cache->neighbour = entry;
+                cache->neighbourGeneration = removedGeneration;
+            }
+        }
+
+        if(entry->state == NeighbourIncomplete){
+            if(entry->queue.get_length() >= NEIGHBOUR_QUEUE_MAX){
+                entry->queue.remove_at(0)->Unref(); // Drop the oldest packet
+            }
+
+            entry->queue.add_back(buffer);
+            releaseLock(&neighboursLock);
+
+            if(probe){
+                SendRequest(adapter, ip);
+            }
+            return;
+        }
+
+        reinterpret_cast<EthernetFrame*>(buffer->data)->dest = entry->mac;
+        releaseLock(&neighboursLock);
+
+        if(probe){
+            SendRequest(adapter, ip);
+        }
+
+        adapter->SendBuffer(buffer);
+    }
+
+    void Update(NetworkAdapter* adapter, const IPv4Address& ip, const MACAddress& mac, bool create){
+        FastList<NetBuffer*> pending;
+        timeval now = Timer::GetSystemUptimeStruct();
+
+        acquireLock(&neighboursLock);
+        NeighbourEntry* entry;
+        if(entries.get({adapter, ip}, entry)){
+            entry->state = NeighbourReachable;
+        } else if(create){
+            // The host is talking to us so it is likely we will reply,
+            // but nothing has confirmed that it can hear us yet.
+            entry = new NeighbourEntry(adapter, ip);
+            entry->state = NeighbourStale;
+            entry->used = now;
+
+            entries.insert({adapter, ip}, entry);
+            entryList.add_back(entry);
+        } else {
+            releaseLock(&neighboursLock);
+            return;
+        }
+
+        entry->mac = mac;
+        entry->probes = 0;
+        entry->updated = now;
+
+        while(entry->queue.get_length()){
+            pending.add_back(entry->queue.remove_at(0));
+        }
+
+        WakeWaiters(entry);
+        releaseLock(&neighboursLock);
+
+        while(pending.get_length()){
+            NetBuffer* buffer = pending.remove_at(0);
+
+            reinterpret_cast<EthernetFrame*>(buffer->data)->dest = mac;
+            adapter->SendBuffer(buffer);
+        }
+    }
+
+    void RemoveAdapter(NetworkAdapter* adapter){
+        acquireLock(&neighboursLock);
+        for(unsigned i = 0; i < entryList.get_length();){
+            NeighbourEntry* entry = entryList[i];
+            if(entry->adapter == adapter){
+                entryList.erase(i);
+                RemoveEntry(entry);
+            } else {
+                i++;
+            }
+        }
+        releaseLock(&neighboursLock);
+    }
+}
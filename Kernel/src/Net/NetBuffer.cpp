@@ -0,0 +1,217 @@
+#include <Net/NetBuffer.h>
+
+#include <CPU.h>
+#include <CString.h>
+#include <Errno.h>
+#include <Lock.h>
+#include <MM/KMalloc.h>
+#include <MM/Reclaim.h>
+#include <PhysicalAllocator.h>
+#include <UserPointer.h>
+
+namespace Network {
+class NetBufferPool final : public Memory::Shrinker {
+public:
+    NetBuffer* Take() {
+        InterruptDisabler disableInterrupts;
+        ScopedSpinLock lockPool(m_lock);
+
+        NetBuffer* buffer = m_free;
+        if (buffer) {
+            m_free = buffer->next;
+            m_freeCount--;
+        }
+
+        return buffer;
+    }
+
+    void Return(NetBuffer* buffer) {
+        InterruptDisabler disableInterrupts;
+        ScopedSpinLock lockPool(m_lock);
+
+        buffer->next = m_free;
+        m_free = buffer;
+        m_freeCount++;
+    }
+
+    void Grow(unsigned count) {
+        while (count-- && m_totalCount < NET_BUFFER_POOL_MAX) {
+            NetBuffer* buffer = new NetBuffer();
+            buffer->m_physical = Memory::AllocatePhysicalMemoryBlock();
+            buffer->m_head = reinterpret_cast<uint8_t*>(Memory::KernelAllocate4KPages(1));
+            Memory::KernelMapVirtualMemory4K(buffer->m_physical, reinterpret_cast<uintptr_t>(buffer->m_head), 1);
+
+            __atomic_add_fetch(&m_totalCount, 1, __ATOMIC_RELAXED);
+            Return(buffer);
+        }
+    }
+
+    ALWAYS_INLINE unsigned FreeCount() const { return m_freeCount; }
+
+    size_t CountReclaimable() override {
+        if (m_totalCount <= NET_BUFFER_POOL_MIN) {
+            return 0;
+        }
+
+        // Each buffer is a page
+        unsigned excess = m_totalCount - NET_BUFFER_POOL_MIN;
+        return (excess < m_freeCount) ? excess : m_freeCount;
+    }
+
+    size_t Shrink(size_t pages) override {
+        size_t freed = 0;
+        while (freed < pages && m_totalCount > NET_BUFFER_POOL_MIN) {
+            NetBuffer* buffer = Take();
+            if (!buffer) {
+                break;
+            }
+
+            Memory::FreePhysicalMemoryBlock(buffer->m_physical);
+            Memory::KernelFree4KPages(buffer->m_head, 1);
+            delete buffer;
+
+            __atomic_sub_fetch(&m_totalCount, 1, __ATOMIC_RELAXED);
+            freed++;
+        }
+
+        return freed;
+    }
+
+private:
+    lock_t m_lock = 0;
+    NetBuffer* m_free = nullptr;
+    unsigned m_freeCount = 0;
+    unsigned m_totalCount = 0;
+};
+
+static NetBufferPool* pool = nullptr;
+static lock_t poolInitLock = 0;
+
+static NetBufferPool* Pool() {
+    if (!pool) {
+        ScopedSpinLock lockInit(poolInitLock);
+        if (!pool) {
+            NetBufferPool* newPool = new NetBufferPool();
+            newPool->Grow(NET_BUFFER_POOL_RESERVE * 2);
+            Memory::RegisterShrinker(newPool);
+
+            __atomic_store_n(&pool, newPool, __ATOMIC_RELEASE);
+        }
+    }
+
+    return pool;
+}
+
+NetBuffer* NetBuffer::Allocate() {
+    NetBufferPool* p = Pool();
+    if (p->FreeCount() < NET_BUFFER_POOL_RESERVE && CheckInterrupts()) {
+        p->Grow(NET_BUFFER_POOL_GROW);
+    }
+
+    NetBuffer* buffer = p->Take();
+    if (!buffer) {
+        return nullptr;
+    }
+
+    buffer->next = buffer->prev = nullptr;
+    buffer->adapter = nullptr;
+    buffer->data = buffer->tail = buffer->m_head;
+    buffer->checksumStart = nullptr;
+    buffer->checksumOffset = 0;
+    buffer->gsoSize = 0;
+    buffer->payloadChecksum = 0;
+    buffer->hasPayloadChecksum = false;
+    buffer->m_refCount = 1;
+
+    return buffer;
+}
+
+NetBuffer* NetBuffer::AllocateWithHeadroom() {
+    NetBuffer* buffer = Allocate();
+    if (buffer) {
+        buffer->Reserve(NET_BUFFER_HEADROOM);
+    }
+
+    return buffer;
+}
+
+void NetBuffer::FillPool() {
+    NetBufferPool* p = Pool();
+    if (p->FreeCount() < NET_BUFFER_POOL_RESERVE) {
+        p->Grow(NET_BUFFER_POOL_GROW);
+    }
+}
+
+void NetBuffer::Unref() {
+    assert(m_refCount);
+
+    if (__atomic_sub_fetch(&m_refCount, 1, __ATOMIC_ACQ_REL) == 0) {
+        Pool()->Return(this);
+    }
+}
+
+NetBufferQueue::~NetBufferQueue() { Clear(); }
+
+void NetBufferQueue::Enqueue(NetBuffer* buffer) {
+    size_t length = buffer->Length();
+
+    ScopedSpinLock lockQueue(m_lock);
+
+    // Only append to a buffer nobody else holds, otherwise they would see the data too
+    NetBuffer* back = m_buffers.get_back();
+    if (back && length <= NET_BUFFER_COALESCE_MAX && back->m_refCount == 1 && back->Tailroom() >= length) {
+        memcpy(back->Put(length), buffer->data, length);
+        m_length += length;
+        return;
+    }
+
+    buffer->Ref();
+    m_buffers.add_back(buffer);
+    m_length += length;
+    m_memory += NET_BUFFER_SIZE;
+}
+
+int64_t NetBufferQueue::Read(void* buffer, size_t length) {
+    ScopedSpinLock lockQueue(m_lock);
+
+    uint8_t* dest = reinterpret_cast<uint8_t*>(buffer);
+    size_t read = 0;
+    while (read < length && m_buffers.get_length()) {
+        NetBuffer* front = m_buffers.get_front();
+
+        size_t count = front->Length();
+        if (count > length - read) {
+            count = length - read;
+        }
+
+        if (UserCopy(dest + read, front->data, count)) {
+            return read ? static_cast<int64_t>(read) : -EFAULT;
+        }
+
+        front->Pull(count);
+        read += count;
+        m_length -= count;
+
+        if (!front->Length()) {
+            m_buffers.remove(front);
+            m_memory -= NET_BUFFER_SIZE;
+            front->Unref();
+        }
+    }
+
+    return read;
+}
+
+void NetBufferQueue::Clear() {
+    ScopedSpinLock lockQueue(m_lock);
+
+    while (m_buffers.get_length()) {
+        NetBuffer* front = m_buffers.get_front();
+        m_buffers.remove(front);
+        front->Unref();
+    }
+
+    m_length = 0;
+    m_memory = 0;
+}
+} // namespace Network
@@ -1,10 +1,13 @@
 #include <Net/Adapter.h>
+#include <Net/Neighbour.h>
+#include <Net/Route.h>
 
 #include <List.h>
 #include <Logging.h>
 #include <Assert.h>
 #include <Errno.h>
 #include <Net/Socket.h>
+#include <UserPointer.h>
 
 namespace Network {
     extern Vector<NetworkAdapter*> adapters;
@@ -17,6 +20,11 @@ namespace Network {
         assert(!"NetworkAdapter: Base class SendPacket has been called");
     }
 
+    void NetworkAdapter::SendBuffer(NetBuffer* buffer){
+        SendPacket(buffer->data, buffer->Length());
+        buffer->Unref();
+    }
+
     int NetworkAdapter::GetLink() const {
         return linkState;
     }
@@ -25,7 +33,7 @@ namespace Network {
         return queue.get_length();
     }
 
-    NetworkPacket* NetworkAdapter::Dequeue() { 
+    NetBuffer* NetworkAdapter::Dequeue() { 
         if(queue.get_length()) {
             packetSemaphore.SetValue(queue.get_length() - 1);
             return queue.remove_at(0); 
@@ -34,7 +42,25 @@ namespace Network {
         }
     }
 
-    NetworkPacket* NetworkAdapter::DequeueBlocking() {
+    int NetworkAdapter::Poll(int budget){
+        return 0; // Drivers that do not poll queue packets from their interrupt handler
+    }
+
+    void NetworkAdapter::EnableReceiveInterrupts(){}
+
+    void NetworkAdapter::SchedulePoll(){
+        if(!__atomic_exchange_n(&pollScheduled, true, __ATOMIC_ACQ_REL)){
+            Network::packetQueueSemaphore.Signal(); // Wake the network thread
+        }
+    }
+
+    void NetworkAdapter::CompletePoll(){
+        // Clear before unmasking so an interrupt straight after schedules another poll
+        __atomic_store_n(&pollScheduled, false, __ATOMIC_RELEASE);
+        EnableReceiveInterrupts();
+    }
+
+    NetBuffer* NetworkAdapter::DequeueBlocking() {
         if(packetSemaphore.Wait()){
             return nullptr; // We were interrupted
         }
@@ -46,60 +72,90 @@ namespace Network {
         }
     }
     
-    void NetworkAdapter::CachePacket(NetworkPacket* pkt){
-        if(cache.get_length() < maxCache){
-            acquireLock(&cacheLock);
-
-            cache.add_back(pkt);
-
-            releaseLock(&cacheLock);
-        } else {
-            delete pkt;
-        }
-    };
-
     int NetworkAdapter::Ioctl(uint64_t cmd, uint64_t arg){
         Process* currentProcess = Scheduler::GetCurrentProcess();
 
-        if(cmd == SIOCADDRT){
+        if(cmd == SIOCADDRT || cmd == SIOCDELRT){
             rtentry* route = reinterpret_cast<rtentry*>(arg);
             if(!Memory::CheckUsermodePointer(arg, sizeof(rtentry), currentProcess->addressSpace)){
                 return -EFAULT;
             }
 
-            if(!((route->rt_flags & RTF_GATEWAY) && (route->rt_flags & RTF_UP))){
+            if(currentProcess->euid != 0){
+                IF_DEBUG(debugLevelNetwork >= DebugLevelVerbose, {
+                    Log::Warning("[Network] NetworkAdapter::Ioctl: Attempted SIOCADDRT/SIOCDELRT as EUID %d!", currentProcess->euid);
+                });
+                return -EPERM; // We are not root
+            }
+
+            NetworkAdapter* namedAdapter = nullptr;
+            if(route->rt_dev){
+                size_t nameLen;
+                if(strlenSafe(route->rt_dev, nameLen, currentProcess->addressSpace)){
+                    return -EFAULT;
+                }
+
+                namedAdapter = NetFS::GetInstance()->FindAdapter(route->rt_dev, nameLen);
+                if(!namedAdapter){
+                    return -ENODEV;
+                }
+            }
+
+            // An unspecified destination and mask make a default route
+            const sockaddr_in* dest = reinterpret_cast<const sockaddr_in*>(&route->rt_dst);
+            const sockaddr_in* mask = reinterpret_cast<const sockaddr_in*>(&route->rt_genmask);
+            if((dest->sin_family && dest->sin_family != SocketProtocol::InternetProtocol) ||
+                (mask->sin_family && mask->sin_family != SocketProtocol::InternetProtocol)){
+                return -EPROTONOSUPPORT; // Not IPv4 address
+            }
+
+            IPv4Address destination = dest->sin_family ? dest->sin_addr.s_addr : INADDR_ANY;
+            IPv4Address destinationMask = mask->sin_family ? mask->sin_addr.s_addr : INADDR_ANY;
+            if(route->rt_flags & RTF_HOST){
+                destinationMask = INADDR_BROADCAST; // 255.255.255.255
+            }
+
+            if(cmd == SIOCDELRT){
+                return Routing::RemoveRoute(destination, destinationMask, namedAdapter);
+            }
+
+            if(!(route->rt_flags & RTF_UP)){
                 return -EINVAL;
             }
 
-            size_t nameLen;
-            if(strlenSafe(route->rt_dev, nameLen, currentProcess->addressSpace)){
-                return -EFAULT;
+            IPv4Address gateway = INADDR_ANY;
+            if(route->rt_flags & RTF_GATEWAY){
+                sockaddr_in* addr = reinterpret_cast<sockaddr_in*>(&route->rt_gateway);
+                if(addr->sin_family != SocketProtocol::InternetProtocol){
+                    IF_DEBUG(debugLevelNetwork >= DebugLevelVerbose, {
+                        Log::Warning("[Network] NetworkAdapter::Ioctl: Not an IPv4 address! :O :O");
+                    });
+                    return -EPROTONOSUPPORT; // Not IPv4 address
+                }
+                gateway = addr->sin_addr.s_addr;
             }
 
-            NetworkAdapter* namedAdapter = NetFS::GetInstance()->FindAdapter(route->rt_dev, nameLen);
             if(!namedAdapter){
-                return -ENODEV;
+                // Send through the adapter the gateway (or destination) is reachable on
+                IPv4Address nextHop;
+                if(Route(INADDR_ANY, gateway.value ? gateway : destination, nextHop, namedAdapter)){
+                    return -ENETUNREACH;
+                }
             }
 
-            if(currentProcess->euid != 0){
-                IF_DEBUG(debugLevelNetwork >= DebugLevelVerbose, {
-                    Log::Warning("[Network] NetworkAdapter::Ioctl: Attempted SIOCADDRT as EUID %d!", currentProcess->euid);
-                });
-                return -EPERM; // We are not root
+            if(int e = Routing::AddRoute(destination, destinationMask, gateway, namedAdapter, route->rt_metric)){
+                return e;
             }
 
-            sockaddr_in* addr = reinterpret_cast<sockaddr_in*>(&route->rt_gateway);
-            if(addr->sin_family != SocketProtocol::InternetProtocol){
-                IF_DEBUG(debugLevelNetwork >= DebugLevelVerbose, {
-                    Log::Warning("[Network] NetworkAdapter::Ioctl: Not an IPv4 address! :O :O");
-                });
-                return -EPROTONOSUPPORT; // Not IPv4 address
-            }
-            namedAdapter->gatewayIP.value = addr->sin_addr.s_addr;
+            if(gateway.value){
+                if(!destinationMask.value){
+                    namedAdapter->gatewayIP = gateway;
+                }
 
-            // Add the gateway to the ARP cache
-            MACAddress mac;
-            IPLookup(namedAdapter, namedAdapter->gatewayIP, mac);
+                // Start resolving the gateway so the first packets through it do not have to wait
+                MACAddress mac;
+                Neighbour::Resolve(namedAdapter, gateway, mac, false);
+            }
             return 0;
         } else if(cmd >= SIOCGIFNAME && cmd <= SIOCGIFCOUNT){
             ifreq* req = reinterpret_cast<ifreq*>(arg);
@@ -143,6 +199,7 @@ namespace Network {
                 }
 
                 namedAdapter->adapterIP.value = addr->sin_addr.s_addr;
+                Routing::UpdateAdapter(namedAdapter);
                 break;
             } case SIOCGIFNETMASK: {
                 sockaddr_in* addr = reinterpret_cast<sockaddr_in*>(&req->ifr_netmask);
@@ -166,6 +223,7 @@ namespace Network {
                 }
 
                 namedAdapter->subnetMask.value = addr->sin_addr.s_addr;
+                Routing::UpdateAdapter(namedAdapter);
                 break;
             } case SIOCGIFHWADDR: {
                 memcpy(req->ifr_hwaddr.data, namedAdapter->mac.data, sizeof(MACAddress));  // Hardware (MAC) address
@@ -177,6 +235,28 @@ namespace Network {
                 return -EINVAL;
             }
             return 0;
+        } else if(cmd == SIOCGIFSTATS){
+            ifreq* req = reinterpret_cast<ifreq*>(arg);
+
+            if(!Memory::CheckUsermodePointer(arg, sizeof(ifreq), currentProcess->addressSpace)){
+                return -EFAULT;
+            }
+
+            NetworkAdapter* namedAdapter = NetFS::GetInstance()->FindAdapter(req->ifr_name, IF_NAMESIZE);
+            if(!namedAdapter){
+                return -ENODEV;
+            }
+
+            if_stats result;
+            result.rx_packets = namedAdapter->stats.rxPackets;
+            result.rx_dropped = namedAdapter->stats.rxDropped;
+            result.rx_polls = namedAdapter->stats.rxPolls;
+            result.tx_dropped = namedAdapter->stats.txDropped;
+
+            if(CopyToUser(req->ifr_data, &result, sizeof(if_stats))){
+                return -EFAULT;
+            }
+            return 0;
         } else {
             return -EINVAL;
         }
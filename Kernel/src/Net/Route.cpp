@@ -0,0 +1,297 @@
+#include <Net/Route.h>
+
+#include <Net/Adapter.h>
+
+#include <Errno.h>
+#include <Lock.h>
+#include <Logging.h>
+#include <Math.h>
+
+namespace Network::Routing {
+    struct RouteEntry {
+        RouteEntry* next = nullptr; // Next route to the same prefix, ordered by metric
+
+        IPv4Address gateway;
+        NetworkAdapter* adapter;
+        int metric;
+        bool connected; // Route to the adapter's own subnet
+    };
+
+    // Prefixes are kept in host byte order so bits can be compared from the most significant
+    struct RouteNode {
+        uint32_t prefix; // Bits past length are zero
+        unsigned length;
+
+        RouteNode* children[2] = {nullptr, nullptr};
+        RouteEntry* routes = nullptr; // Routes to this prefix, internal nodes may have none
+    };
+
+    static ReadWriteLock tableLock;
+    static RouteNode* root = nullptr;
+    static unsigned generation = 1; // 0 is never used so an empty CachedRoute is always out of date
+
+    ALWAYS_INLINE static uint32_t PrefixMask(unsigned length){
+        return length ? ~0U << (32 - length) : 0;
+    }
+
+    ALWAYS_INLINE static unsigned PrefixBit(uint32_t prefix, unsigned index){
+        return (prefix >> (31 - index)) & 1;
+    }
+
+    // Get the prefix length of a mask, -1 if it is not contiguous
+    static int MaskLength(const IPv4Address& mask){
+        uint32_t hostMask = __builtin_bswap32(mask.value);
+        if(~hostMask & (~hostMask + 1)){
+            return -1; // There are ones after the first zero
+        }
+
+        return __builtin_popcount(hostMask);
+    }
+
+    // Find or create the node for a prefix, tableLock must be held for writing
+    static RouteNode* InsertNode(uint32_t prefix, unsigned length){
+        RouteNode** link = &root;
+        for(;;){
+            RouteNode* node = *link;
+            if(!node){
+                node = new RouteNode{prefix, length};
+                *link = node;
+                return node;
+            }
+
+            // Length of the prefix shared by the node and the new prefix
+            unsigned common = MIN(node->length, length);
+            if(uint32_t difference = node->prefix ^ prefix; difference){
+                common = MIN(common, static_cast<unsigned>(__builtin_clz(difference)));
+            }
+
+            if(common == node->length){
+                if(common == length){
+                    return node;
+                }
+
+                link = &node->children[PrefixBit(prefix, node->length)]; // The node covers the prefix
+                continue;
+            }
+
+            // Split the compressed path where the prefixes differ
+            RouteNode* split = new RouteNode{prefix & PrefixMask(common), common};
+            split->children[PrefixBit(node->prefix, common)] = node;
+            *link = split;
+
+            if(common == length){
+                return split; // The new prefix covers the node
+            }
+
+            RouteNode* leaf = new RouteNode{prefix, length};
+            split->children[PrefixBit(prefix, common)] = leaf;
+            return leaf;
+        }
+    }
+
+    // Find the node for a prefix, tableLock must be held
+    static RouteNode* FindNode(uint32_t prefix, unsigned length){
+        RouteNode* node = root;
+        while(node && node->length <= length && (prefix & PrefixMask(node->length)) == node->prefix){
+            if(node->length == length){
+                return node;
+            }
+
+            node = node->children[PrefixBit(prefix, node->length)];
+        }
+
+        return nullptr;
+    }
+
+    // Insert a route to a node keeping the routes ordered by metric
+    static void InsertRoute(RouteNode* node, RouteEntry* route){
+        RouteEntry** link = &node->routes;
+        while(*link && (*link)->metric <= route->metric){
+            link = &(*link)->next;
+        }
+
+        route->next = *link;
+        *link = route;
+    }
+
+    // Remove routes matching a predicate from the whole table, tableLock must be held for writing
+    template<typename P>
+    static void RemoveRoutes(RouteNode* node, P&& predicate){
+        if(!node){
+            return;
+        }
+
+        for(RouteEntry** link = &node->routes; *link;){
+            RouteEntry* route = *link;
+            if(predicate(route)){
+                *link = route->next;
+                delete route;
+            } else {
+                link = &route->next;
+            }
+        }
+
+        RemoveRoutes(node->children[0], predicate);
+        RemoveRoutes(node->children[1], predicate);
+    }
+
+    int AddRoute(const IPv4Address& destination, const IPv4Address& mask, const IPv4Address& gateway, NetworkAdapter* adapter, int metric){
+        int length = MaskLength(mask);
+        if(length < 0){
+            return -EINVAL;
+        }
+
+        uint32_t prefix = __builtin_bswap32(destination.value) & PrefixMask(length);
+
+        tableLock.AcquireWrite();
+        RouteNode* node = InsertNode(prefix, length);
+        for(RouteEntry* route = node->routes; route; route = route->next){
+            if(route->adapter == adapter && route->gateway.value == gateway.value){
+                tableLock.ReleaseWrite();
+                return -EEXIST;
+            }
+        }
+
+        InsertRoute(node, new RouteEntry{nullptr, gateway, adapter, metric, false});
+        __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+        tableLock.ReleaseWrite();
+
+        IF_DEBUG(debugLevelNetwork >= DebugLevelVerbose, {
+            Log::Info("[Network] Added route to %d.%d.%d.%d/%d through %d.%d.%d.%d (%s, metric %d)", destination.data[0], destination.data[1], destination.data[2], destination.data[3], length,
+                gateway.data[0], gateway.data[1], gateway.data[2], gateway.data[3], adapter->InstanceName().c_str(), metric);
+        });
+        return 0;
+    }
+
+    int RemoveRoute(const IPv4Address& destination, const IPv4Address& mask, NetworkAdapter* adapter){
+        int length = MaskLength(mask);
+        if(length < 0){
+            return -EINVAL;
+        }
+
+        uint32_t prefix = __builtin_bswap32(destination.value) & PrefixMask(length);
+
+        tableLock.AcquireWrite();
+        RouteNode* node = FindNode(prefix, length);
+        if(node){
+            for(RouteEntry** link = &node->routes; *link; link = &(*link)->next){
+                RouteEntry* route = *link;
+                if(!route->connected && (!adapter || route->adapter == adapter)){
+                    *link = route->next;
+                    delete route;
+
+                    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+                    tableLock.ReleaseWrite();
+                    return 0;
+                }
+            }
+        }
+        tableLock.ReleaseWrite();
+
+        return -ESRCH;
+    }
+
+    void UpdateAdapter(NetworkAdapter* adapter){
+        int length = MaskLength(adapter->subnetMask);
+
+        tableLock.AcquireWrite();
+        RemoveRoutes(root, [adapter](RouteEntry* route) -> bool { return route->connected && route->adapter == adapter; });
+
+        if(adapter->adapterIP.value != INADDR_ANY && length >= 0){
+            uint32_t prefix = __builtin_bswap32(adapter->adapterIP.value) & PrefixMask(length);
+            InsertRoute(InsertNode(prefix, length), new RouteEntry{nullptr, INADDR_ANY, adapter, 0, true});
+        }
+
+        __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+        tableLock.ReleaseWrite();
+    }
+
+    void RemoveAdapter(NetworkAdapter* adapter){
+        tableLock.AcquireWrite();
+        RemoveRoutes(root, [adapter](RouteEntry* route) -> bool { return route->adapter == adapter; });
+
+        __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+        tableLock.ReleaseWrite();
+    }
+
+    unsigned Generation(){
+        return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    }
+}
+
+namespace Network {
+    int Route(const IPv4Address& local, const IPv4Address& dest, IPv4Address& nextHop, NetworkAdapter*& adapter){
+        using namespace Routing;
+
+        uint32_t address = __builtin_bswap32(dest.value);
+
+        // Every prefix matching the destination, from the shortest to the longest
+        RouteNode* matches[33];
+        unsigned matchCount = 0;
+
+        tableLock.AcquireRead();
+        RouteNode* node = root;
+        while(node && (address & PrefixMask(node->length)) == node->prefix){
+            if(node->routes){
+                matches[matchCount++] = node;
+            }
+
+            if(node->length == 32){
+                break;
+            }
+
+            node = node->children[PrefixBit(address, node->length)];
+        }
+
+        while(matchCount--){
+            for(RouteEntry* route = matches[matchCount]->routes; route; route = route->next){
+                if(adapter && route->adapter != adapter){
+                    continue; // Bound to another adapter
+                }
+
+                if(local.value != INADDR_ANY && route->adapter->adapterIP.value != local.value){
+                    continue; // Local address does not correspond to the adapter IP address
+                }
+
+                adapter = route->adapter;
+                nextHop = route->gateway.value == INADDR_ANY ? dest : route->gateway;
+                tableLock.ReleaseRead();
+
+                Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] Route: %d.%d.%d.%d through %s", dest.data[0], dest.data[1], dest.data[2], dest.data[3], adapter->InstanceName().c_str());
+                return 0;
+            }
+        }
+        tableLock.ReleaseRead();
+
+        return -ENETUNREACH;
+    }
+
+    int Route(const IPv4Address& local, const IPv4Address& dest, CachedRoute& cache, IPv4Address& nextHop, NetworkAdapter*& adapter){
+        unsigned generation = Routing::Generation();
+
+        acquireLock(&cache.lock);
+        if(cache.generation == generation && cache.destination.value == dest.value && cache.local.value == local.value && (!adapter || adapter == cache.adapter)){
+            nextHop = cache.nextHop;
+            adapter = cache.adapter;
+
+            releaseLock(&cache.lock);
+            return 0;
+        }
+        releaseLock(&cache.lock);
+
+        if(int e = Route(local, dest, nextHop, adapter)){
+            return e;
+        }
+
+        // If the table changed since we read the generation, the route is looked up again next time
+        acquireLock(&cache.lock);
+        cache.generation = generation;
+        cache.local = local;
+        cache.destination = dest;
+        cache.nextHop = nextHop;
+        cache.adapter = adapter;
+        releaseLock(&cache.lock);
+
+        return 0;
+    }
+}
@@ -93,6 +93,41 @@ int64_t Socket::SendTo(void* buffer, size_t len, int flags, const sockaddr* src,
     return -1; // We should not return but get the compiler to shut up
 }
 
+int64_t Socket::ReceiveMessage(msghdr* msg, int flags) {
+    long read = 0;
+    for (unsigned i = 0; i < static_cast<unsigned>(msg->msg_iovlen); i++) {
+        socklen_t len = msg->msg_namelen;
+        long ret = ReceiveFrom(msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len, flags,
+                               reinterpret_cast<sockaddr*>(msg->msg_name), &len, msg->msg_control, msg->msg_controllen);
+        msg->msg_namelen = len;
+
+        if (ret < 0) {
+            return ret;
+        }
+
+        read += ret;
+    }
+
+    return read;
+}
+
+int64_t Socket::SendMessage(const msghdr* msg, int flags) {
+    long sent = 0;
+    for (unsigned i = 0; i < static_cast<unsigned>(msg->msg_iovlen); i++) {
+        long ret = SendTo(msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len, flags,
+                          reinterpret_cast<const sockaddr*>(msg->msg_name), msg->msg_namelen, msg->msg_control,
+                          msg->msg_controllen);
+
+        if (ret < 0) {
+            return ret;
+        }
+
+        sent += ret;
+    }
+
+    return sent;
+}
+
 int Socket::GetSocketOptions(int level, int opt, void* optValue, socklen_t* optLength) {
     if (level == SOL_SOCKET) {
         switch (opt) {
@@ -2,58 +2,47 @@
 #include <Net/Socket.h>
 #include <Net/Adapter.h>
 
+#include <Objects/Process.h>
+#include <Scheduler.h>
 #include <Timer.h>
 #include <Math.h>
 
 #include <Errno.h>
-
-// Create an identifier for a connection with the source IP, dest IP, source port and destination port.
-// This allows for one connection per port per remote address per local adddress
-struct TCPConnectionIdentifier{
-    IPv4Address localIP; // Local TCP Endpoint IP
-    IPv4Address remoteIP; // Remote TCP Endpoint IP
-    uint16_t localPort; // Local Port
-    uint16_t remotePort; // Remote Port
-
-    TCPConnectionIdentifier() = default;
-
-    TCPConnectionIdentifier(const IPv4Address& local, const IPv4Address& remote, uint16_t lPort, uint16_t rPort) : localIP(local), remoteIP(remote), localPort(lPort), remotePort(rPort){
-
-    }
-
-    inline bool operator==(const TCPConnectionIdentifier& other) const{
-        return remoteIP.value == other.remoteIP.value && localIP.value == other.localIP.value && remotePort == other.remotePort && localPort == other.localPort;
-    }
-};
-
-template<>
-inline unsigned Hash<TCPConnectionIdentifier>(const TCPConnectionIdentifier& id){
-    return ::Hash(id.remoteIP.value) ^ ::Hash(id.localIP.value) ^ ::Hash(id.remotePort) ^ ::Hash(id.localPort);
-}
+#include <UserPointer.h>
 
 namespace Network {
     namespace TCP {
+        // Sockets that have been closed by their owner but are still shutting down the connection
         List<TCPSocket*> closedSockets;
-        HashMap<TCPConnectionIdentifier, TCPSocket*> sockets;
+        lock_t closedSocketsLock = 0;
+
+        // Looked up concurrently by the protocol workers,
+        // which take a reference under the bucket lock before the socket can be removed
+        ConcurrentHashMap<TCPConnectionIdentifier, TCPSocket*> sockets;
         uint16_t nextEphemeralPort = EPHEMERAL_PORT_RANGE_START;
 
+        static void RefSocket(TCPSocket* sock){
+            sock->Ref();
+        }
+
+        // Returns a reference to the socket, which the caller must drop
         TCPSocket* FindSocket(TCPConnectionIdentifier id){
             TCPSocket* sock = nullptr;
             
-            if(sockets.get(id, sock)){
+            if(sockets.get(id, sock, RefSocket)){
                 return sock;
             }
 
             id.remoteIP = INADDR_ANY;
             id.remotePort = INADDR_ANY;
             
-            if(sockets.get(id, sock)){
+            if(sockets.get(id, sock, RefSocket)){
                 return sock; // We may want to initiate a connection to a listen socket
             }
 
             id.localIP.value = INADDR_ANY;
             
-            if(sockets.get(id, sock)){
+            if(sockets.get(id, sock, RefSocket)){
                 return sock;
             }
 
@@ -68,12 +57,10 @@ namespace Network {
 
             TCPConnectionIdentifier id = TCPConnectionIdentifier(localAddress, remoteAddress, port, remotePort);
 
-            if(sockets.find(id)){
-                Log::Warning("[Network] AcquirePort: Port %d in use on %d.%d.%d.%d!", port, localAddress.data[0], localAddress.data[0], localAddress.data[1], localAddress.data[2], localAddress.data[3]);
+            if(!sockets.insert(id, sock)){
+                Log::Warning("[Network] AcquirePort: Port %d in use on %d.%d.%d.%d!", port, localAddress.data[0], localAddress.data[1], localAddress.data[2], localAddress.data[3]);
                 return -EADDRINUSE;
             }
-
-            sockets.insert(id, sock);
             
             return 0;
         }
@@ -82,7 +69,7 @@ namespace Network {
             unsigned short port = EPHEMERAL_PORT_RANGE_START;
 
             if(nextEphemeralPort < PORT_MAX){
-                port = nextEphemeralPort++;
+                port = __atomic_fetch_add(&nextEphemeralPort, 1, __ATOMIC_RELAXED);
                 
                 if(AcquirePort(sock, sock->LocalIPAddress(), sock->PeerIPAddress(), port, sock->PeerPort())){
                     port = 0;
@@ -105,84 +92,159 @@ namespace Network {
             return 0;
         }
 
-        BigEndian<uint16_t> CalculateTCPChecksum(const IPv4Address& src, const IPv4Address& dest, void* data, uint16_t size){
-            struct PseudoIPv4Header{
-                uint32_t source;
-                uint32_t destination;
-                uint8_t zero = 0;
-                uint8_t protocol = IPv4ProtocolTCP;
-                BigEndian<uint16_t> length = 0;
-            } __attribute__((packed));
-            uint32_t checksum = 0;
-
-            PseudoIPv4Header pseudoHeader;
-            pseudoHeader.source = src.value;
-            pseudoHeader.destination = dest.value;
-            pseudoHeader.zero = 0;
-            pseudoHeader.protocol = IPv4ProtocolTCP;
-            pseudoHeader.length = size;
-
-            uint16_t* ptr = (uint16_t*)&pseudoHeader;
-            uint16_t count = sizeof(PseudoIPv4Header);
-            while(count >= 2){
-                checksum += *ptr++;
-                count -= 2;
-            }
+        // Unfolded sum of the pseudo header in front of every TCP segment
+        static uint64_t PseudoHeaderSum(const IPv4Address& src, const IPv4Address& dest, uint16_t size){
+            uint64_t sum = static_cast<uint64_t>(src.value) + dest.value;
 
-            ptr = (uint16_t*)data;
-            count = size;
-            while(count >= 2){
-                checksum += *ptr++;
-                count -= 2;
-            }
+            BigEndian<uint16_t> protocol;
+            protocol = IPv4ProtocolTCP; // Zero byte followed by the protocol
+            BigEndian<uint16_t> length;
+            length = size;
 
-            if(count){ // Uneven amount of data
-                checksum += ((uint16_t)(*reinterpret_cast<uint8_t*>(ptr)));
-            }
+            return sum + protocol.value + length.value;
+        }
 
-            checksum = (checksum & 0xFFFF) + (checksum >> 16);
+        BigEndian<uint16_t> CalculateTCPChecksum(const IPv4Address& src, const IPv4Address& dest, void* data, uint16_t size){
+            return ChecksumFinish(ChecksumPartial(data, size, PseudoHeaderSum(src, dest, size)));
+        }
 
+        // Sum of the pseudo header only, folded but not inverted
+        // With checksum offload the adapter adds the rest of the segment to this
+        static BigEndian<uint16_t> CalculatePseudoHeaderChecksum(const IPv4Address& src, const IPv4Address& dest, uint16_t size){
             BigEndian<uint16_t> ret;
-            ret.value = ~checksum;
+            ret.value = ChecksumFold(PseudoHeaderSum(src, dest, size));
             return ret;
         }
 
-        int SendTCP(void* data, size_t length, IPv4Address& source, IPv4Address& destination, TCPHeader& header, NetworkAdapter* adapter = nullptr){
-            uint8_t buffer[1600];
+        // Sequence numbers wrap, compare using the signed difference
+        static inline bool SequenceBefore(uint32_t a, uint32_t b){
+            return static_cast<int32_t>(a - b) < 0;
+        }
 
-            if(length + sizeof(TCPHeader) > 1600){
-                length = 1600 - sizeof(TCPHeader);
-            }
+        static inline bool SequenceAfter(uint32_t a, uint32_t b){
+            return static_cast<int32_t>(a - b) > 0;
+        }
 
-            TCPHeader* tcpHeader = reinterpret_cast<TCPHeader*>(buffer);
+        static inline uint32_t ReadBigEndian32(const uint8_t* p){
+            return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+        }
 
-            memcpy(buffer + sizeof(TCPHeader), data, length);
+        static inline void WriteBigEndian32(uint8_t* p, uint32_t value){
+            p[0] = value >> 24;
+            p[1] = (value >> 16) & 0xff;
+            p[2] = (value >> 8) & 0xff;
+            p[3] = value & 0xff;
+        }
 
-            *tcpHeader = header;
+        static uint32_t GenerateSequenceNumber(){
+            return (Timer::GetSystemUptime() % 512) * (rand() % 255) + Timer::GetTicks();
+        }
 
-            tcpHeader->checksum = 0;
-            tcpHeader->checksum = CalculateTCPChecksum(source, destination, buffer, length + sizeof(TCPHeader));
+        static void ParseOptions(TCPHeader* tcpHeader, size_t headerLength, TCPOptions& options){
+            uint8_t* option = reinterpret_cast<uint8_t*>(tcpHeader) + sizeof(TCPHeader);
+            uint8_t* end = reinterpret_cast<uint8_t*>(tcpHeader) + headerLength;
+
+            while(option < end){
+                uint8_t kind = option[0];
+                if(kind == TCPOptionEnd){
+                    break;
+                } else if(kind == TCPOptionNop){
+                    option++;
+                    continue;
+                }
 
-            if(int e = SendIPv4(buffer, length + sizeof(TCPHeader), source, destination, IPv4ProtocolTCP, adapter); e){
-                return e;
+                if(option + 2 > end || option[1] < 2 || option + option[1] > end){
+                    Log::Debug(debugLevelNetwork, DebugLevelNormal, "[Network] [TCP] Malformed option (kind %hhu)", kind);
+                    break;
+                }
+
+                uint8_t length = option[1];
+                switch(kind){
+                    case TCPOptionMSS:
+                        if(length == 4){
+                            options.mss = (option[2] << 8) | option[3];
+                        }
+                        break;
+                    case TCPOptionWindowScale:
+                        if(length == 3){
+                            options.windowScale = option[2];
+                        }
+                        break;
+                    case TCPOptionSACKPermitted:
+                        options.sackPermitted = true;
+                        break;
+                    case TCPOptionSACK:
+                        for(unsigned i = 2; i + 8 <= length && options.sackCount < TCP_SACK_BLOCKS_MAX; i += 8){
+                            options.sack[options.sackCount].left = ReadBigEndian32(option + i);
+                            options.sack[options.sackCount].right = ReadBigEndian32(option + i + 4);
+                            options.sackCount++;
+                        }
+                        break;
+                    default:
+                        break; // Unknown option, skip it
+                }
+
+                option += length;
             }
+        }
+
+        // Every TCP socket, walked by the timer thread
+        List<TCPSocket*> timerSockets;
+        lock_t timerSocketsLock = 0;
+
+        void TimerThread(){
+            struct Retransmission {
+                NetBuffer* segment;
+                IPv4Address source;
+                IPv4Address destination;
+                NetworkAdapter* adapter;
+            };
+            Vector<Retransmission> retransmissions;
+
+            for(;;){
+                Scheduler::GetCurrentThread()->Sleep(TCP_TIMER_INTERVAL);
+
+                {
+                    ScopedSpinLock lockSockets(timerSocketsLock);
+                    for(TCPSocket* sock : timerSockets){
+                        if(NetBuffer* segment = sock->OnTimer(); segment){
+                            retransmissions.add_back({segment, sock->address, sock->peerAddress, sock->adapter});
+                        }
+                    }
+                }
+
+                // Sending takes the neighbour cache and adapter locks, so never send with the sockets locked
+                for(Retransmission& r : retransmissions){
+                    SendIPv4(r.segment, r.source, r.destination, IPv4ProtocolTCP, r.adapter);
+                }
+                retransmissions.clear();
+            }
+        }
 
-            return length;
+        void InitializeTimerThread(){
+            Process::CreateKernelProcess((void*)TimerThread, "TCPTimer", nullptr)->Start();
         }
 
-        void OnReceiveTCP(IPv4Header& ipHeader, void* data, size_t length){
-            TCPHeader* tcpHeader = reinterpret_cast<TCPHeader*>(data);
-            BigEndian<uint16_t> checksum = tcpHeader->checksum;
+        void OnReceiveTCP(IPv4Header& ipHeader, NetBuffer* buffer){
+            if(buffer->Length() < sizeof(TCPHeader)){
+                Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] Discarding packet (too short)");
+                return;
+            }
+
+            TCPHeader* tcpHeader = reinterpret_cast<TCPHeader*>(buffer->data);
 
             Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] Recieving Packet from %hd.%hd.%hd.%hd:%hu (destination: %hd.%hd.%hd.%hd:%hu)!", ipHeader.sourceIP.data[0], ipHeader.sourceIP.data[1], ipHeader.sourceIP.data[2], ipHeader.sourceIP.data[3], (uint16_t)tcpHeader->srcPort, ipHeader.destIP.data[0], ipHeader.destIP.data[1], ipHeader.destIP.data[2], ipHeader.destIP.data[3], (uint16_t)tcpHeader->destPort);
 
-            /*tcpHeader->checksum = 0;
-            if(uint16_t chk = CalculateTCPChecksum(ipHeader.sourceIP, ipHeader.destIP, data, ipHeader.length).value; chk != checksum.value){
-                Log::Warning("[Network] [TCP] Dropping Packet (invalid checksum %hx, should be: %hx)", (uint16_t)checksum, EndianBigToLittle16(chk));
-            }*/
-            tcpHeader->checksum = checksum;
+            // Summing the segment including its checksum gives 0xFFFF when it is valid
+            // Loopback packets never leave memory so they are not checked
+            if(!buffer->adapter || buffer->adapter->Type() != NetworkAdapter::NetworkAdapterLoopback){
+                if(ChecksumFold(ChecksumPartial(tcpHeader, buffer->Length(), PseudoHeaderSum(ipHeader.sourceIP, ipHeader.destIP, buffer->Length()))) != 0xFFFF){
+                    Log::Debug(debugLevelNetwork, DebugLevelNormal, "[Network] [TCP] Discarding packet (invalid checksum %hx)", (uint16_t)tcpHeader->checksum);
+                    return;
+                }
+            }
 
-            if(tcpHeader->dataOffset * 4 < sizeof(TCPHeader)){
+            if(tcpHeader->dataOffset * 4 < sizeof(TCPHeader) || tcpHeader->dataOffset * 4 > buffer->Length()){
                 return; // Invalid data offset (must be at least 5)
             }
 
@@ -192,15 +254,20 @@ namespace Network {
                 return; // Port not bound to socket
             }
 
-            if(sock->state == TCPSocket::TCPStateUnknown){
-                return; // Has not attempted to open connecction and is not a listen socket
+            if(sock->state != TCPSocket::TCPStateUnknown){ // Unknown if it has not attempted to open a connection and is not a listen socket
+                sock->OnReceive(ipHeader.sourceIP, ipHeader.destIP, buffer);
             }
 
-            sock->OnReceive(ipHeader.sourceIP, ipHeader.destIP, reinterpret_cast<uint8_t*>(data), length);
+            sock->Unref();
         }
 
-        void TCPSocket::OnReceive(const IPv4Address& source, const IPv4Address& dest, uint8_t* data, size_t length){
-            TCPHeader* tcpHeader = reinterpret_cast<TCPHeader*>(data); // Checksum has already been verified
+        void TCPSocket::OnReceive(const IPv4Address& source, const IPv4Address& dest, NetBuffer* buffer){
+            TCPHeader* tcpHeader = reinterpret_cast<TCPHeader*>(buffer->data); // Checksum has already been verified
+            size_t headerLength = tcpHeader->dataOffset * 4;
+            size_t dataLength = buffer->Length() - headerLength;
+
+            TCPOptions options;
+            ParseOptions(tcpHeader, headerLength, options);
 
             if(state == TCPStateUnknown){
                 return; // We should not be receiving packets as we have not opened a connection and we are not listening
@@ -218,15 +285,18 @@ namespace Network {
                 }
 
                 if(syn){
-                    Log::Warning("[Network] [TCP] (State: LISTEN) TCP listen sockets not yet supported! (maybe update your system)");
+                    OnSynchronize(source, dest, tcpHeader, options);
                 }
                 return;
             }
 
+            NetBuffer* retransmit = nullptr;
+
             if(tcpHeader->rst){
                 state = TCPStateUnknown; // Abort connection
 
                 UnblockAll();
+                m_sendSemaphore.Signal();
             } else if(state == TCPStateSyn){
                 bool ack = tcpHeader->ack;
                 bool syn = tcpHeader->syn;
@@ -246,6 +316,9 @@ namespace Network {
                     m_lastAcknowledged = tcpHeader->acknowledgementNumber;
 
                     if(m_lastAcknowledged == m_sequenceNumber){ // The ACK number must be equal to the sequence number.
+                        ApplyOptions(options);
+                        m_sendWindow = tcpHeader->windowSize; // The window in a SYN is never scaled
+
                         state = TCPStateEstablished; // Our SYN has been acknowledged with a SYN-ACK
 
                         UnblockAll(); // Unblock waiting threads
@@ -254,22 +327,45 @@ namespace Network {
 
                 return;
             } else if(state == TCPStateSynAck){
-                bool ack = tcpHeader->ack;
+                if(tcpHeader->syn && !tcpHeader->ack){
+                    SynchronizeAcknowledge(m_sequenceNumber - 1, m_remoteSequenceNumber); // Our SYN-ACK was lost, the peer has sent its SYN again
+                    return;
+                }
 
-                if(ack){
-                    Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] (State: SYN-RECV) Recieved ACK from %d.%d.%d.%d:%d", source.data[0], source.data[1], source.data[2], source.data[3], (uint16_t)tcpHeader->srcPort);
+                if(!tcpHeader->ack || tcpHeader->acknowledgementNumber != m_sequenceNumber){
+                    return;
+                }
 
-                    m_remoteSequenceNumber = tcpHeader->sequence;
+                Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] (State: SYN-RECV) Recieved ACK from %d.%d.%d.%d:%d", source.data[0], source.data[1], source.data[2], source.data[3], (uint16_t)tcpHeader->srcPort);
+
+                m_lastAcknowledged = tcpHeader->acknowledgementNumber;
+                m_sendWindow = static_cast<uint32_t>(tcpHeader->windowSize) << m_sendWindowShift;
+
+                state = TCPStateEstablished; // Our SYN has been acknowledged with a SYN-ACK
 
-                    state = TCPStateEstablished; // Our SYN has been acknowledged with a SYN-ACK
+                if(m_listener){
+                    TCPSocket* listener = m_listener;
+                    m_listener = nullptr;
 
-                    UnblockAll(); // Unblock waiting threads
+                    acquireLock(&listener->m_pendingLock);
+                    listener->pending.add_back(this);
+                    releaseLock(&listener->m_pendingLock);
+
+                    listener->UnblockAll(); // Wake Accept
+                }
+
+                UnblockAll(); // Unblock waiting threads
+
+                if(!dataLength && !tcpHeader->fin){
+                    return;
                 }
-            } else if(state == TCPStateEstablished){
+                // The ACK may carry data, handle it as ESTABLISHED
+            }
+
+            if(state == TCPStateEstablished){
                 bool ack = tcpHeader->ack;
                 bool psh = tcpHeader->psh;
-                bool fin = tcpHeader->fin;
-                
+
                 bool doUnblock = false;
                 uint16_t other = (tcpHeader->flags & (TCPHeader::FlagsMask ^ (TCPHeader::ACK | TCPHeader::PSH | TCPHeader::FIN | TCPHeader::ECE))); // Get all other flags
 
@@ -277,59 +373,26 @@ namespace Network {
                     return; // Unsupported flags
                 }
 
-                if(tcpHeader->sequence != m_remoteSequenceNumber){
-                    Log::Debug(debugLevelNetwork, DebugLevelNormal, "[Network] [TCP] (State: ESTABLISHED) Received packet with sequence number of %d, Expected %d", tcpHeader->sequence, m_remoteSequenceNumber);
-                    return; // Either a previous packet has been dropped, or it is retransmitting a previous packet
-                }
-
-                uint16_t dataOffset = tcpHeader->dataOffset * 4;
-                uint16_t dataLength = length - dataOffset;
-
                 if(ack){
-                    if(tcpHeader->acknowledgementNumber > m_sequenceNumber){
-                        Log::Debug(debugLevelNetwork, DebugLevelNormal, "[Network] [TCP] (State: ESTABLIHSED) recieved ACK wth ack number > sequence number");
-                        return;
-                    }
-
                     acquireLock(&m_unacknowledgedPacketsLock);
+                    bool valid = ProcessAcknowledgement(tcpHeader, dataLength, options, retransmit);
+                    releaseLock(&m_unacknowledgedPacketsLock);
 
-                    m_lastAcknowledged = tcpHeader->acknowledgementNumber;
-
-                    for(auto it = m_unacknowledgedPackets.begin(); it != m_unacknowledgedPackets.end(); it++){
-                        if(it->sequenceNumber <= m_lastAcknowledged){
-                            m_unacknowledgedPackets.remove(it);
-                        }
+                    if(!valid){
+                        Log::Debug(debugLevelNetwork, DebugLevelNormal, "[Network] [TCP] (State: ESTABLIHSED) recieved ACK wth ack number > sequence number");
 
-                        if(it == m_unacknowledgedPackets.end()){
-                            break;
-                        }
+                        Acknowledge(m_remoteSequenceNumber);
+                        return;
                     }
+                }
 
-                    releaseLock(&m_unacknowledgedPacketsLock);
+                if(retransmit){
+                    SendIPv4(retransmit, address, peerAddress, IPv4ProtocolTCP, adapter, &cachedRoute);
                 }
 
                 Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] Recieving %d bytes of data (Flags: %hx, total len: %d)", dataLength, tcpHeader->flags & TCPHeader::FlagsMask);
 
-                if(dataLength){
-                    m_inboundData.Write(data + dataOffset, dataLength);
-
-                    acquireLock(&blockedLock);
-                    FilesystemBlocker* bl = blocked.get_front();
-                    while(bl){
-                        FilesystemBlocker* next = blocked.next(bl);
-
-                        if(bl->RequestedLength() <= m_inboundData.Pos()){
-                            bl->Unblock();
-                        }
-
-                        bl = next;
-                    }
-                    releaseLock(&blockedLock);
-
-                    m_remoteSequenceNumber = tcpHeader->sequence + dataLength;
-
-                    Acknowledge(m_remoteSequenceNumber);
-                }
+                bool finished = ProcessData(tcpHeader, buffer, headerLength, dataLength);
 
                 if(psh){
                     Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] PSH!");
@@ -337,11 +400,10 @@ namespace Network {
                     doUnblock = true;
                 }
 
-                if(fin){
+                if(finished){
                     Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] (State: ESTABLISHED) Peer closed connection with FIN, entering CLOSE-WAIT");
                     state = TCPStateCloseWait; // Connection ended, wait for process(es) to close file descriptors
 
-                    Acknowledge(m_remoteSequenceNumber);
                     doUnblock = true;
                 }
 
@@ -358,18 +420,32 @@ namespace Network {
                     return; // Unexpected flags
                 }
 
-                if(fin && ack){
+                bool finAcknowledged = false;
+                if(ack){
+                    acquireLock(&m_unacknowledgedPacketsLock);
+                    ProcessAcknowledgement(tcpHeader, dataLength, options, retransmit);
+                    releaseLock(&m_unacknowledgedPacketsLock);
+
+                    if(retransmit){
+                        SendIPv4(retransmit, address, peerAddress, IPv4ProtocolTCP, adapter, &cachedRoute);
+                    }
+
+                    finAcknowledged = (tcpHeader->acknowledgementNumber == m_sequenceNumber); // Our FIN is the last thing we sent
+                }
+
+                if(fin && finAcknowledged){
+                    m_remoteSequenceNumber = tcpHeader->sequence + 1;
                     state = TCPStateTimeWait;
 
                     Acknowledge(m_remoteSequenceNumber);
-                } else if(ack){
+                } else if(finAcknowledged){
                     m_remoteSequenceNumber = tcpHeader->sequence;
 
                     state = TCPStateFinWait2;
                 } else if(fin){
                     m_remoteSequenceNumber = tcpHeader->sequence + 1;
 
-                    FinishAcknowledge(m_remoteSequenceNumber);
+                    Acknowledge(m_remoteSequenceNumber); // Simultaneous close, wait for our FIN to be acknowledged
 
                     state = TCPStateLastAck;
                 }
@@ -393,6 +469,17 @@ namespace Network {
 
                     Acknowledge(m_remoteSequenceNumber);
                 }
+            } else if(state == TCPStateCloseWait && (tcpHeader->flags & TCPHeader::FlagsMask) == TCPHeader::ACK){
+                // We may still be sending data after the peer has closed its side
+                acquireLock(&m_unacknowledgedPacketsLock);
+                ProcessAcknowledgement(tcpHeader, dataLength, options, retransmit);
+                releaseLock(&m_unacknowledgedPacketsLock);
+
+                if(retransmit){
+                    SendIPv4(retransmit, address, peerAddress, IPv4ProtocolTCP, adapter, &cachedRoute);
+                }
+            } else if(state == TCPStateCloseWait && tcpHeader->fin){
+                Acknowledge(m_remoteSequenceNumber); // Our ACK of the FIN was lost
             } else if(state == TCPStateCloseWait || state == TCPStateTimeWait){
                 state = TCPStateUnknown;
 
@@ -411,161 +498,592 @@ namespace Network {
             }
 
             if(m_fileClosed && state == TCPStateUnknown){
+                acquireLock(&closedSocketsLock);
                 closedSockets.remove(this);
+                releaseLock(&closedSocketsLock);
+
                 if(port) {
                     ReleasePort();
                 }
 
-                delete this;
+                Unref(); // Freed once the worker delivering this packet drops its reference
             }
         }
 
-        int TCPSocket::Synchronize(uint32_t seqNumber){ // TCP SYN (Establish a connection to the server)
-            TCPHeader tcpHeader;
-            memset(&tcpHeader, 0, sizeof(TCPHeader));
-            
-            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [SYN] Sequence Number: %u", seqNumber);
+        void TCPSocket::OnSynchronize(const IPv4Address& source, const IPv4Address& dest, TCPHeader* tcpHeader, const TCPOptions& options){
+            acquireLock(&m_pendingLock);
+            bool full = pending.get_length() >= m_backlog;
+            releaseLock(&m_pendingLock);
 
-            tcpHeader.srcPort = port;
-            tcpHeader.destPort = destinationPort;
-            tcpHeader.sequence = seqNumber;
-            tcpHeader.acknowledgementNumber = 0;
+            if(full){
+                Log::Debug(debugLevelNetwork, DebugLevelNormal, "[Network] [TCP] (State: LISTEN) Backlog full, dropping SYN");
+                return; // The peer will retransmit its SYN
+            }
 
-            tcpHeader.dataOffset = sizeof(TCPHeader) / 4; // Size of the TCP Header in DWORDs
-            tcpHeader.syn = 1; // SYN/Synchronize
+            TCPSocket* sock = new TCPSocket(StreamSocket, 0);
+            sock->address = dest;
+            sock->peerAddress = source;
+            sock->port = port;
+            sock->destinationPort = tcpHeader->srcPort;
+            sock->adapter = adapter ? adapter : NetFS::GetInstance()->FindAdapter(dest.value);
 
-            tcpHeader.windowSize = 65535;
+            if(!sock->adapter || Network::TCP::AcquirePort(sock, dest, source, port, tcpHeader->srcPort)){
+                delete sock; // No route back or the connection already exists
+                return;
+            }
 
-            tcpHeader.checksum = CalculateTCPChecksum(adapter->adapterIP, peerAddress, &tcpHeader, sizeof(TCPHeader));
+            sock->bound = true;
+            sock->m_listener = this;
 
-            if(int e = SendIPv4(&tcpHeader, sizeof(TCPHeader), address, peerAddress, IPv4ProtocolTCP, adapter); e){
-                return e;
+            sock->ApplyOptions(options);
+            sock->m_sendWindow = tcpHeader->windowSize; // The window in a SYN is never scaled
+            sock->m_remoteSequenceNumber = tcpHeader->sequence + 1;
+
+            uint32_t initialSequence = GenerateSequenceNumber();
+            sock->m_lastAcknowledged = initialSequence;
+            sock->m_recover = initialSequence;
+            sock->m_sequenceNumber = initialSequence + 1; // Our SYN takes up a sequence number
+
+            sock->state = TCPStateSynAck;
+
+            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] (State: LISTEN) Connection from %d.%d.%d.%d:%d", source.data[0], source.data[1], source.data[2], source.data[3], (uint16_t)tcpHeader->srcPort);
+
+            sock->SynchronizeAcknowledge(initialSequence, sock->m_remoteSequenceNumber);
+        }
+
+        NetBuffer* TCPSocket::OnTimer(){
+            NetBuffer* retransmit = nullptr;
+            bool timedOut = false;
+
+            acquireLock(&m_unacknowledgedPacketsLock);
+            if(!m_retransmitTimerActive || Timer::GetSystemUptimeStruct() < m_retransmitDeadline){
+                releaseLock(&m_unacknowledgedPacketsLock);
+                return nullptr;
             }
 
-            return 0;
+            if(!m_unacknowledgedPackets.get_length()){
+                m_retransmitTimerActive = false;
+            } else if(m_unacknowledgedPackets.get_front().retransmits >= TCP_MAX_RETRANSMITS){
+                m_retransmitTimerActive = false;
+                timedOut = true;
+            } else {
+                // Retransmission timeout, go back to slow start (RFC 5681 3.1)
+                uint32_t flight = m_sequenceNumber - m_lastAcknowledged;
+                m_slowStartThreshold = MAX(flight / 2, 2U * m_sendMSS);
+                m_congestionWindow = m_sendMSS;
+                m_duplicateAcks = 0;
+                m_inRecovery = true;
+                m_timeoutRecovery = true;
+                m_recover = m_sequenceNumber;
+
+                // The receiver may have discarded SACKed data (RFC 2018 section 8)
+                for(TCPPacket& packet : m_unacknowledgedPackets){
+                    packet.sacked = false;
+                }
+
+                TCPPacket& packet = m_unacknowledgedPackets.get_front();
+                packet.retransmits++;
+                retransmit = BuildRetransmission(packet);
+
+                // Back off the timer (RFC 6298 5.5)
+                m_rto = MIN(m_rto * 2, TCP_RETRY_MAX);
+                ArmRetransmitTimer();
+            }
+            releaseLock(&m_unacknowledgedPacketsLock);
+
+            if(timedOut){
+                Log::Debug(debugLevelNetwork, DebugLevelNormal, "[Network] [TCP] Connection timed out");
+
+                state = TCPStateUnknown;
+
+                UnblockAll();
+                m_sendSemaphore.Signal();
+            }
+
+            return retransmit;
         }
-        
-        int TCPSocket::Acknowledge(uint32_t ackNumber){ // TCP ACK (Acknowledge connection)
-            TCPHeader tcpHeader;
-            memset(&tcpHeader, 0, sizeof(TCPHeader));
 
-            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [ACK] Acknowledgement Number: %u", ackNumber);
-            
-            tcpHeader.srcPort = port;
-            tcpHeader.destPort = destinationPort;
-            tcpHeader.sequence = m_sequenceNumber;
-            tcpHeader.acknowledgementNumber = ackNumber;
+        NetBuffer* TCPSocket::BuildSegment(uint16_t flags, uint32_t sequence, uint32_t ackNumber, NetBuffer* payload){
+            if(!payload && !(payload = NetBuffer::AllocateWithHeadroom())){
+                return nullptr;
+            }
 
-            tcpHeader.dataOffset = sizeof(TCPHeader) / 4; // Size of the TCP Header in DWORDs
-            tcpHeader.ack = 1; // ACK/Acknowledge
+            TCPHeader header;
+            memset(&header, 0, sizeof(TCPHeader));
 
-            tcpHeader.windowSize = 65535;
+            header.srcPort = port;
+            header.destPort = destinationPort;
+            header.sequence = sequence;
+            header.acknowledgementNumber = ackNumber;
+            header.flags = flags; // Set before dataOffset, they share the same word
+
+            uint8_t options[TCP_OPTIONS_MAX];
+            size_t optionsLength = 0;
+
+            if(flags & TCPHeader::SYN){
+                options[optionsLength++] = TCPOptionMSS;
+                options[optionsLength++] = 4;
+                options[optionsLength++] = TCP_MAX_SEGMENT_SIZE >> 8;
+                options[optionsLength++] = TCP_MAX_SEGMENT_SIZE & 0xff;
+
+                // A SYN-ACK may only carry these if the peer's SYN did
+                bool reply = flags & TCPHeader::ACK;
+                if(!reply || m_windowScaling){
+                    options[optionsLength++] = TCPOptionNop;
+                    options[optionsLength++] = TCPOptionWindowScale;
+                    options[optionsLength++] = 3;
+                    options[optionsLength++] = TCP_WINDOW_SCALE;
+                }
 
-            tcpHeader.checksum = CalculateTCPChecksum(adapter->adapterIP, peerAddress, &tcpHeader, sizeof(TCPHeader));
+                if(!reply || m_sackPermitted){
+                    options[optionsLength++] = TCPOptionNop;
+                    options[optionsLength++] = TCPOptionNop;
+                    options[optionsLength++] = TCPOptionSACKPermitted;
+                    options[optionsLength++] = 2;
+                }
 
-            if(int e = SendIPv4(&tcpHeader, sizeof(TCPHeader), address, peerAddress, IPv4ProtocolTCP, adapter); e){
-                return e;
+                header.windowSize = MIN(TCP_RECEIVE_BUFFER, 65535); // The window in a SYN is never scaled
+            } else {
+                header.windowSize = ReceiveWindow();
+
+                // Tell the peer which out of order data we hold
+                if(m_sackPermitted && !payload->Length()){
+                    ScopedSpinLock lockOutOfOrder(m_outOfOrderLock);
+
+                    if(m_outOfOrder.get_length()){
+                        options[optionsLength++] = TCPOptionNop;
+                        options[optionsLength++] = TCPOptionNop;
+                        options[optionsLength++] = TCPOptionSACK;
+                        uint8_t& sackLength = options[optionsLength++];
+                        sackLength = 2;
+
+                        unsigned blocks = 0;
+                        unsigned i = 0;
+                        while(i < m_outOfOrder.get_length() && blocks < TCP_SACK_BLOCKS_MAX){
+                            uint32_t left = m_outOfOrder[i].sequenceNumber;
+                            uint32_t right = left + m_outOfOrder[i].buffer->Length();
+
+                            // Merge adjacent segments into one block
+                            for(i++; i < m_outOfOrder.get_length() && !SequenceAfter(m_outOfOrder[i].sequenceNumber, right); i++){
+                                uint32_t end = m_outOfOrder[i].sequenceNumber + m_outOfOrder[i].buffer->Length();
+                                if(SequenceAfter(end, right)){
+                                    right = end;
+                                }
+                            }
+
+                            WriteBigEndian32(options + optionsLength, left);
+                            WriteBigEndian32(options + optionsLength + 4, right);
+                            optionsLength += 8;
+                            sackLength += 8;
+                            blocks++;
+                        }
+                    }
+                }
             }
 
-            return 0;
+            assert(!(optionsLength & 3));
+            memcpy(payload->Push(optionsLength), options, optionsLength);
+
+            header.dataOffset = (sizeof(TCPHeader) + optionsLength) / 4; // Size of the TCP Header in DWORDs
+
+            size_t length = payload->Length();
+            TCPHeader* tcpHeader = reinterpret_cast<TCPHeader*>(payload->Push(sizeof(TCPHeader)));
+            *tcpHeader = header;
+
+            if(adapter && (adapter->features & NetworkAdapter::AdapterFeatureChecksumOffload)){
+                tcpHeader->checksum = CalculatePseudoHeaderChecksum(address, peerAddress, length + sizeof(TCPHeader));
+
+                payload->checksumStart = reinterpret_cast<uint8_t*>(tcpHeader);
+                payload->checksumOffset = offsetof(TCPHeader, checksum);
+            } else if(payload->hasPayloadChecksum){
+                // The payload was summed as it was copied in, only the headers are left
+                size_t headerLength = sizeof(TCPHeader) + optionsLength;
+
+                tcpHeader->checksum = 0;
+                uint64_t sum = ChecksumPartial(tcpHeader, headerLength, PseudoHeaderSum(address, peerAddress, length + sizeof(TCPHeader)));
+                tcpHeader->checksum = ChecksumFinish(ChecksumAdd(sum, payload->payloadChecksum));
+            } else {
+                tcpHeader->checksum = 0;
+                tcpHeader->checksum = CalculateTCPChecksum(address, peerAddress, tcpHeader, length + sizeof(TCPHeader));
+            }
+
+            return payload;
         }
-        
-        int TCPSocket::SynchronizeAcknowledge(uint32_t seqNumber, uint32_t ackNumber){ // TCP SYN-ACK (Establish connection to client and acknowledge the connection
-            TCPHeader tcpHeader;
-            memset(&tcpHeader, 0, sizeof(TCPHeader));
 
-            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [SYN-ACK] Sequence Number: %u, Acknowledgement Number: %u", seqNumber, ackNumber);
-            
-            tcpHeader.srcPort = port;
-            tcpHeader.destPort = destinationPort;
-            tcpHeader.sequence = seqNumber;
-            tcpHeader.acknowledgementNumber = ackNumber;
+        int TCPSocket::SendSegment(uint16_t flags, uint32_t sequence, uint32_t ackNumber, NetBuffer* payload){
+            NetBuffer* segment = BuildSegment(flags, sequence, ackNumber, payload);
+            if(!segment){
+                return -ENOBUFS;
+            }
+
+            return SendIPv4(segment, address, peerAddress, IPv4ProtocolTCP, adapter, &cachedRoute);
+        }
 
-            tcpHeader.dataOffset = sizeof(TCPHeader) / 4; // Size of the TCP Header in DWORDs
-            tcpHeader.syn = 1; // SYN/Synchronize
-            tcpHeader.ack = 1; // ACK/Acknowledge
+        NetBuffer* TCPSocket::BuildRetransmission(TCPPacket& packet){
+            // The original buffer may still be on a transmit descriptor, so copy the payload
+            NetBuffer* segment = NetBuffer::AllocateWithHeadroom();
+            if(!segment){
+                return nullptr; // The timer will try again
+            }
 
-            tcpHeader.windowSize = 65535;
+            memcpy(segment->Put(packet.length), packet.buffer->tail - packet.length, packet.length);
+            segment->payloadChecksum = packet.buffer->payloadChecksum; // Same payload, same sum
+            segment->hasPayloadChecksum = packet.buffer->hasPayloadChecksum;
+            if(packet.length > m_sendMSS){
+                segment->gsoSize = m_sendMSS; // Sent with segmentation offload
+            }
 
-            tcpHeader.checksum = CalculateTCPChecksum(adapter->adapterIP, peerAddress, &tcpHeader, sizeof(TCPHeader));
+            return BuildSegment(TCPHeader::ACK | TCPHeader::PSH, packet.sequenceNumber, m_remoteSequenceNumber, segment);
+        }
 
-            if(int e = SendIPv4(&tcpHeader, sizeof(TCPHeader), address, peerAddress, IPv4ProtocolTCP, adapter); e){
-                return e;
+        NetBuffer* TCPSocket::RetransmitFirstHole(){
+            for(TCPPacket& packet : m_unacknowledgedPackets){
+                if(!packet.sacked){
+                    packet.retransmits++;
+                    return BuildRetransmission(packet);
+                }
             }
 
-            return 0;
+            return nullptr;
         }
 
-        int TCPSocket::Finish(){ // TCP FIN (Last packet from sender)
-            TCPHeader tcpHeader;
-            memset(&tcpHeader, 0, sizeof(TCPHeader));
+        void TCPSocket::ApplyOptions(const TCPOptions& options){
+            m_sendMSS = options.mss ? MIN(options.mss, TCP_MAX_SEGMENT_SIZE) : TCP_DEFAULT_MSS;
 
-            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [FIN]");
-            
-            tcpHeader.srcPort = port;
-            tcpHeader.destPort = destinationPort;
-            tcpHeader.sequence = m_sequenceNumber;
+            if(options.windowScale >= 0){ // Only used if both ends send the option (RFC 7323 2.2)
+                m_windowScaling = true;
+                m_sendWindowShift = MIN(options.windowScale, 14);
+                m_receiveWindowShift = TCP_WINDOW_SCALE;
+            }
 
-            tcpHeader.dataOffset = sizeof(TCPHeader) / 4; // Size of the TCP Header in DWORDs
-            tcpHeader.fin = 1; // FIN/Finish
+            m_sackPermitted = options.sackPermitted;
 
-            tcpHeader.windowSize = 65535;
+            // Initial window (RFC 5681 3.1)
+            m_congestionWindow = MIN(4U * m_sendMSS, MAX(2U * m_sendMSS, 4380U));
+        }
 
-            tcpHeader.checksum = CalculateTCPChecksum(adapter->adapterIP, peerAddress, &tcpHeader, sizeof(TCPHeader));
+        uint16_t TCPSocket::ReceiveWindow() const {
+            // Charge whole buffers rather than the payload, the same as UDP
+            size_t queued = m_inboundData.Memory();
+            size_t window = (queued < TCP_RECEIVE_BUFFER) ? (TCP_RECEIVE_BUFFER - queued) : 0;
 
-            if(int e = SendIPv4(&tcpHeader, sizeof(TCPHeader), address, peerAddress, IPv4ProtocolTCP, adapter); e){
-                return e;
+            window >>= m_receiveWindowShift;
+            return (window > UINT16_MAX) ? UINT16_MAX : window;
+        }
+
+        size_t TCPSocket::UsableSendWindow() const {
+            uint32_t window = MIN(m_congestionWindow, m_sendWindow);
+            uint32_t flight = m_sequenceNumber - m_lastAcknowledged;
+
+            if(flight >= window){
+                // With nothing in flight send a byte to probe a zero window,
+                // the retransmission timer keeps probing until it opens (RFC 1122 4.2.2.17)
+                return (!flight && !m_sendWindow) ? 1 : 0;
             }
 
-            return 0;
+            return window - flight;
         }
 
-        int TCPSocket::FinishAcknowledge(uint32_t ackNumber){ // TCP FIN-ACK (Last packet from sender, acknowledge)
-            TCPHeader tcpHeader;
-            memset(&tcpHeader, 0, sizeof(TCPHeader));
+        bool TCPSocket::ProcessAcknowledgement(TCPHeader* tcpHeader, size_t dataLength, const TCPOptions& options, NetBuffer*& retransmit){
+            uint32_t ackNumber = tcpHeader->acknowledgementNumber;
 
-            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [FIN-ACK] Acknowledgement Number: %u", ackNumber);
-            
-            tcpHeader.srcPort = port;
-            tcpHeader.destPort = destinationPort;
-            tcpHeader.sequence = m_sequenceNumber;
-            tcpHeader.acknowledgementNumber = ackNumber;
+            if(SequenceAfter(ackNumber, m_sequenceNumber)){
+                return false;
+            }
+
+            if(SequenceBefore(ackNumber, m_lastAcknowledged)){
+                return true; // Old ACK, arrived out of order
+            }
 
-            tcpHeader.dataOffset = sizeof(TCPHeader) / 4; // Size of the TCP Header in DWORDs
-            tcpHeader.ack = 1; // ACK/Acknowledge
-            tcpHeader.fin = 1;
+            uint32_t window = static_cast<uint32_t>(tcpHeader->windowSize) << m_sendWindowShift;
+            bool windowChanged = (window != m_sendWindow);
+            m_sendWindow = window;
 
-            tcpHeader.windowSize = 65535;
+            if(m_sackPermitted){
+                for(unsigned i = 0; i < options.sackCount; i++){
+                    for(TCPPacket& packet : m_unacknowledgedPackets){
+                        if(!SequenceBefore(packet.sequenceNumber, options.sack[i].left) && !SequenceAfter(packet.sequenceNumber + packet.length, options.sack[i].right)){
+                            packet.sacked = true;
+                        }
+                    }
+                }
+            }
 
-            tcpHeader.checksum = CalculateTCPChecksum(adapter->adapterIP, peerAddress, &tcpHeader, sizeof(TCPHeader));
+            uint32_t flight = m_sequenceNumber - m_lastAcknowledged;
 
-            if(int e = SendIPv4(&tcpHeader, sizeof(TCPHeader), address, peerAddress, IPv4ProtocolTCP, adapter); e){
-                return e;
+            if(ackNumber == m_lastAcknowledged){
+                // Only a pure ACK that leaves the window alone whilst we have data outstanding
+                // counts as a duplicate (RFC 5681 2)
+                if(dataLength || tcpHeader->syn || tcpHeader->fin || windowChanged || !flight){
+                    if(windowChanged){
+                        m_sendSemaphore.Signal();
+                    }
+                    return true;
+                }
+
+                m_duplicateAcks++;
+
+                if(m_inRecovery && !m_timeoutRecovery){
+                    m_congestionWindow += m_sendMSS; // A segment has left the network, inflate the window
+                    m_sendSemaphore.Signal();
+                } else if(!m_inRecovery && m_duplicateAcks == TCP_DUPLICATE_ACK_THRESHOLD){
+                    // Fast retransmit, then fast recovery (RFC 6582 3.2)
+                    m_slowStartThreshold = MAX(flight / 2, 2U * m_sendMSS);
+                    m_congestionWindow = m_slowStartThreshold + TCP_DUPLICATE_ACK_THRESHOLD * m_sendMSS;
+                    m_recover = m_sequenceNumber;
+                    m_inRecovery = true;
+                    m_timeoutRecovery = false;
+
+                    retransmit = RetransmitFirstHole();
+                }
+
+                return true;
             }
 
-            return 0;
+            uint32_t acknowledged = ackNumber - m_lastAcknowledged;
+            m_lastAcknowledged = ackNumber;
+            m_duplicateAcks = 0;
+
+            long rtt = -1;
+            timeval now = Timer::GetSystemUptimeStruct();
+            while(m_unacknowledgedPackets.get_length()){
+                TCPPacket& packet = m_unacknowledgedPackets.get_front();
+                if(SequenceAfter(packet.sequenceNumber + packet.length, ackNumber)){
+                    break; // Not fully acknowledged
+                }
+
+                if(!packet.retransmits){
+                    rtt = now - packet.sent; // Karn's algorithm, the newest segment gives the best sample
+                }
+
+                packet.buffer->Unref();
+                m_unacknowledgedPackets.remove_at(0);
+            }
+
+            if(rtt >= 0){
+                SampleRTT(rtt);
+            }
+
+            if(m_inRecovery){
+                if(!SequenceBefore(ackNumber, m_recover)){
+                    // Full acknowledgement, everything sent before recovery has arrived
+                    if(!m_timeoutRecovery){
+                        uint32_t outstanding = m_sequenceNumber - ackNumber;
+                        m_congestionWindow = MIN(m_slowStartThreshold, MAX(outstanding, static_cast<uint32_t>(m_sendMSS)) + m_sendMSS);
+                    }
+
+                    m_inRecovery = false;
+                    m_timeoutRecovery = false;
+                } else {
+                    // Partial acknowledgement, the next hole was lost as well
+                    retransmit = RetransmitFirstHole();
+
+                    if(m_timeoutRecovery){
+                        m_congestionWindow += MIN(acknowledged, static_cast<uint32_t>(m_sendMSS));
+                    } else {
+                        // Deflate by the amount acknowledged, then add back a segment
+                        m_congestionWindow = ((m_congestionWindow > acknowledged) ? (m_congestionWindow - acknowledged) : 0) + m_sendMSS;
+                    }
+                }
+            } else if(m_congestionWindow < m_slowStartThreshold){
+                m_congestionWindow += MIN(acknowledged, static_cast<uint32_t>(m_sendMSS)); // Slow start
+            } else {
+                m_congestionWindow += MAX(1U, static_cast<uint32_t>(m_sendMSS) * m_sendMSS / m_congestionWindow); // Congestion avoidance
+            }
+
+            // Restart the timer when new data is acknowledged (RFC 6298 5.2 and 5.3)
+            if(m_unacknowledgedPackets.get_length()){
+                ArmRetransmitTimer();
+            } else {
+                m_retransmitTimerActive = false;
+            }
+
+            m_sendSemaphore.Signal();
+            return true;
         }
 
-        int TCPSocket::Reset(){ // TCP RST (Abort connection)
-            TCPHeader tcpHeader;
-            memset(&tcpHeader, 0, sizeof(TCPHeader));
+        void TCPSocket::SampleRTT(long rtt){
+            if(rtt <= 0){
+                rtt = 1; // 0 means no sample has been taken
+            }
 
-            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [RST]");
-            
-            tcpHeader.srcPort = port;
-            tcpHeader.destPort = destinationPort;
-            tcpHeader.sequence = m_sequenceNumber;
+            if(!m_smoothedRTT){
+                m_smoothedRTT = rtt;
+                m_rttVariance = rtt / 2;
+            } else {
+                long delta = m_smoothedRTT - rtt;
+                if(delta < 0){
+                    delta = -delta;
+                }
+
+                m_rttVariance = (3 * m_rttVariance + delta) / 4;
+                m_smoothedRTT = (7 * m_smoothedRTT + rtt) / 8;
+            }
 
-            tcpHeader.dataOffset = sizeof(TCPHeader) / 4; // Size of the TCP Header in DWORDs
-            tcpHeader.rst = 1; // RST, Abort the connections
+            m_rto = m_smoothedRTT + MAX(static_cast<long>(TCP_CLOCK_GRANULARITY), 4 * m_rttVariance);
+            if(m_rto < TCP_RETRY_MIN){
+                m_rto = TCP_RETRY_MIN;
+            } else if(m_rto > TCP_RETRY_MAX){
+                m_rto = TCP_RETRY_MAX;
+            }
+        }
 
-            tcpHeader.checksum = CalculateTCPChecksum(adapter->adapterIP, peerAddress, &tcpHeader, sizeof(TCPHeader));
+        void TCPSocket::ArmRetransmitTimer(){
+            m_retransmitDeadline = Timer::GetSystemUptimeStruct();
+            m_retransmitDeadline.tv_usec += m_rto;
+            m_retransmitDeadline.tv_sec += m_retransmitDeadline.tv_usec / 1000000;
+            m_retransmitDeadline.tv_usec %= 1000000;
 
-            if(int e = SendIPv4(&tcpHeader, sizeof(TCPHeader), address, peerAddress, IPv4ProtocolTCP, adapter); e){
-                return e;
+            m_retransmitTimerActive = true;
+        }
+
+        bool TCPSocket::ProcessData(TCPHeader* tcpHeader, NetBuffer* buffer, size_t headerLength, size_t dataLength){
+            uint32_t sequence = tcpHeader->sequence;
+            bool fin = tcpHeader->fin;
+
+            if(!dataLength && !fin){
+                return false;
             }
 
-            return 0;
+            buffer->Pull(headerLength);
+
+            if(SequenceBefore(sequence, m_remoteSequenceNumber)){
+                uint32_t duplicate = m_remoteSequenceNumber - sequence;
+                if(duplicate > dataLength || (duplicate == dataLength && !fin)){
+                    Acknowledge(m_remoteSequenceNumber); // Already received, our ACK may have been lost
+                    return false;
+                }
+
+                // Drop the part we already have
+                buffer->Pull(duplicate);
+                dataLength -= duplicate;
+                sequence = m_remoteSequenceNumber;
+            }
+
+            if(sequence != m_remoteSequenceNumber){
+                Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] Out of order segment (sequence number %u, expected %u)", sequence, m_remoteSequenceNumber);
+
+                if(dataLength && sequence - m_remoteSequenceNumber < TCP_RECEIVE_BUFFER){
+                    QueueOutOfOrder(sequence, buffer);
+                }
+
+                Acknowledge(m_remoteSequenceNumber); // Send a duplicate ACK straight away (RFC 5681 4.2)
+                return false;
+            }
+
+            if(dataLength && m_inboundData.Memory() >= TCP_RECEIVE_BUFFER){
+                Acknowledge(m_remoteSequenceNumber); // Past our window, the peer will retransmit once it opens
+                return false;
+            }
+
+            if(dataLength){
+                // Queue the buffer itself rather than copying the payload out of it
+                m_inboundData.Enqueue(buffer);
+                m_remoteSequenceNumber += dataLength;
+
+                DrainOutOfOrder(); // We may have filled a gap
+
+                acquireLock(&blockedLock);
+                FilesystemBlocker* bl = blocked.get_front();
+                while(bl){
+                    FilesystemBlocker* next = blocked.next(bl);
+
+                    if(bl->RequestedLength() <= m_inboundData.Length()){
+                        bl->Unblock();
+                    }
+
+                    bl = next;
+                }
+                releaseLock(&blockedLock);
+            }
+
+            // Only accept the FIN once everything before it has arrived
+            bool finished = fin && (sequence + dataLength == m_remoteSequenceNumber);
+            if(finished){
+                m_remoteSequenceNumber++; // FIN takes up a sequence number
+            }
+
+            Acknowledge(m_remoteSequenceNumber);
+            return finished;
+        }
+
+        void TCPSocket::QueueOutOfOrder(uint32_t sequence, NetBuffer* buffer){
+            ScopedSpinLock lockOutOfOrder(m_outOfOrderLock);
+
+            if(m_outOfOrder.get_length() >= TCP_OUT_OF_ORDER_MAX){
+                return; // Drop it, the peer will retransmit
+            }
+
+            for(unsigned i = 0; i < m_outOfOrder.get_length(); i++){
+                if(m_outOfOrder[i].sequenceNumber == sequence){
+                    return; // Already have it
+                }
+            }
+
+            buffer->Ref();
+            m_outOfOrder.add_back({sequence, buffer});
+
+            // Keep the segments in sequence order
+            for(unsigned i = m_outOfOrder.get_length() - 1; i > 0 && SequenceBefore(m_outOfOrder[i].sequenceNumber, m_outOfOrder[i - 1].sequenceNumber); i--){
+                TCPSegment segment = m_outOfOrder[i];
+                m_outOfOrder[i] = m_outOfOrder[i - 1];
+                m_outOfOrder[i - 1] = segment;
+            }
+        }
+
+        void TCPSocket::DrainOutOfOrder(){
+            ScopedSpinLock lockOutOfOrder(m_outOfOrderLock);
+
+            while(m_outOfOrder.get_length() && !SequenceAfter(m_outOfOrder[0].sequenceNumber, m_remoteSequenceNumber)){
+                TCPSegment segment = m_outOfOrder[0];
+                m_outOfOrder.erase(0);
+
+                uint32_t end = segment.sequenceNumber + segment.buffer->Length();
+                if(SequenceAfter(end, m_remoteSequenceNumber)){
+                    segment.buffer->Pull(m_remoteSequenceNumber - segment.sequenceNumber); // Drop anything we already have
+                    m_inboundData.Enqueue(segment.buffer);
+
+                    m_remoteSequenceNumber = end;
+                }
+
+                segment.buffer->Unref();
+            }
+        }
+
+        int TCPSocket::Synchronize(uint32_t seqNumber){ // TCP SYN (Establish a connection to the server)
+            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [SYN] Sequence Number: %u", seqNumber);
+
+            return SendSegment(TCPHeader::SYN, seqNumber, 0);
+        }
+
+        int TCPSocket::Acknowledge(uint32_t ackNumber){ // TCP ACK (Acknowledge connection)
+            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [ACK] Acknowledgement Number: %u", ackNumber);
+
+            return SendSegment(TCPHeader::ACK, m_sequenceNumber, ackNumber);
+        }
+
+        int TCPSocket::SynchronizeAcknowledge(uint32_t seqNumber, uint32_t ackNumber){ // TCP SYN-ACK (Establish connection to client and acknowledge the connection
+            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [SYN-ACK] Sequence Number: %u, Acknowledgement Number: %u", seqNumber, ackNumber);
+
+            return SendSegment(TCPHeader::SYN | TCPHeader::ACK, seqNumber, ackNumber);
+        }
+
+        int TCPSocket::Finish(){ // TCP FIN (Last packet from sender)
+            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [FIN]");
+
+            return SendSegment(TCPHeader::FIN, m_sequenceNumber, 0);
+        }
+
+        int TCPSocket::FinishAcknowledge(uint32_t ackNumber){ // TCP FIN-ACK (Last packet from sender, acknowledge)
+            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [FIN-ACK] Acknowledgement Number: %u", ackNumber);
+
+            return SendSegment(TCPHeader::FIN | TCPHeader::ACK, m_sequenceNumber, ackNumber);
+        }
+
+        int TCPSocket::Reset(){ // TCP RST (Abort connection)
+            Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] [RST]");
+
+            return SendSegment(TCPHeader::RST, m_sequenceNumber, 0);
         }
 
         unsigned short TCPSocket::AllocatePort(){
@@ -582,14 +1100,60 @@ namespace Network {
 
         TCPSocket::TCPSocket(int type, int protocol) : IPSocket(type, protocol) {
             assert(type == StreamSocket);
+
+            ScopedSpinLock lockSockets(timerSocketsLock);
+            timerSockets.add_back(this);
         }
 
         TCPSocket::~TCPSocket(){
+            acquireLock(&timerSocketsLock);
+            timerSockets.remove(this);
+            releaseLock(&timerSocketsLock);
+
+            while(m_unacknowledgedPackets.get_length()){
+                m_unacknowledgedPackets.remove_at(0).buffer->Unref();
+            }
 
+            for(unsigned i = 0; i < m_outOfOrder.get_length(); i++){
+                m_outOfOrder[i].buffer->Unref();
+            }
         }
 
         Socket* TCPSocket::Accept(sockaddr* addr, socklen_t* addrlen, int mode){
-            return nullptr;
+            if(state != TCPStateListen){
+                return nullptr;
+            }
+
+            TCPSocket* sock = nullptr;
+            for(;;){
+                FilesystemBlocker bl(this); // Constructed before checking so a connection completing in between is not missed
+
+                acquireLock(&m_pendingLock);
+                if(pending.get_length()){
+                    sock = static_cast<TCPSocket*>(pending.remove_at(0));
+                }
+                releaseLock(&m_pendingLock);
+
+                if(sock){
+                    break;
+                }
+
+                if((mode & O_NONBLOCK) || state != TCPStateListen){
+                    return nullptr;
+                }
+
+                if(Scheduler::GetCurrentThread()->Block(&bl)){
+                    return nullptr; // We were interrupted
+                }
+            }
+
+            if(addr && addrlen && *addrlen >= sizeof(sockaddr_in)){
+                *reinterpret_cast<sockaddr_in*>(addr) = {.sin_family = AF_INET, .sin_port = sock->destinationPort, .sin_addr = {sock->peerAddress.value}};
+
+                *addrlen = sizeof(sockaddr_in);
+            }
+
+            return sock;
         }
 
         int TCPSocket::Bind(const sockaddr* addr, socklen_t addrlen){
@@ -630,8 +1194,8 @@ namespace Network {
                 return -ECONNREFUSED;
             }
 
-            MACAddress mac;
-            if(int e = Route(address, peerAddress, mac, adapter)){
+            IPv4Address nextHop;
+            if(int e = Route(address, peerAddress, cachedRoute, nextHop, adapter)){
                 return e;
             }
 
@@ -656,20 +1220,33 @@ namespace Network {
 
             Log::Debug(debugLevelNetwork, DebugLevelVerbose, "[Network] [TCP] Connecting to %hd.%hd.%hd.%hd:%hd", peerAddress.data[0], peerAddress.data[1], peerAddress.data[2], peerAddress.data[3], (uint16_t)destinationPort);
 
-            m_sequenceNumber = (Timer::GetSystemUptime() % 512) * (rand() % 255) + Timer::GetTicks() + 1;
+            m_sequenceNumber = GenerateSequenceNumber() + 1;
+            m_recover = m_sequenceNumber;
             Synchronize(m_sequenceNumber - 1); // The peer should acknowledge the sent sequence number + 1, so just send (sequenceNumber - 1)
 
-            long retryPeriod = TCP_RETRY_MIN;
-            while(state == TCPStateSyn){
+            // Retransmit the SYN with exponential backoff (RFC 6298 5.5)
+            long retryPeriod = TCP_INITIAL_RTO;
+            long waited = 0;
+            for(;;){
                 FilesystemBlocker bl(this);
+                if(state != TCPStateSyn){
+                    break;
+                }
 
                 long timeout = retryPeriod;
                 if(Scheduler::GetCurrentThread()->Block(&bl, timeout)){
                     return -EINTR;
                 }
 
-                if(timeout <= 0){
-                    retryPeriod *= 4;
+                if(timeout <= 0 && state == TCPStateSyn){
+                    waited += retryPeriod;
+                    if(waited >= TCP_RETRY_MAX){
+                        state = TCPStateUnknown;
+                        return -ETIMEDOUT;
+                    }
+
+                    retryPeriod *= 2;
+                    Synchronize(m_sequenceNumber - 1);
                 }
             }
 
@@ -692,16 +1269,17 @@ namespace Network {
             }
 
             state = TCPStateListen;
+            passive = true;
 
             if(backlog > 0){
-                pendingConnections = Semaphore(backlog - pending.get_length());
+                m_backlog = backlog;
             }
 
             return 0;
         }
 
         int64_t TCPSocket::ReceiveFrom(void* buffer, size_t len, int flags, sockaddr* src, socklen_t* addrlen, const void* ancillary, size_t ancillaryLen){
-            if(state != TCPStateEstablished && !m_inboundData.Pos()){
+            if(state != TCPStateEstablished && m_inboundData.Empty()){
                 Log::Debug(debugLevelNetwork, DebugLevelNormal, "TCPSocket::ReceiveFrom: Not connected!");
                 return -ENOTCONN;
             }
@@ -712,7 +1290,7 @@ namespace Network {
                 *addrlen = sizeof(sockaddr_in);
             }
 
-            if(state == TCPStateEstablished && m_inboundData.Pos() < len){ // We do not want to block when in CLOSE-WAIT
+            if(state == TCPStateEstablished && m_inboundData.Length() < len){ // We do not want to block when in CLOSE-WAIT
                 FilesystemBlocker bl(this, len);
 
                 if(Scheduler::GetCurrentThread()->Block(&bl)){
@@ -724,19 +1302,27 @@ namespace Network {
                 return -ECONNRESET; // If state is now unknown we recieved an RST
             }
 
-            if(len > m_inboundData.Pos()){
-                len = m_inboundData.Pos(); // We could have been unblocked earlier by a PSH or FIN
+            if(len > m_inboundData.Length()){
+                len = m_inboundData.Length(); // We could have been unblocked earlier by a PSH or FIN
 
                 if(!len){
                     return 0;
                 }
             }
 
-            return m_inboundData.Read(buffer, len);
+            size_t queued = m_inboundData.Memory();
+            int64_t read = m_inboundData.Read(buffer, len);
+
+            // Tell the peer once the window has opened back up past half of the buffer
+            if(read > 0 && state == TCPStateEstablished && queued >= TCP_RECEIVE_BUFFER / 2 && m_inboundData.Memory() < TCP_RECEIVE_BUFFER / 2){
+                Acknowledge(m_remoteSequenceNumber);
+            }
+
+            return read;
         }
 
         int64_t TCPSocket::SendTo(void* buffer, size_t len, int flags, const sockaddr* dest, socklen_t addrlen, const void* ancillary, size_t ancillaryLen){
-            if(state != TCPStateEstablished){
+            if(state != TCPStateEstablished && state != TCPStateCloseWait){
                 Log::Debug(debugLevelNetwork, DebugLevelNormal, "TCPSocket::SendTo: Not connected!");
                 return -ENOTCONN;
             }
@@ -746,35 +1332,84 @@ namespace Network {
                 return -EISCONN; // dest is invalid
             }
 
-            uint16_t shortLength = static_cast<uint16_t>(len);
+            uint8_t* data = reinterpret_cast<uint8_t*>(buffer);
+            size_t sent = 0;
+            while(sent < len){
+                if(state != TCPStateEstablished && state != TCPStateCloseWait){
+                    return sent ? static_cast<int64_t>(sent) : -ECONNRESET;
+                }
 
-            TCPHeader header;
-            memset(&header, 0, sizeof(TCPHeader));
+                // Reset before checking the window so an ACK arriving in between still wakes us
+                m_sendSemaphore.SetValue(0);
 
-            header.srcPort = port;
-            header.destPort = destinationPort;
-            header.sequence = m_sequenceNumber;
-            header.acknowledgementNumber = m_remoteSequenceNumber;
+                acquireLock(&m_unacknowledgedPacketsLock);
+                size_t count = UsableSendWindow();
+                releaseLock(&m_unacknowledgedPacketsLock);
 
-            header.dataOffset = sizeof(TCPHeader) / 4;
+                if(!count){
+                    if(flags & MSG_DONTWAIT){
+                        return sent ? static_cast<int64_t>(sent) : -EAGAIN;
+                    }
 
-            header.windowSize = 65535;
+                    long timeout = m_rto;
+                    if(m_sendSemaphore.WaitTimeout(timeout)){
+                        return sent ? static_cast<int64_t>(sent) : -EINTR;
+                    }
+                    continue;
+                }
 
-            header.ack = 1;
-            header.psh = 1;
+                // With segmentation offload the adapter splits larger segments into MSS sized ones
+                size_t segmentLimit = m_sendMSS;
+                if(adapter && (adapter->features & NetworkAdapter::AdapterFeatureSegmentationOffload)){
+                    segmentLimit = TCP_TSO_MAX_SEGMENT;
+                }
 
-            TCPPacket pack = { .header = header, .sequenceNumber = m_sequenceNumber, .length = shortLength, .data = new uint8_t[len]};
-            memcpy(pack.data, buffer, shortLength);
+                count = MIN(count, len - sent);
+                count = MIN(count, segmentLimit);
 
-            m_sequenceNumber += shortLength;
+                NetBuffer* segment = NetBuffer::AllocateWithHeadroom();
+                if(!segment){
+                    return sent ? static_cast<int64_t>(sent) : -ENOBUFS;
+                }
 
-            int64_t ret = SendTCP(buffer, shortLength, address, peerAddress, header, adapter);
-            if(ret >= 0){
-                ScopedSpinLock acquired(m_unacknowledgedPacketsLock);
-                m_unacknowledgedPackets.add_back(pack);
+                // Copy the payload once, straight into the buffer that is sent
+                // Without checksum offload it is summed in the same pass
+                int fault;
+                if(adapter && (adapter->features & NetworkAdapter::AdapterFeatureChecksumOffload)){
+                    fault = UserCopy(segment->Put(count), data + sent, count);
+                } else {
+                    fault = UserMemcpyChecksum(segment->Put(count), data + sent, count, &segment->payloadChecksum);
+                    segment->hasPayloadChecksum = true;
+                }
+
+                if(fault){
+                    segment->Unref();
+                    return sent ? static_cast<int64_t>(sent) : -EFAULT; // buffer may be a user buffer
+                }
+
+                if(count > m_sendMSS){
+                    segment->gsoSize = m_sendMSS;
+                }
+
+                acquireLock(&m_unacknowledgedPacketsLock);
+                uint32_t sequence = m_sequenceNumber;
+                m_sequenceNumber += count;
+
+                // The payload stays at the end of the buffer as headers are pushed in front of it
+                segment->Ref(); // Keep the segment until it is acknowledged
+                m_unacknowledgedPackets.add_back({ .sequenceNumber = sequence, .length = static_cast<uint32_t>(count), .buffer = segment, .sent = Timer::GetSystemUptimeStruct(), .retransmits = 0, .sacked = false });
+
+                if(!m_retransmitTimerActive){
+                    ArmRetransmitTimer();
+                }
+                releaseLock(&m_unacknowledgedPacketsLock);
+
+                // If sending fails the segment is treated as lost and retransmitted
+                SendSegment(TCPHeader::ACK | TCPHeader::PSH, sequence, m_remoteSequenceNumber, segment);
+                sent += count;
             }
 
-            return ret;
+            return sent;
         }
 
         int TCPSocket::SetSocketOptions(int level, int opt, const void* optValue, socklen_t optLength){
@@ -842,7 +1477,16 @@ namespace Network {
 
                 m_fileClosed = true;
 
-                if(state == TCPStateListen || state == TCPStateUnknown){
+                if(state == TCPStateListen){
+                    state = TCPStateUnknown; // Stop accepting connections
+                    passive = false;
+
+                    ReleasePort();
+                    UnblockAll();
+                    return;
+                }
+
+                if(state == TCPStateUnknown){
                     return; // No active connection
                 }
                 
@@ -852,17 +1496,26 @@ namespace Network {
                     return;
                 }
 
-                if(state == TCPStateEstablished){
-                    state = TCPStateFinWait1;
+                if(state == TCPStateEstablished || state == TCPStateCloseWait){
+                    if(state == TCPStateEstablished){
+                        state = TCPStateFinWait1;
 
-                    FinishAcknowledge(m_remoteSequenceNumber);
-                } else if(state == TCPStateCloseWait){
-                    state = TCPStateLastAck;
+                        FinishAcknowledge(m_remoteSequenceNumber);
+                    } else {
+                        state = TCPStateLastAck;
+
+                        Finish();
+                    }
 
-                    Finish();
+                    // FIN takes up a sequence number
+                    acquireLock(&m_unacknowledgedPacketsLock);
+                    m_sequenceNumber++;
+                    releaseLock(&m_unacknowledgedPacketsLock);
                 }
 
+                acquireLock(&closedSocketsLock);
                 closedSockets.add_back(this);
+                releaseLock(&closedSocketsLock);
             }
         }
     }
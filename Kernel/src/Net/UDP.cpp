@@ -1,60 +1,55 @@
 #include <Net/Socket.h>
 #include <Net/Net.h>
+#include <Net/NetBuffer.h>
+#include <Net/Route.h>
 
 #include <Hash.h>
 #include <Errno.h>
 #include <Math.h>
 #include <Debug.h>
+#include <UserPointer.h>
 
 namespace Network::UDP{
-    HashMap<uint16_t, UDPSocket*> sockets = HashMap<uint16_t, UDPSocket*>(256); // 256 buuckets is enough
-    lock_t socketsLock = 0;
+    // Looked up concurrently by the protocol workers
+    ConcurrentHashMap<uint16_t, UDPSocket*> sockets = ConcurrentHashMap<uint16_t, UDPSocket*>(256); // 256 buuckets is enough
     uint16_t nextEphemeralPort = EPHEMERAL_PORT_RANGE_START;
 
-    Socket* FindSocket(BigEndian<uint16_t> port){
-        ScopedSpinLock lockSockets(socketsLock);
+    // Returns a reference to the socket, which the caller must drop
+    UDPSocket* FindSocket(BigEndian<uint16_t> port){
         UDPSocket* sock = nullptr;
             
-        if(!sockets.get(port.value, sock)){
+        if(!sockets.get((uint16_t)port, sock, [](UDPSocket* s){ s->Ref(); })){
             return nullptr;
         }
 
         return sock;
     }
 
-    int AcquirePortUnlocked(UDPSocket* sock, unsigned int port){
+    int AcquirePort(UDPSocket* sock, unsigned int port){
         if(!port || port > PORT_MAX){
             Log::Warning("[Network] AcquirePort: Invalid port: %d", port);
             return -EINVAL;
         }
 
-        if(sockets.find(port)){
+        if(!sockets.insert(port, sock)){
             Log::Warning("[Network] AcquirePort: Port %d in use!", port);
             return -EADDRINUSE;
         }
-
-        sockets.insert(port, sock);
         
         return 0;
     }
 
-    int AcquirePort(UDPSocket* sock, unsigned int port){
-        ScopedSpinLock lockSockets(socketsLock);
-        return AcquirePortUnlocked(sock, port);
-    }
-
     unsigned short AllocatePort(UDPSocket* sock){
         unsigned short port = EPHEMERAL_PORT_RANGE_START;
-        ScopedSpinLock lockSockets(socketsLock);
 
         if(nextEphemeralPort < PORT_MAX){
-            port = nextEphemeralPort++;
+            port = __atomic_fetch_add(&nextEphemeralPort, 1, __ATOMIC_RELAXED);
             
-            if(AcquirePortUnlocked(sock, port)){
+            if(AcquirePort(sock, port)){
                 port = 0;
             }
         } else {
-            while(port < EPHEMERAL_PORT_RANGE_END && AcquirePortUnlocked(sock, port)) port++;
+            while(port < EPHEMERAL_PORT_RANGE_END && AcquirePort(sock, port)) port++;
         }
 
         if(port > EPHEMERAL_PORT_RANGE_END || port <= 0){
@@ -67,7 +62,6 @@ namespace Network::UDP{
 
     int ReleasePort(unsigned short port){
         assert(port <= PORT_MAX);
-        ScopedSpinLock lockSockets(socketsLock);
 
         sockets.remove(port);
 
@@ -75,34 +69,50 @@ namespace Network::UDP{
     }
 
     int SendUDP(void* data, size_t length, IPv4Address& source, IPv4Address& destination, BigEndian<uint16_t> sourcePort, BigEndian<uint16_t> destinationPort, NetworkAdapter* adapter){
-		if(length > 1518){
+		if(length > UDP_MAX_PAYLOAD){
 			return -EMSGSIZE;
 		}
 
-		uint8_t buffer[1600];
+		NetBuffer* buffer = NetBuffer::AllocateWithHeadroom();
+		if(!buffer){
+			return -ENOBUFS;
+		}
 
-		UDPHeader* header = (UDPHeader*)buffer;
+		if(UserCopy(buffer->Put(length), data, length)){
+			buffer->Unref();
+			return -EFAULT; // data may be a user buffer
+		}
+
+		return SendUDP(buffer, source, destination, sourcePort, destinationPort, adapter);
+	}
+
+    int SendUDP(NetBuffer* buffer, IPv4Address& source, IPv4Address& destination, BigEndian<uint16_t> sourcePort, BigEndian<uint16_t> destinationPort, NetworkAdapter* adapter, CachedRoute* route){
+		size_t length = buffer->Length();
+		if(length > UDP_MAX_PAYLOAD){
+			buffer->Unref();
+			return -EMSGSIZE;
+		}
+
+		UDPHeader* header = (UDPHeader*)buffer->Push(sizeof(UDPHeader));
 		header->destPort = destinationPort;
 		header->srcPort = sourcePort;
 		header->length = sizeof(UDPHeader) + length;
 		header->checksum = 0;
 
-		memcpy(header->data, data, length);
-
 		//header->checksum = CaclulateChecksum(header, sizeof(UDPHeader));
 
-		return SendIPv4(header, header->length, source, destination, IPv4ProtocolUDP, adapter);
+		return SendIPv4(buffer, source, destination, IPv4ProtocolUDP, adapter, route);
 	}
 
-    void OnReceiveUDP(IPv4Header& ipHeader, void* data, size_t length){
-		if(length < sizeof(UDPHeader)){
+    void OnReceiveUDP(IPv4Header& ipHeader, NetBuffer* buffer){
+		if(buffer->Length() < sizeof(UDPHeader)){
 			Log::Warning("[Network] [UDP] Discarding packet (too short)");
 			return;
 		}
 
-		UDPHeader* header = (UDPHeader*)data;
-        if(header->length > length){
-			Log::Warning("[Network] [UDP] Discarding packet (too long)");
+		UDPHeader* header = (UDPHeader*)buffer->data;
+        if(header->length > buffer->Length() || header->length < sizeof(UDPHeader)){
+			Log::Warning("[Network] [UDP] Discarding packet (invalid length)");
             return;
         }
 		
@@ -110,20 +120,94 @@ namespace Network::UDP{
 		    Log::Info("[Network] [UDP] Receiving Packet (Source port: %d, Destination port: %d)", (uint16_t)header->srcPort, (uint16_t)header->destPort);
         });
 
-        UDPSocket* sock = nullptr;
-        if(sockets.get((uint16_t)header->destPort, sock) && sock){
-            sock->OnReceive(ipHeader.sourceIP, header->srcPort, header->data, header->length);
+        UDPSocket* sock = FindSocket(header->destPort);
+        if(sock){
+            BigEndian<uint16_t> sourcePort = header->srcPort;
+
+            buffer->Trim(header->length);
+            buffer->Pull(sizeof(UDPHeader));
+
+            sock->OnReceive(ipHeader.sourceIP, sourcePort, buffer);
+            sock->Unref();
         }
     }
 
+    // The iovecs are in kernel memory, their buffers are checked here as userspace may have changed them since the syscall
+    // Both return non-zero on a fault
+    static int CopyFromIovecs(const iovec* iov, size_t iovCount, size_t offset, void* dest, size_t length){
+        uint8_t* out = reinterpret_cast<uint8_t*>(dest);
+        for(size_t i = 0; i < iovCount && length; i++){
+            if(offset >= iov[i].iov_len){
+                offset -= iov[i].iov_len;
+                continue;
+            }
+
+            size_t count = MIN(iov[i].iov_len - offset, length);
+            if(CopyFromUser(out, reinterpret_cast<uint8_t*>(iov[i].iov_base) + offset, count)){
+                return 1;
+            }
+
+            out += count;
+            length -= count;
+            offset = 0;
+        }
+
+        return 0;
+    }
+
+    static int CopyToIovecs(const iovec* iov, size_t iovCount, size_t offset, const void* src, size_t length){
+        const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+        for(size_t i = 0; i < iovCount && length; i++){
+            if(offset >= iov[i].iov_len){
+                offset -= iov[i].iov_len;
+                continue;
+            }
+
+            size_t count = MIN(iov[i].iov_len - offset, length);
+            if(CopyToUser(reinterpret_cast<uint8_t*>(iov[i].iov_base) + offset, in, count)){
+                return 1;
+            }
+
+            in += count;
+            length -= count;
+            offset = 0;
+        }
+
+        return 0;
+    }
+
+    // Control message data follows the header, aligned to size_t like in libc
+    static constexpr size_t ControlMessageAlign(size_t length){
+        return (length + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+    }
+
     UDPSocket::UDPSocket(int type, int protocol) : IPSocket(type, protocol){
         assert(type == DatagramSocket);
+
+        m_ring = new UDPPacket[UDP_RECEIVE_RING_SIZE];
     }
 
     UDPSocket::~UDPSocket(){
         if(bound){
             ReleasePort();
         }
+
+        for(unsigned i = 0; i < m_ringCount; i++){
+            m_ring[(m_ringHead + i) % UDP_RECEIVE_RING_SIZE].buffer->Unref();
+        }
+
+        delete[] m_ring;
+    }
+
+    void UDPSocket::Close(){
+        handleCount--;
+
+        if(handleCount <= 0){
+            IPSocket::Close(); // Releases the port, so no more references can be taken
+            bound = false;
+
+            Unref();
+        }
     }
 
     unsigned short UDPSocket::AllocatePort(){
@@ -138,16 +222,25 @@ namespace Network::UDP{
         return Network::UDP::ReleasePort(port);
     }
 
-    int64_t UDPSocket::OnReceive(IPv4Address& sourceIP, BigEndian<uint16_t> sourcePort, void* buffer, size_t len){
-        UDPPacket pkt;
-        pkt.sourceIP = sourceIP;
-        pkt.sourcePort = sourcePort;
-        pkt.length = len;
+    int64_t UDPSocket::OnReceive(IPv4Address& sourceIP, BigEndian<uint16_t> sourcePort, NetBuffer* buffer){
+        acquireLock(&packetsLock);
+        // Every datagram holds a whole buffer, so that is what counts against SO_RCVBUF
+        // One datagram is always let through so a tiny SO_RCVBUF does not stop us receiving at all
+        if(m_ringCount >= UDP_RECEIVE_RING_SIZE || (m_ringCount && m_receiveQueued + NET_BUFFER_SIZE > m_receiveBufferSize)){
+            m_receiveDropped++;
+            releaseLock(&packetsLock);
 
-        pkt.data = new uint8_t[len];
-        memcpy(pkt.data, buffer, len);
+            IF_DEBUG(debugLevelNetwork >= DebugLevelVerbose, {
+                Log::Warning("[Network] [UDP] Receive buffer full, dropping datagram (%u dropped)", m_receiveDropped);
+            });
+            return -ENOBUFS;
+        }
 
-        packets.add_back(pkt);
+        buffer->Ref(); // Keep the payload in the buffer it was received into
+        m_ring[(m_ringHead + m_ringCount) % UDP_RECEIVE_RING_SIZE] = { .sourceIP = sourceIP, .sourcePort = sourcePort, .buffer = buffer };
+        m_ringCount++;
+        m_receiveQueued += NET_BUFFER_SIZE;
+        releaseLock(&packetsLock);
 
         acquireLock(&blockedLock);
         while(blocked.get_length()){
@@ -188,40 +281,108 @@ namespace Network::UDP{
         return -EOPNOTSUPP;
     }
 
-    int64_t UDPSocket::ReceiveFrom(void* buffer, size_t len, int flags, sockaddr* src, socklen_t* addrlen, const void* ancillary, size_t ancillaryLen){
+    int64_t UDPSocket::ReceiveDatagrams(const iovec* iov, size_t iovCount, int flags, sockaddr* src, socklen_t* addrlen, uint16_t& segmentSize, int& messageFlags){
+        size_t capacity = 0;
+        for(size_t i = 0; i < iovCount; i++){
+            capacity += iov[i].iov_len;
+        }
+
         acquireLock(&packetsLock);
-        if(packets.get_length() <= 0){
+        while(!m_ringCount){
             releaseLock(&packetsLock);
             if(flags & MSG_DONTWAIT){
                 return -EAGAIN; // Don't wait
             } else if(FilesystemBlocker bl(this); Scheduler::GetCurrentThread()->Block(&bl)){
                 return -EINTR; // We were interrupted
             }
+            acquireLock(&packetsLock);
+        }
+
+        UDPPacket packets[UDP_SEGMENTS_MAX];
+        packets[0] = m_ring[m_ringHead];
+
+        size_t datagramLength = packets[0].buffer->Length();
+        size_t total = MIN(datagramLength, capacity);
+        unsigned count = 1;
+
+        // With UDP_GRO take a run of datagrams from the same source, all the same size except for a shorter last one,
+        // so the caller can split them up again
+        if(m_gro && datagramLength && datagramLength <= capacity){
+            while(count < m_ringCount && count < UDP_SEGMENTS_MAX){
+                const UDPPacket& next = m_ring[(m_ringHead + count) % UDP_RECEIVE_RING_SIZE];
+                size_t nextLength = next.buffer->Length();
+                if(next.sourceIP.value != packets[0].sourceIP.value || next.sourcePort.value != packets[0].sourcePort.value ||
+                    !nextLength || nextLength > datagramLength || total + nextLength > capacity){
+                    break;
+                }
+
+                packets[count++] = next;
+                total += nextLength;
+
+                if(nextLength < datagramLength){
+                    break;
+                }
+            }
         }
 
-        UDPPacket pkt = packets.remove_at(0);
+        m_ringHead = (m_ringHead + count) % UDP_RECEIVE_RING_SIZE;
+        m_ringCount -= count;
+        m_receiveQueued -= count * NET_BUFFER_SIZE;
         releaseLock(&packetsLock);
 
+        size_t copied = 0;
+        for(unsigned i = 0; i < count; i++){
+            size_t length = MIN(packets[i].buffer->Length(), total - copied);
+            if(CopyToIovecs(iov, iovCount, copied, packets[i].buffer->data, length)){
+                // Leave the datagrams for the next receive
+                acquireLock(&packetsLock);
+                for(unsigned j = count; j > 0; j--){
+                    if(m_ringCount >= UDP_RECEIVE_RING_SIZE){
+                        packets[j - 1].buffer->Unref(); // Filled up in the meantime
+                        m_receiveDropped++;
+                        continue;
+                    }
+
+                    m_ringHead = (m_ringHead + UDP_RECEIVE_RING_SIZE - 1) % UDP_RECEIVE_RING_SIZE;
+                    m_ring[m_ringHead] = packets[j - 1];
+                    m_ringCount++;
+                    m_receiveQueued += NET_BUFFER_SIZE;
+                }
+                releaseLock(&packetsLock);
+                return -EFAULT;
+            }
+
+            copied += length;
+        }
+
+        if(datagramLength > capacity){
+            messageFlags |= MSG_TRUNC; // The rest of the datagram is lost
+        }
+
+        segmentSize = (count > 1) ? datagramLength : 0;
+
+        for(unsigned i = 0; i < count; i++){
+            packets[i].buffer->Unref(); // Return the buffer to the pool
+        }
+
         if(src && addrlen){
             sockaddr_in addr;
             addr.sin_family = InternetProtocol;
-            addr.sin_port = pkt.sourcePort;
-            addr.sin_addr.s_addr = pkt.sourceIP.value;
+            addr.sin_port = packets[0].sourcePort;
+            addr.sin_addr.s_addr = packets[0].sourceIP.value;
 
-            memcpy(src, &addr, *addrlen); // Make sure to stay within bounds of addrlen
+            // Make sure to stay within bounds of addrlen
+            if(CopyToUser(src, &addr, MIN(*addrlen, sizeof(sockaddr_in)))){
+                return -EFAULT;
+            }
 
             *addrlen = sizeof(sockaddr_in); // addrlen is updated to contain the actual size of the source address
         }
 
-        size_t finalLength = MIN(len, pkt.length);
-        memcpy(buffer, pkt.data, finalLength);
-
-        delete[] pkt.data; // Free buffer
-
-        return finalLength;
+        return copied;
     }
 
-    int64_t UDPSocket::SendTo(void* buffer, size_t len, int flags, const sockaddr* dest, socklen_t addrlen, const void* ancillary, size_t ancillaryLen){
+    int64_t UDPSocket::SendDatagrams(const iovec* iov, size_t iovCount, const sockaddr* dest, socklen_t addrlen, uint16_t segmentSize){
         IPv4Address sendIPAddress;
         BigEndian<uint16_t> destPort;
 
@@ -245,6 +406,21 @@ namespace Network::UDP{
             destPort = destinationPort;
         }
 
+        size_t length = 0;
+        for(size_t i = 0; i < iovCount; i++){
+            length += iov[i].iov_len;
+        }
+
+        if(segmentSize && length > segmentSize){
+            if(segmentSize > UDP_MAX_PAYLOAD || (length + segmentSize - 1) / segmentSize > UDP_SEGMENTS_MAX){
+                return -EINVAL;
+            }
+        } else if(length > UDP_MAX_PAYLOAD){
+            return -EMSGSIZE;
+        } else {
+            segmentSize = length; // Sent as a single datagram
+        }
+
         if(!port){
             port = AllocatePort();
 
@@ -254,23 +430,237 @@ namespace Network::UDP{
             }
         }
 
-        if(!adapter){
-            MACAddress mac;
-            NetworkAdapter* adapter = nullptr;
-            
-            if(int e = Route(INADDR_ANY, sendIPAddress, mac, adapter)){
+        NetworkAdapter* sendAdapter = adapter;
+        if(!sendAdapter){
+            IPv4Address nextHop;
+            if(int e = Route(INADDR_ANY, sendIPAddress, cachedRoute, nextHop, sendAdapter)){
                 return e;
             }
-        
-            if(int e = SendUDP(buffer, len, address, sendIPAddress, port, destPort, adapter)){
-                return e;
+        }
+
+        // Each segment becomes its own datagram, all from the same syscall
+        size_t sent = 0;
+        do {
+            size_t count = MIN(static_cast<size_t>(segmentSize), length - sent);
+
+            NetBuffer* buffer = NetBuffer::AllocateWithHeadroom();
+            if(!buffer){
+                return sent ? static_cast<int64_t>(sent) : -ENOBUFS;
             }
-        } else {
-            if(int e = SendUDP(buffer, len, address, sendIPAddress, port, destPort, adapter)){
-                return e;
+
+            if(CopyFromIovecs(iov, iovCount, sent, buffer->Put(count), count)){
+                buffer->Unref();
+                return sent ? static_cast<int64_t>(sent) : -EFAULT;
+            }
+
+            if(int e = SendUDP(buffer, address, sendIPAddress, port, destPort, sendAdapter, &cachedRoute)){
+                return sent ? static_cast<int64_t>(sent) : e;
+            }
+
+            sent += count;
+        } while(sent < length);
+
+        return sent;
+    }
+
+    int64_t UDPSocket::ReceiveFrom(void* buffer, size_t len, int flags, sockaddr* src, socklen_t* addrlen, const void* ancillary, size_t ancillaryLen){
+        iovec iov = { .iov_base = buffer, .iov_len = len };
+
+        socklen_t nameLength = 0;
+        if(addrlen && CopyFromUser(&nameLength, addrlen, sizeof(socklen_t))){
+            return -EFAULT;
+        }
+
+        uint16_t segmentSize;
+        int messageFlags = 0;
+        int64_t ret = ReceiveDatagrams(&iov, 1, flags, src, addrlen ? &nameLength : nullptr, segmentSize, messageFlags);
+        if(ret >= 0 && addrlen && CopyToUser(addrlen, &nameLength, sizeof(socklen_t))){
+            return -EFAULT;
+        }
+
+        return ret;
+    }
+
+    int64_t UDPSocket::SendTo(void* buffer, size_t len, int flags, const sockaddr* dest, socklen_t addrlen, const void* ancillary, size_t ancillaryLen){
+        iovec iov = { .iov_base = buffer, .iov_len = len };
+
+        return SendDatagrams(&iov, 1, dest, addrlen, m_segmentSize);
+    }
+
+    // Take a copy of a message header and its iovecs so userspace cannot change them after they are checked
+    static int64_t CopyMessageHeader(const msghdr* msg, msghdr& header, iovec* iov){
+        if(CopyFromUser(&header, msg, sizeof(msghdr))){
+            return -EFAULT;
+        }
+
+        if(static_cast<unsigned>(header.msg_iovlen) > UDP_IOVECS_MAX){
+            return -EMSGSIZE;
+        }
+
+        if(CopyFromUser(iov, header.msg_iov, sizeof(iovec) * header.msg_iovlen)){
+            return -EFAULT;
+        }
+
+        header.msg_iov = iov;
+        return 0;
+    }
+
+    int64_t UDPSocket::ReceiveMessage(msghdr* msg, int flags){
+        msghdr header;
+        iovec iov[UDP_IOVECS_MAX];
+        if(int64_t e = CopyMessageHeader(msg, header, iov)){
+            return e;
+        }
+
+        uint16_t segmentSize = 0;
+        int messageFlags = 0;
+
+        socklen_t nameLength = header.msg_namelen;
+        int64_t ret = ReceiveDatagrams(iov, header.msg_iovlen, flags, reinterpret_cast<sockaddr*>(header.msg_name), header.msg_name ? &nameLength : nullptr, segmentSize, messageFlags);
+        if(ret < 0){
+            return ret;
+        }
+
+        socklen_t controlLength = 0;
+        if(segmentSize){ // Tell the caller where to split the coalesced datagrams
+            size_t dataOffset = ControlMessageAlign(sizeof(cmsghdr));
+            if(header.msg_control && header.msg_controllen >= dataOffset + sizeof(int)){
+                cmsghdr control;
+                control.cmsg_len = dataOffset + sizeof(int);
+                control.cmsg_level = SOL_UDP;
+                control.cmsg_type = UDP_GRO;
+
+                int value = segmentSize;
+                if(CopyToUser(header.msg_control, &control, sizeof(cmsghdr)) || CopyToUser(reinterpret_cast<uint8_t*>(header.msg_control) + dataOffset, &value, sizeof(int))){
+                    return -EFAULT;
+                }
+
+                controlLength = control.cmsg_len;
+            } else {
+                messageFlags |= MSG_CTRUNC;
+            }
+        }
+
+        header.msg_namelen = nameLength;
+        header.msg_controllen = controlLength;
+        header.msg_flags = messageFlags;
+        if(CopyToUser(&msg->msg_namelen, &header.msg_namelen, sizeof(header.msg_namelen)) || CopyToUser(&msg->msg_controllen, &header.msg_controllen, sizeof(header.msg_controllen))
+            || CopyToUser(&msg->msg_flags, &header.msg_flags, sizeof(header.msg_flags))){
+            return -EFAULT;
+        }
+
+        return ret;
+    }
+
+    int64_t UDPSocket::SendMessage(const msghdr* msg, int flags){
+        msghdr header;
+        iovec iov[UDP_IOVECS_MAX];
+        if(int64_t e = CopyMessageHeader(msg, header, iov)){
+            return e;
+        }
+
+        uint16_t segmentSize = m_segmentSize;
+
+        // A UDP_SEGMENT control message overrides the socket option for this send
+        size_t dataOffset = ControlMessageAlign(sizeof(cmsghdr));
+        size_t offset = 0;
+        while(header.msg_control && offset + dataOffset <= header.msg_controllen){
+            cmsghdr control;
+            if(CopyFromUser(&control, reinterpret_cast<uint8_t*>(header.msg_control) + offset, sizeof(cmsghdr))){
+                return -EFAULT;
+            }
+
+            if(control.cmsg_len < dataOffset || offset + control.cmsg_len > header.msg_controllen){
+                return -EINVAL;
+            }
+
+            if(control.cmsg_level == SOL_UDP && control.cmsg_type == UDP_SEGMENT){
+                if(control.cmsg_len < dataOffset + sizeof(uint16_t)){
+                    return -EINVAL;
+                }
+
+                if(CopyFromUser(&segmentSize, reinterpret_cast<uint8_t*>(header.msg_control) + offset + dataOffset, sizeof(uint16_t))){
+                    return -EFAULT;
+                }
+            }
+
+            offset += ControlMessageAlign(control.cmsg_len);
+        }
+
+        // SendDatagrams reads the destination address more than once
+        sockaddr_in dest = {};
+        socklen_t destLength = MIN(header.msg_namelen, sizeof(sockaddr_in));
+        if(header.msg_name && destLength && CopyFromUser(&dest, header.msg_name, destLength)){
+            return -EFAULT;
+        }
+
+        return SendDatagrams(iov, header.msg_iovlen, header.msg_name ? reinterpret_cast<const sockaddr*>(&dest) : nullptr, header.msg_name ? header.msg_namelen : 0, segmentSize);
+    }
+
+    int UDPSocket::SetSocketOptions(int level, int opt, const void* optValue, socklen_t optLength){
+        if(level == SOL_UDP){
+            if(optLength < sizeof(int)){
+                return -EINVAL; // need to be at least int size
+            }
+
+            int value = *reinterpret_cast<const int*>(optValue);
+            switch(opt){
+                case UDP_SEGMENT:
+                    if(value < 0 || value > static_cast<int>(UDP_MAX_PAYLOAD)){
+                        return -EINVAL;
+                    }
+
+                    m_segmentSize = value;
+                    return 0;
+                case UDP_GRO:
+                    m_gro = value;
+                    return 0;
+                default:
+                    Log::Warning("UDPSocket::SetSocketOptions: Unknown option: %d", opt);
+                    return -ENOPROTOOPT;
+            }
+        } else if(level == SOL_SOCKET && opt == SO_RCVBUF){
+            if(optLength < sizeof(int)){
+                return -EINVAL;
+            }
+
+            int value = *reinterpret_cast<const int*>(optValue);
+            if(value < 0){
+                return -EINVAL;
+            }
+
+            acquireLock(&packetsLock);
+            m_receiveBufferSize = MIN(static_cast<size_t>(MAX(value, NET_BUFFER_SIZE)), static_cast<size_t>(UDP_RECEIVE_BUFFER_MAX));
+            releaseLock(&packetsLock);
+            return 0;
+        }
+
+        return IPSocket::SetSocketOptions(level, opt, optValue, optLength);
+    }
+
+    int UDPSocket::GetSocketOptions(int level, int opt, void* optValue, socklen_t* optLength){
+        if(level == SOL_UDP || (level == SOL_SOCKET && opt == SO_RCVBUF)){
+            if(*optLength < sizeof(int)){
+                return -EINVAL; // Not big enough, callers job to check the memory space
+            }
+
+            int value;
+            if(level == SOL_SOCKET){
+                value = m_receiveBufferSize;
+            } else if(opt == UDP_SEGMENT){
+                value = m_segmentSize;
+            } else if(opt == UDP_GRO){
+                value = m_gro;
+            } else {
+                Log::Warning("UDPSocket::GetSocketOptions: Unknown option: %d", opt);
+                return -ENOPROTOOPT;
             }
+
+            *optLength = sizeof(int);
+            *reinterpret_cast<int*>(optValue) = value;
+            return 0;
         }
 
-        return len;
+        return IPSocket::GetSocketOptions(level, opt, optValue, optLength);
     }
 }
\ No newline at end of file
@@ -0,0 +1,119 @@
+#include <Net/Adapter.h>
+#include <Net/Net.h>
+#include <Net/NetBuffer.h>
+
+#include <Hash.h>
+#include <Lock.h>
+#include <Logging.h>
+#include <Objects/Process.h>
+#include <SMP.h>
+
+namespace Network {
+    struct ProtocolWorker {
+        lock_t queueLock = 0;
+        FastList<NetBuffer*> queue; // Packets waiting to be processed
+        Semaphore packetSemaphore = Semaphore(0);
+    };
+
+    static ProtocolWorker* workers = nullptr;
+    static unsigned workerCount = 0; // Packets are processed on the network thread when 0
+
+    // Hash of the addresses and ports, from our side of the connection so it matches the socket lookup
+    static unsigned FlowHash(const uint8_t* packet, size_t length){
+        if(length < sizeof(IPv4Header)){
+            return 0;
+        }
+
+        const IPv4Header* header = reinterpret_cast<const IPv4Header*>(packet);
+        size_t headerLength = header->ihl * 4;
+
+        uint16_t sourcePort = 0;
+        uint16_t destPort = 0;
+        if((header->protocol == IPv4ProtocolTCP || header->protocol == IPv4ProtocolUDP) && headerLength >= sizeof(IPv4Header) && length >= headerLength + 2 * sizeof(uint16_t)){
+            // TCP and UDP headers both start with the source and destination ports
+            const BigEndian<uint16_t>* ports = reinterpret_cast<const BigEndian<uint16_t>*>(packet + headerLength);
+            sourcePort = ports[0];
+            destPort = ports[1];
+        }
+
+        return ::Hash(TCPConnectionIdentifier(header->destIP, header->sourceIP, destPort, sourcePort));
+    }
+
+    // index is the worker and the CPU it was started on
+    static void ProtocolWorkerThread(unsigned index){
+        ProtocolWorker& worker = workers[index];
+
+        for(;;){
+            if(worker.packetSemaphore.Wait()){
+                continue; // We got interrupted
+            }
+
+            NetBuffer* buffer = nullptr;
+            acquireLock(&worker.queueLock);
+            if(worker.queue.get_length()){
+                buffer = worker.queue.remove_at(0);
+            }
+            releaseLock(&worker.queueLock);
+
+            if(buffer){
+                ProcessPacket(buffer->adapter, buffer);
+                buffer->Unref(); // Sockets take their own reference to anything they keep
+            }
+        }
+    }
+
+    void InitializeProtocolWorkers(){
+        unsigned count = SMP::processorCount;
+        if(count > NET_WORKERS_MAX){
+            count = NET_WORKERS_MAX;
+        }
+
+        if(count <= 1){
+            return; // Nothing to gain from handing packets to another thread
+        }
+
+        workers = new ProtocolWorker[count];
+        for(unsigned i = 0; i < count; i++){
+            FancyRefPtr<Process> proc = Process::CreateKernelProcess((void*)ProtocolWorkerThread, "NetworkWorker", nullptr);
+            proc->GetMainThread()->registers.rdi = i; // First argument
+            proc->Start(i);
+        }
+
+        __atomic_store_n(&workerCount, count, __ATOMIC_RELEASE);
+
+        Log::Info("[Network] Started %u protocol workers", count);
+    }
+
+    void ReceivePacket(NetworkAdapter* adapter, NetBuffer* buffer){
+        unsigned count = __atomic_load_n(&workerCount, __ATOMIC_ACQUIRE);
+        if(!count){
+            ProcessPacket(adapter, buffer);
+            buffer->Unref();
+            return;
+        }
+
+        const uint8_t* packet = buffer->data;
+        size_t length = buffer->Length();
+        if(adapter->Type() == NetworkAdapter::NetworkAdapterEthernet){
+            const EthernetFrame* frame = reinterpret_cast<const EthernetFrame*>(packet);
+            if(length < sizeof(EthernetFrame) || static_cast<uint16_t>(frame->etherType) != EtherTypeIPv4){
+                // Packets and threads may be waiting on ARP replies, so never queue them behind other traffic
+                ProcessPacket(adapter, buffer);
+                buffer->Unref();
+                return;
+            }
+
+            packet += sizeof(EthernetFrame);
+            length -= sizeof(EthernetFrame);
+        }
+
+        buffer->adapter = adapter;
+
+        ProtocolWorker& worker = workers[FlowHash(packet, length) % count];
+        acquireLock(&worker.queueLock);
+        worker.queue.add_back(buffer);
+        releaseLock(&worker.queueLock);
+
+        worker.packetSemaphore.Signal();
+    }
+}
@@ -2,6 +2,7 @@
 
 #include <Errno.h>
 #include <Logging.h>
+#include <UserPointer.h>
 
 MessageEndpoint::MessageEndpoint(uint16_t maxSize){
     maxMessageSize = maxSize;
@@ -87,7 +88,18 @@ int64_t MessageEndpoint::Call(uint64_t id, uint16_t size, uint64_t data, uint64_
 
     releaseLock(&waitingResponseLock);
 
-    Write(id, size, data); // Send message
+    if(int64_t e = Write(id, size, data); e){ // Send message
+        acquireLock(&waitingResponseLock);
+        for(auto it = waitingResponse.begin(); it != waitingResponse.end(); it++){
+            if(it->item1 == &s){
+                waitingResponse.remove(it);
+                break;
+            }
+        }
+        releaseLock(&waitingResponseLock);
+
+        return e;
+    }
 
     // TODO: timeout
     if(s.Wait()){ // Await response
@@ -122,9 +134,15 @@ int64_t MessageEndpoint::Write(uint64_t id, uint16_t size, uint64_t data){
             Response& response = it->item2;
 
             if(size){
-                *it->item2.buffer = new uint8_t[size];
+                uint8_t* buffer = new uint8_t[size];
+                if(CopyFromUser(buffer, reinterpret_cast<uint8_t*>(data), size)){
+                    delete[] buffer;
 
-                memcpy(*it->item2.buffer, reinterpret_cast<uint8_t*>(data), size);
+                    releaseLock(&peer->waitingResponseLock);
+                    return -EFAULT;
+                }
+
+                *it->item2.buffer = buffer;
             }
 
             *response.size = size;
@@ -149,16 +167,18 @@ int64_t MessageEndpoint::Write(uint64_t id, uint16_t size, uint64_t data){
     acquireLock(&peer->queueLock);
 
     Message* m;
-    if(peer->cache.Dequeue(m)){ // Check for a cached message allocaiton
-        m->size = size;
-        m->id = id;
-        memcpy(m->data, (uint8_t*)data, size);
-    } else {
+    if(!peer->cache.Dequeue(m)){ // Check for a cached message allocaiton
         m = AllocateMessage(); // Nothing left in cache, allocate a new message
+    }
+
+    m->size = size;
+    m->id = id;
+    if(CopyFromUser(m->data, reinterpret_cast<uint8_t*>(data), size)){
+        peer->cache.Enqueue(m);
+        releaseLock(&peer->queueLock);
 
-        m->size = size;
-        m->id = id;
-        memcpy(m->data, (uint8_t*)data, size);
+        queueAvailablilitySemaphore.Signal(); // Give back our space in the queue
+        return -EFAULT;
     }
 
     peer->queue.Enqueue(m);
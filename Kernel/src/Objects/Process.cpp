@@ -69,10 +69,9 @@ FancyRefPtr<Process> Process::CreateELFProcess(void* elf, const Vector<String>&
     thread->registers.rsp = (uintptr_t)thread->stack + 0x400000;
     thread->registers.rbp = (uintptr_t)thread->stack + 0x400000;
 
-    // Force the first 12KB to be allocated
-    stackRegion->vmObject->Hit(stackRegion->base, 0x400000 - 0x1000, proc->GetPageMap());
-    stackRegion->vmObject->Hit(stackRegion->base, 0x400000 - 0x2000, proc->GetPageMap());
-    stackRegion->vmObject->Hit(stackRegion->base, 0x400000 - 0x3000, proc->GetPageMap());
+    // Force the top of the stack to be allocated
+    stackRegion->vmObject->Populate(stackRegion->base, 0x400000 - STACK_PREFAULT_SIZE, STACK_PREFAULT_SIZE,
+                                    proc->GetPageMap());
 
     thread->registers.rip = proc->LoadELF(&thread->registers.rsp, elfInfo, argv, envp, execPath);
     if (!thread->registers.rip) {
@@ -470,6 +469,14 @@ void Process::Start(){
     m_started = true;
 }
 
+void Process::Start(unsigned cpu){
+    ScopedSpinLock acq(m_processLock);
+    assert(!m_started);
+
+    Scheduler::InsertNewThreadIntoQueue(m_mainThread.get(), cpu);
+    m_started = true;
+}
+
 void Process::Watch(KernelObjectWatcher& watcher, int events) {
     ScopedSpinLock acq(m_watchingLock);
 
@@ -1,8 +1,10 @@
 #include <Stream.h>
 
 #include <Assert.h>
+#include <Errno.h>
 #include <Logging.h>
 #include <Timer.h>
+#include <UserPointer.h>
 
 int64_t Stream::Read(void* buffer, size_t len) {
     assert(!"Stream::Read called from base class");
@@ -48,7 +50,10 @@ int64_t DataStream::Read(void* data, size_t len) {
         return 0;
     }
 
-    memcpy(data, buffer, len);
+    if (UserCopy(data, buffer, len)) {
+        releaseLock(&streamLock);
+        return -EFAULT; // data may be a user buffer
+    }
 
     memcpy(buffer, buffer + len, bufferPos - len);
     bufferPos -= len;
@@ -69,7 +74,10 @@ int64_t DataStream::Peek(void* data, size_t len) {
         return 0;
     }
 
-    memcpy(data, buffer, len);
+    if (UserCopy(data, buffer, len)) {
+        releaseLock(&streamLock);
+        return -EFAULT;
+    }
 
     releaseLock(&streamLock);
 
@@ -91,7 +99,10 @@ int64_t DataStream::Write(void* data, size_t len) {
         kfree(oldBuffer);
     }
 
-    memcpy(buffer + bufferPos, data, len);
+    if (UserCopy(buffer + bufferPos, data, len)) {
+        releaseLock(&streamLock);
+        return -EFAULT;
+    }
     bufferPos += len;
 
     if (bufferPos > 0 && waiting.get_length() > 0) {
@@ -124,13 +135,16 @@ int64_t PacketStream::Read(void* buffer, size_t len) {
     if (packets.get_length() <= 0)
         return 0;
 
-    stream_packet_t pkt = packets.remove_at(0);
+    stream_packet_t pkt = packets.get_at(0);
 
     if (len > pkt.len)
         len = pkt.len;
 
-    memcpy(buffer, pkt.data, len);
+    if (UserCopy(buffer, pkt.data, len)) {
+        return -EFAULT; // Leave the packet in the stream
+    }
 
+    packets.remove_at(0);
     kfree(pkt.data);
 
     return len;
@@ -145,7 +159,9 @@ int64_t PacketStream::Peek(void* buffer, size_t len) {
     if (len > pkt.len)
         len = pkt.len;
 
-    memcpy(buffer, pkt.data, len);
+    if (UserCopy(buffer, pkt.data, len)) {
+        return -EFAULT;
+    }
 
     return len;
 }
@@ -154,7 +170,10 @@ int64_t PacketStream::Write(void* buffer, size_t len) {
     stream_packet_t pkt;
     pkt.len = len;
     pkt.data = reinterpret_cast<uint8_t*>(kmalloc(len));
-    memcpy(pkt.data, buffer, len);
+    if (UserCopy(pkt.data, buffer, len)) {
+        kfree(pkt.data);
+        return -EFAULT;
+    }
 
     packets.add_back(pkt);
 
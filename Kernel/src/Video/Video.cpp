@@ -159,7 +159,29 @@ class FramebufferVMO : public VMObject {
         : VMObject(PAGE_COUNT_4K(screenPitch * screenHeight * (screenDepth / 8)) << PAGE_SHIFT_4K, false, true) {}
 
     void MapAllocatedBlocks(uintptr_t base, PageMap* pMap) {
-        Memory::MapVirtualMemory4K(videoMode.physicalAddress, base, size >> PAGE_SHIFT_4K, pMap);
+        uintptr_t phys = videoMode.physicalAddress;
+        uintptr_t virt = base;
+        size_t remaining = size;
+
+        if (!(phys & (PAGE_SIZE_2M - 1)) && !(virt & (PAGE_SIZE_2M - 1)) && remaining >= PAGE_SIZE_2M) {
+            // Map as much of the framebuffer as we can with 2MB pages
+            while (remaining >= PAGE_SIZE_2M) {
+                page_table_t oldTable =
+                    Memory::MapVirtualMemory2M(phys, virt, PAGE_USER | PAGE_WRITABLE | PAGE_PRESENT, pMap);
+                if (oldTable.phys) {
+                    Memory::ShootdownTLB(pMap); // Other CPUs may still be walking the page table
+                    Memory::FreePageTable(oldTable);
+                }
+
+                phys += PAGE_SIZE_2M;
+                virt += PAGE_SIZE_2M;
+                remaining -= PAGE_SIZE_2M;
+            }
+        }
+
+        if (remaining) {
+            Memory::MapVirtualMemory4K(phys, virt, remaining >> PAGE_SHIFT_4K, pMap);
+        }
     }
 
     [[noreturn]] VMObject* Clone() { assert(!"Framebuffer VMO cannot be copied! (copyright?)"); }
@@ -86,6 +86,9 @@ public:
         UpdateFixedBounds();
     };
 
+    void Damage(const Rect& rect); // Report an area of the widget that has changed to the window
+    inline void Damage() { Damage(fixedBounds); }
+
     Widget* active = nullptr; // Only applies to containers, etc. is so widgets know whether they are active or not
 protected:
     Widget* parent = nullptr;
@@ -254,9 +257,11 @@ protected:
 class Label : public Widget {
 public:
     rgba_colour_t textColour = Theme::Current().ColourTextLight();
-    std::string label;
+    std::string label; // Use SetLabel to change, it reports the change to the window
     Label(const char* _label, rect_t _bounds);
 
+    void SetLabel(const std::string& text);
+
     void Paint(surface_t* surface);
 };
 
@@ -322,6 +327,9 @@ public:
 
     void SetModel(DataModel* model);
 
+    // Refresh the model and redraw the list
+    void Refresh();
+
     void Paint(surface_t* surface);
 
     void OnMouseDown(vector2i_t mousePos);
@@ -400,6 +408,7 @@ public:
     void ClearItems() {
         items.clear();
         ResetScrollBar();
+        Damage();
     }
 
     void UpdateFixedBounds();
@@ -490,6 +499,8 @@ class ScrollView : public Container {
 
     rect_t scrollBounds = {0, 0, 0, 0};
 
+    void DamageVisible();
+
 public:
     ScrollView(rect_t b) : Container(b) {}
     void Paint(surface_t* surface);
@@ -21,6 +21,10 @@
 
 #define WINDOW_MENUBAR_HEIGHT 20
 
+#define WINDOW_BUFFER_MAX_DAMAGE 16          // Damaged rects a window buffer can hold
+#define WINDOW_BUFFER_DAMAGE_ALL 0xFFFFFFFFU // Damage count for when the whole window is damaged
+#define WINDOW_DAMAGE_TILE_SIZE 32           // Size of the tiles compared by Paint() to find damage
+
 namespace Lemon::GUI {
 typedef void (*WindowPaintHandler)(surface_t*);
 
@@ -45,6 +49,15 @@ struct WindowBuffer {
     uint64_t buffer2Offset;
     uint32_t drawing; // Is being drawn?
     uint32_t dirty;   // Does it need to be drawn?
+
+    // Areas of the window changed since the window manager last drew it, in window coordinates.
+    // The client appends to the list until the window manager has consumed it,
+    // and only starts a new list once damageConsumed has caught up with damageSerial.
+    // Clients which never increment damageSerial are always drawn in full.
+    uint32_t damageSerial;   // Incremented by the client after publishing the damage of a swap
+    uint32_t damageConsumed; // Last serial drawn by the window manager
+    uint32_t damageCount;    // WINDOW_BUFFER_DAMAGE_ALL if the whole window is damaged
+    Rect damage[WINDOW_BUFFER_MAX_DAMAGE];
 };
 
 enum WindowType {
@@ -134,9 +147,30 @@ public:
     /// \brief Swap the window buffers
     ///
     /// Swap the window buffers, equivalent to Paint() on a Basic Window without OnPaint()
+    /// Only the areas passed to Damage() since the last swap are redrawn by the window manager,
+    /// if there are none the whole window is.
     /////////////////////////////
     void SwapBuffers();
 
+    /////////////////////////////
+    /// \brief Report a changed area of the window
+    ///
+    /// Only the damaged areas need to be painted before the next swap,
+    /// the rest of the window is kept from the last frame.
+    /// Widgets report what they change from their event handlers and setters (e.g. Label::SetLabel, ListView::Refresh).
+    /// Anything changed outside of an event handler by other means (e.g. writing to a widget's members)
+    /// must be damaged explicitly. Paint() compares the whole window against the last frame when nothing
+    /// was reported, but not when something else was, so unreported changes may then not be displayed.
+    ///
+    /// \param rect Area of the window that has been painted
+    /////////////////////////////
+    void Damage(const Rect& rect);
+
+    /////////////////////////////
+    /// \brief Report that the whole window has changed
+    /////////////////////////////
+    inline void DamageAll() { m_damageAll = true; }
+
     /////////////////////////////
     /// \brief Check the event queue for events.
     ///
@@ -339,6 +373,25 @@ private:
 
     timespec m_lastClick = {0, 0};
 
+    // Compare the back buffer against the buffer being displayed and damage the tiles which differ,
+    // tiles within reported damage are skipped
+    void DamageChangedTiles();
+    // Copy the areas not painted this frame from the displayed buffer so the back buffer is complete
+    void CopyUndamagedAreas();
+    // Publish the damage of this frame in the window buffer
+    void PublishDamage();
+
+    std::vector<Rect> m_damage; // Damage reported since the last swap
+    bool m_damageAll = false;
+    bool m_paintedAll = false; // Whole back buffer was painted this frame
+    // Widgets may have changed without reporting it (events were handled or widgets were added or removed),
+    // so Paint() has to look for changes outside of the reported damage
+    bool m_unreportedChanges = true;
+
+    // Damage of the displayed buffer, the back buffer is only out of date in these areas
+    std::vector<Rect> m_lastDamage;
+    bool m_lastDamageAll = true;
+
     std::unique_ptr<TooltipWindow> m_tooltipWindow = nullptr;
     std::queue<Lemon::LemonEvent> m_eventQueue;
 
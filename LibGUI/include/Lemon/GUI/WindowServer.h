@@ -40,6 +40,19 @@ public:
         return {r.width, r.height};
     }
 
+    /////////////////////////////
+    /// \brief Get Display Statistics
+    ///
+    /// \param framerate Frames rendered over the last second
+    /// \param bytesPerSecond Bytes copied to the display over the last second
+    /////////////////////////////
+    inline void GetDisplayStatistics(int& framerate, uint64_t& bytesPerSecond) {
+        LemonWMServer::GetDisplayStatisticsResponse r = LemonWMServerEndpoint::GetDisplayStatistics();
+
+        framerate = r.framerate;
+        bytesPerSecond = r.bytesPerSecond;
+    }
+
     /////////////////////////////
     /// \brief Get path to system theme
     ///
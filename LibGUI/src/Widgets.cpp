@@ -28,6 +28,12 @@ Widget::~Widget() {}
 
 void Widget::Paint(__attribute__((unused)) surface_t* surface) {}
 
+void Widget::Damage(const Rect& rect) {
+    if (window) {
+        window->Damage(rect);
+    }
+}
+
 void Widget::OnMouseEnter(vector2i_t mousePos) { OnMouseMove(mousePos); }
 
 void Widget::OnMouseExit(__attribute__((unused)) vector2i_t mousePos) {}
@@ -126,6 +132,7 @@ void Container::AddWidget(Widget* w) {
     }
 
     UpdateFixedBounds();
+    Damage();
 }
 
 void Container::RemoveWidget(Widget* w) {
@@ -138,6 +145,7 @@ void Container::RemoveWidget(Widget* w) {
         lastMousedOver = nullptr;
 
     children.erase(std::remove(children.begin(), children.end(), w), children.end());
+    Damage();
 }
 
 void Container::Paint(surface_t* surface) {
@@ -365,6 +373,15 @@ void Bitmap::Paint(surface_t* surface) { Graphics::surfacecpy(surface, &this->su
 //////////////////////////
 Label::Label(const char* _label, rect_t _bounds) : Widget(_bounds) { label = _label; }
 
+void Label::SetLabel(const std::string& text) {
+    if (label == text) {
+        return;
+    }
+
+    label = text;
+    Damage();
+}
+
 void Label::Paint(surface_t* surface) {
     Graphics::DrawString(label.c_str(), fixedBounds.pos.x, fixedBounds.pos.y, textColour.r, textColour.g, textColour.b,
                          surface);
@@ -584,6 +601,12 @@ void TextBox::Paint(surface_t* surface) {
         if (msec < 250 || (msec > 500 && msec < 750)) // Only draw the cursor for a quarter of a second so it blinks
             Graphics::DrawRect(fixedBounds.pos.x + cursorX, fixedBounds.pos.y + cursorY, 2, font->lineHeight,
                                textColour.r, textColour.g, textColour.b, surface);
+
+        // The cursor changes whether it was drawn or not, so the window does not have to look for it
+        Rect cursor = {fixedBounds.pos.x + cursorX, fixedBounds.pos.y + cursorY, 2, font->lineHeight};
+        if (cursor.Intersects(fixedBounds)) {
+            Damage(cursor.GetIntersect(fixedBounds));
+        }
     }
 }
 
@@ -621,6 +644,8 @@ void TextBox::LoadText(const char* text) {
     } else {
         contents.push_back(std::string(text2));
     }
+
+    Damage();
 }
 
 void TextBox::OnMouseDown(vector2i_t mousePos) {
@@ -786,6 +811,7 @@ ListView::~ListView() {}
 
 void ListView::SetModel(DataModel* model) {
     this->model = model;
+    Damage();
 
     model->Refresh();
 
@@ -796,6 +822,14 @@ void ListView::SetModel(DataModel* model) {
     }
 }
 
+void ListView::Refresh() {
+    if (model) {
+        model->Refresh();
+    }
+
+    Damage();
+}
+
 void ListView::Paint(surface_t* surface) {
     if (drawBackground) {
         Graphics::DrawRect(fixedBounds.x, fixedBounds.y, fixedBounds.width, columnDisplayHeight,
@@ -912,6 +946,8 @@ void ListView::OnMouseDown(vector2i_t mousePos) {
         return;
     }
 
+    Damage(); // Selection, scroll position or edit box
+
     if (editing) {
         if (Graphics::PointInRect(editbox.GetFixedBounds(), mousePos)) {
             editbox.OnMouseDown(mousePos);
@@ -969,6 +1005,8 @@ void ListView::OnDoubleClick(vector2i_t mousePos) {
         return;
     }
 
+    Damage();
+
     if (!Graphics::PointInRect({fixedBounds.x, fixedBounds.y + columnDisplayHeight,
                                 fixedBounds.width - (showScrollBar ? 12 : 0), fixedBounds.height - columnDisplayHeight},
                                mousePos)) {
@@ -995,6 +1033,7 @@ void ListView::OnDoubleClick(vector2i_t mousePos) {
 void ListView::OnMouseMove(vector2i_t mousePos) {
     if (showScrollBar && sBar.pressed) {
         sBar.OnMouseMoveRelative({0, mousePos.y - fixedBounds.pos.y});
+        Damage();
     }
 }
 
@@ -1005,6 +1044,8 @@ void ListView::OnKeyPress(int key) {
         return;
     }
 
+    Damage();
+
     if (editing) {
         editbox.OnKeyPress(key);
         return;
@@ -1030,6 +1071,7 @@ void ListView::OnKeyPress(int key) {
 }
 
 void ListView::OnInactive() {
+    Damage();
     OnEditboxSubmit();
     editing = false;
 }
@@ -1286,6 +1328,7 @@ int GridView::AddItem(GridItem& item) {
     items.push_back(item);
 
     ResetScrollBar();
+    Damage();
 
     return items.size() - 1;
 }
@@ -1326,8 +1369,10 @@ void ScrollView::OnMouseDown(vector2i_t mousePos) {
     mousePos -= fixedBounds.pos;
     if (mousePos.x >= fixedBounds.width - 16) {
         sBarVertical.OnMouseDownRelative(mousePos - (vector2i_t){fixedBounds.width - 16, 0});
+        DamageVisible();
     } else if (mousePos.y >= fixedBounds.height - 16) {
         sBarHorizontal.OnMouseDownRelative(mousePos - (vector2i_t){0, fixedBounds.height - 16});
+        DamageVisible();
     } else
         for (Widget* w : children) {
             if (Graphics::PointInRect(w->GetFixedBounds(), mousePos)) {
@@ -1352,14 +1397,22 @@ void ScrollView::OnMouseMove(vector2i_t mousePos) {
     if (sBarVertical.pressed) {
         sBarVertical.OnMouseMoveRelative(mousePos - (vector2i_t){fixedBounds.width - 16, 0});
         UpdateFixedBounds();
+        DamageVisible();
     } else if (sBarHorizontal.pressed) {
         sBarHorizontal.OnMouseMoveRelative(mousePos - (vector2i_t){0, fixedBounds.height - 16});
         UpdateFixedBounds();
+        DamageVisible();
     } else if (active) {
         active->OnMouseMove(mousePos);
     }
 }
 
+// fixedBounds is moved by the scroll position, damage the area the view takes up in the window
+void ScrollView::DamageVisible() {
+    Damage({fixedBounds.x + sBarHorizontal.scrollPos, fixedBounds.y + sBarVertical.scrollPos,
+            fixedBounds.width - sBarHorizontal.scrollPos, fixedBounds.height - sBarVertical.scrollPos});
+}
+
 void ScrollView::UpdateFixedBounds() {
     Widget::UpdateFixedBounds();
 
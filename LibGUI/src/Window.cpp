@@ -5,8 +5,11 @@
 #include <Lemon/GUI/WindowServer.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <list>
 #include <sstream>
 
 namespace Lemon::GUI {
@@ -82,6 +85,12 @@ void Window::Resize(vector2i_t size) {
     surface.width = size.x;
     surface.height = size.y;
 
+    // New buffers, nothing painted before the resize is kept
+    m_damage.clear();
+    m_damageAll = true;
+    m_lastDamage.clear();
+    m_lastDamageAll = true;
+
     Paint();
 }
 
@@ -96,6 +105,17 @@ void Window::SwapBuffers() {
     if (m_windowBufferInfo->drawing)
         return;
 
+    if (!m_damageAll && m_damage.empty()) {
+        m_damageAll = true; // Nothing was reported, assume the whole window changed
+    }
+
+    if (!m_damageAll && !m_paintedAll) {
+        CopyUndamagedAreas();
+    }
+
+    bool wasDirty = m_windowBufferInfo->dirty;
+    PublishDamage();
+
     if (surface.buffer == m_buffer1) {
         m_windowBufferInfo->currentBuffer = 0;
         surface.buffer = m_buffer2;
@@ -104,7 +124,148 @@ void Window::SwapBuffers() {
         surface.buffer = m_buffer1;
     }
 
-    m_windowBufferInfo->dirty = 1;
+    __atomic_store_n(&m_windowBufferInfo->dirty, 1, __ATOMIC_RELEASE);
+
+    if (!wasDirty) {
+        // The window manager has drawn the last swap and may be waiting for something to change
+        WindowServer::Instance()->Damaged(m_windowID);
+    }
+
+    m_lastDamage = std::move(m_damage);
+    m_lastDamageAll = m_damageAll;
+
+    m_damage.clear();
+    m_damageAll = false;
+    m_paintedAll = false;
+}
+
+void Window::Damage(const Rect& rect) {
+    if (m_damageAll) {
+        return;
+    }
+
+    Rect clip = rect;
+    if (!clip.Intersects(GetRect())) {
+        return;
+    }
+    clip = clip.GetIntersect(GetRect());
+
+    for (Rect& r : m_damage) {
+        if (r.Contains(clip)) {
+            return;
+        }
+
+        // Join rects stacked on top of each other, Paint() finds damage one row of tiles at a time
+        if (r.x == clip.x && r.width == clip.width && r.bottom() == clip.y) {
+            r.bottom(clip.bottom());
+            return;
+        }
+    }
+
+    if (m_damage.size() >= WINDOW_BUFFER_MAX_DAMAGE) {
+        m_damageAll = true; // Cheaper to redraw the whole window than to track many small areas
+        return;
+    }
+
+    m_damage.push_back(clip);
+}
+
+void Window::DamageChangedTiles() {
+    const uint8_t* displayed = (surface.buffer == m_buffer1) ? m_buffer2 : m_buffer1;
+    int pitch = surface.width * 4;
+
+    std::vector<Rect> reported = m_damage; // Already known to have changed, not compared
+
+    for (int y = 0; y < surface.height; y += WINDOW_DAMAGE_TILE_SIZE) {
+        int tileHeight = std::min(WINDOW_DAMAGE_TILE_SIZE, surface.height - y);
+
+        int spanStart = -1; // Start of the run of changed tiles on this row
+        for (int x = 0; x < surface.width; x += WINDOW_DAMAGE_TILE_SIZE) {
+            int tileWidth = std::min(WINDOW_DAMAGE_TILE_SIZE, surface.width - x);
+
+            Rect tile = {x, y, tileWidth, tileHeight};
+            if (std::any_of(reported.begin(), reported.end(), [&tile](const Rect& r) { return r.Contains(tile); })) {
+                if (spanStart >= 0) { // End the run of changed tiles before it
+                    Damage({spanStart, y, x - spanStart, tileHeight});
+                    spanStart = -1;
+                }
+                continue;
+            }
+
+            bool changed = false;
+            for (int i = 0; i < tileHeight && !changed; i++) {
+                size_t offset = (y + i) * pitch + x * 4;
+                changed = memcmp(surface.buffer + offset, displayed + offset, tileWidth * 4);
+            }
+
+            if (changed && spanStart < 0) {
+                spanStart = x;
+            } else if (!changed && spanStart >= 0) {
+                Damage({spanStart, y, x - spanStart, tileHeight});
+                spanStart = -1;
+            }
+        }
+
+        if (spanStart >= 0) {
+            Damage({spanStart, y, surface.width - spanStart, tileHeight});
+        }
+
+        if (m_damageAll) {
+            return;
+        }
+    }
+}
+
+void Window::CopyUndamagedAreas() {
+    std::list<Rect> stale; // Areas of the back buffer not painted since they last changed
+    if (m_lastDamageAll) {
+        stale.push_back(GetRect());
+    } else {
+        stale.insert(stale.end(), m_lastDamage.begin(), m_lastDamage.end());
+    }
+
+    for (const Rect& painted : m_damage) {
+        for (auto it = stale.begin(); it != stale.end();) {
+            if (!it->Intersects(painted)) {
+                it++;
+                continue;
+            }
+
+            for (const Rect& piece : it->Split(painted)) {
+                if (piece.width > 0 && piece.height > 0) {
+                    stale.insert(it, piece);
+                }
+            }
+            it = stale.erase(it);
+        }
+    }
+
+    surface_t displayed = surface;
+    displayed.buffer = (surface.buffer == m_buffer1) ? m_buffer2 : m_buffer1;
+    for (const Rect& rect : stale) {
+        surface.Blit(&displayed, rect.pos, rect);
+    }
+}
+
+void Window::PublishDamage() {
+    WindowBuffer* info = m_windowBufferInfo;
+
+    // Keep adding to the list until the window manager has consumed it
+    uint32_t count = 0;
+    if (__atomic_load_n(&info->damageConsumed, __ATOMIC_ACQUIRE) != info->damageSerial) {
+        count = info->damageCount;
+    }
+
+    if (m_damageAll || count == WINDOW_BUFFER_DAMAGE_ALL || count + m_damage.size() > WINDOW_BUFFER_MAX_DAMAGE) {
+        count = WINDOW_BUFFER_DAMAGE_ALL;
+    } else {
+        for (const Rect& rect : m_damage) {
+            info->damage[count++] = rect;
+        }
+    }
+
+    info->damageCount = count;
+    __atomic_store_n(&info->damageSerial, info->damageSerial + 1, __ATOMIC_RELEASE);
 }
 
 void Window::Paint() {
@@ -122,6 +283,25 @@ void Window::Paint() {
     if (OnPaintEnd)
         OnPaintEnd(&surface);
 
+    // Widgets report what they change, e.g. a TextBox its blinking cursor.
+    // Comparing with the frame being displayed is the fallback for when something may have changed
+    // without being reported: nothing was reported at all, events were handled or the app paints itself.
+    if (!m_damageAll && (m_damage.empty() || m_unreportedChanges || OnPaint || OnPaintEnd)) {
+        // The whole window was painted, only report what differs from the frame being displayed
+        m_paintedAll = true;
+        DamageChangedTiles();
+
+        if (!m_damageAll && m_damage.empty()) {
+            // Nothing changed, the back buffer now matches the displayed buffer
+            m_lastDamage.clear();
+            m_lastDamageAll = false;
+            m_paintedAll = false;
+            m_unreportedChanges = false;
+            return;
+        }
+    }
+
+    m_unreportedChanges = false;
     SwapBuffers();
 }
 
@@ -154,6 +334,8 @@ void Window::GUIPollEvents() {
 }
 
 void Window::GUIHandleEvent(LemonEvent& ev) {
+    m_unreportedChanges = true; // Not every widget reports what it changes in response
+
     switch (ev.event) {
     case EventMousePressed: {
         lastMousePos = ev.mousePos;
@@ -263,11 +445,20 @@ void Window::GUIHandleEvent(LemonEvent& ev) {
     }
 }
 
-void Window::AddWidget(Widget* w) { rootContainer.AddWidget(w); }
+void Window::AddWidget(Widget* w) {
+    rootContainer.AddWidget(w);
+    m_unreportedChanges = true;
+}
 
-void Window::RemoveWidget(Widget* w) { rootContainer.RemoveWidget(w); }
+void Window::RemoveWidget(Widget* w) {
+    rootContainer.RemoveWidget(w);
+    m_unreportedChanges = true;
+}
 
-void Window::SetActive(Widget* w) { rootContainer.active = w; }
+void Window::SetActive(Widget* w) {
+    rootContainer.active = w;
+    m_unreportedChanges = true;
+}
 
 void Window::DisplayContextMenu(const std::vector<ContextMenuEntry>& entries, vector2i_t pos) {
     if (pos.x == -1 && pos.y == -1) {
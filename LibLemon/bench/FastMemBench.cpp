@@ -0,0 +1,157 @@
+#include "FastMem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Measures the pixel kernels in FastMem, results are in cycles per 1024 pixels
+// Runs on the host, build with ./build.sh and run ./fastmembench
+
+#define FASTMEM_BENCH_MIN_SIZE 16
+#define FASTMEM_BENCH_MAX_SIZE 8192
+#define FASTMEM_BENCH_PIXELS (16 * 1024 * 1024) // Pixels processed for each size and kernel
+
+static inline uint64_t ReadTSC() {
+    uint32_t low, high;
+    asm volatile("lfence; rdtsc" : "=a"(low), "=d"(high)::"memory");
+    return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+template <typename F> static uint64_t Measure(size_t size, F&& func) {
+    unsigned iterations = FASTMEM_BENCH_PIXELS / size;
+
+    func(); // Warm the cache
+
+    uint64_t start = ReadTSC();
+    for (unsigned i = 0; i < iterations; i++) {
+        func();
+    }
+    uint64_t cycles = ReadTSC() - start;
+
+    return cycles * 1024 / (static_cast<uint64_t>(iterations) * size);
+}
+
+static const char* levelNames[] = {"scalar", "sse4.1", "avx2"};
+
+static uint32_t seed = 0x12345678;
+static uint32_t Random() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) | (seed << 16);
+}
+
+// Window contents: mostly opaque with runs of transparent and translucent pixels (shadows, rounded corners)
+static void FillSource(uint32_t* buffer, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t r = Random();
+        uint32_t alpha = (i / 64) % 4 == 0 ? (r >> 24) : ((i / 64) % 4 == 1 ? 0 : 0xff);
+        buffer[i] = (alpha << 24) | (r & 0xffffff);
+    }
+}
+
+// Check the kernels of a level against the scalar versions, including translucent destinations
+static bool Verify(FastMemLevel level, uint32_t* src, const uint8_t* mask, uint32_t* dest, uint32_t* expected,
+                   size_t count) {
+    fastmem_select(level);
+
+    // Opaque destination, translucent pixels scattered through it and transparent runs (as in a TextObject)
+    for (int destType = 0; destType < 3; destType++) {
+        for (size_t i = 0; i < count; i++) {
+            uint32_t alpha = 0xff000000;
+            if (destType == 1 && i % 7 == 0) {
+                alpha = 0;
+            } else if (destType == 2 && (i / 32) % 2) {
+                alpha = 0;
+            }
+
+            expected[i] = dest[i] = (Random() & 0xffffff) | alpha;
+        }
+
+        // Unaligned starts and odd lengths exercise the tails
+        alphablend_scalar(expected + 1, src + 3, count - 5);
+        alphablend_optimized(dest + 1, src + 3, count - 5);
+        if (memcmp(dest, expected, count * 4)) {
+            return false;
+        }
+
+        alphafill_scalar(expected + 3, 0x80336699, count - 4);
+        alphafill_optimized(dest + 3, 0x80336699, count - 4);
+        if (memcmp(dest, expected, count * 4)) {
+            return false;
+        }
+
+        alphamask_scalar(expected + 2, mask + 1, 0xff102030, count - 9);
+        alphamask_optimized(dest + 2, mask + 1, 0xff102030, count - 9);
+        if (memcmp(dest, expected, count * 4)) {
+            return false;
+        }
+    }
+
+    static const uint32_t weights[] = {0, 1, 77, 128, 255, 256};
+    for (uint32_t weight : weights) {
+        lerp32_scalar(expected + 1, src + 2, src + 5, weight, count - 11);
+        lerp32_optimized(dest + 1, src + 2, src + 5, weight, count - 11);
+        if (memcmp(dest, expected, count * 4)) {
+            return false;
+        }
+    }
+
+    memset32_scalar(expected + 1, 0xdeadbeef, count - 3);
+    memset32_optimized(dest + 1, 0xdeadbeef, count - 3);
+    memcpy32_scalar(expected + 2, src + 1, count - 7);
+    memcpy32_optimized(dest + 2, src + 1, count - 7);
+
+    return !memcmp(dest, expected, count * 4);
+}
+
+int main() {
+    uint32_t* src = reinterpret_cast<uint32_t*>(malloc(FASTMEM_BENCH_MAX_SIZE * 4));
+    uint32_t* dest = reinterpret_cast<uint32_t*>(malloc(FASTMEM_BENCH_MAX_SIZE * 4));
+    uint32_t* expected = reinterpret_cast<uint32_t*>(malloc(FASTMEM_BENCH_MAX_SIZE * 4));
+
+    FillSource(src, FASTMEM_BENCH_MAX_SIZE);
+
+    // Glyph coverage: mostly empty or solid with antialiased edges
+    uint8_t* mask = reinterpret_cast<uint8_t*>(malloc(FASTMEM_BENCH_MAX_SIZE));
+    for (size_t i = 0; i < FASTMEM_BENCH_MAX_SIZE; i++) {
+        uint32_t r = Random();
+        mask[i] = (i / 8) % 3 == 0 ? 0 : ((i / 8) % 3 == 1 ? 0xff : (r & 0xff));
+    }
+
+    int supported = fastmem_supported_level();
+    printf("Supported: %s\n", levelNames[supported]);
+
+    // Every kernel has to agree with the scalar version before the timings mean anything
+    for (int level = FastMemSSE41; level <= supported; level++) {
+        if (!Verify(static_cast<FastMemLevel>(level), src, mask, dest, expected, FASTMEM_BENCH_MAX_SIZE)) {
+            printf("%s kernels do not match the scalar kernels\n", levelNames[level]);
+            return 1;
+        }
+    }
+
+    printf("Cycles per 1024 pixels (size, level, memset32, memcpy32, alphablend, alphafill, alphamask, lerp32)\n");
+    for (size_t size = FASTMEM_BENCH_MIN_SIZE; size <= FASTMEM_BENCH_MAX_SIZE; size *= 4) {
+        for (int level = FastMemScalar; level <= supported; level++) {
+            fastmem_select(static_cast<FastMemLevel>(level));
+
+            uint64_t set = Measure(size, [&]() { memset32_optimized(dest, 0xff336699, size); });
+            uint64_t copy = Measure(size, [&]() { memcpy32_optimized(dest, src, size); });
+            uint64_t blend = Measure(size, [&]() {
+                memset32_optimized(dest, 0xff336699, size); // Keep the destination opaque
+                alphablend_optimized(dest, src, size);
+            });
+            blend = blend > set ? blend - set : 0;
+            uint64_t fill = Measure(size, [&]() { alphafill_optimized(dest, 0x80336699, size); });
+            uint64_t glyphs = Measure(size, [&]() { alphamask_optimized(dest, mask, 0xff102030, size); });
+            uint64_t lerp = Measure(size, [&]() { lerp32_optimized(dest, src, expected, 77, size); });
+
+            printf("%zu: %s %lu %lu %lu %lu %lu %lu\n", size, levelNames[level], set, copy, blend, fill, glyphs, lerp);
+        }
+    }
+
+    free(src);
+    free(mask);
+    free(dest);
+    free(expected);
+
+    return 0;
+}
@@ -0,0 +1,7 @@
+#!/bin/sh
+if [ -z "$CXX" ]; then
+	CXX=g++
+fi
+
+echo "Building $(pwd)/fastmembench"
+$CXX -o fastmembench -std=c++17 -O2 -I../include -I../src/Graphics FastMemBench.cpp ../src/Graphics/FastMem.cpp -Wall -Wextra
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Icon atlas
+//
+// Every icon in /system/lemon/resources/icons pre-rendered at 16x16, 32x32 and 64x64
+// as uncompressed 32-bit pixels, built with the system by Scripts/iconatlas.py.
+// LemonWM loads it once into shared memory which IconManager maps in every process.
+//
+// Icons are found with a minimal perfect hash:
+// bucket = IconAtlasHash(name, 0) % bucketCount
+// slot = IconAtlasHash(name, displacement[bucket]) % iconCount
+// The name of the entry in the slot still has to be compared as names not in the atlas map to a slot as well.
+
+#define ICON_ATLAS_PATH "/system/lemon/resources/icons.atlas"
+#define ICON_ATLAS_MAGIC 0x4c544149 // 'IATL'
+#define ICON_ATLAS_VERSION 1
+
+namespace Lemon {
+struct IconAtlasHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;          // Size of the atlas, a multiple of the page size
+    uint32_t iconCount;     // Number of icons and slots
+    uint32_t bucketCount;
+    uint32_t bucketsOffset; // Displacement (uint32_t) for each bucket
+    uint32_t iconsOffset;   // IconAtlasEntry for each slot
+    uint32_t namesOffset;
+    uint32_t pixelsOffset;  // Page aligned
+};
+
+struct IconAtlasEntry {
+    uint32_t nameOffset; // From namesOffset, names are not null terminated
+    uint32_t nameLength;
+    uint32_t pixels[3];  // Offsets of the 16x16, 32x32 and 64x64 icons
+};
+
+// FNV-1a with a murmur3 finaliser so each seed gives an unrelated hash
+inline uint32_t IconAtlasHash(const char* name, size_t length, uint32_t seed) {
+    uint32_t hash = 2166136261U ^ seed;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<uint8_t>(name[i]);
+        hash *= 16777619U;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+    return hash;
+}
+} // namespace Lemon
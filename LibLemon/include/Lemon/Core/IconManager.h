@@ -1,6 +1,7 @@
 #pragma once
 
 #include <Lemon/Core/Icon.h>
+#include <Lemon/Core/IconAtlas.h>
 #include <Lemon/Graphics/Surface.h>
 
 #include <map>
@@ -22,7 +23,8 @@ class IconManager final {
     /////////////////////////////
     /// \brief Get icon surface
     ///
-    /// Attempts to find surface for icon of preferred size
+    /// Attempts to find surface for icon of preferred size,
+    /// looking in the shared icon atlas before loading the icon
     ///
     /// \param name Name of icon
     /// \param preferredSize Preferred icon size
@@ -34,11 +36,18 @@ class IconManager final {
   private:
     IconManager();
 
+    // Map the icon atlas shared by LemonWM
+    void MapAtlas();
+    // Point the surfaces of icon at the atlas, returns false if name is not in the atlas
+    bool FindAtlasIcon(const std::string& name, Icon& icon);
+
     static IconManager* m_instance;
     static std::mutex m_mutex;
 
     Icon m_missingIcon; // Filler icon for when no sucessful icon could be found
 
+    const IconAtlasHeader* m_atlas = nullptr;
+
     std::map<std::string, Icon> m_icons; // Icon cache
 };
 } // namespace Lemon
@@ -47,3 +47,41 @@ typedef struct RGBAColour {
 } __attribute__((packed)) rgba_colour_t;
 
 using Colour = RGBAColour;
+
+namespace Lemon::Graphics {
+// Blend src over dest, both 0xAARRGGBB with straight (not premultiplied) alpha
+static inline uint32_t AlphaBlendInt(uint32_t dest, uint32_t src) {
+    uint16_t alpha = src >> 24;
+    uint16_t destAlpha = dest >> 24;
+
+    if (alpha == 0) {
+        return dest;
+    } else if (alpha == 0xff || destAlpha == 0) {
+        return src;
+    } else if (destAlpha == 0xff) {
+        // Opaque destination (the common case), the result stays opaque
+        // c = (cs * a + cd * (255 - a)) / 255, rounded. The SIMD kernels in FastMem give the same result
+        uint32_t inverse = 255 - alpha;
+        uint32_t result = 0xff000000;
+        for (int shift = 0; shift < 24; shift += 8) {
+            uint32_t c = ((src >> shift) & 0xff) * alpha + ((dest >> shift) & 0xff) * inverse + 128;
+            result |= ((c + (c >> 8)) >> 8) << shift;
+        }
+
+        return result;
+    }
+
+    // Unfortunately the red channel bleeds into the blue if we do not separate them
+    // Most of the fancy optimizations ive tried have resulted in severe inaccuraccies
+    uint16_t mulAlpha = alpha << 8;
+    uint16_t mulDestAlpha = (255 - alpha) * destAlpha;
+    uint32_t resultAlpha = mulAlpha + mulDestAlpha;
+
+    uint32_t r = ((dest & 0xff) * mulDestAlpha + mulAlpha * (src & 0xff)) / resultAlpha;
+    uint32_t g = (((dest >> 8) & 0xff) * mulDestAlpha + mulAlpha * ((src >> 8) & 0xff)) / resultAlpha;
+    uint32_t b = (((dest >> 16) & 0xff) * mulDestAlpha + mulAlpha * ((src >> 16) & 0xff)) / resultAlpha;
+
+    return ((resultAlpha >> 8 << 24) & 0xff000000) | (r & 0x000000ff) | ((g << 8) & 0x0000ff00) |
+           ((b << 16) & 0x00ff0000);
+}
+} // namespace Lemon::Graphics
@@ -6,6 +6,8 @@
 #include FT_FREETYPE_H
 
 namespace Lemon::Graphics {
+class GlyphCache;
+
 struct Font {
     bool monospace = false;
     FT_Face face;
@@ -15,6 +17,8 @@ struct Font {
     int width;
     int tabWidth = 4;
     char* id;
+
+    GlyphCache* glyphs = nullptr; // Rendered glyphs, metrics and kerning (see text.cpp)
 };
 
 class FontException : public std::exception {
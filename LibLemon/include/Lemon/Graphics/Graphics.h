@@ -158,31 +158,6 @@ static inline int IdentifyImage(const void* data) {
     return type;
 }
 
-static inline uint32_t AlphaBlendInt(uint32_t dest, uint32_t src) {
-    uint16_t alpha = src >> 24;
-    uint16_t destAlpha = dest >> 24;
-
-    if (alpha == 0) {
-        return dest;
-    } else if (alpha == 0xff || destAlpha == 0) {
-        return src;
-    }
-
-    // TODO: optimize out the divisions
-    // Unfortunately the red channel bleeds into the blue if we do not separate them
-    // Most of the fancy optimizations ive tried have resulted in severe inaccuraccies
-    uint16_t mulAlpha = alpha << 8;
-    uint16_t mulDestAlpha = (255 - alpha) * destAlpha;
-    uint32_t resultAlpha = mulAlpha + mulDestAlpha;
-
-    uint32_t r = ((dest & 0xff) * mulDestAlpha + mulAlpha * (src & 0xff)) / resultAlpha;
-    uint32_t g = (((dest >> 8) & 0xff) * mulDestAlpha + mulAlpha * ((src >> 8) & 0xff)) / resultAlpha;
-    uint32_t b = (((dest >> 16) & 0xff) * mulDestAlpha + mulAlpha * ((src >> 16) & 0xff)) / resultAlpha;
-
-    return ((resultAlpha >> 8 << 24) & 0xff000000) | (r & 0x000000ff) | ((g << 8) & 0x0000ff00) |
-           ((b << 16) & 0x00ff0000);
-}
-
 static inline uint32_t AlphaBlendF(uint32_t oldColour, uint8_t r, uint8_t g, uint8_t b, double opacity) {
     return AlphaBlendInt(oldColour, RGBAColour::ToARGB({r, g, b, static_cast<uint8_t>(opacity * 255)}));
 }
@@ -256,6 +231,10 @@ int LoadBitmapImage(FILE* f, surface_t* surface);
 int DrawImage(int x, int y, int w, int h, uint8_t* data, size_t dataSz, surface_t* surface, bool preserveAspectRatio);
 int DrawBitmapImage(int x, int y, int w, int h, uint8_t* data, surface_t* surface, bool preserveAspectRatio = false);
 
+// ScaleSurface (const surface_t*, const Rect&, surface_t*, const Rect&) - Scale srcRegion of src to fill destRect of
+// dest, using a box filter when shrinking and bilinear filtering otherwise. Pixels outside of dest are skipped.
+void ScaleSurface(const surface_t* src, const Rect& srcRegion, surface_t* dest, const Rect& destRect);
+
 void DrawGradient(int x, int y, int width, int height, rgba_colour_t c1, rgba_colour_t c2, surface_t* surface);
 void DrawGradientVertical(rect_t rect, rgba_colour_t c1, rgba_colour_t c2, surface_t* surface);
 void DrawGradientVertical(rect_t rect, rgba_colour_t c1, rgba_colour_t c2, surface_t* surface, rect_t limits);
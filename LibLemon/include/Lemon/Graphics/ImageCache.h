@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Lemon/Graphics/Surface.h>
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#define IMAGE_CACHE_MAX_SIZE (16 * 1024 * 1024) // Decoded bytes kept once no one else holds the images
+#define IMAGE_CACHE_MAX_IMAGE_SIZE (1024 * 1024) // Larger images (e.g. wallpapers) are not kept once decoded
+
+namespace Lemon::Graphics {
+using ImagePtr = std::shared_ptr<const Surface>;
+
+// Thread safe cache of decoded images shared across a process
+//
+// Images are keyed by path and checked against the modification time and size
+// of the file, so a file which has changed is decoded again. Images which are only
+// held by the cache are evicted least recently used first once IMAGE_CACHE_MAX_SIZE is exceeded.
+// Images larger than IMAGE_CACHE_MAX_IMAGE_SIZE are only shared by requests made whilst they are decoded.
+class ImageCache final {
+  public:
+    static ImageCache& Instance();
+
+    /////////////////////////////
+    /// \brief Get decoded image
+    ///
+    /// Decodes the image on the calling thread if it is not cached,
+    /// waits if it is being decoded by another thread.
+    ///
+    /// \param path Path of image
+    /// \param error Set to the LoadImage error code on failure
+    ///
+    /// \return Immutable image, nullptr on failure
+    /////////////////////////////
+    ImagePtr Get(const std::string& path, int* error = nullptr);
+
+  private:
+    struct Entry {
+        std::string path;
+        time_t mtime;
+        off_t size;
+
+        std::promise<ImagePtr> promise;
+        std::shared_future<ImagePtr> image;
+        int error = 0;
+
+        bool ready = false;
+        size_t bytes = 0;
+        uint64_t lastUsed = 0;
+    };
+
+    ImageCache() = default;
+
+    // Find the entry for path, creating it if it is missing or stale.
+    // decode is set if the caller has to decode the new entry.
+    std::shared_ptr<Entry> Lookup(const std::string& path, bool& decode, int& error);
+    void Decode(const std::shared_ptr<Entry>& entry);
+    void Trim();
+
+    std::mutex m_lock;
+    std::map<std::string, std::shared_ptr<Entry>> m_entries;
+    size_t m_cachedBytes = 0;
+    uint64_t m_useCounter = 0;
+};
+} // namespace Lemon::Graphics
@@ -5,10 +5,13 @@
 #include <Lemon/Graphics/Types.h>
 
 #include <string>
+#include <vector>
 
 #include <assert.h>
 
 namespace Lemon::Graphics {
+struct CachedGlyph;
+
 class TextObject {
 public:
     enum {
@@ -39,8 +42,10 @@ public:
     inline void SetFont(Font* font) {
         assert(font);
 
-        m_font = font;
-        m_textDirty = true;
+        if (font != m_font) {
+            m_font = font;
+            m_layoutDirty = m_textDirty = true;
+        }
     }
 
     /////////////////////////////
@@ -49,9 +54,10 @@ public:
     /// \param text Text to render
     /////////////////////////////
     inline void SetText(const char* t) {
-        m_text = t;
-
-        m_textDirty = true;
+        if (m_text != t) {
+            m_text = t;
+            m_layoutDirty = m_textDirty = true;
+        }
     }
 
     /////////////////////////////
@@ -60,9 +66,10 @@ public:
     /// \param text Text to render
     /////////////////////////////
     inline void SetText(const std::string& t) {
-        m_text = t;
-
-        m_textDirty = true;
+        if (m_text != t) {
+            m_text = t;
+            m_layoutDirty = m_textDirty = true;
+        }
     }
 
     /////////////////////////////
@@ -77,7 +84,12 @@ public:
     ///
     /// \param colour New colour
     /////////////////////////////
-    inline void SetColour(const RGBAColour& colour) { m_colour = colour; }
+    inline void SetColour(const RGBAColour& colour) {
+        if (RGBAColour::ToARGB(colour) != RGBAColour::ToARGB(m_colour)) {
+            m_colour = colour;
+            m_textDirty = true;
+        }
+    }
 
     /////////////////////////////
     /// \brief Get size of the font being rendered
@@ -121,7 +133,15 @@ protected:
 
     vector2i_t m_pos;
 
-    bool m_textDirty = true;
+    // Glyphs and their positions, laid out again only when the text or font changes
+    struct PositionedGlyph {
+        const CachedGlyph* glyph;
+        int x;
+    };
+    std::vector<PositionedGlyph> m_run;
+
+    bool m_layoutDirty = true;
+    bool m_textDirty = true; // Surface has to be rendered again
     vector2i_t m_textSize;
 
     int m_renderMode = RenderNormal;
@@ -129,6 +149,7 @@ protected:
     Surface m_surface{};
 
     void CalculateSizes();
+    void Layout();
     void Update();
 };
 } // namespace Lemon::Graphics
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <abi-bits/vm-flags.h>
+
+// mmap flags supported by the kernel which are not in every libc ABI,
+// programs should include this header rather than define them themselves
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0x08000 // Allocate the whole mapping up front, same value as Linux
+#endif
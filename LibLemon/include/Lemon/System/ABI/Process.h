@@ -19,4 +19,5 @@ typedef struct LemonProcessInfo {
     bool isCPUIdle = false; // Whether or not the process is an idle process
 
     uint64_t usedMem; // Used memory in KB
+    uint64_t hugePageMem; // Memory mapped with 2MB pages in KB
 } lemon_process_info_t;
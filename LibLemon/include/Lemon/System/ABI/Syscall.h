@@ -103,4 +103,8 @@
 #define SYS_SIGNAL_ACTION 102
 #define SYS_SIGPROCMASK 103
 #define SYS_KILL 104
-#define SYS_SIGNAL_RETURN 105
\ No newline at end of file
+#define SYS_SIGNAL_RETURN 105
+#define SYS_ALARM 106
+#define SYS_GET_RESOURCE_LIMIT 107
+#define SYS_SENDMMSG 108
+#define SYS_RECVMMSG 109
\ No newline at end of file
@@ -0,0 +1,539 @@
+#include "FastMem.h"
+
+#include <Lemon/Graphics/Colour.h>
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+using Lemon::Graphics::AlphaBlendInt;
+
+#define FASTMEM_ALPHA_MASK 0xff000000U
+
+void memset32_scalar(void* _dest, uint32_t c, size_t count) {
+    uint32_t* dest = reinterpret_cast<uint32_t*>(_dest);
+    while (count--) {
+        *(dest++) = c;
+    }
+}
+
+void memcpy32_scalar(void* _dest, const void* _src, size_t count) {
+    uint32_t* dest = reinterpret_cast<uint32_t*>(_dest);
+    const uint32_t* src = reinterpret_cast<const uint32_t*>(_src);
+    while (count--) {
+        *(dest++) = *(src++);
+    }
+}
+
+void alphablend_scalar(uint32_t* dest, const uint32_t* src, size_t count) {
+    for (; count; count--, dest++, src++) {
+        *dest = AlphaBlendInt(*dest, *src);
+    }
+}
+
+void alphafill_scalar(uint32_t* dest, uint32_t colour, size_t count) {
+    if (!(colour >> 24)) {
+        return; // Fully transparent
+    } else if ((colour >> 24) == 0xff) {
+        memset32_scalar(dest, colour, count);
+        return;
+    }
+
+    for (; count; count--, dest++) {
+        *dest = AlphaBlendInt(*dest, colour);
+    }
+}
+
+void alphamask_scalar(uint32_t* dest, const uint8_t* mask, uint32_t colour, size_t count) {
+    colour &= ~FASTMEM_ALPHA_MASK;
+
+    for (; count; count--, dest++, mask++) {
+        if (*mask == 0xff) {
+            *dest = colour | FASTMEM_ALPHA_MASK;
+        } else if (*mask) {
+            *dest = AlphaBlendInt(*dest, colour | (static_cast<uint32_t>(*mask) << 24));
+        }
+    }
+}
+
+void lerp32_scalar(uint32_t* dest, const uint32_t* a, const uint32_t* b, uint32_t weight, size_t count) {
+    // Red and blue, then alpha and green, two channels at a time
+    for (; count; count--, dest++, a++, b++) {
+        uint32_t rb = (((*a & 0xff00ff) * (256 - weight) + (*b & 0xff00ff) * weight + 0x800080) >> 8) & 0xff00ff;
+        uint32_t ag = (((*a >> 8) & 0xff00ff) * (256 - weight) + ((*b >> 8) & 0xff00ff) * weight + 0x800080) & 0xff00ff00;
+        *dest = rb | ag;
+    }
+}
+
+// SSE4.1
+//
+// The blend expands each channel to 16 bits and computes
+// c = (cs * a + cd * (255 - a) + 128) / 255
+// for opaque destinations. The division is done as (t * 257) >> 16 (_mm_mulhi_epu16),
+// which is exact for every t that can occur, so the result matches AlphaBlendInt.
+
+// Blend the channels of two pixels expanded to 16 bits
+__attribute__((target("sse4.1"))) static inline __m128i BlendChannels(__m128i src, __m128i dest, __m128i alpha) {
+    const __m128i vector00ff = _mm_set1_epi16(0xff);
+    const __m128i rounding = _mm_set1_epi16(128);
+    const __m128i divide255 = _mm_set1_epi16(257);
+
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(src, alpha), _mm_mullo_epi16(dest, _mm_xor_si128(alpha, vector00ff)));
+    return _mm_mulhi_epu16(_mm_add_epi16(t, rounding), divide255);
+}
+
+__attribute__((target("sse4.1"))) void memset32_sse41(void* _dest, uint32_t c, size_t count) {
+    uint8_t* dest = reinterpret_cast<uint8_t*>(_dest);
+    __m128i value = _mm_set1_epi32(c);
+
+    for (; count >= 8; count -= 8, dest += 32) {
+        _mm_storeu_si128(reinterpret_cast<__m128i_u*>(dest), value);
+        _mm_storeu_si128(reinterpret_cast<__m128i_u*>(dest + 16), value);
+    }
+
+    memset32_scalar(dest, c, count);
+}
+
+__attribute__((target("sse4.1"))) void memcpy32_sse41(void* _dest, const void* _src, size_t count) {
+    uint8_t* dest = reinterpret_cast<uint8_t*>(_dest);
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(_src);
+
+    for (; count >= 8; count -= 8, dest += 32, src += 32) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i_u*>(src));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i_u*>(src + 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i_u*>(dest), a);
+        _mm_storeu_si128(reinterpret_cast<__m128i_u*>(dest + 16), b);
+    }
+
+    memcpy32_scalar(dest, src, count);
+}
+
+__attribute__((target("sse4.1"))) void alphablend_sse41(uint32_t* dest, const uint32_t* src, size_t count) {
+    const __m128i alphaMask = _mm_set1_epi32(FASTMEM_ALPHA_MASK);
+    // Broadcast the alpha of each pixel to its 16-bit channels
+    const __m128i alphaShuffleLow = _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+    const __m128i alphaShuffleHigh = _mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; count >= 4; count -= 4, dest += 4, src += 4) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i_u*>(src));
+        __m128i sAlpha = _mm_and_si128(s, alphaMask);
+        if (_mm_testz_si128(s, alphaMask)) {
+            continue; // Source is transparent, dest does not change
+        } else if (_mm_movemask_epi8(_mm_cmpeq_epi32(sAlpha, alphaMask)) == 0xffff) {
+            _mm_storeu_si128(reinterpret_cast<__m128i_u*>(dest), s); // Source is opaque
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i_u*>(dest));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(d, alphaMask), alphaMask)) != 0xffff) {
+            alphablend_scalar(dest, src, 4); // Translucent destination
+            continue;
+        }
+
+        __m128i low = BlendChannels(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero),
+                                    _mm_shuffle_epi8(s, alphaShuffleLow));
+        __m128i high = BlendChannels(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero),
+                                     _mm_shuffle_epi8(s, alphaShuffleHigh));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i_u*>(dest), _mm_or_si128(_mm_packus_epi16(low, high), alphaMask));
+    }
+
+    alphablend_scalar(dest, src, count);
+}
+
+__attribute__((target("sse4.1"))) void alphafill_sse41(uint32_t* dest, uint32_t colour, size_t count) {
+    uint32_t alpha = colour >> 24;
+    if (!alpha) {
+        return;
+    } else if (alpha == 0xff) {
+        memset32_sse41(dest, colour, count);
+        return;
+    }
+
+    const __m128i alphaMask = _mm_set1_epi32(FASTMEM_ALPHA_MASK);
+    const __m128i divide255 = _mm_set1_epi16(257);
+    const __m128i zero = _mm_setzero_si128();
+
+    // cs * a + 128 is the same for every pixel
+    __m128i colourTerm = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set1_epi32(colour), zero),
+                                                       _mm_set1_epi16(alpha)),
+                                       _mm_set1_epi16(128));
+    __m128i inverse = _mm_set1_epi16(255 - alpha);
+
+    for (; count >= 4; count -= 4, dest += 4) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i_u*>(dest));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(d, alphaMask), alphaMask)) != 0xffff) {
+            alphafill_scalar(dest, colour, 4);
+            continue;
+        }
+
+        __m128i low = _mm_mulhi_epu16(_mm_add_epi16(colourTerm, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inverse)),
+                                      divide255);
+        __m128i high = _mm_mulhi_epu16(_mm_add_epi16(colourTerm, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inverse)),
+                                       divide255);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i_u*>(dest), _mm_or_si128(_mm_packus_epi16(low, high), alphaMask));
+    }
+
+    alphafill_scalar(dest, colour, count);
+}
+
+__attribute__((target("sse4.1"))) void alphamask_sse41(uint32_t* dest, const uint8_t* mask, uint32_t colour, size_t count) {
+    const __m128i alphaMask = _mm_set1_epi32(FASTMEM_ALPHA_MASK);
+    // Broadcast the coverage of each pixel (zero extended to 32 bits) to its 16-bit channels
+    const __m128i coverageShuffleLow = _mm_setr_epi8(0, -1, 0, -1, 0, -1, 0, -1, 4, -1, 4, -1, 4, -1, 4, -1);
+    const __m128i coverageShuffleHigh = _mm_setr_epi8(8, -1, 8, -1, 8, -1, 8, -1, 12, -1, 12, -1, 12, -1, 12, -1);
+    const __m128i zero = _mm_setzero_si128();
+
+    const __m128i opaqueColour = _mm_set1_epi32(colour | FASTMEM_ALPHA_MASK);
+    const __m128i colourChannels = _mm_unpacklo_epi8(opaqueColour, zero);
+    const __m128i colourRGB = _mm_set1_epi32(colour & ~FASTMEM_ALPHA_MASK);
+
+    for (; count >= 4; count -= 4, dest += 4, mask += 4) {
+        uint32_t coverageBytes;
+        __builtin_memcpy(&coverageBytes, mask, 4);
+        if (!coverageBytes) {
+            continue;
+        } else if (coverageBytes == 0xffffffff) {
+            _mm_storeu_si128(reinterpret_cast<__m128i_u*>(dest), opaqueColour);
+            continue;
+        }
+
+        __m128i coverage = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(coverageBytes));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i_u*>(dest));
+        __m128i dAlpha = _mm_and_si128(d, alphaMask);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(dAlpha, alphaMask)) == 0xffff) {
+            __m128i low = BlendChannels(colourChannels, _mm_unpacklo_epi8(d, zero),
+                                        _mm_shuffle_epi8(coverage, coverageShuffleLow));
+            __m128i high = BlendChannels(colourChannels, _mm_unpackhi_epi8(d, zero),
+                                         _mm_shuffle_epi8(coverage, coverageShuffleHigh));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i_u*>(dest), _mm_or_si128(_mm_packus_epi16(low, high), alphaMask));
+        } else if (_mm_movemask_epi8(_mm_cmpeq_epi32(dAlpha, zero)) == 0xffff) {
+            // Transparent destination (e.g. a cleared TextObject surface) takes the colour with the coverage as alpha
+            __m128i result = _mm_or_si128(colourRGB, _mm_slli_epi32(coverage, 24));
+            _mm_storeu_si128(reinterpret_cast<__m128i_u*>(dest),
+                             _mm_blendv_epi8(d, result, _mm_cmpgt_epi32(coverage, zero)));
+        } else {
+            alphamask_scalar(dest, mask, colour, 4);
+        }
+    }
+
+    alphamask_scalar(dest, mask, colour, count);
+}
+
+// Interpolate the channels of two pixels expanded to 16 bits,
+// the weighted sum is at most 255 * 256 so it fits in 16 bits with the rounding term
+__attribute__((target("sse4.1"))) static inline __m128i LerpChannels(__m128i a, __m128i b, __m128i weightA,
+                                                                     __m128i weightB) {
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, weightA), _mm_mullo_epi16(b, weightB));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(0x80)), 8);
+}
+
+__attribute__((target("sse4.1"))) void lerp32_sse41(uint32_t* dest, const uint32_t* a, const uint32_t* b,
+                                                     uint32_t weight, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weightA = _mm_set1_epi16(256 - weight);
+    const __m128i weightB = _mm_set1_epi16(weight);
+
+    for (; count >= 4; count -= 4, dest += 4, a += 4, b += 4) {
+        __m128i pa = _mm_loadu_si128(reinterpret_cast<const __m128i_u*>(a));
+        __m128i pb = _mm_loadu_si128(reinterpret_cast<const __m128i_u*>(b));
+
+        __m128i low = LerpChannels(_mm_unpacklo_epi8(pa, zero), _mm_unpacklo_epi8(pb, zero), weightA, weightB);
+        __m128i high = LerpChannels(_mm_unpackhi_epi8(pa, zero), _mm_unpackhi_epi8(pb, zero), weightA, weightB);
+        _mm_storeu_si128(reinterpret_cast<__m128i_u*>(dest), _mm_packus_epi16(low, high));
+    }
+
+    lerp32_scalar(dest, a, b, weight, count);
+}
+
+// AVX2
+//
+// Same as the SSE4.1 kernels with 8 pixels at a time.
+// Unpacking and shuffles work within each 128-bit lane, so the shuffle masks repeat for both lanes.
+// The remaining pixels are left to the SSE4.1 kernels, clear the upper halves of the registers first
+// or every SSE instruction pays for the transition.
+
+__attribute__((target("avx2"))) static inline __m256i BlendChannels256(__m256i src, __m256i dest, __m256i alpha) {
+    const __m256i vector00ff = _mm256_set1_epi16(0xff);
+    const __m256i rounding = _mm256_set1_epi16(128);
+    const __m256i divide255 = _mm256_set1_epi16(257);
+
+    __m256i t =
+        _mm256_add_epi16(_mm256_mullo_epi16(src, alpha), _mm256_mullo_epi16(dest, _mm256_xor_si256(alpha, vector00ff)));
+    return _mm256_mulhi_epu16(_mm256_add_epi16(t, rounding), divide255);
+}
+
+__attribute__((target("avx2"))) void memset32_avx2(void* _dest, uint32_t c, size_t count) {
+    uint8_t* dest = reinterpret_cast<uint8_t*>(_dest);
+    __m256i value = _mm256_set1_epi32(c);
+
+    for (; count >= 16; count -= 16, dest += 64) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(dest), value);
+        _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(dest + 32), value);
+    }
+
+    _mm256_zeroupper();
+    memset32_sse41(dest, c, count);
+}
+
+__attribute__((target("avx2"))) void memcpy32_avx2(void* _dest, const void* _src, size_t count) {
+    uint8_t* dest = reinterpret_cast<uint8_t*>(_dest);
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(_src);
+
+    for (; count >= 16; count -= 16, dest += 64, src += 64) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(src));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(src + 32));
+        _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(dest), a);
+        _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(dest + 32), b);
+    }
+
+    _mm256_zeroupper();
+    memcpy32_sse41(dest, src, count);
+}
+
+__attribute__((target("avx2"))) void alphablend_avx2(uint32_t* dest, const uint32_t* src, size_t count) {
+    const __m256i alphaMask = _mm256_set1_epi32(FASTMEM_ALPHA_MASK);
+    const __m256i alphaShuffleLow = _mm256_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1, 3, -1, 3,
+                                                     -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+    const __m256i alphaShuffleHigh =
+        _mm256_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1, 11, -1, 11, -1, 11, -1, 11, -1,
+                         15, -1, 15, -1, 15, -1, 15, -1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (; count >= 8; count -= 8, dest += 8, src += 8) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(src));
+        __m256i sAlpha = _mm256_and_si256(s, alphaMask);
+        if (_mm256_testz_si256(s, alphaMask)) {
+            continue;
+        } else if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(sAlpha, alphaMask)) == -1) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(dest), s);
+            continue;
+        }
+
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(dest));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(d, alphaMask), alphaMask)) != -1) {
+            alphablend_scalar(dest, src, 8);
+            continue;
+        }
+
+        __m256i low = BlendChannels256(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero),
+                                       _mm256_shuffle_epi8(s, alphaShuffleLow));
+        __m256i high = BlendChannels256(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero),
+                                        _mm256_shuffle_epi8(s, alphaShuffleHigh));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(dest),
+                            _mm256_or_si256(_mm256_packus_epi16(low, high), alphaMask));
+    }
+
+    _mm256_zeroupper();
+    alphablend_sse41(dest, src, count);
+}
+
+__attribute__((target("avx2"))) void alphafill_avx2(uint32_t* dest, uint32_t colour, size_t count) {
+    uint32_t alpha = colour >> 24;
+    if (!alpha) {
+        return;
+    } else if (alpha == 0xff) {
+        memset32_avx2(dest, colour, count);
+        return;
+    }
+
+    const __m256i alphaMask = _mm256_set1_epi32(FASTMEM_ALPHA_MASK);
+    const __m256i divide255 = _mm256_set1_epi16(257);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i colourTerm = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(_mm256_set1_epi32(colour), zero),
+                                                             _mm256_set1_epi16(alpha)),
+                                          _mm256_set1_epi16(128));
+    __m256i inverse = _mm256_set1_epi16(255 - alpha);
+
+    for (; count >= 8; count -= 8, dest += 8) {
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(dest));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(d, alphaMask), alphaMask)) != -1) {
+            alphafill_scalar(dest, colour, 8);
+            continue;
+        }
+
+        __m256i low = _mm256_mulhi_epu16(
+            _mm256_add_epi16(colourTerm, _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), inverse)), divide255);
+        __m256i high = _mm256_mulhi_epu16(
+            _mm256_add_epi16(colourTerm, _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), inverse)), divide255);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(dest),
+                            _mm256_or_si256(_mm256_packus_epi16(low, high), alphaMask));
+    }
+
+    _mm256_zeroupper();
+    alphafill_sse41(dest, colour, count);
+}
+
+__attribute__((target("avx2"))) void alphamask_avx2(uint32_t* dest, const uint8_t* mask, uint32_t colour, size_t count) {
+    const __m256i alphaMask = _mm256_set1_epi32(FASTMEM_ALPHA_MASK);
+    const __m256i coverageShuffleLow = _mm256_setr_epi8(0, -1, 0, -1, 0, -1, 0, -1, 4, -1, 4, -1, 4, -1, 4, -1, 0, -1,
+                                                        0, -1, 0, -1, 0, -1, 4, -1, 4, -1, 4, -1, 4, -1);
+    const __m256i coverageShuffleHigh =
+        _mm256_setr_epi8(8, -1, 8, -1, 8, -1, 8, -1, 12, -1, 12, -1, 12, -1, 12, -1, 8, -1, 8, -1, 8, -1, 8, -1, 12, -1,
+                         12, -1, 12, -1, 12, -1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    const __m256i opaqueColour = _mm256_set1_epi32(colour | FASTMEM_ALPHA_MASK);
+    const __m256i colourChannels = _mm256_unpacklo_epi8(opaqueColour, zero);
+    const __m256i colourRGB = _mm256_set1_epi32(colour & ~FASTMEM_ALPHA_MASK);
+
+    for (; count >= 8; count -= 8, dest += 8, mask += 8) {
+        uint64_t coverageBytes;
+        __builtin_memcpy(&coverageBytes, mask, 8);
+        if (!coverageBytes) {
+            continue;
+        } else if (coverageBytes == ~0ULL) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(dest), opaqueColour);
+            continue;
+        }
+
+        __m256i coverage = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(coverageBytes));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(dest));
+        __m256i dAlpha = _mm256_and_si256(d, alphaMask);
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(dAlpha, alphaMask)) == -1) {
+            __m256i low = BlendChannels256(colourChannels, _mm256_unpacklo_epi8(d, zero),
+                                           _mm256_shuffle_epi8(coverage, coverageShuffleLow));
+            __m256i high = BlendChannels256(colourChannels, _mm256_unpackhi_epi8(d, zero),
+                                            _mm256_shuffle_epi8(coverage, coverageShuffleHigh));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(dest),
+                                _mm256_or_si256(_mm256_packus_epi16(low, high), alphaMask));
+        } else if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(dAlpha, zero)) == -1) {
+            __m256i result = _mm256_or_si256(colourRGB, _mm256_slli_epi32(coverage, 24));
+            _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(dest),
+                                _mm256_blendv_epi8(d, result, _mm256_cmpgt_epi32(coverage, zero)));
+        } else {
+            alphamask_scalar(dest, mask, colour, 8);
+        }
+    }
+
+    _mm256_zeroupper();
+    alphamask_sse41(dest, mask, colour, count);
+}
+
+__attribute__((target("avx2"))) void lerp32_avx2(uint32_t* dest, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                                                   size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i weightA = _mm256_set1_epi16(256 - weight);
+    const __m256i weightB = _mm256_set1_epi16(weight);
+    const __m256i rounding = _mm256_set1_epi16(0x80);
+
+    for (; count >= 8; count -= 8, dest += 8, a += 8, b += 8) {
+        __m256i pa = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(a));
+        __m256i pb = _mm256_loadu_si256(reinterpret_cast<const __m256i_u*>(b));
+
+        __m256i low = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(pa, zero), weightA),
+                                       _mm256_mullo_epi16(_mm256_unpacklo_epi8(pb, zero), weightB));
+        __m256i high = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(pa, zero), weightA),
+                                        _mm256_mullo_epi16(_mm256_unpackhi_epi8(pb, zero), weightB));
+        low = _mm256_srli_epi16(_mm256_add_epi16(low, rounding), 8);
+        high = _mm256_srli_epi16(_mm256_add_epi16(high, rounding), 8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i_u*>(dest), _mm256_packus_epi16(low, high));
+    }
+
+    _mm256_zeroupper();
+    lerp32_sse41(dest, a, b, weight, count);
+}
+
+// Runtime dispatch
+
+FastMemLevel fastmem_supported_level() {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1)) {
+        return FastMemScalar;
+    }
+
+    // AVX registers can only be used when the OS saves them (OSXSAVE and XCR0 bits 1 and 2)
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+        uint32_t xcr0Low, xcr0High;
+        asm volatile("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+
+        if ((xcr0Low & 0x6) == 0x6 && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2)) {
+            return FastMemAVX2;
+        }
+    }
+
+    return FastMemSSE41;
+}
+
+static void memset32_resolve(void* dest, uint32_t c, size_t count);
+static void memcpy32_resolve(void* dest, const void* src, size_t count);
+static void alphablend_resolve(uint32_t* dest, const uint32_t* src, size_t count);
+static void alphafill_resolve(uint32_t* dest, uint32_t colour, size_t count);
+static void alphamask_resolve(uint32_t* dest, const uint8_t* mask, uint32_t colour, size_t count);
+static void lerp32_resolve(uint32_t* dest, const uint32_t* a, const uint32_t* b, uint32_t weight, size_t count);
+
+void (*memset32_optimized)(void* dest, uint32_t c, size_t count) = memset32_resolve;
+void (*memcpy32_optimized)(void* dest, const void* src, size_t count) = memcpy32_resolve;
+void (*alphablend_optimized)(uint32_t* dest, const uint32_t* src, size_t count) = alphablend_resolve;
+void (*alphafill_optimized)(uint32_t* dest, uint32_t colour, size_t count) = alphafill_resolve;
+void (*alphamask_optimized)(uint32_t* dest, const uint8_t* mask, uint32_t colour, size_t count) = alphamask_resolve;
+void (*lerp32_optimized)(uint32_t* dest, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                         size_t count) = lerp32_resolve;
+
+void fastmem_select(FastMemLevel level) {
+    switch (level) {
+    case FastMemAVX2:
+        memset32_optimized = memset32_avx2;
+        memcpy32_optimized = memcpy32_avx2;
+        alphablend_optimized = alphablend_avx2;
+        alphafill_optimized = alphafill_avx2;
+        alphamask_optimized = alphamask_avx2;
+        lerp32_optimized = lerp32_avx2;
+        break;
+    case FastMemSSE41:
+        memset32_optimized = memset32_sse41;
+        memcpy32_optimized = memcpy32_sse41;
+        alphablend_optimized = alphablend_sse41;
+        alphafill_optimized = alphafill_sse41;
+        alphamask_optimized = alphamask_sse41;
+        lerp32_optimized = lerp32_sse41;
+        break;
+    default:
+        memset32_optimized = memset32_scalar;
+        memcpy32_optimized = memcpy32_scalar;
+        alphablend_optimized = alphablend_scalar;
+        alphafill_optimized = alphafill_scalar;
+        alphamask_optimized = alphamask_scalar;
+        lerp32_optimized = lerp32_scalar;
+        break;
+    }
+}
+
+// Every thread resolves to the same kernels, so it does not matter if several race here
+static void memset32_resolve(void* dest, uint32_t c, size_t count) {
+    fastmem_select(fastmem_supported_level());
+    memset32_optimized(dest, c, count);
+}
+
+static void memcpy32_resolve(void* dest, const void* src, size_t count) {
+    fastmem_select(fastmem_supported_level());
+    memcpy32_optimized(dest, src, count);
+}
+
+static void alphablend_resolve(uint32_t* dest, const uint32_t* src, size_t count) {
+    fastmem_select(fastmem_supported_level());
+    alphablend_optimized(dest, src, count);
+}
+
+static void alphafill_resolve(uint32_t* dest, uint32_t colour, size_t count) {
+    fastmem_select(fastmem_supported_level());
+    alphafill_optimized(dest, colour, count);
+}
+
+static void alphamask_resolve(uint32_t* dest, const uint8_t* mask, uint32_t colour, size_t count) {
+    fastmem_select(fastmem_supported_level());
+    alphamask_optimized(dest, mask, colour, count);
+}
+
+static void lerp32_resolve(uint32_t* dest, const uint32_t* a, const uint32_t* b, uint32_t weight, size_t count) {
+    fastmem_select(fastmem_supported_level());
+    lerp32_optimized(dest, a, b, weight, count);
+}
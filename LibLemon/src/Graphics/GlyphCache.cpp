@@ -0,0 +1,160 @@
+#include "GlyphCache.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+namespace Lemon::Graphics {
+GlyphCache::GlyphCache(Font* font) : m_font(font) {
+    m_hasKerning = FT_HAS_KERNING(font->face);
+
+    // Square slots big enough for almost every glyph, anything bigger gets its own bitmap
+    FT_Size_Metrics& metrics = font->face->size->metrics;
+    int size = std::max((metrics.ascender - metrics.descender) >> 6, metrics.max_advance >> 6) + 2;
+    m_slotWidth = m_slotHeight = std::max(size, 1);
+
+    int slotCount = GLYPH_CACHE_ATLAS_SIZE / (m_slotWidth * m_slotHeight);
+    slotCount = std::clamp(slotCount, GLYPH_CACHE_MIN_SLOTS, GLYPH_CACHE_MAX_SLOTS);
+
+    m_slotOwner.resize(slotCount, -1);
+    m_slotUsed.resize(slotCount, 0);
+}
+
+const CachedGlyph& GlyphCache::Get(unsigned char c) {
+    CachedGlyph& glyph = m_glyphs[c];
+    if (glyph.loaded) {
+        return glyph;
+    }
+
+    glyph.loaded = true;
+    glyph.index = FT_Get_Char_Index(m_font->face, c);
+
+    if (FT_Load_Glyph(m_font->face, glyph.index, FT_LOAD_RENDER)) {
+        return glyph;
+    }
+
+    FT_GlyphSlot ftGlyph = m_font->face->glyph;
+    glyph.advance = ftGlyph->advance.x >> 6;
+    glyph.top = ftGlyph->bitmap_top;
+    glyph.width = ftGlyph->bitmap.width;
+    glyph.height = ftGlyph->bitmap.rows;
+    glyph.valid = true;
+
+    StoreBitmap(c); // The glyph has just been rendered, keep it
+    return glyph;
+}
+
+const uint8_t* GlyphCache::Bitmap(const CachedGlyph& constGlyph) {
+    unsigned char c = &constGlyph - m_glyphs;
+    CachedGlyph& glyph = m_glyphs[c];
+
+    if (!glyph.valid || !glyph.width || !glyph.height) {
+        return nullptr;
+    } else if (glyph.oversize.size()) {
+        return glyph.oversize.data();
+    } else if (glyph.slot >= 0) {
+        m_slotUsed[glyph.slot] = ++m_useCounter;
+        return m_atlas.data() + glyph.slot * m_slotWidth * m_slotHeight;
+    }
+
+    // Evicted, render it again
+    if (FT_Load_Glyph(m_font->face, glyph.index, FT_LOAD_RENDER)) {
+        return nullptr;
+    }
+
+    return StoreBitmap(c);
+}
+
+const uint8_t* GlyphCache::StoreBitmap(unsigned char c) {
+    CachedGlyph& glyph = m_glyphs[c];
+
+    const FT_Bitmap& bitmap = m_font->face->glyph->bitmap;
+    if (!glyph.width || !glyph.height) {
+        return nullptr; // Nothing to draw (e.g. space)
+    } else if (static_cast<int>(bitmap.width) != glyph.width || static_cast<int>(bitmap.rows) != glyph.height) {
+        return nullptr;
+    }
+
+    uint8_t* dest;
+    int pitch;
+    if (glyph.width > m_slotWidth || glyph.height > m_slotHeight) {
+        glyph.oversize.resize(glyph.width * glyph.height);
+
+        dest = glyph.oversize.data();
+        pitch = glyph.width;
+    } else {
+        glyph.slot = AllocateSlot(c);
+
+        dest = m_atlas.data() + glyph.slot * m_slotWidth * m_slotHeight;
+        pitch = m_slotWidth;
+    }
+
+    for (int i = 0; i < glyph.height; i++) {
+        const uint8_t* row = bitmap.buffer + i * bitmap.pitch;
+
+        if (bitmap.pixel_mode == FT_PIXEL_MODE_MONO) {
+            for (int j = 0; j < glyph.width; j++) {
+                dest[i * pitch + j] = (row[j >> 3] & (0x80 >> (j & 7))) ? 0xff : 0;
+            }
+        } else {
+            memcpy(dest + i * pitch, row, glyph.width);
+        }
+    }
+
+    return dest;
+}
+
+int GlyphCache::Kerning(unsigned left, unsigned right) {
+    if (!m_hasKerning || !left) {
+        return 0;
+    }
+
+    uint64_t key = (static_cast<uint64_t>(left) << 32) | right;
+    if (auto it = m_kerning.find(key); it != m_kerning.end()) {
+        return it->second;
+    }
+
+    FT_Vector delta;
+    int kerning = 0;
+    if (!FT_Get_Kerning(m_font->face, left, right, FT_KERNING_DEFAULT, &delta)) {
+        kerning = delta.x >> 6;
+    }
+
+    m_kerning[key] = kerning;
+    return kerning;
+}
+
+int GlyphCache::AllocateSlot(unsigned char c) {
+    // Take a free slot, otherwise evict the least recently used glyph
+    int slot = 0;
+    for (int i = 0; i < static_cast<int>(m_slotOwner.size()); i++) {
+        if (m_slotOwner[i] < 0) {
+            slot = i;
+            break;
+        } else if (m_slotUsed[i] < m_slotUsed[slot]) {
+            slot = i;
+        }
+    }
+
+    if (m_slotOwner[slot] >= 0) {
+        m_glyphs[m_slotOwner[slot]].slot = -1;
+    }
+
+    size_t end = (slot + 1) * m_slotWidth * m_slotHeight;
+    if (m_atlas.size() < end) {
+        m_atlas.resize(end);
+    }
+
+    m_slotOwner[slot] = c;
+    m_slotUsed[slot] = ++m_useCounter;
+    return slot;
+}
+
+GlyphCache* GetGlyphCache(Font* font) {
+    if (!font->glyphs) {
+        font->glyphs = new GlyphCache(font);
+    }
+
+    return font->glyphs;
+}
+} // namespace Lemon::Graphics
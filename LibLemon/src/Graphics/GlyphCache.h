@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Lemon/Graphics/Font.h>
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#define GLYPH_CACHE_ATLAS_SIZE (256 * 1024) // Maximum size in bytes of the coverage atlas of each font
+#define GLYPH_CACHE_MIN_SLOTS 16
+#define GLYPH_CACHE_MAX_SLOTS 256
+
+namespace Lemon::Graphics {
+struct CachedGlyph {
+    bool loaded = false; // Metrics have been loaded
+    bool valid = false;  // Font has the glyph and it could be rendered
+
+    unsigned index = 0; // FreeType glyph index
+    int advance = 0;
+    int top = 0; // Distance from the baseline to the top of the bitmap
+    int width = 0;
+    int height = 0;
+
+    int slot = -1;                 // Atlas slot holding the bitmap, -1 when evicted
+    std::vector<uint8_t> oversize; // Bitmap of a glyph too large for an atlas slot
+};
+
+// Glyph cache
+//
+// Keeps the metrics of every character of a font drawn so far and the 8-bit coverage
+// bitmaps of the most recently used glyphs. Bitmaps are packed into fixed size slots
+// of a single atlas sized from the font metrics, when the atlas is full the least
+// recently used glyph is evicted and rendered again by FreeType the next time it is drawn.
+//
+// Like the FT_Face it wraps it is not thread safe.
+class GlyphCache {
+public:
+    GlyphCache(Font* font);
+
+    /////////////////////////////
+    /// \brief Get the metrics of a character
+    ///
+    /// \return Glyph, invalid if the font cannot render the character
+    /////////////////////////////
+    const CachedGlyph& Get(unsigned char c);
+
+    /////////////////////////////
+    /// \brief Get the coverage bitmap of a glyph
+    ///
+    /// Renders the glyph into the atlas if it has been evicted.
+    /// Rows are Pitch(glyph) bytes apart.
+    ///
+    /// \return Bitmap, nullptr if the glyph could not be rendered
+    /////////////////////////////
+    const uint8_t* Bitmap(const CachedGlyph& glyph);
+
+    inline int Pitch(const CachedGlyph& glyph) const {
+        return glyph.oversize.size() ? glyph.width : m_slotWidth;
+    }
+
+    /////////////////////////////
+    /// \brief Get the horizontal kerning between two glyph indices in pixels
+    /////////////////////////////
+    int Kerning(unsigned left, unsigned right);
+
+private:
+    Font* m_font;
+    bool m_hasKerning;
+
+    CachedGlyph m_glyphs[256];
+    std::unordered_map<uint64_t, int> m_kerning;
+
+    int m_slotWidth;
+    int m_slotHeight;
+    std::vector<uint8_t> m_atlas; // Allocated as slots are first used
+    std::vector<int> m_slotOwner; // Character in each slot, -1 if free
+    std::vector<uint64_t> m_slotUsed;
+    uint64_t m_useCounter = 0;
+
+    // Copy the bitmap FreeType has just rendered for c into the atlas
+    const uint8_t* StoreBitmap(unsigned char c);
+    int AllocateSlot(unsigned char c);
+};
+
+/////////////////////////////
+/// \brief Get the glyph cache of a font, creating it on first use
+/////////////////////////////
+GlyphCache* GetGlyphCache(Font* font);
+} // namespace Lemon::Graphics
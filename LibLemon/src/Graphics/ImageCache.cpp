@@ -0,0 +1,135 @@
+#include <Lemon/Graphics/ImageCache.h>
+
+#include <Lemon/Graphics/Graphics.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+namespace Lemon::Graphics {
+ImageCache& ImageCache::Instance() {
+    static ImageCache* instance = new ImageCache(); // Never destroyed, images may still be released after main returns
+    return *instance;
+}
+
+ImagePtr ImageCache::Get(const std::string& path, int* error) {
+    bool decode;
+    int err = 0;
+
+    std::shared_ptr<Entry> entry = Lookup(path, decode, err);
+    if (!entry) {
+        if (error) {
+            *error = err;
+        }
+        return nullptr;
+    }
+
+    if (decode) {
+        Decode(entry);
+    }
+
+    ImagePtr image = entry->image.get();
+    if (!image && error) {
+        *error = entry->error; // Written before the promise was fulfilled
+    }
+
+    return image;
+}
+
+std::shared_ptr<ImageCache::Entry> ImageCache::Lookup(const std::string& path, bool& decode, int& error) {
+    decode = false;
+
+    struct stat st;
+    if (stat(path.c_str(), &st)) {
+        error = -1; // Same as LoadImage failing to open the file
+        return nullptr;
+    }
+
+    std::unique_lock lock(m_lock);
+
+    std::shared_ptr<Entry>& entry = m_entries[path];
+    if (entry && entry->mtime == st.st_mtime && entry->size == st.st_size) {
+        entry->lastUsed = ++m_useCounter;
+        return entry;
+    }
+
+    if (entry) {
+        m_cachedBytes -= entry->bytes; // Stale, anyone still holding the old image keeps it
+    }
+
+    entry = std::make_shared<Entry>();
+    entry->path = path;
+    entry->mtime = st.st_mtime;
+    entry->size = st.st_size;
+    entry->image = entry->promise.get_future().share();
+    entry->lastUsed = ++m_useCounter;
+
+    decode = true;
+    return entry;
+}
+
+void ImageCache::Decode(const std::shared_ptr<Entry>& entry) {
+    surface_t surface;
+    int error = -1;
+
+    if (FILE* file = fopen(entry->path.c_str(), "rb"); file) {
+        error = LoadImage(file, &surface);
+        fclose(file);
+    }
+
+    ImagePtr image;
+    if (!error) {
+        image = ImagePtr(new Surface(surface), [](const Surface* s) -> void {
+            free(s->buffer); // The decoders allocate with malloc
+            delete s;
+        });
+    }
+
+    {
+        std::unique_lock lock(m_lock);
+        entry->error = error;
+
+        auto it = m_entries.find(entry->path);
+        if (it != m_entries.end() && it->second == entry) {
+            if (image && image->BufferSize() <= IMAGE_CACHE_MAX_IMAGE_SIZE) {
+                entry->bytes = image->BufferSize();
+                m_cachedBytes += entry->bytes;
+            } else {
+                // Try again next time if it failed, the file may be fixed.
+                // Large images are freed as soon as the callers are done with them.
+                m_entries.erase(it);
+            }
+        }
+    }
+
+    entry->promise.set_value(image);
+
+    std::unique_lock lock(m_lock);
+    entry->ready = true;
+    Trim();
+}
+
+// Evict the least recently used images no one else holds until the cache fits, m_lock must be held
+void ImageCache::Trim() {
+    while (m_cachedBytes > IMAGE_CACHE_MAX_SIZE) {
+        auto victim = m_entries.end();
+        for (auto it = m_entries.begin(); it != m_entries.end(); it++) {
+            const Entry& entry = *it->second;
+            if (!entry.ready || entry.image.get().use_count() > 1) {
+                continue; // Being decoded or in use
+            }
+
+            if (victim == m_entries.end() || entry.lastUsed < victim->second->lastUsed) {
+                victim = it;
+            }
+        }
+
+        if (victim == m_entries.end()) {
+            return; // Everything left is in use
+        }
+
+        m_cachedBytes -= victim->second->bytes;
+        m_entries.erase(victim);
+    }
+}
+} // namespace Lemon::Graphics
@@ -0,0 +1,174 @@
+#include <Lemon/Graphics/Graphics.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "FastMem.h"
+
+namespace Lemon::Graphics {
+// Source coordinate in 16.16 fixed point of each destination column (or row), sampling at pixel centres
+static void MapSamples(std::vector<int>& index, std::vector<uint32_t>& weight, int srcSize, int destSize) {
+    index.resize(destSize);
+    weight.resize(destSize);
+
+    for (int i = 0; i < destSize; i++) {
+        int64_t pos = ((2 * static_cast<int64_t>(i) + 1) * srcSize << 16) / (2 * destSize) - 0x8000;
+        pos = std::clamp<int64_t>(pos, 0, static_cast<int64_t>(srcSize - 1) << 16);
+
+        index[i] = pos >> 16;
+        weight[i] = (pos >> 8) & 0xff;
+    }
+}
+
+// Interpolate horizontally along a source row, two channels at a time
+static void ScaleRow(uint32_t* dest, const uint32_t* src, int srcWidth, const int* index, const uint32_t* weight,
+                     int count) {
+    for (int i = 0; i < count; i++) {
+        uint32_t a = src[index[i]];
+        uint32_t b = src[std::min(index[i] + 1, srcWidth - 1)];
+        uint32_t w = weight[i];
+
+        uint32_t rb = (((a & 0xff00ff) * (256 - w) + (b & 0xff00ff) * w + 0x800080) >> 8) & 0xff00ff;
+        uint32_t ag = (((a >> 8) & 0xff00ff) * (256 - w) + ((b >> 8) & 0xff00ff) * w + 0x800080) & 0xff00ff00;
+        dest[i] = rb | ag;
+    }
+}
+
+// Bilinear filter for enlarging (or shrinking one dimension)
+//
+// Each destination row interpolates between two horizontally scaled source rows,
+// which are kept between destination rows as they are usually shared.
+static void ScaleBilinear(const surface_t* src, const Rect& region, surface_t* dest, const Rect& destRect,
+                          const Rect& visible) {
+    std::vector<int> xIndex, yIndex;
+    std::vector<uint32_t> xWeight, yWeight;
+    MapSamples(xIndex, xWeight, region.width, destRect.width);
+    MapSamples(yIndex, yWeight, region.height, destRect.height);
+
+    int columns = visible.width;
+    const int* columnIndex = xIndex.data() + (visible.x - destRect.x);
+    const uint32_t* columnWeight = xWeight.data() + (visible.x - destRect.x);
+
+    std::vector<uint32_t> rows(columns * 2);
+    uint32_t* upper = rows.data();
+    uint32_t* lower = rows.data() + columns;
+    int upperRow = -1;
+    int lowerRow = -1;
+
+    const uint32_t* srcBuffer = reinterpret_cast<const uint32_t*>(src->buffer) + region.y * src->width + region.x;
+    for (int i = visible.y; i < visible.bottom(); i++) {
+        int row = yIndex[i - destRect.y];
+        int nextRow = std::min(row + 1, region.height - 1);
+
+        if (upperRow != row) {
+            if (lowerRow == row) {
+                std::swap(upper, lower);
+                lowerRow = upperRow;
+            } else {
+                ScaleRow(upper, srcBuffer + row * src->width, region.width, columnIndex, columnWeight, columns);
+            }
+            upperRow = row;
+        }
+
+        if (lowerRow != nextRow) {
+            ScaleRow(lower, srcBuffer + nextRow * src->width, region.width, columnIndex, columnWeight, columns);
+            lowerRow = nextRow;
+        }
+
+        uint32_t* destRow = reinterpret_cast<uint32_t*>(dest->buffer) + i * dest->width + visible.x;
+        lerp32_optimized(destRow, upper, lower, yWeight[i - destRect.y], columns);
+    }
+}
+
+// Box filter for shrinking
+//
+// Averages every source pixel covered by a destination pixel. Colours are weighted by alpha
+// so transparent pixels (which often have a meaningless colour) do not bleed into the edges of icons.
+static void ScaleBox(const surface_t* src, const Rect& region, surface_t* dest, const Rect& destRect,
+                     const Rect& visible) {
+    int columns = visible.width;
+
+    // First source column of each destination column and the one after the last
+    std::vector<int> columnStart(columns + 1);
+    for (int j = 0; j <= columns; j++) {
+        columnStart[j] = static_cast<int64_t>(visible.x - destRect.x + j) * region.width / destRect.width;
+    }
+
+    // Sums of alpha, then red, green and blue multiplied by alpha
+    std::vector<uint64_t> sums(columns * 4);
+
+    const uint32_t* srcBuffer = reinterpret_cast<const uint32_t*>(src->buffer) + region.y * src->width + region.x;
+    for (int i = visible.y; i < visible.bottom(); i++) {
+        int rowStart = static_cast<int64_t>(i - destRect.y) * region.height / destRect.height;
+        int rowEnd = static_cast<int64_t>(i - destRect.y + 1) * region.height / destRect.height;
+
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int row = rowStart; row < rowEnd; row++) {
+            const uint32_t* srcRow = srcBuffer + row * src->width;
+
+            for (int j = 0; j < columns; j++) {
+                uint64_t* sum = sums.data() + j * 4;
+                for (int x = columnStart[j]; x < columnStart[j + 1]; x++) {
+                    uint32_t pixel = srcRow[x];
+                    uint32_t alpha = pixel >> 24;
+
+                    sum[0] += alpha;
+                    sum[1] += ((pixel >> 16) & 0xff) * alpha;
+                    sum[2] += ((pixel >> 8) & 0xff) * alpha;
+                    sum[3] += (pixel & 0xff) * alpha;
+                }
+            }
+        }
+
+        uint32_t* destRow = reinterpret_cast<uint32_t*>(dest->buffer) + i * dest->width + visible.x;
+        for (int j = 0; j < columns; j++) {
+            const uint64_t* sum = sums.data() + j * 4;
+            if (!sum[0]) {
+                destRow[j] = 0;
+                continue;
+            }
+
+            uint64_t count = static_cast<uint64_t>(columnStart[j + 1] - columnStart[j]) * (rowEnd - rowStart);
+            uint32_t alpha = (sum[0] + count / 2) / count;
+            uint32_t r = (sum[1] + sum[0] / 2) / sum[0];
+            uint32_t g = (sum[2] + sum[0] / 2) / sum[0];
+            uint32_t b = (sum[3] + sum[0] / 2) / sum[0];
+
+            destRow[j] = (alpha << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+}
+
+void ScaleSurface(const surface_t* src, const Rect& srcRegion, surface_t* dest, const Rect& destRect) {
+    Rect region = srcRegion;
+    if (region.x < 0) {
+        region.left(0);
+    }
+    if (region.y < 0) {
+        region.top(0);
+    }
+    region.width = std::min(region.width, src->width - region.x);
+    region.height = std::min(region.height, src->height - region.y);
+
+    // Only the part of destRect within the destination surface is drawn
+    Rect visible = destRect;
+    if (visible.x < 0) {
+        visible.left(0);
+    }
+    if (visible.y < 0) {
+        visible.top(0);
+    }
+    visible.width = std::min(visible.width, dest->width - visible.x);
+    visible.height = std::min(visible.height, dest->height - visible.y);
+
+    if (region.width <= 0 || region.height <= 0 || visible.width <= 0 || visible.height <= 0) {
+        return;
+    }
+
+    if (region.width >= destRect.width && region.height >= destRect.height) {
+        ScaleBox(src, region, dest, destRect, visible);
+    } else {
+        ScaleBilinear(src, region, dest, destRect, visible);
+    }
+}
+} // namespace Lemon::Graphics
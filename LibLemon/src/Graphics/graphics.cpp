@@ -213,7 +213,7 @@ static void DrawCircleQuadrant(int x, int y, uint8_t r, uint8_t g, uint8_t b, in
             yOffset = surface->width * yPos;
         }
 
-        if(yPos > maxHeight || yPos < minY){
+        if(yPos >= maxHeight || yPos < minY){
             continue;
         }
 
@@ -230,7 +230,7 @@ static void DrawCircleQuadrant(int x, int y, uint8_t r, uint8_t g, uint8_t b, in
             if (quadrant == 1 || quadrant == 4) {
                 xPos = x + j - 1;
 
-                if(xPos > maxWidth || xPos < minX){
+                if(xPos >= maxWidth || xPos < minX){
                     continue;
                 }
 
@@ -239,14 +239,14 @@ static void DrawCircleQuadrant(int x, int y, uint8_t r, uint8_t g, uint8_t b, in
             } else {
                 xPos = x + radius - j;
 
-                if(xPos > maxWidth || xPos < minX){
+                if(xPos >= maxWidth || xPos < minX){
                     continue;
                 }
 
                 uint32_t& pixel = reinterpret_cast<uint32_t*>(surface->buffer)[yOffset + xPos];
 
                 if (opacity >= 1) { // That should be all opaque pixels on this row
-                    memset32_optimized(&pixel, colour_i, j);
+                    memset32_optimized(&pixel, colour_i, std::min(j, maxWidth - xPos));
                     break;
                 }
 
@@ -287,4 +287,58 @@ void DrawRoundedRect(int x, int y, int width, int height, uint8_t r, uint8_t g,
     DrawRect(x + bottomLeftRadius, y + height - bottomRightRadius, width - bottomRightRadius - bottomLeftRadius,
              bottomRightRadius, r, g, b, surface, mask); // Bottom
 }
+
+void BlitRounded(Surface* dest, const Surface* src, vector2i_t offset, int radius) {
+    radius = std::clamp(radius, 0, std::min(src->width, src->height) / 2);
+
+    // Part of the source which lands on dest
+    int srcX = std::max(0, -offset.x);
+    int srcY = std::max(0, -offset.y);
+    int srcEndX = std::min(src->width, dest->width - offset.x);
+    int srcEndY = std::min(src->height, dest->height - offset.y);
+    if (srcEndX <= srcX || srcEndY <= srcY) {
+        return;
+    }
+
+    const uint32_t* srcBuffer = reinterpret_cast<const uint32_t*>(src->buffer);
+    uint32_t* destBuffer = reinterpret_cast<uint32_t*>(dest->buffer);
+
+    for (int y = srcY; y < srcEndY; y++) {
+        const uint32_t* srcRow = srcBuffer + y * src->width;
+        uint32_t* destRow = destBuffer + (y + offset.y) * dest->width + offset.x;
+
+        // Antialias the corner pixels, blending the source scaled by how much of the pixel lies in the circle
+        auto blendCorner = [&](int x, double coverage) {
+            if (x < srcX || x >= srcEndX || coverage <= 0) {
+                return;
+            }
+
+            uint32_t pixel = srcRow[x];
+            uint32_t alpha = static_cast<uint32_t>((pixel >> 24) * coverage);
+            destRow[x] = AlphaBlendInt(destRow[x], (pixel & 0xffffff) | (alpha << 24));
+        };
+
+        int inner = 0; // Columns from each side which are not completely inside the corners
+        int edgeY = std::min(y, src->height - 1 - y);
+        if (edgeY < radius) {
+            double dy = radius - (edgeY + 0.5);
+            for (; inner < radius; inner++) {
+                double dx = radius - (inner + 0.5);
+                double coverage = std::clamp(radius + 0.5 - sqrt(dx * dx + dy * dy), 0.0, 1.0);
+                if (coverage >= 1) {
+                    break; // The rest of the row is inside
+                }
+
+                blendCorner(inner, coverage);
+                blendCorner(src->width - 1 - inner, coverage);
+            }
+        }
+
+        int spanStart = std::max(srcX, inner);
+        int spanEnd = std::min(srcEndX, src->width - inner);
+        if (spanEnd > spanStart) {
+            memcpy32_optimized(destRow + spanStart, srcRow + spanStart, spanEnd - spanStart);
+        }
+    }
+}
 } // namespace Lemon::Graphics
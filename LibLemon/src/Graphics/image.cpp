@@ -1,4 +1,7 @@
 #include <Lemon/Graphics/Graphics.h>
+#include <Lemon/Graphics/ImageCache.h>
+
+#include <algorithm>
 
 #include <assert.h>
 #include <math.h>
@@ -60,87 +63,27 @@ int LoadImage(const char* path, surface_t* surface) {
 }
 
 int LoadImage(const char* path, int x, int y, int w, int h, surface_t* surface, bool preserveAspectRatio) {
-    FILE* imageFile = fopen(path, "rb");
-
-    if (!imageFile) {
-        return -1; // Error opening image file
-    }
-
-    char sig[8];
-
-    fseek(imageFile, 0, SEEK_SET);
-
-    if (!fread(sig, 8, 1, imageFile)) {
-        fclose(imageFile);
-        return -2; // Could not read first 8 bytes of image
-    }
-
-    int type = IdentifyImage(sig); // Identify Image Type
-
-    if (type == Image_Unknown) { // Unknown Image Type
-        fclose(imageFile);
-        return type;
+    int error = 0;
+    ImagePtr image = ImageCache::Instance().Get(path, &error);
+    if (!image) {
+        return error;
     }
 
-    surface_t surf;
-    int r = LoadImage(imageFile, &surf);
-
-    if (r)
-        return r;
-
-    double xScale = ((double)w) / surf.width;
-    double yScale = (((double)h) / surf.height);
-    double xOffset = 0;
-
-    if (preserveAspectRatio) {
-        if (yScale > xScale)
-            xScale = yScale;
-        else
-            yScale = xScale;
+    // Scale to fill (w, h) keeping the aspect ratio, cropping the right or bottom of the image
+    Rect srcRegion = {0, 0, image->width, image->height};
+    if (preserveAspectRatio && w > 0 && h > 0) {
+        if (static_cast<int64_t>(w) * image->height > static_cast<int64_t>(h) * image->width) {
+            srcRegion.height = std::max<int64_t>(static_cast<int64_t>(h) * image->width / w, 1);
+        } else {
+            srcRegion.width = std::max<int64_t>(static_cast<int64_t>(w) * image->height / h, 1);
+        }
     }
 
-    uint8_t* srcBuffer = surf.buffer;
-
     if (!surface->buffer) { // Allocate new surface if needed
         *surface = {.width = w + x, .height = h + y, .depth = 32, .buffer = new uint8_t[(w + x) * (h + y) * 4]};
     }
 
-    uint32_t* destBuffer = (uint32_t*)surface->buffer;
-
-    for (int i = 0; i < h && i + y < surface->height; i++) {
-        double _yval = ((double)i) / yScale;
-        if (ceil(_yval) >= surf.height)
-            break;
-        for (int j = 0; j < w && j + x < surface->width; j++) {
-            double _xval = xOffset + ((double)+j) / xScale;
-            if (ceil(_xval) >= surf.width)
-                break;
-            uint32_t offset = (y + i) * surface->width + x + j;
-
-            long b = Interpolate(srcBuffer[((int)floor(_yval) * surf.width + (int)floor(_xval)) * 4],
-                                 srcBuffer[((int)floor(_yval) * surf.width + (int)ceil(_xval)) * 4],
-                                 srcBuffer[((int)ceil(_yval) * surf.width + (int)floor(_xval)) * 4],
-                                 srcBuffer[((int)ceil(_yval) * surf.width + (int)ceil(_xval)) * 4], _xval, _yval);
-            long g = Interpolate(srcBuffer[((int)floor(_yval) * surf.width + (int)floor(_xval)) * 4 + 1],
-                                 srcBuffer[((int)floor(_yval) * surf.width + (int)ceil(_xval)) * 4 + 1],
-                                 srcBuffer[((int)floor(_yval) * surf.width + (int)ceil(_xval)) * 4 + 1],
-                                 srcBuffer[((int)ceil(_yval) * surf.width + (int)ceil(_xval)) * 4 + 1], _xval, _yval);
-            long r = Interpolate(srcBuffer[((int)floor(_yval) * surf.width + (int)floor(_xval)) * 4 + 2],
-                                 srcBuffer[((int)floor(_yval) * surf.width + (int)ceil(_xval)) * 4 + 2],
-                                 srcBuffer[((int)floor(_yval) * surf.width + (int)ceil(_xval)) * 4 + 2],
-                                 srcBuffer[((int)ceil(_yval) * surf.width + (int)ceil(_xval)) * 4 + 2], _xval, _yval);
-            long a = Interpolate(srcBuffer[((int)floor(_yval) * surf.width + (int)floor(_xval)) * 4 + 3],
-                                 srcBuffer[((int)floor(_yval) * surf.width + (int)ceil(_xval)) * 4 + 3],
-                                 srcBuffer[((int)floor(_yval) * surf.width + (int)ceil(_xval)) * 4 + 3],
-                                 srcBuffer[((int)ceil(_yval) * surf.width + (int)ceil(_xval)) * 4 + 3], _xval, _yval);
-
-            destBuffer[offset] = (a << 24) | (r << 16) | (g << 8) | b;
-        }
-    }
-
-    free(srcBuffer);
-    fclose(imageFile);
-
+    ScaleSurface(image.get(), srcRegion, surface, {x, y, w, h});
     return 0;
 }
 
@@ -282,7 +225,7 @@ int LoadBitmapImage(FILE* f, surface_t* surface) {
             int c1 = row[j * (bpp / 8)];
             int c2 = row[j * (bpp / 8) + 1];
             int c3 = row[j * (bpp / 8) + 2];
-            buffer[(i - 1) * width + j] = (c3 << 16) | (c2 << 8) | c1;
+            buffer[(i - 1) * width + j] = 0xff000000 | (c3 << 16) | (c2 << 8) | c1; // Opaque, alpha is not read
         }
     }
 
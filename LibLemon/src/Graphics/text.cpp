@@ -6,12 +6,70 @@
 
 #include <ctype.h>
 
+#include "FastMem.h"
+#include "GlyphCache.h"
+
 extern uint8_t font_default[];
 
 namespace Lemon::Graphics {
 extern int fontState;
 extern Font* mainFont;
 
+// Blend a cached glyph with its pen position at x and the top of the line at y,
+// clipped to the line, limits and the surface
+static void DrawGlyph(GlyphCache* cache, const CachedGlyph& glyph, int x, int y, uint32_t colour, surface_t* surface,
+                      const rect_t& limits, Font* font) {
+    int top = y + (font->height - glyph.top);
+
+    int rowStart = std::max({top, limits.y, 0});
+    int rowEnd = std::min({top + glyph.height, y + font->lineHeight, limits.y + limits.height, surface->height});
+    int columnStart = std::max({x, limits.x, 0});
+    int columnEnd = std::min({x + glyph.width, limits.x + limits.width, surface->width});
+    if (rowStart >= rowEnd || columnStart >= columnEnd) {
+        return;
+    }
+
+    const uint8_t* bitmap = cache->Bitmap(glyph);
+    if (!bitmap) {
+        return;
+    }
+
+    int pitch = cache->Pitch(glyph);
+    uint32_t* buffer = reinterpret_cast<uint32_t*>(surface->buffer);
+    for (int row = rowStart; row < rowEnd; row++) {
+        alphamask_optimized(buffer + row * surface->width + columnStart, bitmap + (row - top) * pitch + (columnStart - x),
+                            colour, columnEnd - columnStart);
+    }
+}
+
+// Lay out a line of text starting at x, calling draw(glyph, xOffset) for each glyph
+//
+// \return Width of the text
+template <typename F> static int LayoutString(GlyphCache* cache, const char* str, int x, F&& draw) {
+    unsigned int lastGlyph = 0;
+    int xOffset = x;
+    for (; *str; str++) {
+        if (*str == '\n') {
+            break;
+        } else if (!isprint(*str)) {
+            continue;
+        }
+
+        const CachedGlyph& glyph = cache->Get(*str);
+        xOffset += cache->Kerning(lastGlyph, glyph.index);
+        lastGlyph = glyph.index;
+
+        if (!glyph.valid) {
+            continue;
+        }
+
+        draw(glyph, xOffset);
+        xOffset += glyph.advance;
+    }
+
+    return xOffset - x;
+}
+
 int DrawChar(char character, int x, int y, uint8_t r, uint8_t g, uint8_t b, surface_t* surface, rect_t limits,
              Font* font) {
     if (!isprint(character)) {
@@ -37,52 +95,14 @@ int DrawChar(char character, int x, int y, uint8_t r, uint8_t g, uint8_t b, surf
     } else if (fontState != 1 || !font->face)
         InitializeFonts();
 
-    uint32_t colour_i = 0xFF000000 | (r << 16) | (g << 8) | b;
-    uint32_t* buffer = (uint32_t*)surface->buffer;
-    if (int err = FT_Load_Char(font->face, character, FT_LOAD_RENDER)) {
+    GlyphCache* cache = GetGlyphCache(font);
+    const CachedGlyph& glyph = cache->Get(character);
+    if (!glyph.valid) {
         return 0;
     }
 
-    int maxHeight = font->lineHeight - (font->height - font->face->glyph->bitmap_top);
-
-    if (y + maxHeight >= limits.y + limits.height) {
-        maxHeight = limits.y + limits.height - y;
-    }
-
-    if (y + maxHeight >= surface->height) {
-        maxHeight = surface->height - y;
-    }
-
-    if (y < 0 && -y > maxHeight) {
-        return 0;
-    }
-
-    int i = 0;
-    if (y < 0) {
-        i = -y;
-    }
-
-    if (y + (font->height - font->face->glyph->bitmap_top) < limits.y) {
-        i = limits.y - (y + (font->height - font->face->glyph->bitmap_top));
-    }
-
-    for (; i < static_cast<int>(font->face->glyph->bitmap.rows) && i < maxHeight; i++) {
-        if (y + i < 0)
-            continue;
-
-        uint32_t yOffset = (i + y + (font->height - font->face->glyph->bitmap_top)) * (surface->width);
-        for (unsigned int j = 0; j < font->face->glyph->bitmap.width && static_cast<long>(j) + x < surface->width;
-             j++) {
-            if (x + static_cast<long>(j) < 0)
-                continue;
-            if (font->face->glyph->bitmap.buffer[i * font->face->glyph->bitmap.width + j] == 255)
-                buffer[yOffset + (j + x)] = colour_i;
-            else if (font->face->glyph->bitmap.buffer[i * font->face->glyph->bitmap.width + j] > 0) {
-                buffer[yOffset + (j + x)] = AlphaBlendInt(buffer[yOffset + (j + x)], RGBAColour::ToARGB({r, g, b, font->face->glyph->bitmap.buffer[i * font->face->glyph->bitmap.width + j]}));
-            }
-        }
-    }
-    return font->face->glyph->advance.x >> 6;
+    DrawGlyph(cache, glyph, x, y, 0xFF000000 | (r << 16) | (g << 8) | b, surface, limits, font);
+    return glyph.advance;
 }
 
 int DrawChar(char character, int x, int y, uint8_t r, uint8_t g, uint8_t b, surface_t* surface, Font* font) {
@@ -111,89 +131,15 @@ int DrawString(const char* str, int x, int y, uint8_t r, uint8_t g, uint8_t b, s
     } else if (fontState != 1 || !font->face)
         InitializeFonts();
 
-    uint32_t colour_i = 0xFF000000 | (r << 16) | (g << 8) | b;
-    uint32_t* buffer = (uint32_t*)surface->buffer;
-
-    unsigned int maxHeight = font->lineHeight;
-
-    if (y < 0 && static_cast<unsigned>(-y) > maxHeight) {
+    if (y < 0 && -y > font->lineHeight) {
         return 0;
     }
 
-    if (y + static_cast<int>(maxHeight) >= limits.y + limits.height) {
-        maxHeight = limits.y + limits.height - y;
-    }
-
-    if (y + static_cast<int>(maxHeight) >= surface->height) {
-        maxHeight = surface->height - y;
-    }
-
-    unsigned int lastGlyph = 0;
-    int xOffset = x;
-    while (*str != 0) {
-        if (*str == '\n') {
-            break;
-        } else if (!isprint(*str)) {
-            str++;
-            continue;
-        }
-
-        unsigned int glyph = FT_Get_Char_Index(font->face, *str);
-        if (FT_HAS_KERNING(font->face) && lastGlyph) {
-            FT_Vector delta;
-
-            FT_Get_Kerning(font->face, lastGlyph, glyph, FT_KERNING_DEFAULT, &delta);
-            xOffset += delta.x >> 6;
-        }
-        lastGlyph = glyph;
-
-        if (int err = FT_Load_Glyph(font->face, glyph, FT_LOAD_RENDER)) {
-            str++;
-            continue;
-        }
-
-        if (xOffset + (font->face->glyph->advance.x >> 6) < limits.x) {
-            xOffset += font->face->glyph->advance.x >> 6;
-            str++;
-            continue;
-        }
-
-        unsigned i = 0;
-        if (y < 0) {
-            i = -y;
-        }
-
-        if (y + (font->height - font->face->glyph->bitmap_top) < limits.y) {
-            i = limits.y - (y + (font->height - font->face->glyph->bitmap_top));
-        }
-
-        for (; i < font->face->glyph->bitmap.rows && i + (font->height - font->face->glyph->bitmap_top) < maxHeight;
-             i++) {
-            uint32_t yOffset = (i + y + (font->height - font->face->glyph->bitmap_top)) * (surface->width);
-
-            unsigned j = 0;
-            if (xOffset < 0) {
-                j = -x;
-            }
-
-            if (xOffset < limits.x) {
-                j = limits.x - xOffset;
-            }
-
-            for (; j < font->face->glyph->bitmap.width && (xOffset + static_cast<long>(j)) < surface->width; j++) {
-                unsigned off = yOffset + (j + xOffset);
-                if (font->face->glyph->bitmap.buffer[i * font->face->glyph->bitmap.width + j] == 255)
-                    buffer[off] = colour_i;
-                else if (font->face->glyph->bitmap.buffer[i * font->face->glyph->bitmap.width + j]) {
-                    buffer[off] = AlphaBlendInt(buffer[off], RGBAColour::ToARGB({r, g, b, font->face->glyph->bitmap.buffer[i * font->face->glyph->bitmap.width + j]}));
-                }
-            }
-        }
-
-        xOffset += font->face->glyph->advance.x >> 6;
-        str++;
-    }
-    return xOffset - x;
+    uint32_t colour = 0xFF000000 | (r << 16) | (g << 8) | b;
+    GlyphCache* cache = GetGlyphCache(font);
+    return LayoutString(cache, str, x, [&](const CachedGlyph& glyph, int xOffset) {
+        DrawGlyph(cache, glyph, xOffset, y, colour, surface, limits, font);
+    });
 }
 
 int DrawString(const char* str, int x, int y, uint8_t r, uint8_t g, uint8_t b, surface_t* surface, Font* font) {
@@ -224,11 +170,7 @@ int GetCharWidth(char c, Font* font) {
         return 0;
     }
 
-    if (int err = FT_Load_Char(font->face, c, FT_LOAD_ADVANCE_ONLY)) {
-        return 0;
-    }
-
-    return font->face->glyph->advance.x >> 6;
+    return GetGlyphCache(font)->Get(c).advance;
 }
 
 int GetCharWidth(char c) { return GetCharWidth(c, mainFont); }
@@ -240,6 +182,8 @@ int GetTextLength(const char* str, size_t n, Font* font) {
         return strlen(str) * 8;
     }
 
+    GlyphCache* cache = GetGlyphCache(font);
+
     size_t len = 0;
     size_t i = 0;
     while (*str && i++ < n) {
@@ -258,12 +202,7 @@ int GetTextLength(const char* str, size_t n, Font* font) {
             continue;
         }
 
-        if (int err = FT_Load_Char(font->face, *str, FT_LOAD_ADVANCE_ONLY)) {
-            str++;
-            continue;
-        }
-
-        len += font->face->glyph->advance.x >> 6;
+        len += cache->Get(*str).advance;
         str++;
     }
 
@@ -299,14 +238,29 @@ TextObject::TextObject(vector2i_t pos, Font* font) {
     Update();
 }
 
-void TextObject::Update() {
+void TextObject::Layout() {
+    if (!m_font) {
+        m_font = DefaultFont();
+    }
+
     m_textSize.x = GetTextLength(m_text.c_str(), m_font);
     m_textSize.y = m_font->lineHeight;
 
-    if(!m_font){
-        m_font = DefaultFont();
+    m_run.clear();
+    if (fontState == 1 && m_font->face) {
+        LayoutString(GetGlyphCache(m_font), m_text.c_str(), 0,
+                     [this](const CachedGlyph& glyph, int x) { m_run.push_back({&glyph, x}); });
     }
 
+    m_layoutDirty = false;
+}
+
+void TextObject::Update() {
+    if (m_layoutDirty) {
+        Layout();
+    }
+    m_textDirty = false;
+
     if(m_textSize.x <= 0){
         return; // Nothing to render
     }
@@ -326,7 +280,19 @@ void TextObject::Update() {
     case RenderNormal:
     default:
         memset(m_surface.buffer, 0, m_surface.BufferSize());
-        DrawString(m_text.c_str(), 0, 0, m_colour, &m_surface, m_font);
+
+        if (fontState != 1 || !m_font->face) {
+            DrawString(m_text.c_str(), 0, 0, m_colour, &m_surface, m_font);
+            break;
+        }
+
+        // Draw the glyphs where they were laid out, no need to look at the text again
+        GlyphCache* cache = GetGlyphCache(m_font);
+        uint32_t colour = 0xFF000000 | (m_colour.r << 16) | (m_colour.g << 8) | m_colour.b;
+        for (const PositionedGlyph& glyph : m_run) {
+            DrawGlyph(cache, *glyph.glyph, glyph.x, 0, colour, &m_surface, {0, 0, m_surface.width, m_surface.height},
+                      m_font);
+        }
         break;
     }
 }
@@ -1,6 +1,6 @@
 #include <Lemon/Graphics/Graphics.h>
 
-#include <cmath>
+#include <algorithm>
 
 namespace Lemon::Graphics {
 Texture::Texture(vector2i_t size) : size(size) {
@@ -61,50 +61,18 @@ void Texture::UpdateSurface() {
     if (scaling == ScaleNone) {
         surfacecpy(&surface, &source); // No scaling
     } else {
-        double xScale = ((double)size.x) / source.width;
-        double yScale = ((double)size.y) / source.height;
-
-        if (scaling == ScaleFit) {
-            if (yScale > xScale)
-                xScale = yScale;
-            else
-                yScale = xScale;
-        }
-
-        uint8_t* srcBuffer = source.buffer;
-        for (int i = 0; i < surface.height; i++) {
-            double _yval = ((double)i) / yScale;
-            if (ceil(_yval) >= source.height)
-                break;
-            for (int j = 0; j < surface.width; j++) {
-                double _xval = ((double)j) / xScale;
-                if (ceil(_xval) >= source.width)
-                    break;
-                uint32_t offset = i * surface.width + j;
-
-                long b = Interpolate(srcBuffer[((int)floor(_yval) * source.width + (int)floor(_xval)) * 4],
-                                     srcBuffer[((int)floor(_yval) * source.width + (int)ceil(_xval)) * 4],
-                                     srcBuffer[((int)ceil(_yval) * source.width + (int)floor(_xval)) * 4],
-                                     srcBuffer[((int)ceil(_yval) * source.width + (int)ceil(_xval)) * 4], _xval, _yval);
-                long g =
-                    Interpolate(srcBuffer[((int)floor(_yval) * source.width + (int)floor(_xval)) * 4 + 1],
-                                srcBuffer[((int)floor(_yval) * source.width + (int)ceil(_xval)) * 4 + 1],
-                                srcBuffer[((int)floor(_yval) * source.width + (int)ceil(_xval)) * 4 + 1],
-                                srcBuffer[((int)ceil(_yval) * source.width + (int)ceil(_xval)) * 4 + 1], _xval, _yval);
-                long r =
-                    Interpolate(srcBuffer[((int)floor(_yval) * source.width + (int)floor(_xval)) * 4 + 2],
-                                srcBuffer[((int)floor(_yval) * source.width + (int)ceil(_xval)) * 4 + 2],
-                                srcBuffer[((int)floor(_yval) * source.width + (int)ceil(_xval)) * 4 + 2],
-                                srcBuffer[((int)ceil(_yval) * source.width + (int)ceil(_xval)) * 4 + 2], _xval, _yval);
-                long a =
-                    Interpolate(srcBuffer[((int)floor(_yval) * source.width + (int)floor(_xval)) * 4 + 3],
-                                srcBuffer[((int)floor(_yval) * source.width + (int)ceil(_xval)) * 4 + 3],
-                                srcBuffer[((int)floor(_yval) * source.width + (int)ceil(_xval)) * 4 + 3],
-                                srcBuffer[((int)ceil(_yval) * source.width + (int)ceil(_xval)) * 4 + 3], _xval, _yval);
-
-                reinterpret_cast<uint32_t*>(surface.buffer)[offset] = (a << 24) | (r << 16) | (g << 8) | b;
+        Rect srcRegion = {0, 0, source.width, source.height};
+
+        // Fill the surface keeping the aspect ratio, cropping the right or bottom of the source
+        if (scaling == ScaleFit && size.x > 0 && size.y > 0) {
+            if (static_cast<int64_t>(size.x) * source.height > static_cast<int64_t>(size.y) * source.width) {
+                srcRegion.height = std::max<int64_t>(static_cast<int64_t>(size.y) * source.width / size.x, 1);
+            } else {
+                srcRegion.width = std::max<int64_t>(static_cast<int64_t>(size.x) * source.height / size.y, 1);
             }
         }
+
+        ScaleSurface(&source, srcRegion, &surface, {0, 0, surface.width, surface.height});
     }
 }
 } // namespace Lemon::Graphics
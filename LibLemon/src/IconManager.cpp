@@ -1,6 +1,13 @@
 #include <Lemon/Core/IconManager.h>
 
+#include <Lemon/Core/Logger.h>
+#include <Lemon/Core/SharedMemory.h>
 #include <Lemon/Graphics/Graphics.h>
+#include <Lemon/Services/lemon.lemonwm.h>
+
+#include <stdexcept>
+
+#include <string.h>
 
 namespace Lemon {
 IconManager* IconManager::m_instance = nullptr;
@@ -30,6 +37,81 @@ IconManager::IconManager() {
                 .buffer = new uint8_t[64 * 64 * 4],
             },
     };
+
+    MapAtlas();
+}
+
+void IconManager::MapAtlas() {
+    int64_t key;
+    uint64_t size;
+    try {
+        LemonWMServerEndpoint wm("lemon.lemonwm/Instance");
+
+        LemonWMServer::GetIconAtlasResponse r = wm.GetIconAtlas();
+        key = r.key;
+        size = r.size;
+    } catch (EndpointException* e) {
+        delete e;
+        return; // LemonWM is not running, load the icons instead
+    } catch (const std::runtime_error& e) {
+        return;
+    }
+
+    if (key <= 0 || size < sizeof(IconAtlasHeader)) {
+        return; // LemonWM could not load the atlas
+    }
+
+    // Other processes share the pages, never write to them
+    const IconAtlasHeader* atlas = reinterpret_cast<const IconAtlasHeader*>(MapSharedMemory(key));
+    if (!atlas) {
+        return;
+    }
+
+    uint64_t entriesEnd = atlas->iconsOffset + static_cast<uint64_t>(atlas->iconCount) * sizeof(IconAtlasEntry);
+    uint64_t bucketsEnd = atlas->bucketsOffset + static_cast<uint64_t>(atlas->bucketCount) * sizeof(uint32_t);
+    if (atlas->magic != ICON_ATLAS_MAGIC || atlas->version != ICON_ATLAS_VERSION || atlas->size > size ||
+        !atlas->iconCount || !atlas->bucketCount || entriesEnd > atlas->size || bucketsEnd > atlas->size ||
+        atlas->namesOffset > atlas->size) {
+        Logger::Warning("Invalid icon atlas");
+        UnmapSharedMemory(const_cast<IconAtlasHeader*>(atlas), key);
+        return;
+    }
+
+    m_atlas = atlas;
+}
+
+bool IconManager::FindAtlasIcon(const std::string& name, Icon& icon) {
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(m_atlas);
+    const uint32_t* buckets = reinterpret_cast<const uint32_t*>(base + m_atlas->bucketsOffset);
+    const IconAtlasEntry* entries = reinterpret_cast<const IconAtlasEntry*>(base + m_atlas->iconsOffset);
+
+    uint32_t bucket = IconAtlasHash(name.data(), name.length(), 0) % m_atlas->bucketCount;
+    uint32_t slot = IconAtlasHash(name.data(), name.length(), buckets[bucket]) % m_atlas->iconCount;
+    const IconAtlasEntry& entry = entries[slot];
+
+    uint64_t nameStart = static_cast<uint64_t>(m_atlas->namesOffset) + entry.nameOffset;
+    if (entry.nameLength != name.length() || nameStart + entry.nameLength > m_atlas->size ||
+        memcmp(base + nameStart, name.data(), entry.nameLength)) {
+        return false;
+    }
+
+    Surface* surfaces[3] = {&icon.icon16, &icon.icon32, &icon.icon64};
+    for (int i = 0; i < 3; i++) {
+        int iconSize = 16 << i;
+        if (static_cast<uint64_t>(entry.pixels[i]) + iconSize * iconSize * 4 > m_atlas->size) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        int iconSize = 16 << i;
+        *surfaces[i] = {.width = iconSize,
+                        .height = iconSize,
+                        .depth = 32,
+                        .buffer = const_cast<uint8_t*>(base + entry.pixels[i])};
+    }
+
+    return true;
 }
 
 IconManager* IconManager::Instance() {
@@ -45,6 +127,10 @@ IconManager* IconManager::Instance() {
 const Surface* IconManager::GetIcon(const std::string& name, IconSize preferredSize) {
     Icon& icon = m_icons[name];
 
+    if (m_atlas && !icon.icon16.buffer && !icon.icon32.buffer && !icon.icon64.buffer) {
+        FindAtlasIcon(name, icon); // Fills in every size
+    }
+
     if (preferredSize == IconSize16x16) {
         if (icon.icon16.buffer) {
             return &icon.icon16;
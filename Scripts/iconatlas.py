@@ -0,0 +1,317 @@
+#!/usr/bin/env python3
+
+# Builds the icon atlas mapped by IconManager, see LibLemon/include/Lemon/Core/IconAtlas.h
+#
+# Usage: iconatlas.py <output> <icon>...
+# Icons are named after their file and sized by their directory (16, 32 or 64).
+# Each icon is rendered at every size from the closest source, scaled the same way as
+# Graphics::ScaleSurface so atlas icons match the ones IconManager would load itself.
+# Only the standard library is used as the build machine may not have anything else.
+
+import os
+import struct
+import sys
+import zlib
+
+ATLAS_MAGIC = 0x4c544149
+ATLAS_VERSION = 1
+PAGE_SIZE = 4096
+
+ICON_SIZES = [16, 32, 64]
+# Sources to try for each size, in the same order as IconManager::GetIcon
+ICON_SOURCES = {16: [16, 32, 64], 32: [32, 64, 16], 64: [64, 32, 16]}
+
+MASK32 = 0xffffffff
+
+
+def fail(message):
+    sys.exit('iconatlas: ' + message)
+
+
+# Images are (width, height, pixels), pixels are 0xAARRGGBB integers row by row
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc:
+        return a
+    return b if pb <= pc else c
+
+
+def read_png(path, data):
+    chunks = {}
+    idat = b''
+    pos = 8
+    while pos < len(data):
+        length, kind = struct.unpack('>I4s', data[pos:pos + 8])
+        body = data[pos + 8:pos + 8 + length]
+        pos += length + 12
+        if kind == b'IDAT':
+            idat += body
+        else:
+            chunks[kind] = body
+
+    width, height, depth, colour, _, _, interlace = struct.unpack('>IIBBBBB', chunks[b'IHDR'])
+    channels = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}.get(colour)
+    if depth != 8 or interlace or not channels:
+        fail(path + ': only 8-bit non-interlaced PNGs are supported')
+
+    raw = zlib.decompress(idat)
+    stride = width * channels
+    previous = bytearray(stride)
+    rows = []
+    for y in range(height):
+        start = y * (stride + 1)
+        kind = raw[start]
+        row = bytearray(raw[start + 1:start + 1 + stride])
+        for x in range(stride):
+            left = row[x - channels] if x >= channels else 0
+            up = previous[x]
+            up_left = previous[x - channels] if x >= channels else 0
+            if kind == 1:
+                row[x] = (row[x] + left) & 0xff
+            elif kind == 2:
+                row[x] = (row[x] + up) & 0xff
+            elif kind == 3:
+                row[x] = (row[x] + ((left + up) >> 1)) & 0xff
+            elif kind == 4:
+                row[x] = (row[x] + paeth(left, up, up_left)) & 0xff
+        rows.append(row)
+        previous = row
+
+    palette = chunks.get(b'PLTE', b'')
+    transparency = chunks.get(b'tRNS', b'')
+
+    pixels = []
+    for row in rows:
+        for x in range(width):
+            p = row[x * channels:(x + 1) * channels]
+            if colour == 0:
+                r = g = b = p[0]
+                a = 0xff
+            elif colour == 2:
+                r, g, b = p
+                a = 0xff
+            elif colour == 3:
+                r, g, b = palette[p[0] * 3:p[0] * 3 + 3]
+                a = transparency[p[0]] if p[0] < len(transparency) else 0xff
+            elif colour == 4:
+                r = g = b = p[0]
+                a = p[1]
+            else:
+                r, g, b, a = p
+            pixels.append((a << 24) | (r << 16) | (g << 8) | b)
+
+    return width, height, pixels
+
+
+def read_bitmap(path, data):
+    offset, = struct.unpack('<I', data[10:14])
+    width, height, _, bpp = struct.unpack('<iiHH', data[18:30])
+    if bpp not in (24, 32) or width <= 0 or height <= 0:
+        fail(path + ': only 24 and 32-bit bitmaps are supported')
+
+    stride = (bpp * width + 31) // 32 * 4
+    pixels = [0] * (width * height)
+    for y in range(height):
+        row = data[offset + (height - 1 - y) * stride:]
+        for x in range(width):
+            b, g, r = row[x * bpp // 8:x * bpp // 8 + 3]
+            pixels[y * width + x] = 0xff000000 | (r << 16) | (g << 8) | b
+
+    return width, height, pixels
+
+
+def read_image(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    # Identify by signature as LoadImage does, some icons are bitmaps with a .png extension
+    if data[:8] == b'\x89PNG\r\n\x1a\n':
+        return read_png(path, data)
+    if data[:2] == b'BM':
+        return read_bitmap(path, data)
+    fail(path + ': unknown image type')
+
+
+# Scaling, see LibLemon/src/Graphics/Scale.cpp
+
+def lerp(a, b, weight):
+    result = 0
+    for shift in (0, 8, 16, 24):
+        ca = (a >> shift) & 0xff
+        cb = (b >> shift) & 0xff
+        result |= ((ca * (256 - weight) + cb * weight + 128) >> 8) << shift
+    return result
+
+
+def map_samples(src_size, dest_size):
+    samples = []
+    for i in range(dest_size):
+        pos = ((2 * i + 1) * src_size << 16) // (2 * dest_size) - 0x8000
+        pos = min(max(pos, 0), (src_size - 1) << 16)
+        samples.append((pos >> 16, (pos >> 8) & 0xff))
+    return samples
+
+
+def scale_bilinear(image, dest_width, dest_height):
+    width, height, pixels = image
+    columns = map_samples(width, dest_width)
+
+    def scale_row(y):
+        row = pixels[y * width:(y + 1) * width]
+        return [lerp(row[x], row[min(x + 1, width - 1)], w) for x, w in columns]
+
+    result = []
+    for y, weight in map_samples(height, dest_height):
+        upper = scale_row(y)
+        lower = scale_row(min(y + 1, height - 1))
+        result += [lerp(a, b, weight) for a, b in zip(upper, lower)]
+    return result
+
+
+def scale_box(image, dest_width, dest_height):
+    width, height, pixels = image
+
+    result = []
+    for i in range(dest_height):
+        row_start = i * height // dest_height
+        row_end = (i + 1) * height // dest_height
+        for j in range(dest_width):
+            column_start = j * width // dest_width
+            column_end = (j + 1) * width // dest_width
+
+            sums = [0, 0, 0, 0]
+            for y in range(row_start, row_end):
+                for x in range(column_start, column_end):
+                    pixel = pixels[y * width + x]
+                    alpha = pixel >> 24
+                    sums[0] += alpha
+                    sums[1] += ((pixel >> 16) & 0xff) * alpha
+                    sums[2] += ((pixel >> 8) & 0xff) * alpha
+                    sums[3] += (pixel & 0xff) * alpha
+
+            if not sums[0]:
+                result.append(0)
+                continue
+
+            count = (column_end - column_start) * (row_end - row_start)
+            alpha = (sums[0] + count // 2) // count
+            r, g, b = [(s + sums[0] // 2) // sums[0] for s in sums[1:]]
+            result.append((alpha << 24) | (r << 16) | (g << 8) | b)
+    return result
+
+
+def scale(image, size):
+    width, height, _ = image
+    if width >= size and height >= size:
+        return scale_box(image, size, size)
+    return scale_bilinear(image, size, size)
+
+
+def icon_hash(name, seed):
+    value = 2166136261 ^ seed
+    for c in name:
+        value = ((value ^ c) * 16777619) & MASK32
+
+    value ^= value >> 16
+    value = (value * 0x85ebca6b) & MASK32
+    value ^= value >> 13
+    value = (value * 0xc2b2ae35) & MASK32
+    value ^= value >> 16
+    return value
+
+
+# Hash and displace: place the biggest buckets first, finding a displacement
+# which puts every name in the bucket into a free slot
+def perfect_hash(names):
+    count = len(names)
+    bucket_count = max((count + 1) // 2, 1)
+
+    buckets = [[] for _ in range(bucket_count)]
+    for name in names:
+        buckets[icon_hash(name, 0) % bucket_count].append(name)
+
+    displacements = [0] * bucket_count
+    slots = [None] * count
+    for bucket in sorted(range(bucket_count), key=lambda b: -len(buckets[b])):
+        if not buckets[bucket]:
+            continue
+
+        displacement = 1
+        while True:
+            placed = [icon_hash(name, displacement) % count for name in buckets[bucket]]
+            if len(set(placed)) == len(placed) and all(slots[s] is None for s in placed):
+                break
+            displacement += 1
+
+        displacements[bucket] = displacement
+        for name, slot in zip(buckets[bucket], placed):
+            slots[slot] = name
+
+    return displacements, slots
+
+
+def align(value, alignment):
+    return (value + alignment - 1) // alignment * alignment
+
+
+def main():
+    if len(sys.argv) < 2:
+        fail('usage: iconatlas.py <output> <icon>...')
+
+    sources = {}
+    for path in sys.argv[2:]:
+        size = int(os.path.basename(os.path.dirname(path)))
+        if size not in ICON_SIZES:
+            fail(path + ': icons must be in a 16, 32 or 64 directory')
+        name = os.path.splitext(os.path.basename(path))[0].encode()
+        sources.setdefault(name, {})[size] = path
+
+    names = sorted(sources)
+    displacements, slots = perfect_hash(names)
+
+    header_size = 9 * 4
+    buckets_offset = header_size
+    icons_offset = buckets_offset + len(displacements) * 4
+    names_offset = icons_offset + len(slots) * 20
+    names_size = sum(len(name) for name in names)
+    pixels_offset = align(names_offset + names_size, PAGE_SIZE)
+
+    name_offsets = {}
+    name_data = b''
+    for name in names:
+        name_offsets[name] = len(name_data)
+        name_data += name
+
+    icon_pixels = {}
+    pixel_data = b''
+    for name in names:
+        images = {}
+        offsets = []
+        for size in ICON_SIZES:
+            source = next(s for s in ICON_SOURCES[size] if s in sources[name])
+            if source not in images:
+                images[source] = read_image(sources[name][source])
+
+            offsets.append(pixels_offset + len(pixel_data))
+            pixel_data += struct.pack('<%dI' % (size * size), *scale(images[source], size))
+        icon_pixels[name] = offsets
+
+    atlas_size = align(pixels_offset + len(pixel_data), PAGE_SIZE)
+
+    atlas = bytearray(atlas_size)
+    struct.pack_into('<9I', atlas, 0, ATLAS_MAGIC, ATLAS_VERSION, atlas_size, len(names), len(displacements),
+                     buckets_offset, icons_offset, names_offset, pixels_offset)
+    struct.pack_into('<%dI' % len(displacements), atlas, buckets_offset, *displacements)
+    for slot, name in enumerate(slots):
+        struct.pack_into('<5I', atlas, icons_offset + slot * 20, name_offsets[name], len(name), *icon_pixels[name])
+    atlas[names_offset:names_offset + names_size] = name_data
+    atlas[pixels_offset:pixels_offset + len(pixel_data)] = pixel_data
+
+    with open(sys.argv[1], 'wb') as f:
+        f.write(atlas)
+
+
+if __name__ == '__main__':
+    main()
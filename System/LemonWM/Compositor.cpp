@@ -4,9 +4,124 @@
 
 #include <Lemon/Core/Logger.h>
 #include <Lemon/Graphics/Graphics.h>
+#include <Lemon/System/Info.h>
+
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace Lemon;
 
+void DamageRegion::Add(const Rect& rect) {
+    if (rect.width <= 0 || rect.height <= 0) {
+        return;
+    }
+
+    for (auto it = m_rects.begin(); it != m_rects.end();) {
+        if (it->Contains(rect)) {
+            return; // Already damaged
+        } else if (rect.Contains(*it)) {
+            it = m_rects.erase(it);
+            continue;
+        } else if (it->Intersects(rect)) {
+            // Only add the parts outside of the damaged rect
+            for (const Rect& piece : rect.Split(*it)) {
+                Add(piece);
+            }
+            return;
+        }
+
+        it++;
+    }
+
+    m_rects.push_back(rect);
+
+    if (m_rects.size() > DAMAGE_REGION_MAX_RECTS) {
+        // Copying a little extra is cheaper than keeping track of many small rects
+        Rect bounds = m_rects.front();
+        for (const Rect& r : m_rects) {
+            bounds.left(std::min(bounds.left(), r.left()));
+            bounds.top(std::min(bounds.top(), r.top()));
+            bounds.right(std::max(bounds.right(), r.right()));
+            bounds.bottom(std::max(bounds.bottom(), r.bottom()));
+        }
+
+        m_rects.clear();
+        m_rects.push_back(bounds);
+    }
+}
+
+CompositorWorkers::CompositorWorkers() {
+    int cpuCount = Lemon::SysInfo().cpuCount;
+    for (int i = 1; i < cpuCount; i++) {
+        m_threads.push_back(std::thread(&CompositorWorkers::WorkerThread, this));
+    }
+}
+
+CompositorWorkers::~CompositorWorkers() {
+    {
+        std::unique_lock lock(m_lock);
+        m_exit = true;
+    }
+    m_start.notify_all();
+
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void CompositorWorkers::Run(int count, const std::function<void(int)>& job) {
+    if (m_threads.empty() || count <= 1) {
+        for (int i = 0; i < count; i++) {
+            job(i);
+        }
+        return;
+    }
+
+    std::unique_lock lock(m_lock);
+    m_job = &job;
+    m_jobCount = count;
+    m_nextJob = 0;
+    m_busy = m_threads.size();
+    m_generation++;
+    lock.unlock();
+
+    m_start.notify_all();
+    RunJobs();
+
+    lock.lock();
+    m_done.wait(lock, [this]() -> bool { return !m_busy; });
+    m_job = nullptr;
+}
+
+void CompositorWorkers::WorkerThread() {
+    unsigned generation = 0;
+
+    std::unique_lock lock(m_lock);
+    for (;;) {
+        m_start.wait(lock, [this, generation]() -> bool { return m_exit || m_generation != generation; });
+        if (m_exit) {
+            return;
+        }
+
+        generation = m_generation;
+        lock.unlock();
+
+        RunJobs();
+
+        lock.lock();
+        if (!--m_busy) {
+            m_done.notify_one();
+        }
+    }
+}
+
+void CompositorWorkers::RunJobs() {
+    int job;
+    while ((job = m_nextJob.fetch_add(1)) < m_jobCount) {
+        (*m_job)(job);
+    }
+}
+
 Compositor::Compositor(const Surface& displaySurface) : m_displaySurface(displaySurface) {
     // Create a backbuffer surface for rendering
     m_renderSurface = displaySurface;
@@ -26,29 +141,12 @@ Compositor::Compositor(const Surface& displaySurface) : m_displaySurface(display
         m_cursorResize = m_cursorNormal;
     }
 
-    clock_gettime(CLOCK_BOOTTIME, &m_lastRender);
+    clock_gettime(CLOCK_BOOTTIME, &m_statisticsStart);
 }
 
 void Compositor::Render() {
-    if (m_displayFramerate) {
-        timespec cTime;
-        clock_gettime(CLOCK_BOOTTIME, &cTime);
-
-        unsigned long renderTime =
-            (cTime.tv_nsec - m_lastRender.tv_nsec) + (cTime.tv_sec - m_lastRender.tv_sec) * 1000000000;
-
-        m_avgFrametime += renderTime;
-
-        if (m_avgFrametime > 1000000000 && m_fCount) {
-            if (m_avgFrametime)
-                m_fRate = 1000000000 / (m_avgFrametime / m_fCount);
-            m_fCount = 0;
-            m_avgFrametime = renderTime;
-        }
-
-        m_fCount++;
-        m_lastRender = cTime;
-    }
+    UpdateStatistics();
+    m_fCount++;
 
     if (m_wallpaperThread.joinable() && m_wallpaperStatus) {
         m_wallpaperThread.join();
@@ -56,15 +154,50 @@ void Compositor::Render() {
 
     m_renderMutex.lock();
 
+    if (!m_invalidateAll) {
+        UpdateClipping(); // Windows may have moved since the last frame
+    }
+
     Vector2i mousePos = WM::Instance().Input().mouse.pos;
-    if(mousePos != m_lastMousePos){
-        Invalidate({m_lastMousePos, m_cursorCurrent->width, m_cursorCurrent->height});
+    Rect cursorRect = {mousePos, m_cursorCurrent->width, m_cursorCurrent->height};
+
+    bool redrawCursor = false;
+    if (mousePos != m_lastMousePos || m_cursorCurrent != m_lastCursor) {
+        Invalidate({m_lastMousePos, m_lastCursor->width, m_lastCursor->height});
         m_lastMousePos = mousePos;
+        m_lastCursor = m_cursorCurrent;
+
+        redrawCursor = true;
+    }
+
+    bool showContextMenu = WM::Instance().m_showContextMenu;
+    const Rect& contextMenuBounds = WM::Instance().m_contextMenu.bounds;
+
+    bool redrawContextMenu = false;
+    if (!showContextMenu || m_lastContextMenuBounds.pos != contextMenuBounds.pos ||
+        m_lastContextMenuBounds.size != contextMenuBounds.size) {
+        if (m_lastContextMenuBounds.width > 0) {
+            Invalidate(m_lastContextMenuBounds); // Redraw what was beneath the old menu
+        }
+
+        m_lastContextMenuBounds = showContextMenu ? contextMenuBounds : Rect{0, 0, 0, 0};
+        redrawContextMenu = showContextMenu;
     }
 
     if (m_invalidateAll) {
-        RecalculateBackgroundClipping();
-        RecalculateWindowClipping();
+        Rect screen = {0, 0, m_renderSurface.width, m_renderSurface.height};
+
+        m_backgroundRects.clear();
+        m_windowClipRects.clear();
+        RecalculateBackgroundClipping(screen, m_backgroundRects);
+        RecalculateWindowClipping(screen, m_windowClipRects);
+        SortWindowClipping();
+        RecalculateOcclusion();
+        m_clippingDamage.Clear();
+
+        m_damage.Add({0, 0, m_renderSurface.width, m_renderSurface.height});
+        redrawCursor = true;
+        redrawContextMenu = showContextMenu;
 
         // We fill the areas of the screen being redrawn in debug mode
         // This happens before the render surface is blitted to the display surface
@@ -75,58 +208,91 @@ void Compositor::Render() {
 
         if (m_wallpaper.buffer) {
             for (BackgroundClipRect& rect : m_backgroundRects) {
-                m_renderSurface.Blit(&m_wallpaper, rect.rect.pos, rect.rect);
-
-#ifdef COMPOSITOR_DEBUG
-                Lemon::Graphics::DrawRectOutline(rect.rect, {255, 255, 0, 255}, &m_renderSurface);
-#endif
-
+                m_ops.push_back({CompositeOp::TypeBackground, rect.rect});
                 rect.invalid = false;
             }
         }
     } else {
+        std::vector<Rect> damage;
         for (WMWindow* win : WM::Instance().m_windows) {
-            if (win->IsDirtyAndClear()) {
+            damage.clear();
+            if (!win->TakeDamage(damage)) {
+                continue;
+            }
+
+            if (damage.empty()) {
                 Invalidate(win->GetContentRect());
+            } else if (win->IsTransparent()) {
+                // Whatever is beneath the damage has to be redrawn as well
+                for (const Rect& rect : damage) {
+                    Invalidate(rect);
+                }
+            } else {
+                // Only redraw the damaged parts of the window's clips
+                for (const Rect& rect : damage) {
+                    m_windowDamage.push_back({rect, win});
+                }
             }
         }
+
+        // The context menu and cursor are drawn over the clips,
+        // so when anything beneath them changes they are drawn again over fully redrawn clips.
+        // Invalidating beneath one can invalidate clips beneath the other, so repeat until neither changes.
+        bool changed;
+        do {
+            changed = false;
+            if (showContextMenu && !redrawContextMenu && IsInvalid(contextMenuBounds)) {
+                Invalidate(contextMenuBounds);
+                redrawContextMenu = changed = true;
+            }
+
+            if (!redrawCursor && IsInvalid(cursorRect)) {
+                Invalidate(cursorRect);
+                redrawCursor = changed = true;
+            }
+        } while (changed);
+    }
+
+    for (WMWindow* win : WM::Instance().m_windows) {
+        win->LatchBuffer();
     }
 
+    // Gather the clips to redraw, in the order they have to be drawn
     if (m_wallpaper.buffer) {
         for (BackgroundClipRect& rect : m_backgroundRects) {
             if (!rect.invalid) {
                 continue;
             }
 
-            m_renderSurface.Blit(&m_wallpaper, rect.rect.pos, rect.rect);
-
-#ifdef COMPOSITOR_DEBUG
-            Lemon::Graphics::DrawRectOutline(rect.rect, {255, 0, 0, 255}, &m_renderSurface);
-#endif
+            m_ops.push_back({CompositeOp::TypeBackground, rect.rect});
+            m_damage.Add(rect.rect);
 
             rect.invalid = false;
         }
     }
 
-    for (auto it = m_windowClipRects.begin(); it != m_windowClipRects.end();) {
-        WMWindow* win = it->win;
+    for (WindowClipRect& rect : m_windowClipRects) {
+        WMWindow* win = rect.win;
 
-        if (m_invalidateAll || it->invalid) { // Window buffer not dirty, only draw invalid clips
-            if(it->type == WindowClipRect::TypeWindowDecoration){
-                win->DrawDecorationClip(it->rect, &m_renderSurface);
+        if (m_invalidateAll || rect.invalid) { // Window buffer not dirty, only draw invalid clips
+            if(rect.type == WindowClipRect::TypeWindowDecoration){
+                m_ops.push_back({CompositeOp::TypeWindowDecoration, rect.rect, win});
             } else {
-                win->DrawClip(it->rect, &m_renderSurface);
+                m_ops.push_back({CompositeOp::TypeWindow, rect.rect, win});
             }
+            m_damage.Add(rect.rect);
 
-            it->invalid = false;
-            it++;
+            rect.invalid = false;
+        } else if (rect.type == WindowClipRect::TypeWindow) {
+            for (const WindowClipRect& dRect : m_windowDamage) {
+                if (dRect.win != win || !dRect.rect.Intersects(rect.rect)) {
+                    continue;
+                }
 
-#ifdef COMPOSITOR_DEBUG
-            Lemon::Graphics::DrawRect(it->rect, {255, 0, 0, 255}, &m_displaySurface);
-            Lemon::Graphics::DrawRectOutline(it->rect, {0, 0, 255, 255}, &m_renderSurface);
-#endif
-        } else {
-            it++;
+                Rect clip = dRect.rect.GetIntersect(rect.rect);
+                m_ops.push_back({CompositeOp::TypeWindow, clip, win});
+                m_damage.Add(clip);
+            }
         }
     }
 
@@ -135,40 +301,94 @@ void Compositor::Render() {
             continue;
         }
 
-        rect.win->DrawDecorationClip(rect.rect, &m_renderSurface);
-
-#ifdef COMPOSITOR_DEBUG
-        Lemon::Graphics::DrawRect(rect.rect, {0, 255, 0, 255}, &m_displaySurface);
-        Lemon::Graphics::DrawRectOutline(rect.rect, {0, 255, 0, 255}, &m_renderSurface);
-#endif
+        m_ops.push_back({CompositeOp::TypeWindowDecoration, rect.rect, rect.win});
+        m_damage.Add(rect.rect);
 
         rect.invalid = false;
     }
 
-    if (WM::Instance().m_showContextMenu) {
-        Lemon::Graphics::DrawRoundedRect(WM::Instance().m_contextMenu.bounds, WMWindow::theme.titlebarColour, 5, 5, 5,
-                                         5, &m_renderSurface);
+    timespec compositeStart;
+    clock_gettime(CLOCK_BOOTTIME, &compositeStart);
+
+    CompositeTiles();
+
+    timespec compositeEnd;
+    clock_gettime(CLOCK_BOOTTIME, &compositeEnd);
+    m_compositeTime +=
+        (compositeEnd.tv_nsec - compositeStart.tv_nsec) + (compositeEnd.tv_sec - compositeStart.tv_sec) * 1000000000;
+
+    // The overlays are small and drawn over everything else, draw them on this thread
+
+    if (redrawContextMenu) {
+        Lemon::Graphics::DrawRoundedRect(contextMenuBounds, WMWindow::theme.titlebarColour, 5, 5, 5, 5,
+                                         &m_renderSurface);
         for (const auto& ent : WM::Instance().m_contextMenu.entries) {
             const Vector2i& pos = ent.bounds.pos;
             Lemon::Graphics::DrawString(ent.text.c_str(), pos.x, pos.y, GUI::Theme::Current().ColourText(),
                                         &m_renderSurface);
         }
+        m_damage.Add(contextMenuBounds);
     }
 
-    m_renderSurface.AlphaBlit(m_cursorCurrent, mousePos);
+    if (redrawCursor) {
+        m_renderSurface.AlphaBlit(m_cursorCurrent, mousePos);
+        m_damage.Add(cursorRect);
+    }
 
     if (m_displayFramerate) {
-        Lemon::Graphics::DrawRect(0, 0, 80, 18, 0, 0, 0, &m_renderSurface);
-        Lemon::Graphics::DrawString(std::to_string(m_fRate).c_str(), 0, 0, 255, 255, 255, &m_renderSurface);
+        std::string stats = std::to_string(m_fRate) + " fps " + std::to_string(m_presentedBytesPerSecond / 1024) +
+                            " KB/s " + std::to_string(m_compositeTimePerFrame) + " us/frame (" +
+                            std::to_string(m_workers.ThreadCount()) + " threads)";
+        Rect statsRect = {0, 0, Graphics::GetTextLength(stats.c_str()) + 4, 18};
+
+        Lemon::Graphics::DrawRect(statsRect, {0, 0, 0, 255}, &m_renderSurface);
+        Lemon::Graphics::DrawString(stats.c_str(), 0, 0, 255, 255, 255, &m_renderSurface);
+        m_damage.Add(statsRect);
     }
 
-    // Copy the render surface to the display surface
-    m_displaySurface.Blit(&m_renderSurface);
+    m_windowDamage.clear();
+
+    // Copy the damaged areas of the render surface to the display surface
+    Present();
     m_invalidateAll = false;
 
     m_renderMutex.unlock();
 }
 
+bool Compositor::HasDamage() {
+    // Keep the counters up to date even when nothing is drawn as they can be queried by clients
+    if (UpdateStatistics() && m_displayFramerate) {
+        return true;
+    }
+
+    if (m_invalidateAll || !m_clippingDamage.Rects().empty()) {
+        return true;
+    }
+
+    if (WM::Instance().Input().mouse.pos != m_lastMousePos || m_cursorCurrent != m_lastCursor) {
+        return true;
+    }
+
+    // Check if the context menu has been shown, hidden or moved
+    const Rect& contextMenuBounds = WM::Instance().m_contextMenu.bounds;
+    if (WM::Instance().m_showContextMenu) {
+        if (m_lastContextMenuBounds.pos != contextMenuBounds.pos ||
+            m_lastContextMenuBounds.size != contextMenuBounds.size) {
+            return true;
+        }
+    } else if (m_lastContextMenuBounds.width > 0) {
+        return true;
+    }
+
+    for (WMWindow* win : WM::Instance().m_windows) {
+        if (!win->IsMinimized() && win->IsDirty()) {
+            return true;
+        }
+    }
+
+    return IsInvalid({0, 0, m_renderSurface.width, m_renderSurface.height});
+}
+
 void Compositor::InvalidateAll() { m_invalidateAll = true; }
 
 void Compositor::Invalidate(const Rect& rect) {
@@ -176,15 +396,17 @@ void Compositor::Invalidate(const Rect& rect) {
         return;
     }
 
+    // The clips may refer to windows which have since been moved or destroyed
+    UpdateClipping();
+
     for (auto& bgRect : m_backgroundRects) {
-        if (bgRect.invalid) {
+        if (bgRect.invalid || !bgRect.rect.Intersects(rect)) {
             continue;
         }
 
-        if (bgRect.rect.Intersects(rect)) {
-            bgRect.invalid = true; // Set bg rect as invalid
-        }
+        bgRect.invalid = true; // Set bg rect as invalid
 
+        // Transparent windows over the background are drawn again on top of it
         for (auto& wRect : m_windowClipRects) {
             if(wRect.rect.Intersects(bgRect.rect)){
                 wRect.invalid = true;
@@ -217,7 +439,149 @@ void Compositor::Invalidate(const Rect& rect) {
     }
 }
 
-void Compositor::InvalidateWindow(class WMWindow* window) { m_invalidateAll = true; }
+void Compositor::CompositeTiles() {
+    if (m_ops.empty()) {
+        return;
+    }
+
+    int tilesX = (m_renderSurface.width + COMPOSITOR_TILE_SIZE - 1) / COMPOSITOR_TILE_SIZE;
+    int tilesY = (m_renderSurface.height + COMPOSITOR_TILE_SIZE - 1) / COMPOSITOR_TILE_SIZE;
+    m_tileOps.resize(tilesX * tilesY);
+
+    // Sort the ops into the tiles they cover, keeping their order within each tile.
+    // Tiles do not overlap, so drawing them in any order gives the same result as drawing every op in order.
+    for (int i = 0; i < static_cast<int>(m_ops.size()); i++) {
+        const Rect& rect = m_ops[i].rect;
+
+        int left = std::max(rect.left(), 0);
+        int top = std::max(rect.top(), 0);
+        int right = std::min(rect.right(), m_renderSurface.width);
+        int bottom = std::min(rect.bottom(), m_renderSurface.height);
+        if (right <= left || bottom <= top) {
+            continue;
+        }
+
+        for (int y = top / COMPOSITOR_TILE_SIZE; y <= (bottom - 1) / COMPOSITOR_TILE_SIZE; y++) {
+            for (int x = left / COMPOSITOR_TILE_SIZE; x <= (right - 1) / COMPOSITOR_TILE_SIZE; x++) {
+                std::vector<int>& ops = m_tileOps[y * tilesX + x];
+                if (ops.empty()) {
+                    m_dirtyTiles.push_back(y * tilesX + x);
+                }
+
+                ops.push_back(i);
+            }
+        }
+    }
+
+    m_workers.Run(m_dirtyTiles.size(), [this, tilesX](int job) -> void {
+        int tile = m_dirtyTiles[job];
+        Rect tileRect = {(tile % tilesX) * COMPOSITOR_TILE_SIZE, (tile / tilesX) * COMPOSITOR_TILE_SIZE,
+                         COMPOSITOR_TILE_SIZE, COMPOSITOR_TILE_SIZE};
+
+        for (int i : m_tileOps[tile]) {
+            DrawOp(m_ops[i], m_ops[i].rect.GetIntersect(tileRect));
+        }
+    });
+
+    for (int tile : m_dirtyTiles) {
+        m_tileOps[tile].clear();
+    }
+    m_dirtyTiles.clear();
+    m_ops.clear();
+}
+
+void Compositor::DrawOp(const CompositeOp& op, const Rect& clip) {
+    switch (op.type) {
+    case CompositeOp::TypeBackground:
+        m_renderSurface.Blit(&m_wallpaper, clip.pos, clip);
+        break;
+    case CompositeOp::TypeWindow:
+        op.win->DrawClip(clip, &m_renderSurface);
+        break;
+    case CompositeOp::TypeWindowDecoration: {
+        std::unique_lock lock(m_decorationMutex);
+        op.win->DrawDecorationClip(clip, &m_renderSurface);
+        break;
+    }
+    }
+
+#ifdef COMPOSITOR_DEBUG
+    Lemon::Graphics::DrawRectOutline(op.rect, {0, 0, 255, 255}, &m_renderSurface, clip);
+#endif
+}
+
+bool Compositor::IsInvalid(const Rect& rect) const {
+    for (const BackgroundClipRect& bgRect : m_backgroundRects) {
+        if (bgRect.invalid && bgRect.rect.Intersects(rect)) {
+            return true;
+        }
+    }
+
+    for (const WindowClipRect& wRect : m_windowClipRects) {
+        if (wRect.invalid && wRect.rect.Intersects(rect)) {
+            return true;
+        }
+    }
+
+    for (const WindowClipRect& dRect : m_windowDecorationClipRects) {
+        if (dRect.invalid && dRect.rect.Intersects(rect)) {
+            return true;
+        }
+    }
+
+    for (const WindowClipRect& dRect : m_windowDamage) {
+        if (dRect.rect.Intersects(rect)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Compositor::Present() {
+    Rect screen = {0, 0, m_displaySurface.width, m_displaySurface.height};
+
+    for (const Rect& rect : m_damage.Rects()) {
+        if (!rect.Intersects(screen)) {
+            continue;
+        }
+
+        Rect clip = rect.GetIntersect(screen);
+        m_displaySurface.Blit(&m_renderSurface, clip.pos, clip);
+
+        m_presentedBytes += static_cast<uint64_t>(clip.width) * clip.height * 4;
+    }
+
+    m_damage.Clear();
+}
+
+bool Compositor::UpdateStatistics() {
+    timespec cTime;
+    clock_gettime(CLOCK_BOOTTIME, &cTime);
+
+    long elapsed = (cTime.tv_nsec - m_statisticsStart.tv_nsec) + (cTime.tv_sec - m_statisticsStart.tv_sec) * 1000000000;
+    if (elapsed < 1000000000) {
+        return false;
+    }
+
+    m_fRate = m_fCount * 1000000000L / elapsed;
+    m_presentedBytesPerSecond = m_presentedBytes * 1000000000 / elapsed;
+    m_compositeTimePerFrame = m_fCount ? m_compositeTime / m_fCount / 1000 : 0;
+
+    m_fCount = 0;
+    m_presentedBytes = 0;
+    m_compositeTime = 0;
+    m_statisticsStart = cTime;
+    return true;
+}
+
+void Compositor::InvalidateWindow(class WMWindow* window) {
+    if (window->ShouldDrawDecoration() && !window->IsMinimized()) {
+        Invalidate(window->GetTitlebarRect());
+    }
+}
+
+void Compositor::InvalidateClipping(const Rect& bounds) { m_clippingDamage.Add(bounds); }
 
 void Compositor::SetWallpaper(const std::string& path) {
     m_wallpaperStatus = 0;
@@ -238,8 +602,73 @@ void Compositor::SetWallpaper(const std::string& path) {
     m_wallpaperThread = std::move(wallpaperThread);
 }
 
-void Compositor::RecalculateWindowClipping() {
-    m_windowClipRects.clear();
+// Cut bounds out of the clips, keeping the pieces outside of it in the same place in the list
+template <typename T> static void CutClips(std::list<T>& clips, const Rect& bounds) {
+    for (auto it = clips.begin(); it != clips.end();) {
+        if (!it->rect.Intersects(bounds)) {
+            it++;
+            continue;
+        }
+
+        std::list<T> pieces = it->Split(bounds);
+        for (T& piece : pieces) {
+            piece.invalid = it->invalid;
+        }
+
+        clips.splice(it, std::move(pieces));
+        it = clips.erase(it);
+    }
+}
+
+void Compositor::UpdateClipping() {
+    if (m_clippingDamage.Rects().empty()) {
+        return;
+    }
+
+    Rect screen = {0, 0, m_renderSurface.width, m_renderSurface.height};
+    for (const Rect& damaged : m_clippingDamage.Rects()) {
+        if (!damaged.Intersects(screen)) {
+            continue;
+        }
+
+        // Nothing outside of the bounds has changed so the clips there stay as they are,
+        // the new clips within the bounds are all invalid and get drawn next frame.
+        // The damaged rects do not overlap, so neither do the clips of different rects
+        // and the order of the clips only matters within each rect.
+        Rect bounds = damaged.GetIntersect(screen);
+        CutClips(m_backgroundRects, bounds);
+        CutClips(m_windowClipRects, bounds);
+
+        std::list<BackgroundClipRect> backgroundRects;
+        std::list<WindowClipRect> windowRects;
+        RecalculateBackgroundClipping(bounds, backgroundRects);
+        RecalculateWindowClipping(bounds, windowRects);
+
+        m_backgroundRects.splice(m_backgroundRects.end(), std::move(backgroundRects));
+        m_windowClipRects.splice(m_windowClipRects.end(), std::move(windowRects));
+    }
+
+    m_clippingDamage.Clear();
+    SortWindowClipping();
+    RecalculateOcclusion();
+}
+
+void Compositor::SortWindowClipping() {
+    // Splitting a clip moves its pieces to the end of the list, which can put them after the clips of
+    // a window above. Where that window is transparent or has a decoration the lower window would be drawn over it.
+    std::unordered_map<WMWindow*, int> order;
+    int index = 0;
+    for (WMWindow* win : WM::Instance().m_windows) {
+        order[win] = index++;
+    }
+
+    // Stable, clips of the same window do not overlap so their order does not matter
+    m_windowClipRects.sort(
+        [&order](const WindowClipRect& a, const WindowClipRect& b) -> bool { return order[a.win] < order[b.win]; });
+}
+
+void Compositor::RecalculateOcclusion() {
+    std::unordered_set<WMWindow*> windowsBeneath; // Windows drawn before the current window, including itself
 
     for (WMWindow* win : WM::Instance().m_windows) {
         win->occludedBackgroundRects.clear();
@@ -249,8 +678,33 @@ void Compositor::RecalculateWindowClipping() {
             continue;
         }
 
+        windowsBeneath.insert(win);
+        if (!win->IsTransparent()) {
+            continue;
+        }
+
+        for (auto& bgRect : m_backgroundRects) {
+            if (bgRect.rect.Intersects(win->GetContentRect())) {
+                win->occludedBackgroundRects.push_back(&bgRect);
+            }
+        }
+
+        for (auto& wRect : m_windowClipRects) {
+            if (windowsBeneath.count(wRect.win) && wRect.rect.Intersects(win->GetContentRect())) {
+                win->occludedWindowRects.push_back(&wRect);
+            }
+        }
+    }
+}
+
+void Compositor::RecalculateWindowClipping(const Rect& bounds, std::list<WindowClipRect>& rects) {
+    for (WMWindow* win : WM::Instance().m_windows) {
+        if (win->IsMinimized() || !win->GetRect().Intersects(bounds)) {
+            continue;
+        }
+
     retry:
-        for (auto it = m_windowClipRects.begin(); it != m_windowClipRects.end(); it++) {
+        for (auto it = rects.begin(); it != rects.end(); it++) {
             if (win->IsTransparent() && win->GetContentRect().Contains(it->rect)) {
                 continue;
             }
@@ -259,10 +713,10 @@ void Compositor::RecalculateWindowClipping() {
                 auto result = it->SplitModify(win->GetContentRect());
 
                 if (!win->IsTransparent()) {
-                    m_windowClipRects.erase(it);
+                    rects.erase(it);
                 }
 
-                m_windowClipRects.splice(m_windowClipRects.end(), std::move(result));
+                rects.splice(rects.end(), std::move(result));
                 goto retry;
             }
         }
@@ -270,8 +724,18 @@ void Compositor::RecalculateWindowClipping() {
         if(win->ShouldDrawDecoration()){
             auto decorationRects = WindowClipRect{win->GetRect(), win, WindowClipRect::TypeWindowDecoration}.Split(win->GetContentRect());
 
+            // Only keep the parts of the decorations within bounds
+            for (auto it = decorationRects.begin(); it != decorationRects.end();) {
+                if (it->rect.Intersects(bounds)) {
+                    it->rect = it->rect.GetIntersect(bounds);
+                    it++;
+                } else {
+                    it = decorationRects.erase(it);
+                }
+            }
+
             for (auto& rect : decorationRects) {
-                for (auto it = m_windowClipRects.begin(); it != m_windowClipRects.end(); it++) {
+                for (auto it = rects.begin(); it != rects.end(); it++) {
                     // Decoration rects are treated as transparent
                     if (rect.rect.Contains(it->rect)) {
                         continue;
@@ -280,41 +744,27 @@ void Compositor::RecalculateWindowClipping() {
                     if (it->rect.Intersects(rect.rect)) {
                         auto result = it->SplitModify(rect.rect);
 
-                        m_windowClipRects.splice(m_windowClipRects.end(), std::move(result));
+                        rects.splice(rects.end(), std::move(result));
                         goto retry;
                     }
                 }
             }
 
-            m_windowClipRects.splice(m_windowClipRects.end(), std::move(decorationRects));
+            rects.splice(rects.end(), std::move(decorationRects));
         }
 
-        m_windowClipRects.push_back({win->GetContentRect(), win, WindowClipRect::TypeWindow});
-
-        if (win->IsTransparent()) {
-            for (auto& bgRect : m_backgroundRects) {
-                if (bgRect.rect.Intersects(win->GetContentRect())) {
-                    win->occludedBackgroundRects.push_back(&bgRect);
-                }
-            }
-
-            for (auto& bgRect : m_windowClipRects) {
-                if (bgRect.rect.Intersects(win->GetContentRect())) {
-                    win->occludedWindowRects.push_back(&bgRect);
-                }
-            }
+        if (win->GetContentRect().Intersects(bounds)) {
+            rects.push_back({win->GetContentRect().GetIntersect(bounds), win, WindowClipRect::TypeWindow});
         }
     }
 }
 
-void Compositor::RecalculateBackgroundClipping() {
-    m_backgroundRects.clear();
-
-    m_backgroundRects.push_back({Rect{0, 0, m_displaySurface.width, m_displaySurface.height}, true});
+void Compositor::RecalculateBackgroundClipping(const Rect& bounds, std::list<BackgroundClipRect>& rects) {
+    rects.push_back({bounds, true});
 
     auto& windows = WM::Instance().m_windows;
     for (WMWindow* win : windows) {
-        if (win->IsMinimized()) {
+        if (win->IsMinimized() || !win->GetRect().Intersects(bounds)) {
             continue;
         }
 
@@ -324,13 +774,13 @@ void Compositor::RecalculateBackgroundClipping() {
         }
 
     retry:
-        for (auto it = m_backgroundRects.begin(); it != m_backgroundRects.end(); it++) {
+        for (auto it = rects.begin(); it != rects.end(); it++) {
             if (win->ShouldDrawDecoration()) {
                 for (auto& dRect : splitDecorationRects) {
                     if (it->rect.Intersects(dRect) && !dRect.Contains(it->rect)) {
                         auto result = it->SplitModify(dRect);
 
-                        m_backgroundRects.splice(m_backgroundRects.end(), std::move(result));
+                        rects.splice(rects.end(), std::move(result));
                         goto retry;
                     }
                 }
@@ -344,9 +794,9 @@ void Compositor::RecalculateBackgroundClipping() {
                 auto result = it->SplitModify(win->GetContentRect());
 
                 if (!win->IsTransparent()) {
-                    m_backgroundRects.erase(it);
+                    rects.erase(it);
                 }
-                m_backgroundRects.splice(m_backgroundRects.end(), std::move(result));
+                rects.splice(rects.end(), std::move(result));
                 goto retry;
             }
         }
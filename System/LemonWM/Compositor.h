@@ -4,9 +4,13 @@
 #include <Lemon/Graphics/Types.h>
 
 #include <atomic>
+#include <condition_variable>
 #include <ctime>
+#include <functional>
 #include <list>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 template <typename T, class... D> std::list<T> SplitModify(Rect& victim, const Rect& cut, D... extraData) {
     std::list<T> clips;
@@ -95,32 +99,119 @@ struct BackgroundClipRect {
     std::list<BackgroundClipRect> Split(const Rect& cut) { return ::Split<BackgroundClipRect, bool>(rect, cut, true); }
 };
 
+#define DAMAGE_REGION_MAX_RECTS 32 // Past this many rects the region is replaced by its bounds
+
+// Area of the screen changed during a frame
+// Kept as a list of rects which do not overlap so no pixel is presented twice
+class DamageRegion {
+public:
+    void Add(const Rect& rect);
+    inline void Clear() { m_rects.clear(); }
+
+    inline const std::list<Rect>& Rects() const { return m_rects; }
+
+private:
+    std::list<Rect> m_rects;
+};
+
+#define COMPOSITOR_TILE_SIZE 128 // Width and height of the tiles the screen is split into for compositing
+
+// Clip to draw this frame, drawn on every tile it covers
+struct CompositeOp {
+    enum {
+        TypeBackground,
+        TypeWindow,
+        TypeWindowDecoration,
+    } type;
+    Rect rect;
+    class WMWindow* win = nullptr;
+};
+
+// Worker threads which composite tiles in parallel, one for every CPU besides the one running the WM
+class CompositorWorkers {
+public:
+    CompositorWorkers();
+    ~CompositorWorkers();
+
+    // Run job for every index from 0 to count, returns once every job has finished.
+    // The calling thread runs jobs as well.
+    void Run(int count, const std::function<void(int)>& job);
+
+    inline int ThreadCount() const { return m_threads.size() + 1; }
+
+private:
+    void WorkerThread();
+    void RunJobs();
+
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_lock;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    unsigned m_generation = 0; // Incremented for every Run so the workers know there are new jobs
+    int m_busy = 0;            // Workers which have not finished the current jobs
+    bool m_exit = false;
+
+    const std::function<void(int)>* m_job = nullptr;
+    int m_jobCount = 0;
+    std::atomic<int> m_nextJob = 0;
+};
+
 class Compositor {
 public:
     Compositor(const Surface& displaySurface);
 
     void Render();
 
+    // Check if anything has changed since the last frame
+    bool HasDamage();
+
     inline Vector2i GetScreenBounds() const { return {m_renderSurface.width, m_renderSurface.height}; }
 
     void InvalidateAll();
     void Invalidate(const Rect& rect);
+    // Redraw the decorations of a window
     void InvalidateWindow(class WMWindow* window);
+    // The windows covering bounds have changed (a window was moved, resized, raised, shown or hidden),
+    // clipping is recalculated within bounds before the next frame and the area is redrawn
+    void InvalidateClipping(const Rect& bounds);
 
     void SetWallpaper(const std::string& path);
     void SetShouldDisplayFramerate(bool value) { m_displayFramerate = value; }
 
+    inline int GetFramerate() const { return m_fRate; }
+    // Bytes copied to the display surface over the last second
+    inline uint64_t GetPresentedBytesPerSecond() const { return m_presentedBytesPerSecond; }
+
     inline void SetNormalCursor() { m_cursorCurrent = &m_cursorNormal; }
     inline void SetResizeCursor() { m_cursorCurrent = &m_cursorResize; }
 
 private:
-    void RecalculateWindowClipping();
-    void RecalculateBackgroundClipping();
+    // Clip the windows and background within bounds into rects
+    void RecalculateWindowClipping(const Rect& bounds, std::list<WindowClipRect>& rects);
+    void RecalculateBackgroundClipping(const Rect& bounds, std::list<BackgroundClipRect>& rects);
+    // Recalculate clipping within m_clippingDamage, leaving the clips outside of it alone
+    void UpdateClipping();
+    // Put the window clips in the order the windows are drawn, back to front
+    void SortWindowClipping();
+    // Find the clips beneath each transparent window
+    void RecalculateOcclusion();
 
     void InvalidateBackgroundRect(BackgroundClipRect& bgRect);
     void InvalidateWindowRect(WindowClipRect& wRect);
     void InvalidateDecorationRect(WindowClipRect& dRect);
 
+    // Draw m_ops, splitting the screen into tiles which are drawn in parallel
+    void CompositeTiles();
+    void DrawOp(const CompositeOp& op, const Rect& clip);
+
+    // Check if any clip overlapping the rect is going to be redrawn
+    bool IsInvalid(const Rect& rect) const;
+    // Copy the damaged region of the render surface to the display surface
+    void Present();
+    // Update the framerate and presented bytes once a second has passed, returns true if they were updated
+    bool UpdateStatistics();
+
     bool m_invalidateAll = true;
     bool m_displayFramerate = false;
 
@@ -128,12 +219,20 @@ private:
     Surface m_cursorNormal; // Normal mouse cursor
     Surface m_cursorResize; // Window resize mouse cursor
     Surface* m_cursorCurrent = &m_cursorNormal; // Current mouse cursor
+    Surface* m_lastCursor = &m_cursorNormal; // Cursor drawn last frame
 
     // Used for framerate counter
-    timespec m_lastRender;
-    int m_avgFrametime = 0;
+    timespec m_statisticsStart; // Start of the period being counted
     int m_fCount = 0;
     int m_fRate = 0;
+    uint64_t m_presentedBytes = 0; // Bytes presented since the counters were last updated
+    uint64_t m_presentedBytesPerSecond = 0;
+    long m_compositeTime = 0; // Nanoseconds spent compositing tiles since the counters were last updated
+    long m_compositeTimePerFrame = 0; // Average microseconds spent compositing tiles each frame
+
+    DamageRegion m_damage; // Damage of the current frame
+    DamageRegion m_clippingDamage; // Area where clipping has to be recalculated
+    Rect m_lastContextMenuBounds = {0, 0, 0, 0}; // Empty if the context menu was not shown last frame
 
     Surface m_renderSurface;  // Backbuffer to render to
     Surface m_displaySurface; // Display mapped surface
@@ -147,4 +246,11 @@ private:
     std::list<BackgroundClipRect> m_backgroundRects;
     std::list<WindowClipRect> m_windowClipRects;
     std::list<WindowClipRect> m_windowDecorationClipRects;
+    std::list<WindowClipRect> m_windowDamage; // Damage reported by opaque windows this frame, drawn within their clips
+
+    CompositorWorkers m_workers;
+    std::vector<CompositeOp> m_ops; // Clips to draw this frame, in order
+    std::vector<std::vector<int>> m_tileOps; // Indices of the ops covering each tile
+    std::vector<int> m_dirtyTiles; // Tiles with at least one op
+    std::mutex m_decorationMutex; // Decorations draw text and the font rasterizer is not thread safe
 };
@@ -1,9 +1,12 @@
 #include "WM.h"
 
+#include <Lemon/Core/IconAtlas.h>
 #include <Lemon/Core/Keyboard.h>
 #include <Lemon/Core/Logger.h>
+#include <Lemon/Core/SharedMemory.h>
 #include <Lemon/GUI/WindowServer.h>
 
+#include <algorithm>
 #include <cassert>
 #include <unistd.h>
 
@@ -19,12 +22,55 @@ WM::WM(const Surface& displaySurface)
     if (Graphics::LoadImage("/system/lemon/resources/winbuttons.png", &WMWindow::theme.windowButtons)) {
         Logger::Error("Failed to load window buttons!");
     }
+
+    LoadIconAtlas();
+}
+
+void WM::LoadIconAtlas() {
+    FILE* atlasFile = fopen(ICON_ATLAS_PATH, "rb");
+    if (!atlasFile) {
+        Logger::Warning("Failed to open icon atlas, icons will be loaded by each application");
+        return;
+    }
+
+    fseek(atlasFile, 0, SEEK_END);
+    long size = ftell(atlasFile);
+    fseek(atlasFile, 0, SEEK_SET);
+
+    if (size < static_cast<long>(sizeof(Lemon::IconAtlasHeader))) {
+        fclose(atlasFile);
+        return;
+    }
+
+    int64_t key = Lemon::CreateSharedMemory(size, SMEM_FLAGS_SHARED);
+    void* atlas = Lemon::MapSharedMemory(key);
+    if (!atlas) {
+        Logger::Error("Failed to map icon atlas");
+        Lemon::DestroySharedMemory(key);
+        fclose(atlasFile);
+        return;
+    }
+
+    if (fread(atlas, size, 1, atlasFile) != 1) {
+        Logger::Error("Failed to read icon atlas");
+        Lemon::UnmapSharedMemory(atlas, key);
+        Lemon::DestroySharedMemory(key);
+        fclose(atlasFile);
+        return;
+    }
+    fclose(atlasFile);
+
+    // Keep it mapped so it lives as long as the WM
+    m_iconAtlasKey = key;
+    m_iconAtlasSize = size;
 }
 
 void WM::Run() {
-    for (;;) {
-        clock_gettime(CLOCK_BOOTTIME, &m_lastUpdate);
+    // Wait on the interface and every client endpoint
+    Lemon::Waiter waiter;
+    waiter.WaitOnAll(&m_messageInterface);
 
+    for (;;) {
         Lemon::Handle client;
         Lemon::Message message;
         while (m_messageInterface.Poll(client, message)) {
@@ -32,22 +78,30 @@ void WM::Run() {
                 HandleMessage(client, message);
             }
         }
+        waiter.RepopulateHandles(); // Clients may have connected or disconnected
 
         m_input.Poll();
-        m_compositor.Render();
 
-        if (m_targetFramerate <= 0) {
-            continue; // Do not limit framerate
+        long timeout = WM_INPUT_POLL_INTERVAL;
+        if (m_compositor.HasDamage()) {
+            timespec timeSinceBoot;
+            clock_gettime(CLOCK_BOOTTIME, &timeSinceBoot);
+
+            long timeDiff = (timeSinceBoot.tv_sec - m_lastUpdate.tv_sec) * 1000000 +
+                            (timeSinceBoot.tv_nsec - m_lastUpdate.tv_nsec) / 1000;
+            if (m_targetFramerate <= 0 || timeDiff >= m_targetFrameIntervalThreshold) {
+                m_compositor.Render();
+                m_lastUpdate = timeSinceBoot;
+            } else {
+                // Wait out the rest of the frame so buffer swaps and invalidations
+                // arriving in the meantime are drawn together in the next frame
+                timeout = std::min<long>(timeout, m_targetFrameInterval - timeDiff);
+            }
         }
 
-        timespec timeSinceBoot;
-        clock_gettime(CLOCK_BOOTTIME, &timeSinceBoot);
-
-        long timeDiff = (timeSinceBoot.tv_sec - m_lastUpdate.tv_sec) * 1000000 +
-                        (timeSinceBoot.tv_nsec - m_lastUpdate.tv_nsec) / 1000;
-        if (timeDiff < m_targetFrameIntervalThreshold) {
-            usleep(m_targetFrameInterval - timeDiff); // Sleep the remaining time
-        }
+        // The input devices and client window buffers cannot be waited on,
+        // so wake up every WM_INPUT_POLL_INTERVAL to poll them
+        waiter.Wait(std::max<long>(timeout, 1));
     }
 }
 
@@ -274,7 +328,7 @@ void WM::SetActiveWindow(WMWindow* win) {
         m_windows.remove(win);
         m_windows.push_back(win); // Place the new active window on top
 
-        m_compositor.InvalidateAll(); // Recalculate clipping
+        m_compositor.InvalidateClipping(win->GetRect()); // Recalculate clipping beneath the window
         BroadcastWindowState(m_activeWindow);
     }
 }
@@ -287,7 +341,7 @@ void WM::DestroyWindow(WMWindow* win) {
     assert(win);
     m_windows.remove(win);
 
-    m_compositor.InvalidateAll();
+    m_compositor.InvalidateClipping(win->GetRect()); // Redraw what was beneath the window
     BroadcastDestroyedWindow(win);
 
     delete win;
@@ -412,6 +466,11 @@ void WM::OnMinimize(const Lemon::Handle& client, int64_t windowID, bool minimize
     win->Minimize(minimized);
 }
 
+void WM::OnDamaged(const Lemon::Handle& client, int64_t windowID) {
+    // The damage is read from the window buffer when rendering,
+    // the message is only sent so Run wakes up to draw it.
+}
+
 void WM::OnDisplayContextMenu(const Lemon::Handle& client, int64_t windowID, int32_t x, int32_t y,
                               const std::string& entries) {
     WMWindow* win = GetWindowFromID(windowID);
@@ -450,6 +509,8 @@ void WM::OnDisplayContextMenu(const Lemon::Handle& client, int64_t windowID, int
 
     m_contextMenu.window = win;
     m_showContextMenu = true;
+
+    m_compositor.Invalidate(m_contextMenu.bounds); // Make sure the new menu gets drawn
 }
 
 void WM::OnPong(const Lemon::Handle& client, int64_t windowID) {
@@ -494,6 +555,13 @@ void WM::OnGetScreenBounds(const Lemon::Handle& client) {
                                                                 .height = m_compositor.GetScreenBounds().y});
 }
 
+void WM::OnGetDisplayStatistics(const Lemon::Handle& client) {
+    Lemon::EndpointQueue(client.get(), LemonWMServer::ResponseGetDisplayStatistics,
+                         LemonWMServer::GetDisplayStatisticsResponse{
+                             .framerate = m_compositor.GetFramerate(),
+                             .bytesPerSecond = m_compositor.GetPresentedBytesPerSecond()});
+}
+
 void WM::OnReloadConfig(const Lemon::Handle& client) {}
 
 void WM::OnSubscribeToWindowEvents(const Lemon::Handle& client) {
@@ -509,3 +577,8 @@ void WM::OnSubscribeToWindowEvents(const Lemon::Handle& client) {
 
     m_wmEventSubscribers.push_back(std::move(endp));
 }
+
+void WM::OnGetIconAtlas(const Lemon::Handle& client) {
+    Lemon::EndpointQueue(client.get(), LemonWMServer::ResponseGetIconAtlas,
+                         LemonWMServer::GetIconAtlasResponse{.key = m_iconAtlasKey, .size = m_iconAtlasSize});
+}
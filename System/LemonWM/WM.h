@@ -13,6 +13,8 @@
 #define CONTEXT_MENU_ITEM_WIDTH 100
 #define CONTEXT_MENU_ITEM_HEIGHT 20
 
+#define WM_INPUT_POLL_INTERVAL 8000 // Longest time in microseconds between polling the input devices when idle
+
 struct WMContextMenuEntry {
     int id;
     std::string text;
@@ -75,6 +77,7 @@ private:
     void OnGetPosition(const Lemon::Handle& client, int64_t windowID) override;
     void OnResize(const Lemon::Handle& client, int64_t windowID, int32_t width, int32_t height) override;
     void OnMinimize(const Lemon::Handle& client, int64_t windowID, bool minimized) override;
+    void OnDamaged(const Lemon::Handle& client, int64_t windowID) override;
     void OnDisplayContextMenu(const Lemon::Handle& client, int64_t windowID, int32_t x, int32_t y,
                               const std::string& entries) override;
     void OnPong(const Lemon::Handle& client, int64_t windowID) override;
@@ -84,10 +87,15 @@ private:
 
     void OnPeerDisconnect(const Lemon::Handle& client) override;
     void OnGetScreenBounds(const Lemon::Handle& client) override;
+    void OnGetDisplayStatistics(const Lemon::Handle& client) override;
     void OnReloadConfig(const Lemon::Handle& client) override;
     void OnSubscribeToWindowEvents(const Lemon::Handle& client) override;
+    void OnGetIconAtlas(const Lemon::Handle& client) override;
+
+    // Load the icon atlas into shared memory for IconManager in every process
+    void LoadIconAtlas();
 
-    timespec m_lastUpdate;
+    timespec m_lastUpdate = {0, 0}; // Time of the last frame
     long m_targetFramerate = 0;              // Used for framerate limiter
     long m_targetFrameIntervalThreshold = 0; // The maximum time difference to thread sleep
     long m_targetFrameInterval = 0;
@@ -118,4 +126,7 @@ private:
     } m_contextMenu;
 
     std::list<std::unique_ptr<LemonWMClientEndpoint>> m_wmEventSubscribers;
+
+    int64_t m_iconAtlasKey = 0;
+    uint64_t m_iconAtlasSize = 0;
 };
\ No newline at end of file
@@ -14,7 +14,7 @@ WMWindow::WMWindow(const Handle& endpoint, int64_t id, const std::string& title,
 
     UpdateWindowRects();
 
-    WM::Instance().Compositor().InvalidateAll();
+    WM::Instance().Compositor().InvalidateClipping(m_rect);
 }
 
 void WMWindow::DrawDecorationClip(const Rect& clip, Surface* surface) {
@@ -46,18 +46,21 @@ void WMWindow::DrawDecorationClip(const Rect& clip, Surface* surface) {
         minimizeButtonSourceRect.y += theme.windowButtons.height / 2;
     }
 
-    if (clip.Contains(m_closeRect)) {
-        surface->AlphaBlit(&theme.windowButtons, m_closeRect.pos, closeButtonSourceRect);
+    // The clip may only cover part of a button
+    if (clip.Intersects(m_closeRect)) {
+        Rect part = clip.GetIntersect(m_closeRect);
+        surface->AlphaBlit(&theme.windowButtons, part.pos,
+                           {closeButtonSourceRect.pos + (part.pos - m_closeRect.pos), part.size});
     }
 
-    if (clip.Contains(m_minimizeRect)) {
-        surface->AlphaBlit(&theme.windowButtons, m_minimizeRect.pos, minimizeButtonSourceRect);
+    if (clip.Intersects(m_minimizeRect)) {
+        Rect part = clip.GetIntersect(m_minimizeRect);
+        surface->AlphaBlit(&theme.windowButtons, part.pos,
+                           {minimizeButtonSourceRect.pos + (part.pos - m_minimizeRect.pos), part.size});
     }
 }
 
 void WMWindow::DrawClip(const Rect& clip, Surface* surface) {
-    m_windowSurface.buffer = m_buffer->currentBuffer ? (m_buffer2) : (m_buffer1);
-
     Rect clipCopy = clip;
     clipCopy.pos -= m_contentRect.pos;
 
@@ -97,24 +100,30 @@ Vector2i WMWindow::NewWindowSizeFromRect(const Rect& rect) const {
 }
 
 void WMWindow::Relocate(int x, int y) {
+    Rect oldRect = m_rect;
     m_rect.pos = {x, y};
 
     UpdateWindowRects();
 
-    WM::Instance().Compositor().InvalidateAll(); // Window position changed, recaclulate clipping
+    // Window position changed, recalculate clipping where the window was and where it is now
+    WM::Instance().Compositor().InvalidateClipping(oldRect);
+    WM::Instance().Compositor().InvalidateClipping(m_rect);
 }
 
 void WMWindow::Resize(int width, int height) {
     long e = Lemon::DestroySharedMemory(m_bufferKey);
     assert(!e);
 
+    Rect oldRect = m_rect;
     m_size = {width, height};
 
     CreateWindowBuffer();
     Queue(Lemon::Message(LemonWMServer::ResponseResize, LemonWMServer::ResizeResponse{m_bufferKey}));
     UpdateWindowRects();
 
-    WM::Instance().Compositor().InvalidateAll(); // Window size changed, recaclulate clipping
+    // Window size changed, recalculate clipping
+    WM::Instance().Compositor().InvalidateClipping(oldRect);
+    WM::Instance().Compositor().InvalidateClipping(m_rect);
 }
 
 void WMWindow::SetTitle(const std::string& title) {
@@ -129,9 +138,12 @@ void WMWindow::SetFlags(int flags) {
 
     const int invalidatingFlags = GUI::WindowFlag_NoDecoration | GUI::WindowFlag_Transparent;
     if ((oldFlags & invalidatingFlags) != (m_flags & invalidatingFlags)) {
+        Rect oldRect = m_rect;
         UpdateWindowRects();
 
-        WM::Instance().Compositor().InvalidateAll(); // We will need to recalculate clipping
+        // We will need to recalculate clipping
+        WM::Instance().Compositor().InvalidateClipping(oldRect);
+        WM::Instance().Compositor().InvalidateClipping(m_rect);
     }
 }
 
@@ -148,7 +160,7 @@ void WMWindow::Minimize(bool minimized) {
 
     m_minimized = minimized;
 
-    WM::Instance().Compositor().InvalidateAll(); // Window state changed, recaclulate clipping
+    WM::Instance().Compositor().InvalidateClipping(m_rect); // Window state changed, recalculate clipping
     WM::Instance().BroadcastWindowState(this);
 }
 
@@ -180,6 +192,36 @@ void WMWindow::UpdateWindowRects() {
     }
 }
 
+bool WMWindow::TakeDamage(std::vector<Rect>& damage) {
+    if (!__atomic_exchange_n(&m_buffer->dirty, 0, __ATOMIC_ACQ_REL)) {
+        return false;
+    }
+
+    uint32_t serial = __atomic_load_n(&m_buffer->damageSerial, __ATOMIC_ACQUIRE);
+    if (!serial) {
+        return true; // The client does not report damage
+    } else if (serial == m_buffer->damageConsumed) {
+        return false; // Already drawn the damage of the swap that set dirty
+    }
+
+    uint32_t count = __atomic_load_n(&m_buffer->damageCount, __ATOMIC_ACQUIRE);
+    if (count <= WINDOW_BUFFER_MAX_DAMAGE) {
+        for (uint32_t i = 0; i < count; i++) {
+            Rect rect = m_buffer->damage[i];
+            rect.pos += m_contentRect.pos;
+
+            // Do not trust the client to stay within the window
+            if (rect.Intersects(m_contentRect)) {
+                damage.push_back(rect.GetIntersect(m_contentRect));
+            }
+        }
+    }
+
+    // Let the client start a new list
+    __atomic_store_n(&m_buffer->damageConsumed, serial, __ATOMIC_RELEASE);
+    return true;
+}
+
 void WMWindow::CreateWindowBuffer() {
     // Size of each buffer for the window
     // Aligned to 32 bytes
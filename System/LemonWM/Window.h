@@ -4,6 +4,7 @@
 #include <Lemon/Graphics/Types.h>
 
 #include <string>
+#include <vector>
 
 #define RESIZE_HANDLE_SIZE 7
 #define MIN_WINDOW_RESIZE_WIDTH 50
@@ -38,9 +39,14 @@ public:
     WMWindow(const Handle& endpoint, int64_t id, const std::string& title, const Vector2i& pos, const Vector2i& size,
              int flags);
 
+    // Draw the parts of the window within clip, may be called from several threads at once
     void DrawDecorationClip(const Rect& clip, Surface* surface);
     void DrawClip(const Rect& clip, Surface* surface);
 
+    // Pick the buffer the client last swapped to, called once a frame before any clips are drawn
+    // so every clip of the frame shows the same buffer
+    inline void LatchBuffer() { m_windowSurface.buffer = m_buffer->currentBuffer ? m_buffer2 : m_buffer1; }
+
     inline int64_t GetID() const { return m_id; }
     inline int GetFlags() const { return m_flags; }
     inline const std::string& GetTitle() const { return m_title; }
@@ -81,12 +87,12 @@ public:
     // This will get the window content size accounting for the window decorations
     Vector2i NewWindowSizeFromRect(const Rect& rect) const;
 
-    // Get whether the window buffer is dirty and regardless clear it
-    inline bool IsDirtyAndClear() {
-        bool isDirty = m_buffer->dirty;
-        m_buffer->dirty = 0;
-        return isDirty;
-    }
+    // Get whether the window buffer has been swapped since it was last drawn
+    inline bool IsDirty() const { return m_buffer->dirty; }
+
+    // Get the areas of the window changed since it was last drawn, in screen coordinates
+    // Returns false if nothing has changed, damage is left empty if the whole window has changed
+    bool TakeDamage(std::vector<Rect>& damage);
 
     inline void SendEvent(const Lemon::LemonEvent& event) {
         LemonWMClientEndpoint::SendEvent(m_id, event.event, event.data);
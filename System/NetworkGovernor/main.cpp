@@ -241,7 +241,11 @@ DNS Server: %d.%d.%d.%d\n",
 		reinterpret_cast<sockaddr_in*>(&ifRequest.ifr_netmask)->sin_addr.s_addr = subnetMask;
 		ioctl(sock, SIOCSIFNETMASK, &ifRequest);
 
+		// Default route (0.0.0.0/0) through the gateway
 		rtentry route;
+		memset(&route, 0, sizeof(rtentry));
+		route.rt_dst.sa_family = AF_INET;
+		route.rt_genmask.sa_family = AF_INET;
 		route.rt_gateway.sa_family = AF_INET;
 		route.rt_flags = RTF_GATEWAY | RTF_UP;
 		reinterpret_cast<sockaddr_in*>(&route.rt_gateway)->sin_addr.s_addr = defaultGateway;
@@ -279,6 +283,10 @@ int main(){
 			continue; // Ignore . and ..
 		}
 
+		if(strcmp(entry->d_name, "lo") == 0){
+			continue; // Loopback is configured by the kernel
+		}
+
 		int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
 		if(sock < 0){
 			perror("Error creating UDP socket");
@@ -0,0 +1,188 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+enum {
+    TestStream, // Bulk transfer, like netperf TCP_STREAM
+    TestRR, // Request/response, like netperf TCP_RR
+};
+
+int test = TestStream;
+long duration = 5; // Seconds
+size_t messageSize = 0; // 0 uses the default for the test
+uint16_t port = 5001;
+
+long Elapsed(const timespec& start){
+    timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+
+    return (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+bool ReadFull(int fd, uint8_t* buffer, size_t len){
+    size_t done = 0;
+    while(done < len){
+        ssize_t r = read(fd, buffer + done, len - done);
+        if(r <= 0){
+            return false;
+        }
+
+        done += r;
+    }
+
+    return true;
+}
+
+bool WriteFull(int fd, uint8_t* buffer, size_t len){
+    size_t done = 0;
+    while(done < len){
+        ssize_t w = write(fd, buffer + done, len - done);
+        if(w <= 0){
+            return false;
+        }
+
+        done += w;
+    }
+
+    return true;
+}
+
+// Accepts one connection, sinks data (stream) or echoes requests (rr) until the client closes
+int Server(int listenFd){
+    int fd = accept(listenFd, nullptr, nullptr);
+    if(fd < 0){
+        perror("netbench: accept");
+        return 1;
+    }
+
+    uint8_t* buffer = new uint8_t[messageSize];
+    if(test == TestStream){
+        while(read(fd, buffer, messageSize) > 0);
+    } else {
+        while(ReadFull(fd, buffer, messageSize) && WriteFull(fd, buffer, messageSize));
+    }
+
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char** argv){
+    const char* host = "127.0.0.1";
+
+    int opt;
+    while((opt = getopt(argc, argv, "t:l:s:p:")) >= 0){
+        switch(opt){
+            case 't':
+                if(!strcmp(optarg, "stream")){
+                    test = TestStream;
+                } else if(!strcmp(optarg, "rr")){
+                    test = TestRR;
+                } else {
+                    fprintf(stderr, "Unknown test '%s', expected stream or rr\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'l':
+                duration = strtol(optarg, nullptr, 10);
+                break;
+            case 's':
+                messageSize = strtoul(optarg, nullptr, 10);
+                break;
+            case 'p':
+                port = strtoul(optarg, nullptr, 10);
+                break;
+            case '?':
+                printf("Usage: %s [-t stream|rr] [-l seconds] [-s message size] [-p port] [local address]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if(optind < argc){
+        host = argv[optind];
+    }
+
+    if(!messageSize){
+        messageSize = (test == TestStream) ? 65536 : 1;
+    }
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(sockaddr_in));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if(inet_pton(AF_INET, host, &address.sin_addr) <= 0){
+        fprintf(stderr, "Invalid address '%s'\n", host);
+        return 1;
+    }
+
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(sockaddr_in)) || listen(listenFd, 1)){
+        perror("netbench: listen");
+        return 1;
+    }
+
+    pid_t server = fork();
+    if(server == 0){
+        exit(Server(listenFd));
+    }
+    close(listenFd);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(sockaddr_in))){
+        perror("netbench: connect");
+        kill(server, SIGKILL);
+        waitpid(server, nullptr, 0);
+        return 1;
+    }
+
+    uint8_t* buffer = new uint8_t[messageSize];
+    memset(buffer, 0xa5, messageSize);
+
+    timespec start;
+    clock_gettime(CLOCK_BOOTTIME, &start);
+
+    long limit = duration * 1000000;
+    size_t count = 0; // Bytes (stream) or transactions (rr)
+    while(Elapsed(start) < limit){
+        if(test == TestStream){
+            if(!WriteFull(fd, buffer, messageSize)){
+                perror("netbench: write");
+                break;
+            }
+
+            count += messageSize;
+        } else {
+            if(!WriteFull(fd, buffer, messageSize) || !ReadFull(fd, buffer, messageSize)){
+                perror("netbench: transaction");
+                break;
+            }
+
+            count++;
+        }
+    }
+
+    long elapsed = Elapsed(start);
+    close(fd);
+    waitpid(server, nullptr, 0);
+
+    if(elapsed <= 0){
+        elapsed = 1;
+    }
+
+    if(test == TestStream){
+        printf("TCP_STREAM %s: %lu bytes in %ld ms, %lu KB/s (%lu byte writes)\n", host, count, elapsed / 1000, (count * 1000000 / elapsed) / 1024, messageSize);
+    } else {
+        printf("TCP_RR %s: %lu transactions in %ld ms, %lu/s, %ld us per transaction (%lu byte messages)\n", host, count, elapsed / 1000, count * 1000000 / elapsed, count ? elapsed / (long)count : 0, messageSize);
+    }
+
+    return 0;
+}